@@ -0,0 +1,1827 @@
+//
+//  bench.c
+//  ZombieSQL
+//
+//  Micro benchmarks for the engine.  Run "zsql-bench" for all of them or "zsql-bench <name>" for just one.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "zdb.h"
+
+#define BENCH_ROWS              100000
+#define BENCH_WIDE_COLUMNS      32
+
+#define BENCH_ASSERT(stmt)      { if (!(stmt)) { printf("!!BENCH SETUP FAILED!! (%s)\n", #stmt); exit(1); } }
+
+static volatile double benchSink = 0;     /* Keeps the optimizer from throwing scan loops away */
+
+double BenchNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void BenchReport(const char* name, double seconds, long operations, const char* unit)
+{
+    printf("  %-40s %10.3f ms  %10.1f ns/%s\n", name, seconds * 1000.0, seconds * 1e9 / operations, unit);
+}
+
+/* Builds a table of alternating int and float columns, with a varchar in the second slot */
+ZdbTable* BenchCreateWideTable(ZdbDatabase* db, const char* name, int storage, int rowCount)
+{
+    ZdbColumn* columns[BENCH_WIDE_COLUMNS];
+    char columnName[ZDB_LIMIT_VARCHAR];
+
+    for (int i = 0; i < BENCH_WIDE_COLUMNS; i++)
+    {
+        ZdbType* type = (i == 1) ? ZdbStandardTypes->varcharType :
+                        (i % 2) ? ZdbStandardTypes->floatType : ZdbStandardTypes->intType;
+        sprintf(columnName, "C%d", i);
+        BENCH_ASSERT(!ZdbEngineCreateColumn(columnName, type, 0, &columns[i]));
+    }
+
+    ZdbTable* table;
+    BENCH_ASSERT(!ZdbEngineCreateTableWithStorage(db, (char*)name, BENCH_WIDE_COLUMNS, columns, storage, &table));
+
+    int ints[BENCH_WIDE_COLUMNS];
+    float floats[BENCH_WIDE_COLUMNS];
+    void* values[BENCH_WIDE_COLUMNS];
+    for (int r = 0; r < rowCount; r++)
+    {
+        for (int i = 0; i < BENCH_WIDE_COLUMNS; i++)
+        {
+            ints[i] = r + i;
+            floats[i] = (float)(r + i);
+            values[i] = (i == 1) ? "wide" : (i % 2) ? (void*)&floats[i] : (void*)&ints[i];
+        }
+
+        ZdbRow* row;
+        BENCH_ASSERT(!ZdbEngineInsertRow(table, BENCH_WIDE_COLUMNS, &row));
+        BENCH_ASSERT(ZdbEngineUpdateRowValues(table, row, BENCH_WIDE_COLUMNS, values) == 1);
+    }
+
+    return table;
+}
+
+/* The offset computation every field access used to do before tables carried a layout: a walk over all of the
+   preceding columns, asking the type system for each size */
+size_t BenchLegacyRowOffset(ZdbTable* table, int column)
+{
+    size_t offset = 0;
+    for (int i = 0; i <= column; i++)
+    {
+        size_t size = 0;
+        ZdbTypeSizeof(table->columns[i]->type, NULL, &size);
+        if (table->layout.tags[i] == ZDB_LAYOUT_TAG_VARCHAR)
+        {
+            size = sizeof(ZdbVarcharRef);
+        }
+        size_t alignment = table->layout.alignments[i];
+        offset = (offset + alignment - 1) & ~(alignment - 1);
+        if (i < column)
+        {
+            offset += size;
+        }
+    }
+
+    return offset;
+}
+
+double BenchScanNumericColumns(ZdbTable* table, int legacy)
+{
+    double sum = 0;
+    for (int r = 0; r < table->rowCount; r++)
+    {
+        ZdbRow* row = ZdbEngineRowAt(table, r);
+        for (int i = 0; i < table->columnCount; i++)
+        {
+            void* value;
+            if (legacy)
+            {
+                value = row->_rowdata + BenchLegacyRowOffset(table, i);
+            }
+            else
+            {
+                ZdbEngineGetValue(table, row, i, &value);
+            }
+
+            if (table->columns[i]->type == ZdbStandardTypes->intType)
+                sum += *(int*)value;
+            else if (table->columns[i]->type == ZdbStandardTypes->floatType)
+                sum += *(float*)value;
+        }
+    }
+
+    return sum;
+}
+
+void BenchLayout()
+{
+    printf("layout: full scan of %d rows x %d columns\n", BENCH_ROWS, BENCH_WIDE_COLUMNS);
+
+    ZdbDatabase* db;
+    BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+    ZdbTable* table = BenchCreateWideTable(db, "Wide", ZDB_STORAGE_ROW, BENCH_ROWS);
+    long fields = (long)BENCH_ROWS * BENCH_WIDE_COLUMNS;
+
+    double start = BenchNow();
+    double legacySum = BenchScanNumericColumns(table, 1);
+    BenchReport("offset walk per field (before)", BenchNow() - start, fields, "field");
+
+    start = BenchNow();
+    double layoutSum = BenchScanNumericColumns(table, 0);
+    BenchReport("precompiled layout (after)", BenchNow() - start, fields, "field");
+
+    BENCH_ASSERT(legacySum == layoutSum);
+    benchSink += layoutSum;
+
+    ZdbEngineDropDB(db);
+}
+
+void BenchSlab()
+{
+    int rowCount = BENCH_ROWS * 10;
+    printf("slab: bulk load of %d rows x %d columns\n", rowCount, BENCH_WIDE_COLUMNS);
+
+    ZdbDatabase* db;
+    BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+
+    double start = BenchNow();
+    ZdbTable* table = BenchCreateWideTable(db, "Wide", ZDB_STORAGE_ROW, rowCount);
+    BenchReport("insert", BenchNow() - start, rowCount, "row");
+
+    ZdbAllocatorStats stats;
+    BENCH_ASSERT(!ZdbEngineGetAllocatorStats(table, &stats));
+    printf("  slabs %d, reserved %zu bytes, used %zu bytes, wasted %zu bytes (%.2f%%)\n",
+           stats.slabCount, stats.bytesReserved, stats.bytesUsed, stats.bytesWasted,
+           100.0 * stats.bytesWasted / stats.bytesReserved);
+
+    start = BenchNow();
+    ZdbEngineDropDB(db);
+    BenchReport("drop", BenchNow() - start, rowCount, "row");
+}
+
+double BenchSumColumnThroughQuery(ZdbDatabase* db, ZdbTable* table, int column)
+{
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    BENCH_ASSERT(!ZdbQueryCreate(db, &q));
+    BENCH_ASSERT(!ZdbQueryAddTable(q, table));
+    BENCH_ASSERT(!ZdbQueryExecute(q, &rs));
+
+    double sum = 0;
+    while (ZdbQueryNextResult(rs))
+    {
+        int value;
+        ZdbQueryGetInt(rs, column, &value);
+        sum += value;
+    }
+
+    ZdbQueryFree(q);
+    return sum;
+}
+
+double BenchSumColumnChunks(ZdbTable* table, int column)
+{
+    double sum = 0;
+    for (int chunk = 0; chunk < table->chunkCount; chunk++)
+    {
+        int* values;
+        int count;
+        ZdbEngineGetColumnChunk(table, chunk, column, (void**)&values, &count);
+        for (int i = 0; i < count; i++)
+        {
+            sum += values[i];
+        }
+    }
+
+    return sum;
+}
+
+void BenchPax()
+{
+    int rowCount = BENCH_ROWS * 5;
+    int column = BENCH_WIDE_COLUMNS - 2;
+    printf("pax: sum of one int column over %d rows x %d columns\n", rowCount, BENCH_WIDE_COLUMNS);
+
+    ZdbDatabase* db;
+    BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+    ZdbTable* rowTable = BenchCreateWideTable(db, "WideRows", ZDB_STORAGE_ROW, rowCount);
+    ZdbTable* paxTable = BenchCreateWideTable(db, "WidePax", ZDB_STORAGE_PAX, rowCount);
+
+    double start = BenchNow();
+    double rowSum = BenchSumColumnThroughQuery(db, rowTable, column);
+    BenchReport("row storage, recordset", BenchNow() - start, rowCount, "row");
+
+    start = BenchNow();
+    double paxSum = BenchSumColumnThroughQuery(db, paxTable, column);
+    BenchReport("pax storage, recordset", BenchNow() - start, rowCount, "row");
+
+    start = BenchNow();
+    double chunkSum = BenchSumColumnChunks(paxTable, column);
+    BenchReport("pax storage, column chunks", BenchNow() - start, rowCount, "row");
+
+    BENCH_ASSERT(rowSum == paxSum && paxSum == chunkSum);
+    benchSink += chunkSum;
+
+    ZdbEngineDropDB(db);
+}
+
+ZdbTable* BenchCreateEmployeesTableWithStorage(ZdbDatabase* db, const char* name, int storage)
+{
+    ZdbColumn* columns[5];
+    BENCH_ASSERT(!ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    BENCH_ASSERT(!ZdbEngineCreateColumn("Name", ZdbStandardTypes->varcharType, 0, &columns[1]));
+    BENCH_ASSERT(!ZdbEngineCreateColumn("Age", ZdbStandardTypes->intType, 0, &columns[2]));
+    BENCH_ASSERT(!ZdbEngineCreateColumn("Salary", ZdbStandardTypes->floatType, 0, &columns[3]));
+    BENCH_ASSERT(!ZdbEngineCreateColumn("Active", ZdbStandardTypes->booleanType, 0, &columns[4]));
+
+    ZdbTable* table;
+    BENCH_ASSERT(!ZdbEngineCreateTableWithStorage(db, (char*)name, 5, columns, storage, &table));
+    return table;
+}
+
+ZdbTable* BenchCreateEmployeesTable(ZdbDatabase* db, const char* name)
+{
+    return BenchCreateEmployeesTableWithStorage(db, name, ZDB_STORAGE_ROW);
+}
+
+void BenchIngest()
+{
+    int rowCount = BENCH_ROWS * 10;
+    int batchSize = 1024;
+    printf("ingest: %d rows into a 5 column table\n", rowCount);
+
+    ZdbDatabase* db;
+    BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+    ZdbTable* stringTable = BenchCreateEmployeesTable(db, "StringPath");
+    ZdbTable* batchTable = BenchCreateEmployeesTable(db, "BatchPath");
+
+    double start = BenchNow();
+    for (int i = 0; i < rowCount; i++)
+    {
+        char age[16], salary[32];
+        sprintf(age, "%d", 20 + i % 50);
+        sprintf(salary, "%d.0", 1000 + i % 9000);
+
+        ZdbRow* row;
+        BENCH_ASSERT(!ZdbEngineInsertRow(stringTable, 5, &row));
+        BENCH_ASSERT(ZdbEngineUpdateRow(stringTable, row, 5, NULL, "Employee", age, salary, "1") == 1);
+    }
+    double seconds = BenchNow() - start;
+    printf("  %-40s %10.0f rows/s\n", "InsertRow + UpdateRow (strings)", rowCount / seconds);
+
+    char** names = malloc(batchSize * sizeof(char*));
+    int* ages = malloc(batchSize * sizeof(int));
+    float* salaries = malloc(batchSize * sizeof(float));
+    int* active = malloc(batchSize * sizeof(int));
+    void* columns[5] = { NULL, names, ages, salaries, active };
+
+    start = BenchNow();
+    for (int i = 0; i < rowCount; i += batchSize)
+    {
+        int n = rowCount - i < batchSize ? rowCount - i : batchSize;
+        for (int j = 0; j < n; j++)
+        {
+            names[j] = "Employee";
+            ages[j] = 20 + (i + j) % 50;
+            salaries[j] = 1000 + (i + j) % 9000;
+            active[j] = 1;
+        }
+
+        BENCH_ASSERT(ZdbEngineInsertRows(batchTable, n, columns) == n);
+    }
+    seconds = BenchNow() - start;
+    printf("  %-40s %10.0f rows/s\n", "InsertRows (typed batches of 1024)", rowCount / seconds);
+
+    BENCH_ASSERT(stringTable->rowCount == batchTable->rowCount);
+
+    free(names);
+    free(ages);
+    free(salaries);
+    free(active);
+    ZdbEngineDropDB(db);
+}
+
+void BenchFillEmployees(ZdbTable* table, int rowCount)
+{
+    int batchSize = 1024;
+    char** names = malloc(batchSize * sizeof(char*));
+    int* ages = malloc(batchSize * sizeof(int));
+    float* salaries = malloc(batchSize * sizeof(float));
+    int* active = malloc(batchSize * sizeof(int));
+    void* columns[5] = { NULL, names, ages, salaries, active };
+
+    for (int i = 0; i < rowCount; i += batchSize)
+    {
+        int n = rowCount - i < batchSize ? rowCount - i : batchSize;
+        for (int j = 0; j < n; j++)
+        {
+            names[j] = (j % 2) ? "Employee" : "Manager";
+            ages[j] = 20 + (i + j) % 50;
+            salaries[j] = 1000 + (i + j) % 9000;
+            active[j] = (i + j) % 7 != 0;
+        }
+
+        BENCH_ASSERT(ZdbEngineInsertRows(table, n, columns) == n);
+    }
+
+    free(names);
+    free(ages);
+    free(salaries);
+    free(active);
+}
+
+void BenchOpen()
+{
+    const char* path = "zsql-bench.db";
+    printf("open: mapping saved databases of increasing size\n");
+
+    for (int rowCount = BENCH_ROWS; rowCount <= BENCH_ROWS * 100; rowCount *= 10)
+    {
+        ZdbDatabase* db;
+        BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+        BenchFillEmployees(BenchCreateEmployeesTable(db, "Employees"), rowCount);
+
+        double start = BenchNow();
+        BENCH_ASSERT(!ZdbEngineSaveDB(db, path));
+        double saveSeconds = BenchNow() - start;
+        ZdbEngineDropDB(db);
+
+        start = BenchNow();
+        BENCH_ASSERT(!ZdbEngineOpenDB(path, &db));
+        double openSeconds = BenchNow() - start;
+
+        start = BenchNow();
+        benchSink += BenchSumColumnThroughQuery(db, db->tables[0], 2);
+        double scanSeconds = BenchNow() - start;
+
+        printf("  %9d rows: save %9.3f ms, open %8.3f ms, first scan %9.3f ms\n", rowCount,
+               saveSeconds * 1000.0, openSeconds * 1000.0, scanSeconds * 1000.0);
+
+        ZdbEngineDropDB(db);
+    }
+
+    remove(path);
+}
+
+typedef struct
+{
+    ZdbTable* table;
+    double deadline;
+    long rows;
+} BenchWriter;
+
+void* BenchDurableWriter(void* arg)
+{
+    BenchWriter* writer = arg;
+    int age = 30;
+    float salary = 1000.0f;
+    int active = 1;
+    void* values[5] = { NULL, "Employee", &age, &salary, &active };
+
+    while (BenchNow() < writer->deadline)
+    {
+        ZdbRow* row;
+        BENCH_ASSERT(!ZdbEngineInsertRow(writer->table, 5, &row));
+        BENCH_ASSERT(ZdbEngineUpdateRowValues(writer->table, row, 5, values) == 1);
+        writer->rows++;
+    }
+
+    return NULL;
+}
+
+void BenchWal()
+{
+    const char* path = "zsql-bench.wal";
+    double duration = 0.5;
+    printf("wal: durable single row inserts for %.1f s per run\n", duration);
+
+    for (int groupCommit = 0; groupCommit <= 1; groupCommit++)
+    {
+        for (int threadCount = 1; threadCount <= 16; threadCount *= 4)
+        {
+            remove(path);
+
+            ZdbDatabase* db;
+            ZdbLogOptions options;
+            ZdbLogDefaultOptions(&options);
+            options.groupCommit = groupCommit;
+            BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+            BENCH_ASSERT(!ZdbEngineAttachLog(db, path, &options));
+            ZdbTable* table = BenchCreateEmployeesTable(db, "Employees");
+
+            pthread_t threads[16];
+            BenchWriter writers[16];
+            double start = BenchNow();
+            for (int i = 0; i < threadCount; i++)
+            {
+                writers[i].table = table;
+                writers[i].deadline = start + duration;
+                writers[i].rows = 0;
+                BENCH_ASSERT(!pthread_create(&threads[i], NULL, BenchDurableWriter, &writers[i]));
+            }
+
+            long rows = 0;
+            for (int i = 0; i < threadCount; i++)
+            {
+                pthread_join(threads[i], NULL);
+                rows += writers[i].rows;
+            }
+            double seconds = BenchNow() - start;
+
+            ZdbLogStats stats;
+            BENCH_ASSERT(!ZdbEngineGetLogStats(db, &stats));
+            printf("  %-22s %2d thread%s %10.0f rows/s  %6.1f commits/sync\n", groupCommit ? "group commit" : "sync per write",
+                   threadCount, threadCount > 1 ? "s" : " ", rows / seconds, (double)stats.commits / (stats.syncs ? stats.syncs : 1));
+
+            ZdbEngineDropDB(db);
+        }
+    }
+
+    remove(path);
+}
+
+typedef struct
+{
+    ZdbTable* table;
+    volatile int stop;
+    long rows;
+    double longestStall;
+} BenchStallWriter;
+
+/* Inserts rows until told to stop, remembering the longest any one insert took */
+void* BenchStallWriterMain(void* arg)
+{
+    BenchStallWriter* writer = arg;
+    int age = 30;
+    float salary = 1000.0f;
+    int active = 1;
+    void* values[5] = { NULL, "Employee", &age, &salary, &active };
+
+    while (!writer->stop)
+    {
+        double start = BenchNow();
+        ZdbRow* row;
+        BENCH_ASSERT(!ZdbEngineInsertRow(writer->table, 5, &row));
+        BENCH_ASSERT(ZdbEngineUpdateRowValues(writer->table, row, 5, values) == 1);
+
+        double stall = BenchNow() - start;
+        writer->longestStall = stall > writer->longestStall ? stall : writer->longestStall;
+        writer->rows++;
+    }
+
+    return NULL;
+}
+
+void BenchCheckpoint()
+{
+    const char* dbPath = "zsql-bench-checkpoint.db";
+    const char* logPath = "zsql-bench-checkpoint.wal";
+    int rowCount = BENCH_ROWS * 10;
+    printf("checkpoint: saving %d rows while another thread inserts\n", rowCount);
+
+    for (int background = 0; background <= 1; background++)
+    {
+        remove(logPath);
+
+        ZdbDatabase* db;
+        ZdbLogOptions options;
+        ZdbLogDefaultOptions(&options);
+        options.autocommit = 0;
+        BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+        BENCH_ASSERT(!ZdbEngineAttachLog(db, logPath, &options));
+        ZdbTable* table = BenchCreateEmployeesTable(db, "Employees");
+        BenchFillEmployees(table, rowCount);
+
+        BenchStallWriter writer = { table, 0, 0, 0.0 };
+        pthread_t thread;
+        BENCH_ASSERT(!pthread_create(&thread, NULL, BenchStallWriterMain, &writer));
+
+        double start = BenchNow();
+        if (background)
+        {
+            BENCH_ASSERT(!ZdbEngineCheckpoint(db, dbPath));
+            BENCH_ASSERT(!ZdbEngineWaitCheckpoint(db));
+        }
+        else
+        {
+            BENCH_ASSERT(!ZdbEngineSaveDB(db, dbPath));
+        }
+        double seconds = BenchNow() - start;
+
+        writer.stop = 1;
+        pthread_join(thread, NULL);
+
+        printf("  %-12s %9.3f ms  writer: %8ld rows inserted meanwhile, longest insert %8.3f ms\n",
+               background ? "checkpoint" : "save", seconds * 1000.0, writer.rows, writer.longestStall * 1000.0);
+
+        if (background)
+        {
+            ZdbCheckpointStats stats;
+            BENCH_ASSERT(!ZdbEngineGetCheckpointStats(db, &stats));
+            printf("  %-12s pause %.3f ms, duration %.3f ms, %llu bytes written, %llu log bytes truncated\n", "",
+                   stats.lastPause * 1000.0, stats.lastDuration * 1000.0,
+                   (unsigned long long)stats.lastBytes, (unsigned long long)stats.logBytesTruncated);
+        }
+
+        ZdbEngineDropDB(db);
+    }
+
+    remove(dbPath);
+    remove(logPath);
+}
+
+void BenchDelete()
+{
+    int rowCount = BENCH_ROWS * 10;
+    int stepRows = 16384;
+    printf("delete: scanning %d rows with 90%% deleted, then compacting %d rows per step\n", rowCount, stepRows);
+
+    ZdbDatabase* db;
+    BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+    ZdbTable* table = BenchCreateEmployeesTable(db, "Employees");
+    BenchFillEmployees(table, rowCount);
+
+    double start = BenchNow();
+    benchSink += BenchSumColumnThroughQuery(db, table, 2);
+    BenchReport("scan, no deletes", BenchNow() - start, rowCount, "row");
+
+    /* Scattered deletes leave a tombstone in most words; whole deleted runs are skipped a word at a time */
+    int* rowIndexes = malloc(rowCount * sizeof(int));
+    int count = 0;
+    for (int i = 0; i < rowCount; i++)
+    {
+        if (i < rowCount / 2 ? (i % 10 != 0) : (i % (10 * ZDB_ROW_CHUNKS) >= ZDB_ROW_CHUNKS))
+        {
+            rowIndexes[count++] = i;
+        }
+    }
+    start = BenchNow();
+    BENCH_ASSERT(ZdbEngineDeleteRows(table, count, rowIndexes) == count);
+    BenchReport("delete", BenchNow() - start, count, "row");
+    free(rowIndexes);
+
+    start = BenchNow();
+    benchSink += BenchSumColumnThroughQuery(db, table, 2);
+    BenchReport("scan, with tombstones", BenchNow() - start, rowCount, "row");
+
+    int steps = 0;
+    double longest = 0;
+    start = BenchNow();
+    while (1)
+    {
+        double stepStart = BenchNow();
+        int left = ZdbEngineCompactTable(table, stepRows);
+        double step = BenchNow() - stepStart;
+        longest = step > longest ? step : longest;
+        steps++;
+
+        BENCH_ASSERT(left >= 0);
+        if (left == 0)
+        {
+            break;
+        }
+    }
+    BenchReport("compact", BenchNow() - start, rowCount, "row");
+    printf("  %-40s %10d steps, longest %.3f ms\n", "", steps, longest * 1000.0);
+
+    start = BenchNow();
+    benchSink += BenchSumColumnThroughQuery(db, table, 2);
+    BenchReport("scan, compacted", BenchNow() - start, table->rowCount, "row");
+
+    ZdbEngineDropDB(db);
+}
+
+/* Average time of an EQ query on the ID column, from creating the query to reading the one row */
+double BenchPointLookups(ZdbDatabase* db, ZdbTable* table, int lookups)
+{
+    double start = BenchNow();
+    for (int i = 0; i < lookups; i++)
+    {
+        char id[16];
+        sprintf(id, "%d", (int)((i * 2654435761u) % table->rowCount));
+
+        ZdbQuery* q;
+        ZdbRecordset* rs;
+        BENCH_ASSERT(!ZdbQueryCreate(db, &q));
+        BENCH_ASSERT(!ZdbQueryAddTable(q, table));
+        BENCH_ASSERT(!ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_EQ, 0, ZdbStandardTypes->intType, id));
+        BENCH_ASSERT(!ZdbQueryExecute(q, &rs));
+        BENCH_ASSERT(ZdbQueryNextResult(rs));
+        int value;
+        ZdbQueryGetInt(rs, 2, &value);
+        benchSink += value;
+        ZdbQueryFree(q);
+    }
+
+    return (BenchNow() - start) / lookups;
+}
+
+void BenchIndex()
+{
+    printf("index: point lookups on the ID column\n");
+
+    for (int rowCount = 10000; rowCount <= BENCH_ROWS * 10; rowCount *= 10)
+    {
+        ZdbDatabase* db;
+        BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+        ZdbTable* table = BenchCreateEmployeesTable(db, "Employees");
+        BenchFillEmployees(table, rowCount);
+
+        double scan = BenchPointLookups(db, table, 20);
+
+        double start = BenchNow();
+        BENCH_ASSERT(!ZdbEngineCreateIndex(table, 0, ZDB_INDEX_HASH));
+        double build = BenchNow() - start;
+        double indexed = BenchPointLookups(db, table, 100000);
+
+        printf("  %8d rows: scan %10.3f us, hash index %7.3f us (built in %.3f ms)\n",
+               rowCount, scan * 1e6, indexed * 1e6, build * 1000.0);
+
+        ZdbEngineDropDB(db);
+    }
+}
+
+/* Average time of a narrow LT query on the Salary column, reading every matching row */
+double BenchRangeLookups(ZdbDatabase* db, ZdbTable* table, int lookups, int* matches)
+{
+    double start = BenchNow();
+    for (int i = 0; i < lookups; i++)
+    {
+        ZdbQuery* q;
+        ZdbRecordset* rs;
+        BENCH_ASSERT(!ZdbQueryCreate(db, &q));
+        BENCH_ASSERT(!ZdbQueryAddTable(q, table));
+        BENCH_ASSERT(!ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_LT, 3, ZdbStandardTypes->floatType, "1010"));
+        BENCH_ASSERT(!ZdbQueryExecute(q, &rs));
+
+        *matches = 0;
+        while (ZdbQueryNextResult(rs))
+        {
+            int value;
+            ZdbQueryGetInt(rs, 2, &value);
+            benchSink += value;
+            (*matches)++;
+        }
+        ZdbQueryFree(q);
+    }
+
+    return (BenchNow() - start) / lookups;
+}
+
+void BenchBTree()
+{
+    printf("btree: salary < 1010, about 0.1%% of rows\n");
+
+    for (int rowCount = 10000; rowCount <= BENCH_ROWS * 10; rowCount *= 10)
+    {
+        ZdbDatabase* db;
+        BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+        ZdbTable* table = BenchCreateEmployeesTable(db, "Employees");
+        BenchFillEmployees(table, rowCount);
+
+        int matches;
+        double scan = BenchRangeLookups(db, table, 20, &matches);
+
+        /* Salaries repeat every 9000 rows, so this build sorts; IDs are loaded in order and skip the sort */
+        double start = BenchNow();
+        BENCH_ASSERT(!ZdbEngineCreateIndex(table, 3, ZDB_INDEX_BTREE));
+        double build = BenchNow() - start;
+        start = BenchNow();
+        BENCH_ASSERT(!ZdbEngineCreateIndex(table, 0, ZDB_INDEX_BTREE));
+        double sortedBuild = BenchNow() - start;
+        double indexed = BenchRangeLookups(db, table, 1000, &matches);
+
+        printf("  %8d rows, %5d matches: scan %10.3f us, B+tree %8.3f us (built in %.3f ms, %.3f ms when sorted)\n",
+               rowCount, matches, scan * 1e6, indexed * 1e6, build * 1000.0, sortedBuild * 1000.0);
+
+        ZdbEngineDropDB(db);
+    }
+
+    /* The same rows added one batch at a time to a table that already has the index */
+    ZdbDatabase* db;
+    BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+    ZdbTable* table = BenchCreateEmployeesTable(db, "Employees");
+    BENCH_ASSERT(!ZdbEngineCreateIndex(table, 3, ZDB_INDEX_BTREE));
+    BENCH_ASSERT(!ZdbEngineCreateIndex(table, 0, ZDB_INDEX_BTREE));
+    double start = BenchNow();
+    BenchFillEmployees(table, BENCH_ROWS * 10);
+    double incremental = BenchNow() - start;
+
+    start = BenchNow();
+    BenchFillEmployees(BenchCreateEmployeesTable(db, "Plain"), BENCH_ROWS * 10);
+    double plain = BenchNow() - start;
+
+    printf("  %8d rows inserted with both indexes in place: %.3f ms, %.3f ms without\n",
+           BENCH_ROWS * 10, incremental * 1000.0, plain * 1000.0);
+    ZdbEngineDropDB(db);
+}
+
+/* Time to read every row matching one condition */
+double BenchConditionScan(ZdbDatabase* db, ZdbTable* table, ZdbQueryConditionType type, int column, ZdbType* valueType,
+                          const char* value, int* matches)
+{
+    double start = BenchNow();
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    BENCH_ASSERT(!ZdbQueryCreate(db, &q));
+    BENCH_ASSERT(!ZdbQueryAddTable(q, table));
+    BENCH_ASSERT(!ZdbQueryAddCondition(q, type, column, valueType, value));
+    BENCH_ASSERT(!ZdbQueryExecute(q, &rs));
+
+    *matches = 0;
+    while (ZdbQueryNextResult(rs))
+    {
+        (*matches)++;
+    }
+    ZdbQueryFree(q);
+
+    return BenchNow() - start;
+}
+
+void BenchZoneMap()
+{
+    int rowCount = BENCH_ROWS * 10;
+    printf("zonemap: 2%% of %d rows, by increasing ID and by an age that repeats in every chunk\n", rowCount);
+
+    ZdbDatabase* db;
+    BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+    ZdbTable* table = BenchCreateEmployeesTable(db, "Employees");
+    BenchFillEmployees(table, rowCount);
+
+    /* Both match 2% of the rows.  Only the ID condition lets whole chunks be passed over */
+    char id[16];
+    sprintf(id, "%d", rowCount - rowCount / 50);
+    int matches;
+    double byId = BenchConditionScan(db, table, ZDB_QUERY_CONDITION_GTE, 0, ZdbStandardTypes->intType, id, &matches);
+    BenchReport("ID >= newest 2%", byId, rowCount, "row");
+    printf("      %d matches\n", matches);
+    double byAge = BenchConditionScan(db, table, ZDB_QUERY_CONDITION_EQ, 2, ZdbStandardTypes->intType, "45", &matches);
+    BenchReport("age = 45", byAge, rowCount, "row");
+    printf("      %d matches\n", matches);
+
+    ZdbEngineDropDB(db);
+}
+
+/* An int that the engine only knows through its functions, so conditions on it take the type vtable */
+int BenchBoxedCompare(void* value1, void* value2, int* result)
+{
+    int a = *(int*)value1, b = *(int*)value2;
+    *result = a == b ? 0 : a < b ? -1 : 1;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int BenchBoxedSize(void* value, size_t* result) { *result = sizeof(int); return ZDB_RESULT_SUCCESS; }
+int BenchBoxedCopy(void* dest, void* src) { *(int*)dest = *(int*)src; return ZDB_RESULT_SUCCESS; }
+int BenchBoxedFromString(const char* str, void* result) { *(int*)result = str ? atoi(str) : 0; return ZDB_RESULT_SUCCESS; }
+int BenchBoxedToString(void* value, size_t* length, char* result)
+{
+    *length = result ? snprintf(result, *length + 1, "%d", *(int*)value) : snprintf(NULL, 0, "%d", *(int*)value);
+    return ZDB_RESULT_SUCCESS;
+}
+
+void BenchPredicate()
+{
+    int rowCount = BENCH_ROWS * 10;
+    printf("predicate: one condition checked on each of %d rows, by column type\n", rowCount);
+
+    ZdbType* boxedType;
+    BENCH_ASSERT(!ZdbTypeCreate("boxedint", BenchBoxedCompare, BenchBoxedSize, BenchBoxedCopy, BenchBoxedFromString,
+                                BenchBoxedToString, NULL, &boxedType));
+
+    ZdbDatabase* db;
+    BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+    ZdbColumn* columns[4];
+    BENCH_ASSERT(!ZdbEngineCreateColumn("Age", ZdbStandardTypes->intType, 0, &columns[0]));
+    BENCH_ASSERT(!ZdbEngineCreateColumn("Salary", ZdbStandardTypes->floatType, 0, &columns[1]));
+    BENCH_ASSERT(!ZdbEngineCreateColumn("Name", ZdbStandardTypes->varcharType, 0, &columns[2]));
+    BENCH_ASSERT(!ZdbEngineCreateColumn("BoxedAge", boxedType, 0, &columns[3]));
+    ZdbTable* table;
+    BENCH_ASSERT(!ZdbEngineCreateTable(db, "Predicates", 4, columns, &table));
+
+    /* Ages cycle within every chunk, so zones never pass a chunk over and every row is checked */
+    int batchSize = 1024;
+    int ages[1024];
+    float salaries[1024];
+    char* names[1024];
+    void* values[4] = { ages, salaries, names, ages };
+    for (int i = 0; i < rowCount; i += batchSize)
+    {
+        int n = rowCount - i < batchSize ? rowCount - i : batchSize;
+        for (int j = 0; j < n; j++)
+        {
+            ages[j] = 20 + (i + j) % 50;
+            salaries[j] = 1000 + (i + j) % 9000;
+            names[j] = (j % 2) ? "Employee" : "Manager";
+        }
+        BENCH_ASSERT(ZdbEngineInsertRows(table, n, values) == n);
+    }
+
+    struct
+    {
+        const char* name;
+        ZdbQueryConditionType type;
+        int column;
+        ZdbType* valueType;
+        const char* value;
+    } conditions[] =
+    {
+        { "int, age < 45", ZDB_QUERY_CONDITION_LT, 0, ZdbStandardTypes->intType, "45" },
+        { "user type, boxed age < 45", ZDB_QUERY_CONDITION_LT, 3, boxedType, "45" },
+        { "float, salary >= 5000", ZDB_QUERY_CONDITION_GTE, 1, ZdbStandardTypes->floatType, "5000" },
+        { "varchar, name = Manager", ZDB_QUERY_CONDITION_EQ, 2, ZdbStandardTypes->varcharType, "Manager" },
+    };
+
+    for (int c = 0; c < 4; c++)
+    {
+        /* Best of three, since a single pass is only a few milliseconds */
+        double best = 0;
+        int matches;
+        for (int pass = 0; pass < 3; pass++)
+        {
+            double seconds = BenchConditionScan(db, table, conditions[c].type, conditions[c].column, conditions[c].valueType,
+                                                conditions[c].value, &matches);
+            best = (pass == 0 || seconds < best) ? seconds : best;
+        }
+        BenchReport(conditions[c].name, best, rowCount, "row");
+        benchSink += matches;
+    }
+
+    ZdbEngineDropDB(db);
+}
+
+/* Sum of the Age column over the rows matching one condition, read a row at a time or a batch at a time */
+double BenchFilteredSum(ZdbDatabase* db, ZdbTable* table, ZdbQueryConditionType type, int column, ZdbType* valueType,
+                        const char* value, int batched)
+{
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    BENCH_ASSERT(!ZdbQueryCreate(db, &q));
+    BENCH_ASSERT(!ZdbQueryAddTable(q, table));
+    BENCH_ASSERT(!ZdbQueryAddCondition(q, type, column, valueType, value));
+    BENCH_ASSERT(!ZdbQueryExecute(q, &rs));
+
+    double sum = 0;
+    if (batched)
+    {
+        ZdbQueryBatch batch;
+        while (ZdbQueryNextBatch(rs, ZDB_QUERY_BATCH_ROWS, &batch) > 0)
+        {
+            for (int i = 0; i < batch.count; i++)
+            {
+                void* age;
+                ZdbEngineGetValue(table, ZdbEngineRowAt(table, batch.rows[i]), 2, &age);
+                sum += *(int*)age;
+            }
+        }
+    }
+    else
+    {
+        while (ZdbQueryNextResult(rs))
+        {
+            int age;
+            ZdbQueryGetInt(rs, 2, &age);
+            sum += age;
+        }
+    }
+
+    ZdbQueryFree(q);
+    return sum;
+}
+
+void BenchBatch()
+{
+    int rowCount = BENCH_ROWS * 10;
+    printf("batch: filters over %d rows, one row at a time and in batches of %d (%s kernels)\n",
+           rowCount, ZDB_QUERY_BATCH_ROWS, ZdbKernelName());
+
+    ZdbDatabase* db;
+    BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+    const char* names[] = { "row", "pax" };
+    const char* filters[] = { "age = 45 (2%)", "salary < 5000 (44%)" };
+    for (int storage = ZDB_STORAGE_ROW; storage <= ZDB_STORAGE_PAX; storage++)
+    {
+        ZdbTable* table = BenchCreateEmployeesTableWithStorage(db, names[storage], storage);
+        BenchFillEmployees(table, rowCount);
+
+        for (int f = 0; f < 2; f++)
+        {
+            ZdbQueryConditionType type = f == 0 ? ZDB_QUERY_CONDITION_EQ : ZDB_QUERY_CONDITION_LT;
+            int column = f == 0 ? 2 : 3;
+            ZdbType* valueType = f == 0 ? ZdbStandardTypes->intType : ZdbStandardTypes->floatType;
+            const char* value = f == 0 ? "45" : "5000";
+            char label[64];
+
+            double start = BenchNow();
+            double rowSum = BenchFilteredSum(db, table, type, column, valueType, value, 0);
+            sprintf(label, "%s, %s, rows", names[storage], filters[f]);
+            BenchReport(label, BenchNow() - start, rowCount, "row");
+
+            start = BenchNow();
+            double batchSum = BenchFilteredSum(db, table, type, column, valueType, value, 1);
+            sprintf(label, "%s, %s, batches", names[storage], filters[f]);
+            BenchReport(label, BenchNow() - start, rowCount, "row");
+
+            BENCH_ASSERT(rowSum == batchSum);
+            benchSink += batchSum;
+        }
+    }
+
+    ZdbEngineDropDB(db);
+}
+
+/* Time for a scan with the given threads to find every match of one condition */
+double BenchParallelScan(ZdbDatabase* db, ZdbTable* table, ZdbQueryConditionType type, int column, ZdbType* valueType,
+                         const char* value, int threads, int ordered, int* matches)
+{
+    double start = BenchNow();
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    BENCH_ASSERT(!ZdbQueryCreate(db, &q));
+    BENCH_ASSERT(!ZdbQueryAddTable(q, table));
+    BENCH_ASSERT(!ZdbQueryAddCondition(q, type, column, valueType, value));
+    BENCH_ASSERT(!ZdbQuerySetParallel(q, threads, ordered));
+    BENCH_ASSERT(!ZdbQueryExecute(q, &rs));
+
+    *matches = 0;
+    while (ZdbQueryNextResult(rs))
+    {
+        (*matches)++;
+    }
+    ZdbQueryFree(q);
+
+    return BenchNow() - start;
+}
+
+void BenchParallel()
+{
+    int rowCount = BENCH_ROWS * 40;
+    int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int maxThreads = cpus > 4 ? cpus : 4;
+    printf("parallel: filters over %d rows with 1 to %d threads (%d CPUs online)\n", rowCount, maxThreads, cpus);
+
+    ZdbDatabase* db;
+    BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+    ZdbTable* table = BenchCreateEmployeesTable(db, "Employees");
+    BenchFillEmployees(table, rowCount);
+
+    /* One condition the compare kernels handle and one checked a row at a time */
+    const char* filters[] = { "age = 45", "name = Manager" };
+    for (int f = 0; f < 2; f++)
+    {
+        ZdbQueryConditionType type = ZDB_QUERY_CONDITION_EQ;
+        int column = f == 0 ? 2 : 1;
+        ZdbType* valueType = f == 0 ? ZdbStandardTypes->intType : ZdbStandardTypes->varcharType;
+        const char* value = f == 0 ? "45" : "Manager";
+
+        /* Doubling the threads each time, finishing on maxThreads */
+        for (int threads = 1; threads <= maxThreads; threads = threads < maxThreads && threads * 2 > maxThreads ? maxThreads : threads * 2)
+        {
+            for (int ordered = 1; ordered >= 0; ordered--)
+            {
+                char label[64];
+                int matches;
+                double seconds = BenchParallelScan(db, table, type, column, valueType, value, threads, ordered, &matches);
+                sprintf(label, "%s, %d thread%s, %s", filters[f], threads, threads == 1 ? "" : "s", ordered ? "ordered" : "unordered");
+                BenchReport(label, seconds, rowCount, "row");
+                benchSink += matches;
+                if (threads == 1)
+                {
+                    /* A single thread scans in place, so ordering makes no difference */
+                    break;
+                }
+            }
+        }
+    }
+
+    ZdbEngineDropDB(db);
+}
+
+/* Reads ID, name and salary from every row, a value at a time or as projected batches */
+double BenchReadColumns(ZdbDatabase* db, ZdbTable* table, int projected)
+{
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    BENCH_ASSERT(!ZdbQueryCreate(db, &q));
+    BENCH_ASSERT(!ZdbQueryAddTable(q, table));
+    int projection[] = { 0, 1, 3 };
+    BENCH_ASSERT(!ZdbQuerySetProjection(q, projected ? 3 : 0, projection));
+    BENCH_ASSERT(!ZdbQueryExecute(q, &rs));
+
+    double sum = 0;
+    if (projected)
+    {
+        ZdbQueryBatch batch;
+        while (ZdbQueryNextBatch(rs, ZDB_QUERY_BATCH_ROWS, &batch) > 0)
+        {
+            const int* ids = batch.columns[0];
+            const ZdbString* names = batch.columns[1];
+            const float* salaries = batch.columns[2];
+            for (int i = 0; i < batch.count; i++)
+            {
+                sum += ids[i] + names[i].length + salaries[i];
+            }
+        }
+    }
+    else
+    {
+        while (ZdbQueryNextResult(rs))
+        {
+            int id;
+            char* name;
+            float salary;
+            ZdbQueryGetInt(rs, 0, &id);
+            ZdbQueryGetString(rs, 1, &name);
+            ZdbQueryGetFloat(rs, 3, &salary);
+            sum += id + strlen(name) + salary;
+        }
+    }
+
+    ZdbQueryFree(q);
+    return sum;
+}
+
+void BenchProjection()
+{
+    int rowCount = BENCH_ROWS * 10;
+    printf("projection: ID, name and salary of %d rows\n", rowCount);
+
+    ZdbDatabase* db;
+    BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+    const char* names[] = { "row", "pax" };
+    for (int storage = ZDB_STORAGE_ROW; storage <= ZDB_STORAGE_PAX; storage++)
+    {
+        ZdbTable* table = BenchCreateEmployeesTableWithStorage(db, names[storage], storage);
+        BenchFillEmployees(table, rowCount);
+        char label[64];
+
+        double start = BenchNow();
+        double valueSum = BenchReadColumns(db, table, 0);
+        sprintf(label, "%s, value at a time", names[storage]);
+        BenchReport(label, BenchNow() - start, rowCount, "row");
+
+        start = BenchNow();
+        double batchSum = BenchReadColumns(db, table, 1);
+        sprintf(label, "%s, projected batches", names[storage]);
+        BenchReport(label, BenchNow() - start, rowCount, "row");
+
+        BENCH_ASSERT(valueSum == batchSum);
+        benchSink += batchSum;
+    }
+
+    ZdbEngineDropDB(db);
+}
+
+/* Sum of salaries and oldest age, either read back a row at a time or aggregated in the engine */
+double BenchSumSalaries(ZdbDatabase* db, ZdbTable* table, int aggregate, int threads)
+{
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    BENCH_ASSERT(!ZdbQueryCreate(db, &q));
+    BENCH_ASSERT(!ZdbQueryAddTable(q, table));
+
+    double sum = 0, oldest = 0;
+    if (aggregate)
+    {
+        BENCH_ASSERT(!ZdbQuerySetParallel(q, threads, 0));
+        BENCH_ASSERT(!ZdbQueryAddAggregate(q, ZDB_AGG_SUM, 3));
+        BENCH_ASSERT(!ZdbQueryAddAggregate(q, ZDB_AGG_MAX, 2));
+        BENCH_ASSERT(!ZdbQueryExecute(q, &rs));
+        BENCH_ASSERT(!ZdbQueryGetAggregate(rs, 0, &sum));
+        BENCH_ASSERT(!ZdbQueryGetAggregate(rs, 1, &oldest));
+    }
+    else
+    {
+        BENCH_ASSERT(!ZdbQueryExecute(q, &rs));
+        while (ZdbQueryNextResult(rs))
+        {
+            int age;
+            float salary;
+            ZdbQueryGetInt(rs, 2, &age);
+            ZdbQueryGetFloat(rs, 3, &salary);
+            sum += salary;
+            oldest = age > oldest ? age : oldest;
+        }
+    }
+
+    ZdbQueryFree(q);
+    return sum + oldest;
+}
+
+void BenchAggregate()
+{
+    int rowCount = BENCH_ROWS * 10;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("aggregate: SUM(salary) and MAX(age) of %d rows, %ld CPUs\n", rowCount, cpus);
+
+    ZdbDatabase* db;
+    BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+    const char* names[] = { "row", "pax" };
+    for (int storage = ZDB_STORAGE_ROW; storage <= ZDB_STORAGE_PAX; storage++)
+    {
+        ZdbTable* table = BenchCreateEmployeesTableWithStorage(db, names[storage], storage);
+        BenchFillEmployees(table, rowCount);
+        char label[64];
+
+        double start = BenchNow();
+        double clientSum = BenchSumSalaries(db, table, 0, 1);
+        sprintf(label, "%s, row at a time", names[storage]);
+        BenchReport(label, BenchNow() - start, rowCount, "row");
+
+        start = BenchNow();
+        double engineSum = BenchSumSalaries(db, table, 1, 1);
+        sprintf(label, "%s, aggregated", names[storage]);
+        BenchReport(label, BenchNow() - start, rowCount, "row");
+
+        start = BenchNow();
+        double parallelSum = BenchSumSalaries(db, table, 1, 0);
+        sprintf(label, "%s, aggregated in parallel", names[storage]);
+        BenchReport(label, BenchNow() - start, rowCount, "row");
+
+        /* Floats summed in a different order round differently */
+        BENCH_ASSERT(fabs(clientSum - engineSum) <= 1e-6 * fabs(clientSum));
+        BENCH_ASSERT(fabs(engineSum - parallelSum) <= 1e-6 * fabs(engineSum));
+        benchSink += engineSum + parallelSum;
+    }
+
+    ZdbEngineDropDB(db);
+}
+
+/* SUM(salary) grouped by an int column, adding up the sums of every group */
+double BenchGroupSalaries(ZdbDatabase* db, ZdbTable* table, int column, size_t memory, ZdbGroupStats* stats)
+{
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    BENCH_ASSERT(!ZdbQueryCreate(db, &q));
+    BENCH_ASSERT(!ZdbQueryAddTable(q, table));
+    BENCH_ASSERT(!ZdbQueryAddGroup(q, column));
+    BENCH_ASSERT(!ZdbQueryAddAggregate(q, ZDB_AGG_SUM, 3));
+    BENCH_ASSERT(!ZdbQuerySetGroupMemory(q, memory));
+    BENCH_ASSERT(!ZdbQueryExecute(q, &rs));
+
+    double total = 0;
+    while (ZdbQueryNextResult(rs))
+    {
+        double sum;
+        BENCH_ASSERT(!ZdbQueryGetAggregate(rs, 0, &sum));
+        total += sum;
+    }
+    BENCH_ASSERT(!ZdbQueryGetGroupStats(rs, stats));
+
+    ZdbQueryFree(q);
+    return total;
+}
+
+/* The same, with the rows handed back and grouped by the caller into an array indexed by the key */
+double BenchGroupSalariesByHand(ZdbDatabase* db, ZdbTable* table, int column)
+{
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    BENCH_ASSERT(!ZdbQueryCreate(db, &q));
+    BENCH_ASSERT(!ZdbQueryAddTable(q, table));
+    BENCH_ASSERT(!ZdbQueryExecute(q, &rs));
+
+    double sums[128] = { 0 };
+    while (ZdbQueryNextResult(rs))
+    {
+        int key;
+        float salary;
+        ZdbQueryGetInt(rs, column, &key);
+        ZdbQueryGetFloat(rs, 3, &salary);
+        sums[key & 127] += salary;
+    }
+
+    double total = 0;
+    for (int i = 0; i < 128; i++)
+    {
+        total += sums[i];
+    }
+    ZdbQueryFree(q);
+    return total;
+}
+
+void BenchGroupBy()
+{
+    int rowCount = BENCH_ROWS * 10;
+    printf("group by: SUM(salary) of %d rows\n", rowCount);
+
+    ZdbDatabase* db;
+    BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+    ZdbTable* table = BenchCreateEmployeesTableWithStorage(db, "pax", ZDB_STORAGE_PAX);
+    BenchFillEmployees(table, rowCount);
+    ZdbGroupStats stats;
+
+    double start = BenchNow();
+    double byHand = BenchGroupSalariesByHand(db, table, 2);
+    BenchReport("by age, grouped by the caller", BenchNow() - start, rowCount, "row");
+
+    start = BenchNow();
+    double grouped = BenchGroupSalaries(db, table, 2, ZDB_QUERY_GROUP_MEMORY, &stats);
+    BenchReport("by age, 50 groups", BenchNow() - start, rowCount, "row");
+    BENCH_ASSERT(fabs(grouped - byHand) <= 1e-6 * byHand);
+    benchSink += grouped;
+
+    start = BenchNow();
+    grouped = BenchGroupSalaries(db, table, 3, ZDB_QUERY_GROUP_MEMORY, &stats);
+    BenchReport("by salary, 9000 hashed groups", BenchNow() - start, rowCount, "row");
+    benchSink += grouped;
+
+    size_t limits[] = { ZDB_QUERY_GROUP_MEMORY, 16 * 1024 * 1024 };
+    for (int i = 0; i < 2; i++)
+    {
+        char label[64];
+        start = BenchNow();
+        grouped = BenchGroupSalaries(db, table, 0, limits[i], &stats);
+        sprintf(label, "by ID, %d MB", (int)(limits[i] >> 20));
+        BenchReport(label, BenchNow() - start, rowCount, "row");
+        printf("    %d groups, %d passes, peak %.1f MB\n", stats.groupCount, stats.passes, stats.peakBytes / 1048576.0);
+        benchSink += grouped;
+    }
+
+    ZdbEngineDropDB(db);
+}
+
+/* Orders joined to their customers, adding up the customers' ages over every joined row */
+double BenchJoinOrders(ZdbDatabase* db, ZdbTable* orders, ZdbTable* customers, int hashed, int* rows)
+{
+    double sum = 0;
+    *rows = 0;
+    if (hashed)
+    {
+        ZdbQuery* q;
+        ZdbRecordset* rs;
+        BENCH_ASSERT(!ZdbQueryCreate(db, &q));
+        BENCH_ASSERT(!ZdbQueryAddTable(q, orders));
+        BENCH_ASSERT(!ZdbQueryAddTable(q, customers));
+        BENCH_ASSERT(!ZdbQueryAddJoin(q, 1, 0));
+        BENCH_ASSERT(!ZdbQueryExecute(q, &rs));
+        while (ZdbQueryNextResult(rs))
+        {
+            int age;
+            ZdbQueryGetInt(rs, orders->columnCount + 2, &age);
+            sum += age;
+            (*rows)++;
+        }
+        ZdbQueryFree(q);
+        return sum;
+    }
+
+    /* The way it had to be done before: a query of the customers for each order */
+    ZdbQuery* outer;
+    ZdbRecordset* outerRs;
+    BENCH_ASSERT(!ZdbQueryCreate(db, &outer));
+    BENCH_ASSERT(!ZdbQueryAddTable(outer, orders));
+    BENCH_ASSERT(!ZdbQueryExecute(outer, &outerRs));
+    while (ZdbQueryNextResult(outerRs))
+    {
+        int customer;
+        char key[16];
+        ZdbQueryGetInt(outerRs, 1, &customer);
+        sprintf(key, "%d", customer);
+
+        ZdbQuery* inner;
+        ZdbRecordset* innerRs;
+        BENCH_ASSERT(!ZdbQueryCreate(db, &inner));
+        BENCH_ASSERT(!ZdbQueryAddTable(inner, customers));
+        BENCH_ASSERT(!ZdbQueryAddCondition(inner, ZDB_QUERY_CONDITION_EQ, 0, ZdbStandardTypes->intType, key));
+        BENCH_ASSERT(!ZdbQueryExecute(inner, &innerRs));
+        while (ZdbQueryNextResult(innerRs))
+        {
+            int age;
+            ZdbQueryGetInt(innerRs, 2, &age);
+            sum += age;
+            (*rows)++;
+        }
+        ZdbQueryFree(inner);
+    }
+    ZdbQueryFree(outer);
+    return sum;
+}
+
+void BenchJoin()
+{
+    int orderCount = BENCH_ROWS;
+    int customerCount = 5000;
+    printf("join: %d orders to %d customers\n", orderCount, customerCount);
+
+    ZdbDatabase* db;
+    BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+    ZdbTable* customers = BenchCreateEmployeesTableWithStorage(db, "customers", ZDB_STORAGE_PAX);
+    BenchFillEmployees(customers, customerCount);
+
+    ZdbColumn* columns[3];
+    BENCH_ASSERT(!ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    BENCH_ASSERT(!ZdbEngineCreateColumn("Customer", ZdbStandardTypes->intType, 0, &columns[1]));
+    BENCH_ASSERT(!ZdbEngineCreateColumn("Amount", ZdbStandardTypes->floatType, 0, &columns[2]));
+    ZdbTable* orders;
+    BENCH_ASSERT(!ZdbEngineCreateTableWithStorage(db, "orders", 3, columns, ZDB_STORAGE_PAX, &orders));
+    int* customerIds = malloc(orderCount * sizeof(int));
+    float* amounts = malloc(orderCount * sizeof(float));
+    for (int i = 0; i < orderCount; i++)
+    {
+        customerIds[i] = (int)(((long)i * 7919) % customerCount);
+        amounts[i] = (float)(i % 500);
+    }
+    void* values[3] = { NULL, customerIds, amounts };
+    BENCH_ASSERT(ZdbEngineInsertRows(orders, orderCount, values) == orderCount);
+    free(customerIds);
+    free(amounts);
+
+    int nestedRows, hashedRows;
+    double start = BenchNow();
+    double nested = BenchJoinOrders(db, orders, customers, 0, &nestedRows);
+    BenchReport("query per order", BenchNow() - start, orderCount, "order");
+
+    start = BenchNow();
+    double hashed = BenchJoinOrders(db, orders, customers, 1, &hashedRows);
+    BenchReport("hash join", BenchNow() - start, orderCount, "order");
+
+    BENCH_ASSERT(nestedRows == hashedRows && nested == hashed);
+    benchSink += hashed;
+
+    ZdbEngineDropDB(db);
+}
+
+/* Reads the salaries of the top earners, ORDER BY Salary DESC with the limit, and adds them up */
+double BenchOrderSalaries(ZdbDatabase* db, ZdbTable* table, int limit, size_t memory, ZdbSortStats* stats)
+{
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    BENCH_ASSERT(!ZdbQueryCreate(db, &q));
+    BENCH_ASSERT(!ZdbQueryAddTable(q, table));
+    BENCH_ASSERT(!ZdbQueryAddOrder(q, 3, 1));
+    BENCH_ASSERT(!ZdbQuerySetLimit(q, limit));
+    BENCH_ASSERT(!ZdbQuerySetSortMemory(q, memory));
+    BENCH_ASSERT(!ZdbQueryExecute(q, &rs));
+
+    double total = 0;
+    float last = INFINITY;
+    while (ZdbQueryNextResult(rs))
+    {
+        float salary;
+        ZdbQueryGetFloat(rs, 3, &salary);
+        BENCH_ASSERT(salary <= last);
+        last = salary;
+        total += salary;
+    }
+    BENCH_ASSERT(!ZdbQueryGetSortStats(rs, stats));
+
+    ZdbQueryFree(q);
+    return total;
+}
+
+int BenchCompareFloatsDescending(const void* a, const void* b)
+{
+    return (*(const float*)a < *(const float*)b) - (*(const float*)a > *(const float*)b);
+}
+
+/* The same, with every salary handed back and sorted by the caller */
+double BenchOrderSalariesByHand(ZdbDatabase* db, ZdbTable* table, int limit)
+{
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    BENCH_ASSERT(!ZdbQueryCreate(db, &q));
+    BENCH_ASSERT(!ZdbQueryAddTable(q, table));
+    BENCH_ASSERT(!ZdbQueryExecute(q, &rs));
+
+    float* salaries = malloc(table->rowCount * sizeof(float));
+    int count = 0;
+    while (ZdbQueryNextResult(rs))
+    {
+        ZdbQueryGetFloat(rs, 3, &salaries[count++]);
+    }
+    qsort(salaries, count, sizeof(float), BenchCompareFloatsDescending);
+
+    double total = 0;
+    for (int i = 0; i < count && i < limit; i++)
+    {
+        total += salaries[i];
+    }
+    free(salaries);
+    ZdbQueryFree(q);
+    return total;
+}
+
+void BenchOrderBy()
+{
+    int rowCount = BENCH_ROWS * 10;
+    printf("order by: Salary DESC of %d rows\n", rowCount);
+
+    ZdbDatabase* db;
+    BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+    ZdbTable* table = BenchCreateEmployeesTableWithStorage(db, "pax", ZDB_STORAGE_PAX);
+    BenchFillEmployees(table, rowCount);
+    ZdbSortStats stats;
+
+    double start = BenchNow();
+    double byHand = BenchOrderSalariesByHand(db, table, 100);
+    BenchReport("top 100, sorted by the caller", BenchNow() - start, rowCount, "row");
+
+    start = BenchNow();
+    double ordered = BenchOrderSalaries(db, table, 100, ZDB_QUERY_SORT_MEMORY, &stats);
+    BenchReport("top 100, heap", BenchNow() - start, rowCount, "row");
+    BENCH_ASSERT(stats.topN && ordered == byHand);
+    benchSink += ordered;
+
+    size_t limits[] = { ZDB_QUERY_SORT_MEMORY, 4 * 1024 * 1024 };
+    for (int i = 0; i < 2; i++)
+    {
+        char label[64];
+        start = BenchNow();
+        ordered = BenchOrderSalaries(db, table, ZDB_QUERY_NO_LIMIT, limits[i], &stats);
+        sprintf(label, "every row, %d MB", (int)(limits[i] >> 20));
+        BenchReport(label, BenchNow() - start, rowCount, "row");
+        printf("    %d runs spilled, %d merge passes\n", stats.runs, stats.mergePasses);
+        benchSink += ordered;
+    }
+
+    ZdbEngineDropDB(db);
+}
+
+/* Reads a page of 50 rows, by offset or starting after the token, and copies the next page's token into next */
+double BenchReadPage(ZdbDatabase* db, ZdbTable* table, int ordered, int offset, const char* token, char* next)
+{
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    BENCH_ASSERT(!ZdbQueryCreate(db, &q));
+    BENCH_ASSERT(!ZdbQueryAddTable(q, table));
+    if (ordered)
+    {
+        BENCH_ASSERT(!ZdbQueryAddOrder(q, 3, 1));
+    }
+    BENCH_ASSERT(!ZdbQuerySetLimit(q, 50));
+    BENCH_ASSERT(!ZdbQuerySetOffset(q, offset));
+    BENCH_ASSERT(!ZdbQuerySetCursor(q, token));
+    BENCH_ASSERT(!ZdbQueryExecute(q, &rs));
+
+    double total = 0;
+    int count = 0;
+    while (ZdbQueryNextResult(rs))
+    {
+        float salary;
+        ZdbQueryGetFloat(rs, 3, &salary);
+        total += salary;
+        count++;
+    }
+    BENCH_ASSERT(count == 50);
+
+    const char* cursor;
+    BENCH_ASSERT(!ZdbQueryGetCursor(rs, &cursor));
+    if (next != NULL)
+    {
+        strcpy(next, cursor);
+    }
+    ZdbQueryFree(q);
+    return total;
+}
+
+void BenchPaging()
+{
+    int rowCount = BENCH_ROWS * 10;
+    printf("paging: pages of 50 out of %d rows\n", rowCount);
+
+    ZdbDatabase* db;
+    BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+    ZdbTable* table = BenchCreateEmployeesTableWithStorage(db, "pax", ZDB_STORAGE_PAX);
+    BenchFillEmployees(table, rowCount);
+
+    int pages[] = { 1, 100, 1000, 10000 };
+    for (int ordered = 0; ordered < 2; ordered++)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            /* The cursor for the page is the previous page's, found before the clock starts */
+            char token[256] = "", label[64];
+            int offset = (pages[i] - 1) * 50;
+            if (offset > 0)
+            {
+                BenchReadPage(db, table, ordered, offset - 50, NULL, token);
+            }
+
+            double start = BenchNow();
+            double byOffset = BenchReadPage(db, table, ordered, offset, NULL, NULL);
+            sprintf(label, "%s page %d, offset", ordered ? "ordered" : "unordered", pages[i]);
+            BenchReport(label, BenchNow() - start, 1, "page");
+
+            start = BenchNow();
+            double byCursor = BenchReadPage(db, table, ordered, 0, token[0] != '\0' ? token : NULL, NULL);
+            sprintf(label, "%s page %d, cursor", ordered ? "ordered" : "unordered", pages[i]);
+            BenchReport(label, BenchNow() - start, 1, "page");
+
+            BENCH_ASSERT(byOffset == byCursor);
+            benchSink += byCursor;
+        }
+    }
+
+    ZdbEngineDropDB(db);
+}
+
+/* One of the statements an application might send, differing from the others of its kind only in literals */
+void BenchSqlText(char* sql, size_t size, int i)
+{
+    switch (i % 3)
+    {
+        case 0:
+            snprintf(sql, size, "SELECT Name, Age, Salary FROM Employees WHERE ID = %d", i);
+            break;
+        case 1:
+            snprintf(sql, size, "UPDATE Employees SET Salary = %d.5, Active = TRUE WHERE ID = %d", i, i);
+            break;
+        default:
+            snprintf(sql, size, "INSERT INTO Employees (Name, Age, Salary, Active) VALUES ('emp %d', %d, %d.25, FALSE)",
+                     i, i % 60, i);
+            break;
+    }
+}
+
+/* Prepares each statement through the cache and releases it, returning the seconds taken */
+double BenchPrepare(ZdbSqlCache* cache, int count, char (*texts)[128], const int* order)
+{
+    double start = BenchNow();
+    for (int i = 0; i < count; i++)
+    {
+        ZdbSqlStatement* statement;
+        BENCH_ASSERT(!ZdbSqlPrepare(cache, texts[order != NULL ? order[i] : i], &statement));
+        benchSink += ZdbSqlGetStatementType(statement);
+        ZdbSqlRelease(statement);
+    }
+    return BenchNow() - start;
+}
+
+void BenchSql()
+{
+    int statementCount = BENCH_ROWS;
+    printf("sql: preparing %d statements\n", statementCount);
+
+    ZdbDatabase* db;
+    BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+    ZdbTable* table = BenchCreateEmployeesTable(db, "Employees");
+    BenchFillEmployees(table, 1000);
+
+    char (*texts)[128] = malloc(statementCount * sizeof(*texts));
+    size_t bytes = 0;
+    for (int i = 0; i < statementCount; i++)
+    {
+        BenchSqlText(texts[i], sizeof(*texts), i);
+        bytes += strlen(texts[i]);
+    }
+
+    /* Every statement is new, so every one is parsed */
+    ZdbSqlCache* cache;
+    BENCH_ASSERT(!ZdbSqlCreateCache(db, 0, &cache));
+    double seconds = BenchPrepare(cache, statementCount, texts, NULL);
+    BenchReport("parse", seconds, statementCount, "stmt");
+    printf("  %-40s %10.1f MB/s\n", "parse throughput", bytes / seconds / 1e6);
+    ZdbSqlFreeCache(cache);
+
+    /* Most statements come from a small working set, the rest from a long tail the cache can't hold */
+    int hot = ZDB_SQL_CACHE_STATEMENTS / 2;
+    int* order = malloc(statementCount * sizeof(int));
+    unsigned int seed = 12345;
+    for (int i = 0; i < statementCount; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        order[i] = (seed >> 8) % 10 < 9 ? (int)((seed >> 12) % hot) : (int)((seed >> 12) % statementCount);
+    }
+
+    ZdbSqlStats stats;
+    BENCH_ASSERT(!ZdbSqlCreateCache(db, 0, &cache));
+    BenchReport("working set, no cache (before)", BenchPrepare(cache, statementCount, texts, order), statementCount,
+                "stmt");
+    ZdbSqlFreeCache(cache);
+
+    BENCH_ASSERT(!ZdbSqlCreateCache(db, ZDB_SQL_CACHE_STATEMENTS, &cache));
+    BenchReport("working set, cached (after)", BenchPrepare(cache, statementCount, texts, order), statementCount,
+                "stmt");
+    BENCH_ASSERT(!ZdbSqlGetStats(cache, &stats));
+    printf("  %-40s %10.1f %%  (%lld evictions)\n", "cache hit rate", 100.0 * stats.hits / stats.lookups,
+           (long long)stats.evictions);
+
+    memset(order, 0, statementCount * sizeof(int));
+    BenchReport("same statement, cached", BenchPrepare(cache, statementCount, texts, order), statementCount, "stmt");
+    ZdbSqlFreeCache(cache);
+
+    free(order);
+    free(texts);
+    ZdbEngineDropDB(db);
+}
+
+/* Looks up each ID in turn with a query built, parsed and freed per lookup, as callers had to before binding */
+double BenchLookupByBuilding(ZdbDatabase* db, ZdbTable* table, int lookups)
+{
+    double total = 0;
+    for (int i = 0; i < lookups; i++)
+    {
+        char id[16];
+        snprintf(id, sizeof(id), "%d", i);
+        ZdbQuery* q;
+        ZdbRecordset* rs;
+        BENCH_ASSERT(!ZdbQueryCreate(db, &q));
+        BENCH_ASSERT(!ZdbQueryAddTable(q, table));
+        BENCH_ASSERT(!ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_EQ, 0, ZdbStandardTypes->intType, id));
+        BENCH_ASSERT(!ZdbQueryExecute(q, &rs));
+        float salary;
+        BENCH_ASSERT(ZdbQueryNextResult(rs) && !ZdbQueryGetFloat(rs, 3, &salary));
+        total += salary;
+        ZdbQueryFree(q);
+    }
+    return total;
+}
+
+/* The same lookups through one query with a placeholder, rebound and reexecuted into the same recordset */
+double BenchLookupByBinding(ZdbDatabase* db, ZdbTable* table, int lookups)
+{
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    BENCH_ASSERT(!ZdbQueryCreate(db, &q));
+    BENCH_ASSERT(!ZdbQueryAddTable(q, table));
+    BENCH_ASSERT(!ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_EQ, 0, ZdbStandardTypes->intType, NULL));
+    BENCH_ASSERT(!ZdbQueryBindInt(q, 0, 0));
+    BENCH_ASSERT(!ZdbQueryExecute(q, &rs));
+
+    double total = 0;
+    for (int i = 0; i < lookups; i++)
+    {
+        BENCH_ASSERT(!ZdbQueryBindInt(q, 0, i));
+        BENCH_ASSERT(!ZdbQueryReexecute(rs));
+        float salary;
+        BENCH_ASSERT(ZdbQueryNextResult(rs) && !ZdbQueryGetFloat(rs, 3, &salary));
+        total += salary;
+    }
+    ZdbQueryFree(q);
+    return total;
+}
+
+void BenchBind()
+{
+    int rowCount = BENCH_ROWS;
+    printf("bind: point lookups by ID over %d rows\n", rowCount);
+
+    ZdbDatabase* db;
+    BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+
+    const char* indexNames[] = { "hash", "btree" };
+    int indexTypes[] = { ZDB_INDEX_HASH, ZDB_INDEX_BTREE };
+    for (int i = 0; i < 2; i++)
+    {
+        char label[64];
+        ZdbTable* table = BenchCreateEmployeesTable(db, indexNames[i]);
+        BenchFillEmployees(table, rowCount);
+        BENCH_ASSERT(!ZdbEngineCreateIndex(table, 0, indexTypes[i]));
+
+        double start = BenchNow();
+        double built = BenchLookupByBuilding(db, table, rowCount);
+        sprintf(label, "%s, query per lookup (before)", indexNames[i]);
+        BenchReport(label, BenchNow() - start, rowCount, "lookup");
+
+        start = BenchNow();
+        double bound = BenchLookupByBinding(db, table, rowCount);
+        sprintf(label, "%s, bound and reexecuted (after)", indexNames[i]);
+        BenchReport(label, BenchNow() - start, rowCount, "lookup");
+
+        BENCH_ASSERT(built == bound);
+        benchSink += bound;
+    }
+
+    ZdbEngineDropDB(db);
+}
+
+/* Runs the query reps times and sums the salaries it matches */
+double BenchRunQuery(ZdbQuery* q, int reps)
+{
+    double total = 0;
+    for (int i = 0; i < reps; i++)
+    {
+        ZdbRecordset* rs;
+        BENCH_ASSERT(!ZdbQueryExecute(q, &rs));
+        while (ZdbQueryNextResult(rs))
+        {
+            float salary;
+            BENCH_ASSERT(!ZdbQueryGetFloat(rs, 3, &salary));
+            total += salary;
+        }
+    }
+    return total;
+}
+
+void BenchPlan()
+{
+    int rowCount = BENCH_ROWS * 10;
+    int reps = 5;
+    printf("plan: salary ranges through a B+tree or a scan over %d rows\n", rowCount);
+
+    ZdbDatabase* db;
+    BENCH_ASSERT(!ZdbEngineCreateDB("Bench", &db));
+    ZdbTable* table = BenchCreateEmployeesTable(db, "Planned");
+    BenchFillEmployees(table, rowCount);
+    BENCH_ASSERT(!ZdbEngineCreateIndex(table, 3, ZDB_INDEX_BTREE));
+
+    const char* bounds[] = { "1010", "1100", "1900", "5500", "9100" };
+    double before[5];
+    ZdbQuery* queries[5];
+    for (int i = 0; i < 5; i++)
+    {
+        char label[64];
+        BENCH_ASSERT(!ZdbQueryCreate(db, &queries[i]));
+        BENCH_ASSERT(!ZdbQueryAddTable(queries[i], table));
+        BENCH_ASSERT(!ZdbQueryAddCondition(queries[i], ZDB_QUERY_CONDITION_LT, 3, ZdbStandardTypes->floatType, bounds[i]));
+
+        double start = BenchNow();
+        before[i] = BenchRunQuery(queries[i], reps);
+        sprintf(label, "salary < %s, always indexed (before)", bounds[i]);
+        BenchReport(label, (BenchNow() - start) / reps, rowCount, "row");
+    }
+
+    double start = BenchNow();
+    BENCH_ASSERT(!ZdbEngineAnalyzeTable(table));
+    BenchReport("analyze", BenchNow() - start, rowCount, "row");
+
+    for (int i = 0; i < 5; i++)
+    {
+        char label[64];
+        ZdbQueryPlan plan;
+        BENCH_ASSERT(!ZdbQueryGetPlan(queries[i], &plan));
+
+        start = BenchNow();
+        double after = BenchRunQuery(queries[i], reps);
+        sprintf(label, "salary < %s, %s (after)", bounds[i], plan.access == ZDB_QUERY_ACCESS_SCAN ? "scan" : "index");
+        BenchReport(label, (BenchNow() - start) / reps, rowCount, "row");
+
+        BENCH_ASSERT(after == before[i]);
+        benchSink += after;
+        ZdbQueryFree(queries[i]);
+    }
+
+    ZdbEngineDropDB(db);
+}
+
+typedef struct
+{
+    const char* name;
+    void (*run)();
+} BenchEntry;
+
+static BenchEntry benchmarks[] =
+{
+    { "layout", BenchLayout },
+    { "slab", BenchSlab },
+    { "pax", BenchPax },
+    { "ingest", BenchIngest },
+    { "open", BenchOpen },
+    { "wal", BenchWal },
+    { "checkpoint", BenchCheckpoint },
+    { "delete", BenchDelete },
+    { "index", BenchIndex },
+    { "btree", BenchBTree },
+    { "zonemap", BenchZoneMap },
+    { "batch", BenchBatch },
+    { "predicate", BenchPredicate },
+    { "parallel", BenchParallel },
+    { "projection", BenchProjection },
+    { "aggregate", BenchAggregate },
+    { "groupby", BenchGroupBy },
+    { "join", BenchJoin },
+    { "orderby", BenchOrderBy },
+    { "paging", BenchPaging },
+    { "sql", BenchSql },
+    { "bind", BenchBind },
+    { "plan", BenchPlan },
+};
+
+int main(int argc, const char* argv[])
+{
+    if (ZdbTypeInitialize() != ZDB_RESULT_SUCCESS)
+    {
+        printf("Could not initialize type system\n");
+        return 1;
+    }
+
+    int ran = 0;
+    for (int i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+    {
+        if (argc < 2 || !strcmp(argv[1], benchmarks[i].name))
+        {
+            benchmarks[i].run();
+            ran++;
+        }
+    }
+
+    if (!ran)
+    {
+        printf("Unknown benchmark %s\n", argv[1]);
+        return 1;
+    }
+
+    return 0;
+}
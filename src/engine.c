@@ -5,13 +5,22 @@
 //  Copyright 2011 __MyCompanyName__. All rights reserved.
 //
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <math.h>
+#include <sys/mman.h>
 
 #include "engine.h"
 #include "types.h"
+#include "wal.h"
+#include "index.h"
+#include "stats.h"
+#include "storage.h"
 
 /*
  * Private helper methods
@@ -32,263 +41,2309 @@ int _insertTableIntoDatabase(ZdbDatabase* db, ZdbTable* table)
    return ZDB_RESULT_SUCCESS;
 }
 
-size_t _calculateRowSize(int columnCount, ZdbColumn** columns)
+int _layoutTagForType(ZdbType* type)
 {
-   /* TODO: Should memoize this */
-   size_t size = 0;
-   for (int i = 0; i < columnCount; i++)
+   switch (ZdbTypeGetId(type))
    {
-      size_t thisSize = 0;
-      ZdbTypeSizeof(columns[i]->type, NULL, &thisSize);
-      size += thisSize;
+      case ZDB_TYPE_ID_INT:
+         return ZDB_LAYOUT_TAG_INT;
+      case ZDB_TYPE_ID_FLOAT:
+         return ZDB_LAYOUT_TAG_FLOAT;
+      case ZDB_TYPE_ID_BOOLEAN:
+         return ZDB_LAYOUT_TAG_BOOLEAN;
+      case ZDB_TYPE_ID_VARCHAR:
+         return ZDB_LAYOUT_TAG_VARCHAR;
    }
 
-   return size;
+   return ZDB_LAYOUT_TAG_OTHER;
 }
 
-size_t _calculateRowOffset(ZdbColumn** columns, int column)
+size_t _naturalAlignment(size_t size)
 {
-   /* TODO: Should memoize this */
-   size_t offset = 0;
-   for (int i = 1; i <= column; i++)
+   /* Types don't declare an alignment, so use the largest power of two that divides the size.  That gives int and
+      float their natural alignment and leaves byte arrays such as varchar unaligned */
+   size_t alignment = 1;
+   while (alignment < ZDB_LAYOUT_MAX_ALIGNMENT && size % (alignment * 2) == 0)
    {
-      size_t thisSize = 0;
-      ZdbTypeSizeof(columns[i-1]->type, NULL, &thisSize);
-
-      offset += thisSize;
+      alignment *= 2;
    }
 
-   return offset;
+   return alignment;
 }
 
-/*
- * Public Interface Methods
- */
-
-int ZdbEngineCreateColumn(char* name, ZdbType* type, int autoincrement, ZdbColumn** column)
+int _buildRowLayout(int columnCount, ZdbColumn** columns, ZdbRowLayout* layout)
 {
-   ZdbColumn* c = malloc(sizeof(ZdbColumn));
-   c->type = type;
-   strcpy(c->name, name);
-   c->autoincrement = autoincrement;
-   c->lastInsertedValue = NULL;
+   size_t offset = 0;
+   layout->rowAlignment = 1;
+
+   for (int i = 0; i < columnCount; i++)
+   {
+      size_t size = 0;
+      int result = ZdbTypeSizeof(columns[i]->type, NULL, &size);
+      if (result != ZDB_RESULT_SUCCESS)
+      {
+         /* Every column must have a static size to be laid out */
+         return result;
+      }
+
+      layout->valueSizes[i] = size;
+      layout->tags[i] = _layoutTagForType(columns[i]->type);
+
+      size_t alignment;
+      if (layout->tags[i] == ZDB_LAYOUT_TAG_VARCHAR && columns[i]->encoding == ZDB_ENCODING_DICTIONARY)
+      {
+         /* Rows only hold the value's code */
+         layout->tags[i] = ZDB_LAYOUT_TAG_DICTIONARY;
+         size = sizeof(uint32_t);
+         alignment = sizeof(uint32_t);
+      }
+      else if (layout->tags[i] == ZDB_LAYOUT_TAG_VARCHAR)
+      {
+         /* Strings are kept in the table's string heap; the row just points at them */
+         size = sizeof(ZdbVarcharRef);
+         alignment = sizeof(uint32_t);
+      }
+      else
+      {
+         alignment = _naturalAlignment(size);
+      }
+
+      offset = (offset + alignment - 1) & ~(alignment - 1);
+
+      layout->offsets[i] = offset;
+      layout->sizes[i] = size;
+      layout->alignments[i] = alignment;
+
+      if (alignment > layout->rowAlignment)
+      {
+         layout->rowAlignment = alignment;
+      }
+
+      offset += size;
+   }
+
+   /* Pad the row so fields stay aligned when rows are stored back to back */
+   layout->rowSize = (offset + layout->rowAlignment - 1) & ~(layout->rowAlignment - 1);
 
-   *column = c;
    return ZDB_RESULT_SUCCESS;
 }
 
-int ZdbEngineCreateTable(ZdbDatabase* db, char* name, int columnCount, ZdbColumn** columnDefs, ZdbTable** table)
+void _initRowAllocator(ZdbRowAllocator* allocator, const ZdbRowLayout* layout, int storage)
 {
-   int i;
-   ZdbTable* t = malloc(sizeof(ZdbTable));
+   /* Keep every slot aligned for both the row header and the strictest field.  PAX rows keep their fields in
+      column chunks, so their slots only hold the header */
+   size_t alignment = layout->rowAlignment > sizeof(void*) ? layout->rowAlignment : sizeof(void*);
+   size_t dataSize = storage == ZDB_STORAGE_PAX ? 0 : layout->rowSize;
+   allocator->slotSize = (sizeof(ZdbRow) + dataSize + alignment - 1) & ~(alignment - 1);
+   allocator->slabCount = 0;
+   allocator->slabs = NULL;
+   allocator->freeSlots = NULL;
+   allocator->freeSlotCount = 0;
+   allocator->freeSlotCapacity = 0;
+}
 
-   strcpy(t->name, name);
-   t->columnCount = columnCount;
+void _freeRowAllocator(ZdbRowAllocator* allocator)
+{
+   ZdbSlab* slab = allocator->slabs;
+   while (slab != NULL)
+   {
+      ZdbSlab* next = slab->next;
+      free(slab);
+      slab = next;
+   }
 
-   t->columns = malloc(columnCount * sizeof(ZdbColumn*));
-   for (i = 0; i < columnCount; i++)
+   allocator->slabs = NULL;
+   allocator->slabCount = 0;
+
+   free(allocator->freeSlots);
+   allocator->freeSlots = NULL;
+   allocator->freeSlotCount = 0;
+   allocator->freeSlotCapacity = 0;
+}
+
+ZdbRow* _allocateRowSlot(ZdbRowAllocator* allocator)
+{
+   if (allocator->freeSlotCount > 0)
    {
-      t->columns[i] = columnDefs[i];
+      /* Reuse a slot compaction gave back.  New rows always start out zeroed */
+      ZdbRow* row = allocator->freeSlots[--allocator->freeSlotCount];
+      memset(row, 0, allocator->slotSize);
+      return row;
    }
 
-   t->rows = NULL;
-   t->freeRowsLeft = 0;
-   t->rowCount = 0;
+   ZdbSlab* slab = allocator->slabs;
+   if (slab == NULL || slab->size - slab->used < allocator->slotSize)
+   {
+      /* Current slab is full, so start a new one.  Rows wider than a slab get a slab of their own */
+      size_t size = allocator->slotSize > ZDB_SLAB_SIZE ? allocator->slotSize : ZDB_SLAB_SIZE;
+      slab = calloc(1, sizeof(ZdbSlab) + size);
+      if (slab == NULL)
+      {
+         return NULL;
+      }
 
-   _insertTableIntoDatabase(db, t);
+      slab->size = size;
+      slab->used = 0;
+      slab->next = allocator->slabs;
+      allocator->slabs = slab;
+      allocator->slabCount++;
+   }
 
-   *table = t;
-   return ZDB_RESULT_SUCCESS;
+   ZdbRow* row = (ZdbRow*)(slab->_slabdata + slab->used);
+   slab->used += allocator->slotSize;
+
+   return row;
 }
 
-int ZdbEngineCreateDB(char* name, ZdbDatabase** database)
+int _releaseRowSlot(ZdbRowAllocator* allocator, ZdbRow* row)
 {
-   ZdbDatabase* db = malloc(sizeof(ZdbDatabase));
-   strcpy(db->name, name);
-   db->tables = NULL;
-   db->tableCount = 0;
-   db->freeTablesLeft = 0;
+   if (allocator->freeSlotCount == allocator->freeSlotCapacity)
+   {
+      int capacity = allocator->freeSlotCapacity > 0 ? allocator->freeSlotCapacity * 2 : ZDB_ROW_CHUNKS;
+      ZdbRow** slots = realloc(allocator->freeSlots, capacity * sizeof(ZdbRow*));
+      if (slots == NULL)
+      {
+         /* The slot just stays unused until the table is dropped */
+         return ZDB_RESULT_INVALID_OPERATION;
+      }
 
-   *database = db;
+      allocator->freeSlots = slots;
+      allocator->freeSlotCapacity = capacity;
+   }
+
+   allocator->freeSlots[allocator->freeSlotCount++] = row;
    return ZDB_RESULT_SUCCESS;
 }
 
-int ZdbEngineDropTable(ZdbTable* table)
+void* _fieldAddress(ZdbTable* table, ZdbRow* row, int column)
 {
-   int i;
-   for (i = 0; i < table->columnCount; i++)
+   if (table->storage == ZDB_STORAGE_PAX)
    {
-      free(table->columns[i]);
+      char* chunk = table->chunks[row->index / ZDB_ROW_CHUNKS];
+      return chunk + ZDB_ROW_CHUNKS * table->layout.offsets[column] + (row->index % ZDB_ROW_CHUNKS) * table->layout.sizes[column];
    }
-   free(table->columns);
-   table->columns = NULL;
-   table->columnCount = 0;
 
-   for (i = 0; i < table->rowCount; i++)
+   return row->_rowdata + table->layout.offsets[column];
+}
+
+int _rowDeleted(ZdbTable* table, int rowIndex)
+{
+   return (table->tombstones[rowIndex / 64] >> (rowIndex % 64)) & 1;
+}
+
+int _hasZone(ZdbTable* table, int column)
+{
+   int tag = table->layout.tags[column];
+   return tag == ZDB_LAYOUT_TAG_INT || tag == ZDB_LAYOUT_TAG_FLOAT || tag == ZDB_LAYOUT_TAG_BOOLEAN;
+}
+
+void _clearZones(ZdbTable* table, int chunk)
+{
+   for (int i = 0; i < table->columnCount; i++)
    {
-      free(table->rows[i]);
+      ZdbZone* zone = &table->zones[chunk * table->columnCount + i];
+      if (table->layout.tags[i] == ZDB_LAYOUT_TAG_FLOAT)
+      {
+         zone->min.f = INFINITY;
+         zone->max.f = -INFINITY;
+      }
+      else
+      {
+         zone->min.i = INT_MAX;
+         zone->max.i = INT_MIN;
+      }
    }
-   free(table->rows);
-   table->rows = NULL;
-   table->rowCount = 0;
-   table->freeRowsLeft = ZDB_ROW_CHUNKS;
-
-   return ZDB_RESULT_SUCCESS;
 }
 
-int ZdbEngineDropDB(ZdbDatabase* db)
+void _widenZone(ZdbZone* zone, int tag, void* value)
 {
-   int i;
-   for (i = 0; i < db->tableCount; i++)
+   if (tag == ZDB_LAYOUT_TAG_FLOAT)
    {
-      ZdbEngineDropTable(db->tables[i]);
-      free(db->tables[i]);
-      db->tables[i] = NULL;
+      float f = *(float*)value;
+      if (f != f)
+      {
+         /* NaN doesn't order against anything, so the chunk can't be ruled out on this column */
+         zone->min.f = -INFINITY;
+         zone->max.f = INFINITY;
+         return;
+      }
+
+      if (f < zone->min.f)
+      {
+         zone->min.f = f;
+      }
+      if (f > zone->max.f)
+      {
+         zone->max.f = f;
+      }
+      return;
    }
-   free(db->tables);
-   db->tables = NULL;
-   db->tableCount = 0;
-   db->freeTablesLeft = ZDB_TABLE_CHUNKS;
 
-   return ZDB_RESULT_SUCCESS;
+   int i = *(int*)value;
+   if (i < zone->min.i)
+   {
+      zone->min.i = i;
+   }
+   if (i > zone->max.i)
+   {
+      zone->max.i = i;
+   }
 }
 
-int ZdbEngineUpdateRowValues(ZdbTable* table, ZdbRow* row, int valueCount, void** values)
+/* Counts the row's current values in its chunk's zones */
+void _widenRowZones(ZdbTable* table, ZdbRow* row)
 {
-   int newRow = row->data == NULL;
-   if (newRow)
+   ZdbZone* zones = &table->zones[row->index / ZDB_ROW_CHUNKS * table->columnCount];
+   for (int i = 0; i < table->columnCount; i++)
    {
-      row->data = row->_rowdata;
+      if (_hasZone(table, i))
+      {
+         _widenZone(&zones[i], table->layout.tags[i], _fieldAddress(table, row, i));
+      }
    }
+}
 
-	for (int i = 0; i < valueCount; i++)
-	{
-      void* value = row->data + _calculateRowOffset(table->columns, i);
-
-      if (table->columns[i]->autoincrement)
+/* Counts a column of newly written rows in their chunks' zones.  The values are read from the batch they were
+   copied from when there is one, a chunk's run at a time */
+void _widenColumnZones(ZdbTable* table, int column, int firstRow, int rowCount, void* values)
+{
+   int tag = table->layout.tags[column];
+   int row = firstRow;
+   while (row < firstRow + rowCount)
+   {
+      int run = ZDB_ROW_CHUNKS - row % ZDB_ROW_CHUNKS;
+      if (run > firstRow + rowCount - row)
       {
-         if (!newRow)
-         {
-             /* We don't auto increment on an existing row */
-             continue ;
-         }
+         run = firstRow + rowCount - row;
+      }
 
-         /* Automatically incrementing column */
-         if (values[i] != NULL)
+      ZdbZone* zone = &table->zones[row / ZDB_ROW_CHUNKS * table->columnCount + column];
+      if (values == NULL)
+      {
+         for (int i = row; i < row + run; i++)
          {
-             /* Cannot specify explicit value for autoincrement columns */
-             return ZDB_RESULT_VALUE_ERROR;
+            _widenZone(zone, tag, _fieldAddress(table, ZdbEngineRowAt(table, i), column));
          }
-
-         int result = ZdbTypeNextValue(table->columns[i]->type, table->columns[i]->lastInsertedValue, value);
-         if (result != ZDB_RESULT_SUCCESS)
+      }
+      else if (tag == ZDB_LAYOUT_TAG_FLOAT)
+      {
+         const float* f = (const float*)values + (row - firstRow);
+         float min = zone->min.f;
+         float max = zone->max.f;
+         int nan = 0;
+         for (int i = 0; i < run; i++)
          {
-             return result;
+            min = f[i] < min ? f[i] : min;
+            max = f[i] > max ? f[i] : max;
+            nan |= f[i] != f[i];
          }
+         zone->min.f = nan ? -INFINITY : min;
+         zone->max.f = nan ? INFINITY : max;
       }
       else
       {
-         /* Normal column value */
-         int result = ZdbTypeCopy(table->columns[i]->type, value, values[i]);
-         if (result != ZDB_RESULT_SUCCESS)
+         const int* v = (const int*)values + (row - firstRow);
+         int min = zone->min.i;
+         int max = zone->max.i;
+         for (int i = 0; i < run; i++)
          {
-             return result;
+            min = v[i] < min ? v[i] : min;
+            max = v[i] > max ? v[i] : max;
          }
+         zone->min.i = min;
+         zone->max.i = max;
+      }
+      row += run;
+   }
+}
+
+/* Narrows a chunk's zones back to the live rows it holds */
+void _refreshZones(ZdbTable* table, int chunk)
+{
+   _clearZones(table, chunk);
+   table->newRows[chunk] = 0;
+
+   int end = (chunk + 1) * ZDB_ROW_CHUNKS < table->rowCount ? (chunk + 1) * ZDB_ROW_CHUNKS : table->rowCount;
+   for (int i = chunk * ZDB_ROW_CHUNKS; i < end; i++)
+   {
+      if (_rowDeleted(table, i))
+      {
+         continue;
       }
 
-      table->columns[i]->lastInsertedValue = value;
-	}
+      if (ZdbEngineRowAt(table, i)->flags & ZDB_ROW_FLAG_NEW)
+      {
+         table->newRows[chunk]++;
+      }
+      else
+      {
+         _widenRowZones(table, ZdbEngineRowAt(table, i));
+      }
+   }
+}
 
-   return 1;        /* Number of rows affected */
+/* Gives a table opened from a file a directory of its rows, before one is appended or moved */
+int _buildRowDirectory(ZdbTable* table)
+{
+   if (table->rows != NULL || table->rowCount == 0)
+   {
+      return ZDB_RESULT_SUCCESS;
+   }
+
+   ZdbRow** rows = malloc((size_t)(table->rowCount + table->freeRowsLeft) * sizeof(ZdbRow*));
+   if (rows == NULL)
+   {
+      return ZDB_RESULT_OUT_OF_MEMORY;
+   }
+
+   for (int i = 0; i < table->rowCount; i++)
+   {
+      rows[i] = ZdbEngineRowAt(table, i);
+   }
+   table->rows = rows;
+
+   return ZDB_RESULT_SUCCESS;
 }
 
-int ZdbEngineUpdateRow(ZdbTable* table, ZdbRow* row, int valueCount, ...)
+/* Sizes the tombstones, zones and new row counts for a directory growing from capacity to newCapacity rows */
+int _growRowMaps(ZdbTable* table, int capacity, int newCapacity)
 {
-   va_list argp;
-	va_start(argp, valueCount);
+   /* The tombstone bitmap always covers every chunk the directory can hold */
+   size_t words = (size_t)(capacity + ZDB_ROW_CHUNKS - 1) / ZDB_ROW_CHUNKS * ZDB_TOMBSTONE_WORDS;
+   size_t newWords = (size_t)(newCapacity + ZDB_ROW_CHUNKS - 1) / ZDB_ROW_CHUNKS * ZDB_TOMBSTONE_WORDS;
+   uint64_t* tombstones = realloc(table->tombstones, newWords * sizeof(uint64_t));
+   if (tombstones == NULL)
+   {
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+   memset(tombstones + words, 0, (newWords - words) * sizeof(uint64_t));
+   table->tombstones = tombstones;
+
+   /* Zones cover the same chunks, and new ones start out empty */
+   int chunks = (int)(words / ZDB_TOMBSTONE_WORDS);
+   int newChunks = (int)(newWords / ZDB_TOMBSTONE_WORDS);
+   ZdbZone* zones = realloc(table->zones, (size_t)newChunks * table->columnCount * sizeof(ZdbZone));
+   if (zones == NULL && table->columnCount > 0)
+   {
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+   table->zones = zones;
+   for (int i = chunks; i < newChunks; i++)
+   {
+      _clearZones(table, i);
+   }
 
-   size_t rowSize;
-   if (ZdbEngineGetRowDataSize(table, table->columnCount, &rowSize) != ZDB_RESULT_SUCCESS)
+   int* newRows = realloc(table->newRows, newChunks * sizeof(int));
+   if (newRows == NULL)
    {
-      /* Could not calculate the row size */
       return ZDB_RESULT_INVALID_OPERATION;
    }
+   memset(newRows + chunks, 0, (newChunks - chunks) * sizeof(int));
+   table->newRows = newRows;
 
-   void** values = calloc(valueCount, sizeof(void*));
-   void* valueData = calloc(1, rowSize);
+   return ZDB_RESULT_SUCCESS;
+}
 
-   for (int i = 0; i < valueCount; i++)
+int _growRowDirectory(ZdbTable* table, int minimumFree)
+{
+   if (table->freeRowsLeft >= minimumFree)
    {
-      char* str = va_arg(argp, char*);
+      return ZDB_RESULT_SUCCESS;
+   }
 
-      if (str != NULL)
-      {
-         /* Normal column value */
-         int result = ZdbTypeFromString(table->columns[i]->type, str, valueData + _calculateRowOffset(table->columns, i));
-         if (result != ZDB_RESULT_SUCCESS)
-         {
-             return result;
-         }
+   if (_buildRowDirectory(table) != ZDB_RESULT_SUCCESS)
+   {
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
 
-         values[i] = valueData + _calculateRowOffset(table->columns, i);
-      }
-      else
-      {
-         values[i] = NULL;
-      }
+   /* Double the directory so bulk loads copy it a logarithmic number of times */
+   int capacity = table->rowCount + table->freeRowsLeft;
+   int newCapacity = capacity < ZDB_ROW_CHUNKS ? ZDB_ROW_CHUNKS : capacity;
+   while (newCapacity - table->rowCount < minimumFree)
+   {
+      newCapacity *= 2;
    }
 
-   int result = ZdbEngineUpdateRowValues(table, row, valueCount, values);
+   ZdbRow** rows = realloc(table->rows, newCapacity * sizeof(ZdbRow*));
+   if (rows == NULL)
+   {
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+   table->rows = rows;
 
-   free(values);
-   free(valueData);
+   if (_growRowMaps(table, capacity, newCapacity) != ZDB_RESULT_SUCCESS)
+   {
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
 
-	va_end(argp);
+   table->freeRowsLeft = newCapacity - table->rowCount;
 
-   return result;
+   return ZDB_RESULT_SUCCESS;
 }
 
-int ZdbEngineGetRowDataSize(ZdbTable* table, int columnCount, size_t* size)
+int _ensureColumnChunk(ZdbTable* table, int rowIndex)
 {
-   if (table == NULL)
+   int chunk = rowIndex / ZDB_ROW_CHUNKS;
+   if (chunk < table->chunkCount)
    {
-      /* Need a table definition */
-      return ZDB_RESULT_INVALID_NULL;
+      return ZDB_RESULT_SUCCESS;
+   }
+
+   /* Rows are appended, so at most one new chunk is needed.  Size the chunk directory along with the row directory */
+   int capacity = (table->rowCount + table->freeRowsLeft + ZDB_ROW_CHUNKS - 1) / ZDB_ROW_CHUNKS;
+   char** chunks = realloc(table->chunks, capacity * sizeof(char*));
+   if (chunks == NULL)
+   {
+      return ZDB_RESULT_INVALID_OPERATION;
    }
+   table->chunks = chunks;
 
-   *size = _calculateRowSize(columnCount, table->columns);
+   char* data = calloc(ZDB_ROW_CHUNKS, table->layout.rowSize);
+   if (data == NULL)
+   {
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
 
+   table->chunks[table->chunkCount++] = data;
    return ZDB_RESULT_SUCCESS;
 }
 
-int ZdbEngineInsertRow(ZdbTable* table, int columnCount, ZdbRow** row)
+/* Adds a row to the end of the table.  The row directory must already have room for it */
+ZdbRow* _appendRow(ZdbTable* table, int flags)
 {
-   ZdbRow* r = calloc(1, sizeof(ZdbRow) + _calculateRowSize(columnCount, table->columns));
+   /* Take the column chunk first so a failed chunk allocation doesn't strand a row slot */
+   if (table->storage == ZDB_STORAGE_PAX && _ensureColumnChunk(table, table->rowCount) != ZDB_RESULT_SUCCESS)
+   {
+      /* Out of memory for column storage */
+      return NULL;
+   }
 
-   if (table->freeRowsLeft == 0)
+   ZdbRow* r = _allocateRowSlot(&table->allocator);
+   if (r == NULL)
    {
-      /* We're out of free rows, so allocate some more */
-      table->rows = realloc(table->rows, (table->rowCount + ZDB_ROW_CHUNKS)*sizeof(ZdbRow*));
-      table->freeRowsLeft = ZDB_ROW_CHUNKS;
+      return NULL;
    }
 
+   r->index = table->rowCount;
+   r->flags = flags;
+
    table->rows[table->rowCount++] = r;
    table->freeRowsLeft--;
 
-   *row = r;
-   return ZDB_RESULT_SUCCESS;
+   return r;
 }
 
-int ZdbEngineGetValue(ZdbTable* table, ZdbRow* row, int column, void** value)
+void _freeStringHeap(ZdbStringHeap* heap)
 {
-   if (table == NULL || row == NULL || value == NULL)
+   for (int i = heap->mappedPageCount; i < heap->pageCount; i++)
+   {
+      free(heap->pages[i]);
+   }
+   free(heap->pages);
+
+   memset(heap, 0, sizeof(ZdbStringHeap));
+}
+
+char* _stringHeapAllocate(ZdbStringHeap* heap, size_t size, uint32_t* offset)
+{
+   if (heap->pageCount == 0 || ZDB_STRING_PAGE_SIZE - heap->pageUsed < size)
+   {
+      /* Values never straddle pages, so start a fresh one */
+      if (heap->pageCount >= ZDB_LIMIT_STRING_PAGES)
+      {
+         /* Offsets past the last page wouldn't fit in a ZdbVarcharRef */
+         return NULL;
+      }
+
+      char** pages = realloc(heap->pages, (heap->pageCount + 1) * sizeof(char*));
+      if (pages == NULL)
+      {
+         return NULL;
+      }
+      heap->pages = pages;
+
+      char* page = malloc(ZDB_STRING_PAGE_SIZE);
+      if (page == NULL)
+      {
+         return NULL;
+      }
+
+      heap->pages[heap->pageCount++] = page;
+      heap->pageUsed = 0;
+   }
+
+   char* value = heap->pages[heap->pageCount - 1] + heap->pageUsed;
+   *offset = (uint32_t)((size_t)(heap->pageCount - 1) * ZDB_STRING_PAGE_SIZE + heap->pageUsed);
+   heap->pageUsed += size;
+   heap->bytesLive += size;
+
+   return value;
+}
+
+char* _resolveVarchar(ZdbTable* table, ZdbVarcharRef* ref)
+{
+   if (ref->length == 0)
+   {
+      /* Empty and never-written strings don't take up heap space */
+      return "";
+   }
+
+   return table->strings.pages[ref->offset / ZDB_STRING_PAGE_SIZE] + ref->offset % ZDB_STRING_PAGE_SIZE;
+}
+
+int _storeVarchar(ZdbTable* table, ZdbType* type, ZdbVarcharRef* ref, void* src)
+{
+   if (src == NULL)
+   {
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   char* current = _resolveVarchar(table, ref);
+   if (src == current)
+   {
+      /* Writing a field back to itself, as happens when a whole row is rewritten */
+      return ZDB_RESULT_SUCCESS;
+   }
+
+   size_t size = 0;
+   int result = ZdbTypeSizeof(type, src, &size);
+   if (result != ZDB_RESULT_SUCCESS)
+   {
+      return result;
+   }
+
+   uint32_t offset = 0;
+   char* dest = NULL;
+   if (size > 1)
+   {
+      dest = _stringHeapAllocate(&table->strings, size, &offset);
+      if (dest == NULL)
+      {
+         /* The field keeps its old value */
+         return ZDB_RESULT_OUT_OF_MEMORY;
+      }
+   }
+
+   if (ref->length > 0)
+   {
+      /* The old characters stay behind in the heap */
+      table->strings.bytesLive -= ref->length + 1;
+      table->strings.bytesDead += ref->length + 1;
+   }
+
+   if (size <= 1)
+   {
+      ref->length = 0;
+      ref->offset = 0;
+      return ZDB_RESULT_SUCCESS;
+   }
+
+   result = ZdbTypeCopy(type, dest, src);
+   if (result != ZDB_RESULT_SUCCESS)
+   {
+      return result;
+   }
+
+   ref->length = (uint32_t)(size - 1);
+   ref->offset = offset;
+
+   return ZDB_RESULT_SUCCESS;
+}
+
+uint32_t _hashString(const char* value, size_t length)
+{
+   /* FNV-1a */
+   uint32_t hash = 2166136261u;
+   for (size_t i = 0; i < length; i++)
+   {
+      hash ^= (unsigned char)value[i];
+      hash *= 16777619u;
+   }
+
+   return hash;
+}
+
+ZdbDictionary* _createDictionary()
+{
+   ZdbDictionary* dict = calloc(1, sizeof(ZdbDictionary));
+   dict->slotCount = 64;
+   dict->slots = calloc(dict->slotCount, sizeof(uint32_t));
+
+   /* Code 0 is the empty string, which needs no heap space */
+   dict->capacity = 16;
+   dict->entries = calloc(dict->capacity, sizeof(ZdbVarcharRef));
+   dict->values = calloc(dict->capacity, sizeof(char*));
+   dict->values[0] = "";
+   dict->count = 1;
+
+   return dict;
+}
+
+void _freeDictionary(ZdbDictionary* dict)
+{
+   free(dict->entries);
+   free(dict->values);
+   free(dict->slots);
+   free(dict);
+}
+
+/* Returns the slot holding the value, or the empty slot where it would go */
+uint32_t* _dictionarySlot(ZdbDictionary* dict, const char* value, size_t length)
+{
+   uint32_t mask = dict->slotCount - 1;
+   uint32_t i = _hashString(value, length) & mask;
+   while (dict->slots[i] != 0)
+   {
+      uint32_t code = dict->slots[i] - 1;
+      if (dict->entries[code].length == length && !memcmp(dict->values[code], value, length))
+      {
+         break;
+      }
+
+      i = (i + 1) & mask;
+   }
+
+   return &dict->slots[i];
+}
+
+int _growDictionary(ZdbDictionary* dict)
+{
+   if (dict->count == dict->capacity)
+   {
+      int capacity = dict->capacity * 2;
+      ZdbVarcharRef* entries = realloc(dict->entries, capacity * sizeof(ZdbVarcharRef));
+      char** values = realloc(dict->values, capacity * sizeof(char*));
+      if (entries == NULL || values == NULL)
+      {
+         return ZDB_RESULT_INVALID_OPERATION;
+      }
+
+      dict->entries = entries;
+      dict->values = values;
+      dict->capacity = capacity;
+   }
+
+   if ((dict->count + 1) * 2 > dict->slotCount)
+   {
+      /* Keep the hash at most half full, rehashing every code but the empty string */
+      int slotCount = dict->slotCount * 2;
+      uint32_t* slots = calloc(slotCount, sizeof(uint32_t));
+      if (slots == NULL)
+      {
+         return ZDB_RESULT_INVALID_OPERATION;
+      }
+
+      free(dict->slots);
+      dict->slots = slots;
+      dict->slotCount = slotCount;
+      for (int code = 1; code < dict->count; code++)
+      {
+         *_dictionarySlot(dict, dict->values[code], dict->entries[code].length) = code + 1;
+      }
+   }
+
+   return ZDB_RESULT_SUCCESS;
+}
+
+int _storeDictionaryValue(ZdbTable* table, int column, uint32_t* code, void* src)
+{
+   if (src == NULL)
+   {
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   ZdbDictionary* dict = table->dictionaries[column];
+   ZdbType* type = table->columns[column]->type;
+
+   size_t size = 0;
+   int result = ZdbTypeSizeof(type, src, &size);
+   if (result != ZDB_RESULT_SUCCESS)
+   {
+      return result;
+   }
+
+   if (size <= 1)
+   {
+      *code = 0;
+      return ZDB_RESULT_SUCCESS;
+   }
+
+   uint32_t* slot = _dictionarySlot(dict, src, size - 1);
+   if (*slot != 0)
+   {
+      /* Value is already in the dictionary */
+      *code = *slot - 1;
+      return ZDB_RESULT_SUCCESS;
+   }
+
+   if (_growDictionary(dict) != ZDB_RESULT_SUCCESS)
+   {
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   uint32_t offset;
+   char* dest = _stringHeapAllocate(&table->strings, size, &offset);
+   if (dest == NULL)
+   {
+      return ZDB_RESULT_OUT_OF_MEMORY;
+   }
+
+   result = ZdbTypeCopy(type, dest, src);
+   if (result != ZDB_RESULT_SUCCESS)
+   {
+      return result;
+   }
+
+   uint32_t newCode = dict->count++;
+   dict->entries[newCode].length = (uint32_t)(size - 1);
+   dict->entries[newCode].offset = offset;
+   dict->values[newCode] = dest;
+
+   /* The hash may have been rebuilt while growing, so find the slot again */
+   *_dictionarySlot(dict, dest, size - 1) = newCode + 1;
+
+   *code = newCode;
+   return ZDB_RESULT_SUCCESS;
+}
+
+/* Keeps a copy of the last autoincrement value handed out.  Rows move and slots are reused once rows can be
+   deleted, so the column can't just point at the field it was written to */
+int _rememberAutoincrement(ZdbTable* table, int column, void* value)
+{
+   ZdbColumn* c = table->columns[column];
+   if (c->lastInsertedValue == NULL)
+   {
+      c->lastInsertedValue = calloc(1, table->layout.sizes[column]);
+      if (c->lastInsertedValue == NULL)
+      {
+         return ZDB_RESULT_INVALID_OPERATION;
+      }
+   }
+
+   return ZdbTypeCopy(c->type, c->lastInsertedValue, value);
+}
+
+ZdbLog* _tableLog(ZdbTable* table)
+{
+   return table->db != NULL ? table->db->log : NULL;
+}
+
+/* With autocommit, a change only returns once its log record is durable */
+int _commitLogged(ZdbLog* log, uint64_t sequence, int result)
+{
+   if (result >= 0 && ZdbLogIsAutocommit(log))
+   {
+      int logResult = ZdbLogWait(log, sequence);
+      if (logResult != ZDB_RESULT_SUCCESS)
+      {
+         return logResult;
+      }
+   }
+
+   return result;
+}
+
+/*
+ * Public Interface Methods
+ */
+
+int ZdbEngineCreateColumn(char* name, ZdbType* type, int autoincrement, ZdbColumn** column)
+{
+   ZdbColumn* c = malloc(sizeof(ZdbColumn));
+   c->type = type;
+   strcpy(c->name, name);
+   c->autoincrement = autoincrement;
+   c->encoding = ZDB_ENCODING_NONE;
+   c->lastInsertedValue = NULL;
+
+   *column = c;
+   return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbEngineSetColumnEncoding(ZdbColumn* column, int encoding)
+{
+   if (column == NULL)
+   {
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   if (encoding != ZDB_ENCODING_NONE && (encoding != ZDB_ENCODING_DICTIONARY || column->type != ZdbStandardTypes->varcharType))
+   {
+      /* Only varchar columns can be dictionary encoded */
+      return ZDB_RESULT_UNSUPPORTED;
+   }
+
+   if (column->autoincrement && encoding != ZDB_ENCODING_NONE)
+   {
+      /* Autoincrement values are all distinct, so there is nothing to gain */
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   column->encoding = encoding;
+   return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbEngineCreateTable(ZdbDatabase* db, char* name, int columnCount, ZdbColumn** columnDefs, ZdbTable** table)
+{
+   return ZdbEngineCreateTableWithStorage(db, name, columnCount, columnDefs, ZDB_STORAGE_ROW, table);
+}
+
+int _createTable(ZdbDatabase* db, char* name, int columnCount, ZdbColumn** columnDefs, int storage, ZdbTable** table)
+{
+   int i;
+
+   if (storage != ZDB_STORAGE_ROW && storage != ZDB_STORAGE_PAX)
+   {
+      /* Unknown storage mode */
+      return ZDB_RESULT_UNSUPPORTED;
+   }
+
+   if (columnCount < 0 || columnCount > ZDB_LIMIT_COLUMNS)
+   {
+      /* Tables are limited to a fixed number of columns */
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   ZdbTable* t = malloc(sizeof(ZdbTable));
+
+   strcpy(t->name, name);
+   t->db = db;
+   t->columnCount = columnCount;
+   t->storage = storage;
+
+   t->columns = malloc(columnCount * sizeof(ZdbColumn*));
+   for (i = 0; i < columnCount; i++)
+   {
+      t->columns[i] = columnDefs[i];
+   }
+
+   int result = _buildRowLayout(columnCount, t->columns, &t->layout);
+   if (result != ZDB_RESULT_SUCCESS)
+   {
+      free(t->columns);
+      free(t);
+      return result;
+   }
+
+   _initRowAllocator(&t->allocator, &t->layout, storage);
+
+   t->rows = NULL;
+   t->mappedRows = NULL;
+   t->freeRowsLeft = 0;
+   t->rowCount = 0;
+   t->chunks = NULL;
+   t->chunkCount = 0;
+   t->mappedChunkCount = 0;
+   t->tombstones = NULL;
+   t->deletedCount = 0;
+   t->pinCount = 0;
+   t->compactRead = 0;
+   t->compactWrite = 0;
+   t->compactions = 0;
+   t->zones = NULL;
+   t->newRows = NULL;
+   t->indexes = NULL;
+   t->indexCount = 0;
+   t->stats = NULL;
+   memset(&t->strings, 0, sizeof(ZdbStringHeap));
+
+   for (i = 0; i < ZDB_LIMIT_COLUMNS; i++)
+   {
+      t->dictionaries[i] = (i < columnCount && t->layout.tags[i] == ZDB_LAYOUT_TAG_DICTIONARY) ? _createDictionary() : NULL;
+   }
+
+   _insertTableIntoDatabase(db, t);
+
+   *table = t;
+   return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbEngineCreateTableWithStorage(ZdbDatabase* db, char* name, int columnCount, ZdbColumn** columnDefs, int storage, ZdbTable** table)
+{
+   if (db->log == NULL)
+   {
+      return _createTable(db, name, columnCount, columnDefs, storage, table);
+   }
+
+   ZdbLogLock(db->log);
+   uint64_t sequence = 0;
+   int result = _createTable(db, name, columnCount, columnDefs, storage, table);
+   if (result == ZDB_RESULT_SUCCESS)
+   {
+      sequence = ZdbLogCreateTable(db->log, *table);
+   }
+   ZdbLogUnlock(db->log);
+
+   return _commitLogged(db->log, sequence, result);
+}
+
+int ZdbEngineCreateDB(char* name, ZdbDatabase** database)
+{
+   ZdbDatabase* db = malloc(sizeof(ZdbDatabase));
+   strcpy(db->name, name);
+   db->tables = NULL;
+   db->tableCount = 0;
+   db->freeTablesLeft = 0;
+   db->mapping = NULL;
+   db->mappingSize = 0;
+   db->log = NULL;
+   db->logSequence = 0;
+   db->checkpoint = NULL;
+
+   *database = db;
+   return ZDB_RESULT_SUCCESS;
+}
+
+void _dropTable(ZdbTable* table)
+{
+   int i;
+   ZdbIndexFreeAll(table);
+   ZdbStatsFree(table);
+
+   for (i = 0; i < table->columnCount; i++)
+   {
+      free(table->columns[i]->lastInsertedValue);
+      free(table->columns[i]);
+   }
+   free(table->columns);
+   table->columns = NULL;
+   table->columnCount = 0;
+
+   /* Rows live in slabs, so they are released a page at a time rather than one by one */
+   _freeRowAllocator(&table->allocator);
+   free(table->rows);
+   table->rows = NULL;
+   table->mappedRows = NULL;
+   table->rowCount = 0;
+   table->freeRowsLeft = 0;
+   free(table->tombstones);
+   table->tombstones = NULL;
+   table->deletedCount = 0;
+   free(table->zones);
+   table->zones = NULL;
+   free(table->newRows);
+   table->newRows = NULL;
+
+   for (i = table->mappedChunkCount; i < table->chunkCount; i++)
+   {
+      free(table->chunks[i]);
+   }
+   free(table->chunks);
+   table->chunks = NULL;
+   table->chunkCount = 0;
+   table->mappedChunkCount = 0;
+
+   for (i = 0; i < ZDB_LIMIT_COLUMNS; i++)
+   {
+      if (table->dictionaries[i] != NULL)
+      {
+         _freeDictionary(table->dictionaries[i]);
+         table->dictionaries[i] = NULL;
+      }
+   }
+
+   _freeStringHeap(&table->strings);
+}
+
+int ZdbEngineDropTable(ZdbTable* table)
+{
+   if (table->columns == NULL)
+   {
+      /* Already dropped */
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   ZdbLog* log = _tableLog(table);
+   if (log == NULL)
+   {
+      _dropTable(table);
+      return ZDB_RESULT_SUCCESS;
+   }
+
+   /* Logged first, while the table still has its number */
+   ZdbLogLock(log);
+   uint64_t sequence = ZdbLogDropTable(log, table);
+   _dropTable(table);
+   ZdbLogUnlock(log);
+
+   return _commitLogged(log, sequence, ZDB_RESULT_SUCCESS);
+}
+
+int ZdbEngineDropDB(ZdbDatabase* db)
+{
+   int i;
+
+   /* A checkpoint in progress still reads the log */
+   ZdbEngineFreeCheckpoint(db);
+
+   if (db->log != NULL)
+   {
+      /* Everything logged so far reaches the disk before the tables go away */
+      ZdbEngineDetachLog(db);
+   }
+
+   for (i = 0; i < db->tableCount; i++)
+   {
+      ZdbEngineDropTable(db->tables[i]);
+      free(db->tables[i]);
+      db->tables[i] = NULL;
+   }
+   free(db->tables);
+   db->tables = NULL;
+   db->tableCount = 0;
+   db->freeTablesLeft = 0;
+
+   if (db->mapping != NULL)
+   {
+      /* Nothing can point into the file any more */
+      munmap(db->mapping, db->mappingSize);
+      db->mapping = NULL;
+      db->mappingSize = 0;
+   }
+
+   return ZDB_RESULT_SUCCESS;
+}
+
+int _writeRowValues(ZdbTable* table, ZdbRow* row, int valueCount, void** values, int restoring)
+{
+   int newRow = row->flags & ZDB_ROW_FLAG_NEW;
+   row->flags &= ~ZDB_ROW_FLAG_NEW;
+   if (newRow)
+   {
+      /* The row's values go into the zones from now on */
+      table->newRows[row->index / ZDB_ROW_CHUNKS]--;
+   }
+
+	for (int i = 0; i < valueCount; i++)
+	{
+      void* value = _fieldAddress(table, row, i);
+
+      if (restoring && values[i] == NULL)
+      {
+         /* The change being restored left this field alone */
+         continue;
+      }
+
+      if (table->columns[i]->autoincrement && restoring)
+      {
+         /* Replaying a value that was handed out before */
+         int result = ZdbTypeCopy(table->columns[i]->type, value, values[i]);
+         if (result == ZDB_RESULT_SUCCESS)
+         {
+             result = _rememberAutoincrement(table, i, value);
+         }
+
+         if (result != ZDB_RESULT_SUCCESS)
+         {
+             return result;
+         }
+      }
+      else if (table->columns[i]->autoincrement)
+      {
+         if (!newRow)
+         {
+             /* We don't auto increment on an existing row */
+             continue ;
+         }
+
+         /* Automatically incrementing column */
+         if (values[i] != NULL)
+         {
+             /* Cannot specify explicit value for autoincrement columns */
+             return ZDB_RESULT_VALUE_ERROR;
+         }
+
+         int result = ZdbTypeNextValue(table->columns[i]->type, table->columns[i]->lastInsertedValue, value);
+         if (result == ZDB_RESULT_SUCCESS)
+         {
+             result = _rememberAutoincrement(table, i, value);
+         }
+
+         if (result != ZDB_RESULT_SUCCESS)
+         {
+             return result;
+         }
+      }
+      else if (table->layout.tags[i] == ZDB_LAYOUT_TAG_VARCHAR)
+      {
+         /* Out of line string value */
+         int result = _storeVarchar(table, table->columns[i]->type, value, values[i]);
+         if (result != ZDB_RESULT_SUCCESS)
+         {
+             return result;
+         }
+      }
+      else if (table->layout.tags[i] == ZDB_LAYOUT_TAG_DICTIONARY)
+      {
+         /* Intern the value and keep its code */
+         int result = _storeDictionaryValue(table, i, value, values[i]);
+         if (result != ZDB_RESULT_SUCCESS)
+         {
+             return result;
+         }
+      }
+      else
+      {
+         /* Normal column value */
+         int result = ZdbTypeCopy(table->columns[i]->type, value, values[i]);
+         if (result != ZDB_RESULT_SUCCESS)
+         {
+             return result;
+         }
+      }
+
+	}
+
+   return 1;        /* Number of rows affected */
+}
+
+int _updateRowValues(ZdbTable* table, ZdbRow* row, int valueCount, void** values, int restoring)
+{
+   if (_rowDeleted(table, row->index))
+   {
+      /* Deleted rows can't be brought back by writing to them */
+      return ZDB_RESULT_NOT_FOUND;
+   }
+
+   /* A row's first write is its insert as far as the stats go */
+   int newRow = row->flags & ZDB_ROW_FLAG_NEW;
+   if (table->indexCount == 0)
+   {
+      int result = _writeRowValues(table, row, valueCount, values, restoring);
+      _widenRowZones(table, row);
+      if (newRow && table->stats != NULL)
+      {
+         ZdbStatsAddRow(table, row);
+      }
+      return result;
+   }
+
+   /* Index the row under whatever it holds afterwards, even if the update only got part way */
+   ZdbIndexRemoveRow(table, row);
+   int result = _writeRowValues(table, row, valueCount, values, restoring);
+   if (ZdbIndexAddRow(table, row) != ZDB_RESULT_SUCCESS)
+   {
+      /* The values can't be taken back, and an index missing the row would answer wrongly.  Scans still give the
+         right answers, so the indexes go */
+      ZdbIndexFreeAll(table);
+      result = result >= 0 ? ZDB_RESULT_OUT_OF_MEMORY : result;
+   }
+   _widenRowZones(table, row);
+   if (newRow && table->stats != NULL)
+   {
+      ZdbStatsAddRow(table, row);
+   }
+
+   return result;
+}
+
+int ZdbEngineUpdateRowValues(ZdbTable* table, ZdbRow* row, int valueCount, void** values)
+{
+   ZdbLog* log = _tableLog(table);
+   if (log == NULL)
+   {
+      return _updateRowValues(table, row, valueCount, values, 0);
+   }
+
+   ZdbLogLock(log);
+   uint64_t sequence = 0;
+   int newRow = row->flags & ZDB_ROW_FLAG_NEW;
+   int result = _updateRowValues(table, row, valueCount, values, 0);
+   if (result >= 0 || result == ZDB_RESULT_OUT_OF_MEMORY)
+   {
+      /* Running out of memory for the indexes still leaves the new values in the row */
+      sequence = ZdbLogRowValues(log, table, row, valueCount, newRow);
+   }
+   ZdbLogUnlock(log);
+
+   return _commitLogged(log, sequence, result);
+}
+
+int ZdbEngineRestoreRowValues(ZdbTable* table, ZdbRow* row, int valueCount, void** values)
+{
+   if (table == NULL || row == NULL || values == NULL)
+   {
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   return _updateRowValues(table, row, valueCount, values, 1);
+}
+
+int ZdbEngineUpdateRow(ZdbTable* table, ZdbRow* row, int valueCount, ...)
+{
+   va_list argp;
+	va_start(argp, valueCount);
+
+   if (table == NULL || valueCount > table->columnCount)
+   {
+      /* Need a table with enough columns for the values */
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   /* Parsed values need their full static size, which is more than the row stores for out of line fields */
+   size_t valueOffsets[ZDB_LIMIT_COLUMNS];
+   size_t valueDataSize = 0;
+   for (int i = 0; i < valueCount; i++)
+   {
+      valueOffsets[i] = valueDataSize;
+      valueDataSize += (table->layout.valueSizes[i] + ZDB_LAYOUT_MAX_ALIGNMENT - 1) & ~(ZDB_LAYOUT_MAX_ALIGNMENT - 1);
+   }
+
+   void** values = calloc(valueCount, sizeof(void*));
+   void* valueData = calloc(1, valueDataSize);
+
+   for (int i = 0; i < valueCount; i++)
+   {
+      char* str = va_arg(argp, char*);
+
+      if (str != NULL)
+      {
+         /* Normal column value */
+         int result = ZdbTypeFromString(table->columns[i]->type, str, valueData + valueOffsets[i]);
+         if (result != ZDB_RESULT_SUCCESS)
+         {
+             return result;
+         }
+
+         values[i] = valueData + valueOffsets[i];
+      }
+      else
+      {
+         values[i] = NULL;
+      }
+   }
+
+   int result = ZdbEngineUpdateRowValues(table, row, valueCount, values);
+
+   free(values);
+   free(valueData);
+
+	va_end(argp);
+
+   return result;
+}
+
+int ZdbEngineGetRowDataSize(ZdbTable* table, int columnCount, size_t* size)
+{
+   if (table == NULL)
+   {
+      /* Need a table definition */
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   if (columnCount < table->columnCount)
+   {
+      /* Only the leading columns are wanted, which end where the next field starts */
+      *size = columnCount > 0 ? table->layout.offsets[columnCount] : 0;
+   }
+   else
+   {
+      *size = table->layout.rowSize;
+   }
+
+   return ZDB_RESULT_SUCCESS;
+}
+
+int _deleteRow(ZdbTable* table, int rowIndex)
+{
+   if (_rowDeleted(table, rowIndex))
+   {
+      return 0;
+   }
+
+   table->tombstones[rowIndex / 64] |= 1ull << (rowIndex % 64);
+   table->deletedCount++;
+
+   /* The row's strings are garbage now */
+   ZdbRow* row = ZdbEngineRowAt(table, rowIndex);
+   ZdbIndexRemoveRow(table, row);
+   if (row->flags & ZDB_ROW_FLAG_NEW)
+   {
+      table->newRows[rowIndex / ZDB_ROW_CHUNKS]--;
+   }
+   for (int i = 0; i < table->columnCount; i++)
+   {
+      if (table->layout.tags[i] == ZDB_LAYOUT_TAG_VARCHAR)
+      {
+         ZdbVarcharRef* ref = _fieldAddress(table, row, i);
+         if (ref->length > 0)
+         {
+            table->strings.bytesLive -= ref->length + 1;
+            table->strings.bytesDead += ref->length + 1;
+         }
+      }
+   }
+
+   return 1;
+}
+
+/* Moves the live row at from into the deleted row's place at to.  The slots trade places in the directory, so
+   handles to the live row stay valid; PAX fields are copied since their position follows the index */
+void _moveRow(ZdbTable* table, int from, int to)
+{
+   ZdbRow* live = ZdbEngineRowAt(table, from);
+   ZdbRow* dead = ZdbEngineRowAt(table, to);
+
+   if (table->storage == ZDB_STORAGE_PAX)
+   {
+      for (int i = 0; i < table->columnCount; i++)
+      {
+         memcpy(_fieldAddress(table, dead, i), _fieldAddress(table, live, i), table->layout.sizes[i]);
+      }
+   }
+
+   live->index = to;
+   dead->index = from;
+   table->rows[to] = live;
+   table->rows[from] = dead;
+
+   table->tombstones[to / 64] &= ~(1ull << (to % 64));
+   table->tombstones[from / 64] |= 1ull << (from % 64);
+}
+
+/* Gives back the last row of the table, which a compaction pass has already pushed past every live row */
+void _popDeletedRow(ZdbTable* table)
+{
+   int index = table->rowCount - 1;
+   table->tombstones[index / 64] &= ~(1ull << (index % 64));
+   _releaseRowSlot(&table->allocator, ZdbEngineRowAt(table, index));
+
+   if (table->storage == ZDB_STORAGE_PAX)
+   {
+      /* An emptied chunk is freed outright.  Otherwise the row's fields are cleared, since appended rows expect
+         zeroed fields */
+      char* chunk = table->chunks[index / ZDB_ROW_CHUNKS];
+      if (index % ZDB_ROW_CHUNKS == 0)
+      {
+         if (table->chunkCount > table->mappedChunkCount)
+         {
+            free(chunk);
+         }
+         else
+         {
+            table->mappedChunkCount--;
+         }
+         table->chunkCount--;
+      }
+      else
+      {
+         for (int i = 0; i < table->columnCount; i++)
+         {
+            size_t size = table->layout.sizes[i];
+            memset(chunk + ZDB_ROW_CHUNKS * table->layout.offsets[i] + (index % ZDB_ROW_CHUNKS) * size, 0, size);
+         }
+      }
+   }
+
+   if (index % ZDB_ROW_CHUNKS == 0)
+   {
+      _clearZones(table, index / ZDB_ROW_CHUNKS);
+   }
+
+   table->deletedCount--;
+   table->freeRowsLeft++;
+   table->rowCount--;
+}
+
+/* Takes back the rows from firstRow on, which a batch appended before it failed */
+void _discardRows(ZdbTable* table, int firstRow)
+{
+   while (table->rowCount > firstRow)
+   {
+      _deleteRow(table, table->rowCount - 1);
+      _popDeletedRow(table);
+   }
+}
+
+int _insertRow(ZdbTable* table, int columnCount, ZdbRow** row)
+{
+   if (columnCount > table->columnCount)
+   {
+      /* Row can't have more values than the table has columns */
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   if (_growRowDirectory(table, 1) != ZDB_RESULT_SUCCESS)
+   {
+      /* Out of memory for the row directory */
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   /* Every slot is sized for the full row, so a short row can be widened by a later update */
+   ZdbRow* r = _appendRow(table, ZDB_ROW_FLAG_NEW);
+   if (r == NULL)
+   {
+      /* Out of memory for row storage */
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   /* Until it is updated, the new row holds empty values, which scans see too.  Zones count it separately */
+   table->newRows[r->index / ZDB_ROW_CHUNKS]++;
+   int result = ZdbIndexAddRow(table, r);
+   if (result != ZDB_RESULT_SUCCESS)
+   {
+      _discardRows(table, r->index);
+      return result;
+   }
+
+   *row = r;
+   return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbEngineInsertRow(ZdbTable* table, int columnCount, ZdbRow** row)
+{
+   ZdbLog* log = _tableLog(table);
+   if (log == NULL)
+   {
+      return _insertRow(table, columnCount, row);
+   }
+
+   /* The row stays empty until its first update, which is what waits for the log */
+   ZdbLogLock(log);
+   int result = _insertRow(table, columnCount, row);
+   if (result == ZDB_RESULT_SUCCESS)
+   {
+      ZdbLogInsertRow(log, table, *row);
+   }
+   ZdbLogUnlock(log);
+
+   return result;
+}
+
+int ZdbEngineReserveRows(ZdbTable* table, int rowCount)
+{
+   if (table == NULL)
+   {
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   if (rowCount < 0)
+   {
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   return _growRowDirectory(table, rowCount);
+}
+
+int ZdbEngineMapRows(ZdbTable* table, char* slots, int rowCount)
+{
+   if (table == NULL || (slots == NULL && rowCount > 0))
+   {
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   if (rowCount < 0 || table->rowCount > 0 || table->rows != NULL)
+   {
+      /* Only an empty table can take rows this way */
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   if (rowCount == 0)
+   {
+      return ZDB_RESULT_SUCCESS;
+   }
+
+   int result = _growRowMaps(table, 0, rowCount);
+   if (result != ZDB_RESULT_SUCCESS)
+   {
+      return result;
+   }
+
+   table->mappedRows = slots;
+   table->rowCount = rowCount;
+   table->freeRowsLeft = 0;
+
+   return ZDB_RESULT_SUCCESS;
+}
+
+int _insertColumnValues(ZdbTable* table, int column, int firstRow, int rowCount, void* values)
+{
+   ZdbType* type = table->columns[column]->type;
+   int tag = table->layout.tags[column];
+   size_t size = table->layout.sizes[column];
+
+   if (table->storage == ZDB_STORAGE_PAX && (tag == ZDB_LAYOUT_TAG_INT || tag == ZDB_LAYOUT_TAG_FLOAT || tag == ZDB_LAYOUT_TAG_BOOLEAN))
+   {
+      /* The batch is already laid out the way a column chunk is, so copy whole runs */
+      int row = firstRow;
+      while (row < firstRow + rowCount)
+      {
+         int run = ZDB_ROW_CHUNKS - row % ZDB_ROW_CHUNKS;
+         if (run > firstRow + rowCount - row)
+         {
+            run = firstRow + rowCount - row;
+         }
+
+         void* field = _fieldAddress(table, ZdbEngineRowAt(table, row), column);
+         memcpy(field, (char*)values + (row - firstRow) * size, run * size);
+         row += run;
+      }
+
+      return ZDB_RESULT_SUCCESS;
+   }
+
+   for (int i = 0; i < rowCount; i++)
+   {
+      void* dest = _fieldAddress(table, ZdbEngineRowAt(table, firstRow + i), column);
+      int result = ZDB_RESULT_SUCCESS;
+
+      switch (tag)
+      {
+         case ZDB_LAYOUT_TAG_INT:
+         case ZDB_LAYOUT_TAG_BOOLEAN:
+            *(int*)dest = ((int*)values)[i];
+            break;
+         case ZDB_LAYOUT_TAG_FLOAT:
+            *(float*)dest = ((float*)values)[i];
+            break;
+         case ZDB_LAYOUT_TAG_VARCHAR:
+            result = _storeVarchar(table, type, dest, ((char**)values)[i]);
+            break;
+         case ZDB_LAYOUT_TAG_DICTIONARY:
+            result = _storeDictionaryValue(table, column, dest, ((char**)values)[i]);
+            break;
+         default:
+            result = ZdbTypeCopy(type, dest, (char*)values + i * table->layout.valueSizes[column]);
+            break;
+      }
+
+      if (result != ZDB_RESULT_SUCCESS)
+      {
+         return result;
+      }
+   }
+
+   return ZDB_RESULT_SUCCESS;
+}
+
+int _insertAutoincrementValues(ZdbTable* table, int column, int firstRow, int rowCount)
+{
+   ZdbColumn* c = table->columns[column];
+   void* previous = c->lastInsertedValue;
+
+   if (table->layout.tags[column] == ZDB_LAYOUT_TAG_INT)
+   {
+      /* Claim the whole range at once */
+      int first;
+      int result = ZdbTypeNextValue(c->type, previous, &first);
+      if (result != ZDB_RESULT_SUCCESS)
+      {
+         return result;
+      }
+
+      for (int i = 0; i < rowCount; i++)
+      {
+         *(int*)_fieldAddress(table, ZdbEngineRowAt(table, firstRow + i), column) = first + i;
+      }
+   }
+   else
+   {
+      for (int i = 0; i < rowCount; i++)
+      {
+         void* value = _fieldAddress(table, ZdbEngineRowAt(table, firstRow + i), column);
+         int result = ZdbTypeNextValue(c->type, previous, value);
+         if (result != ZDB_RESULT_SUCCESS)
+         {
+            return result;
+         }
+
+         previous = value;
+      }
+   }
+
+   return ZDB_RESULT_SUCCESS;
+}
+
+/* Which pass of a batch insert fills the column */
+int _insertPass(ZdbTable* table, int column, void* values)
+{
+   if (values == NULL)
+   {
+      return 2;
+   }
+
+   return table->layout.tags[column] == ZDB_LAYOUT_TAG_DICTIONARY ? 1 : 0;
+}
+
+int _insertRows(ZdbTable* table, int rowCount, void** columns)
+{
+   if (rowCount <= 0)
+   {
+      return rowCount == 0 ? 0 : ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   int i;
+   for (i = 0; i < table->columnCount; i++)
+   {
+      if ((columns[i] == NULL) != (table->columns[i]->autoincrement != 0))
+      {
+         /* Autoincrement columns are filled in by the engine and every other column needs values */
+         return ZDB_RESULT_VALUE_ERROR;
+      }
+   }
+
+   /* Dictionary codes can't be handed back, so a missing value there is caught before anything is added */
+   for (i = 0; i < table->columnCount; i++)
+   {
+      if (table->layout.tags[i] == ZDB_LAYOUT_TAG_DICTIONARY)
+      {
+         for (int j = 0; j < rowCount; j++)
+         {
+            if (((char**)columns[i])[j] == NULL)
+            {
+               return ZDB_RESULT_INVALID_NULL;
+            }
+         }
+      }
+   }
+
+   /* Grow everything once for the whole batch */
+   if (_growRowDirectory(table, rowCount) != ZDB_RESULT_SUCCESS)
+   {
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   int firstRow = table->rowCount;
+   for (i = 0; i < rowCount; i++)
+   {
+      if (_appendRow(table, 0) == NULL)
+      {
+         /* Out of memory for row storage */
+         _discardRows(table, firstRow);
+         return ZDB_RESULT_INVALID_OPERATION;
+      }
+   }
+
+   /* Plain values first, then dictionary codes, then autoincrement values, so a batch that fails part way is taken
+      back without having used up any codes or IDs */
+   for (int pass = 0; pass < 3; pass++)
+   {
+      for (i = 0; i < table->columnCount; i++)
+      {
+         if (_insertPass(table, i, columns[i]) != pass)
+         {
+            continue;
+         }
+
+         int result = columns[i] == NULL ? _insertAutoincrementValues(table, i, firstRow, rowCount)
+                                         : _insertColumnValues(table, i, firstRow, rowCount, columns[i]);
+         if (result != ZDB_RESULT_SUCCESS)
+         {
+            _discardRows(table, firstRow);
+            return result;
+         }
+      }
+   }
+
+   for (i = 0; i < table->columnCount; i++)
+   {
+      if (_hasZone(table, i))
+      {
+         _widenColumnZones(table, i, firstRow, rowCount, columns[i]);
+      }
+   }
+
+   for (i = firstRow; i < firstRow + rowCount && table->indexCount > 0; i++)
+   {
+      int result = ZdbIndexAddRow(table, ZdbEngineRowAt(table, i));
+      if (result != ZDB_RESULT_SUCCESS)
+      {
+         _discardRows(table, firstRow);
+         return result;
+      }
+   }
+
+   /* Only a batch that went in whole uses up its autoincrement values */
+   for (i = 0; i < table->columnCount; i++)
+   {
+      if (columns[i] == NULL)
+      {
+         ZdbRow* last = ZdbEngineRowAt(table, firstRow + rowCount - 1);
+         int result = _rememberAutoincrement(table, i, _fieldAddress(table, last, i));
+         if (result != ZDB_RESULT_SUCCESS)
+         {
+            _discardRows(table, firstRow);
+            return result;
+         }
+      }
+   }
+
+   if (table->stats != NULL)
+   {
+      ZdbStatsAddRows(table, firstRow, rowCount);
+   }
+
+   return rowCount;        /* Number of rows affected */
+}
+
+int ZdbEngineInsertRows(ZdbTable* table, int rowCount, void** columns)
+{
+   if (table == NULL || columns == NULL)
+   {
+      /* Invalid parameters to call */
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   ZdbLog* log = _tableLog(table);
+   if (log == NULL)
+   {
+      return _insertRows(table, rowCount, columns);
+   }
+
+   ZdbLogLock(log);
+   uint64_t sequence = 0;
+   int firstRow = table->rowCount;
+   int result = _insertRows(table, rowCount, columns);
+   if (result > 0)
+   {
+      sequence = ZdbLogInsertRows(log, table, firstRow, result);
+   }
+   ZdbLogUnlock(log);
+
+   return _commitLogged(log, sequence, result);
+}
+
+/* Examines up to maxRows rows.  A pass first slides live rows down over deleted ones, keeping their order, then
+   gives back the deleted rows that collected at the end.  Everything between the write position and the read
+   position is deleted, so the table is consistent between steps and rows may be appended at any point */
+int _compactStep(ZdbTable* table, int maxRows)
+{
+   if (table->compactRead == 0 && table->deletedCount == 0)
+   {
+      return 0;
+   }
+
+   if (_buildRowDirectory(table) != ZDB_RESULT_SUCCESS)
+   {
+      return ZDB_RESULT_OUT_OF_MEMORY;
+   }
+
+   if (table->compactRead == 0)
+   {
+      /* Start a pass at the first deleted row */
+      int word = 0;
+      while (table->tombstones[word] == 0)
+      {
+         word++;
+      }
+      int first = word * 64 + __builtin_ctzll(table->tombstones[word]);
+      table->compactRead = table->compactWrite = first;
+   }
+
+   int examined = 0;
+   while (examined < maxRows)
+   {
+      if (table->compactRead < table->rowCount)
+      {
+         if (!_rowDeleted(table, table->compactRead))
+         {
+            _moveRow(table, table->compactRead, table->compactWrite);
+
+            ZdbRow* moved = ZdbEngineRowAt(table, table->compactWrite);
+            if (moved->flags & ZDB_ROW_FLAG_NEW)
+            {
+               table->newRows[table->compactRead / ZDB_ROW_CHUNKS]--;
+               table->newRows[table->compactWrite / ZDB_ROW_CHUNKS]++;
+            }
+            else
+            {
+               _widenRowZones(table, moved);
+            }
+            table->compactWrite++;
+
+            /* Every row of a chunk the write position has left behind is live and in place, so its zones can
+               shed the values of the rows that were deleted or moved out */
+            if (table->compactWrite % ZDB_ROW_CHUNKS == 0)
+            {
+               _refreshZones(table, table->compactWrite / ZDB_ROW_CHUNKS - 1);
+            }
+         }
+         table->compactRead++;
+      }
+      else if (table->rowCount > table->compactWrite)
+      {
+         _popDeletedRow(table);
+         table->compactRead = table->rowCount;
+      }
+      else
+      {
+         /* Pass finished.  The last chunk is only partly filled, so it wasn't refreshed on the way */
+         if (table->rowCount % ZDB_ROW_CHUNKS != 0)
+         {
+            _refreshZones(table, table->rowCount / ZDB_ROW_CHUNKS);
+         }
+         table->compactRead = 0;
+         table->compactWrite = 0;
+         break;
+      }
+
+      examined++;
+   }
+
+   return table->deletedCount;
+}
+
+int ZdbEngineDeleteRow(ZdbTable* table, ZdbRow* row)
+{
+   if (table == NULL || row == NULL)
+   {
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   int index = row->index;
+   return ZdbEngineDeleteRows(table, 1, &index);
+}
+
+int ZdbEngineDeleteRows(ZdbTable* table, int count, const int* rowIndexes)
+{
+   if (table == NULL || rowIndexes == NULL)
+   {
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   int i;
+   for (i = 0; i < count; i++)
+   {
+      if (rowIndexes[i] < 0 || rowIndexes[i] >= table->rowCount)
+      {
+         /* No such row */
+         return ZDB_RESULT_INVALID_OPERATION;
+      }
+   }
+
+   ZdbLog* log = _tableLog(table);
+   if (log != NULL)
+   {
+      ZdbLogLock(log);
+   }
+
+   int deleted = 0;
+   for (i = 0; i < count; i++)
+   {
+      deleted += _deleteRow(table, rowIndexes[i]);
+   }
+
+   if (log == NULL)
+   {
+      return deleted;
+   }
+
+   uint64_t sequence = ZdbLogDeleteRows(log, table, count, rowIndexes);
+   ZdbLogUnlock(log);
+
+   return _commitLogged(log, sequence, deleted);     /* Number of rows affected */
+}
+
+int ZdbEngineIsRowDeleted(ZdbTable* table, int rowIndex)
+{
+   return rowIndex >= 0 && rowIndex < table->rowCount && _rowDeleted(table, rowIndex);
+}
+
+int ZdbEngineNextLiveRow(ZdbTable* table, int rowIndex)
+{
+   if (table->deletedCount == 0 || rowIndex >= table->rowCount)
+   {
+      return rowIndex < table->rowCount ? rowIndex : table->rowCount;
+   }
+
+   /* Look at the tombstones a word at a time, so a deleted chunk costs a couple of reads */
+   while (rowIndex < table->rowCount)
+   {
+      uint64_t live = ~table->tombstones[rowIndex / 64] >> (rowIndex % 64);
+      if (live != 0)
+      {
+         rowIndex += __builtin_ctzll(live);
+         break;
+      }
+
+      rowIndex = (rowIndex | 63) + 1;
+   }
+
+   return rowIndex < table->rowCount ? rowIndex : table->rowCount;
+}
+
+int ZdbEngineCompactTable(ZdbTable* table, int maxRows)
+{
+   if (table == NULL)
+   {
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   if (maxRows <= 0)
+   {
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   ZdbLog* log = _tableLog(table);
+   if (log != NULL)
+   {
+      ZdbLogLock(log);
+   }
+
+   int result;
+   if (table->pinCount > 0)
+   {
+      /* Moving rows under a recordset would make it skip or repeat rows */
+      result = ZDB_RESULT_BUSY;
+   }
+   else
+   {
+      int before = table->compactRead;
+      int deletedBefore = table->deletedCount;
+      result = _compactStep(table, maxRows);
+
+      if (table->compactRead != before || table->deletedCount != deletedBefore)
+      {
+         table->compactions++;
+      }
+
+      if (log != NULL && (table->compactRead != before || table->deletedCount != deletedBefore))
+      {
+         /* Replaying the same step against the same rows moves them the same way */
+         ZdbLogCompactTable(log, table, maxRows);
+      }
+   }
+
+   if (log != NULL)
+   {
+      ZdbLogUnlock(log);
+   }
+
+   return result;
+}
+
+void ZdbEnginePinTable(ZdbTable* table)
+{
+   table->pinCount++;
+}
+
+void ZdbEngineUnpinTable(ZdbTable* table)
+{
+   table->pinCount--;
+}
+
+int ZdbEngineGetValue(ZdbTable* table, ZdbRow* row, int column, void** value)
+{
+   if (table == NULL || row == NULL || value == NULL)
+   {
+      /* Invalid parameters to call */
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   if (column < 0 || column >= table->columnCount)
+   {
+      /* Column is out of range for this table */
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   *value = _fieldAddress(table, row, column);
+   if (table->layout.tags[column] == ZDB_LAYOUT_TAG_VARCHAR)
+   {
+      /* Hand out the characters in the heap rather than a copy */
+      *value = _resolveVarchar(table, *value);
+   }
+   else if (table->layout.tags[column] == ZDB_LAYOUT_TAG_DICTIONARY)
+   {
+      *value = table->dictionaries[column]->values[*(uint32_t*)*value];
+   }
+
+   return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbEngineGetAllocatorStats(ZdbTable* table, ZdbAllocatorStats* stats)
+{
+   if (table == NULL || stats == NULL)
+   {
+      /* Invalid parameters to call */
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   size_t slabBytes = 0;
+   size_t freeTail = (size_t)table->allocator.freeSlotCount * table->allocator.slotSize;
+   for (ZdbSlab* slab = table->allocator.slabs; slab != NULL; slab = slab->next)
+   {
+      slabBytes += sizeof(ZdbSlab) + slab->size;
+      if (slab == table->allocator.slabs)
+      {
+         /* The tail of the current slab will still be handed out */
+         freeTail += slab->size - slab->used;
+      }
+   }
+
+   size_t rowBytes;
+   size_t chunkBytes = 0;
+   if (table->storage == ZDB_STORAGE_PAX)
+   {
+      /* Slots only hold headers; field data lives in the column chunks */
+      rowBytes = (size_t)table->rowCount * sizeof(ZdbRow);
+      chunkBytes = (size_t)table->chunkCount * ZDB_ROW_CHUNKS * table->layout.rowSize;
+   }
+   else
+   {
+      rowBytes = (size_t)table->rowCount * (sizeof(ZdbRow) + table->layout.rowSize);
+   }
+   size_t directoryBytes = (size_t)(table->rowCount + table->freeRowsLeft) * sizeof(ZdbRow*);
+
+   size_t stringBytes = (size_t)table->strings.pageCount * ZDB_STRING_PAGE_SIZE;
+   size_t stringTail = table->strings.pageCount > 0 ? ZDB_STRING_PAGE_SIZE - table->strings.pageUsed : 0;
+
+   stats->slabCount = table->allocator.slabCount;
+   stats->bytesReserved = slabBytes + chunkBytes + directoryBytes + stringBytes;
+   stats->bytesUsed = rowBytes + (size_t)table->rowCount * (sizeof(ZdbRow*) + (chunkBytes ? table->layout.rowSize : 0)) + table->strings.bytesLive;
+   stats->bytesWasted = slabBytes - rowBytes - freeTail + (stringBytes - table->strings.bytesLive - stringTail);
+
+   return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbEngineGetValueCode(ZdbTable* table, ZdbRow* row, int column, uint32_t* code)
+{
+   if (table == NULL || row == NULL || code == NULL)
+   {
+      /* Invalid parameters to call */
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   if (column < 0 || column >= table->columnCount || table->layout.tags[column] != ZDB_LAYOUT_TAG_DICTIONARY)
+   {
+      /* Only dictionary encoded columns have codes */
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   *code = *(uint32_t*)_fieldAddress(table, row, column);
+
+   return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbEngineLookupCode(ZdbTable* table, int column, const char* value, uint32_t* code)
+{
+   if (table == NULL || value == NULL || code == NULL)
+   {
+      /* Invalid parameters to call */
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   if (column < 0 || column >= table->columnCount || table->layout.tags[column] != ZDB_LAYOUT_TAG_DICTIONARY)
+   {
+      /* Only dictionary encoded columns have codes */
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   size_t size = 0;
+   ZdbTypeSizeof(table->columns[column]->type, (void*)value, &size);
+   if (size <= 1)
+   {
+      *code = 0;
+      return ZDB_RESULT_SUCCESS;
+   }
+
+   uint32_t* slot = _dictionarySlot(table->dictionaries[column], value, size - 1);
+   if (*slot == 0)
+   {
+      /* No row has ever held this value */
+      return ZDB_RESULT_NOT_FOUND;
+   }
+
+   *code = *slot - 1;
+   return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbEngineGetDictionary(ZdbTable* table, int column, int* count, char*** values)
+{
+   if (table == NULL || count == NULL || values == NULL)
+   {
+      /* Invalid parameters to call */
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   if (column < 0 || column >= table->columnCount || table->layout.tags[column] != ZDB_LAYOUT_TAG_DICTIONARY)
+   {
+      /* Only dictionary encoded columns have a dictionary */
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   *count = table->dictionaries[column]->count;
+   *values = table->dictionaries[column]->values;
+
+   return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbEngineLoadDictionary(ZdbTable* table, int column, int count, const ZdbVarcharRef* entries)
+{
+   if (table == NULL || entries == NULL)
+   {
+      /* Invalid parameters to call */
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   if (column < 0 || column >= table->columnCount || table->layout.tags[column] != ZDB_LAYOUT_TAG_DICTIONARY || count < 1)
+   {
+      /* Only dictionary encoded columns have a dictionary, and it always holds the empty string */
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   /* Codes are already stored in rows, so entries keep their positions.  The strings must already be in the
+      table's string heap */
+   ZdbDictionary* dict = table->dictionaries[column];
+   dict->count = 1;
+   for (int code = 1; code < count; code++)
+   {
+      if (_growDictionary(dict) != ZDB_RESULT_SUCCESS)
+      {
+         return ZDB_RESULT_INVALID_OPERATION;
+      }
+
+      dict->entries[code] = entries[code];
+      dict->values[code] = _resolveVarchar(table, &dict->entries[code]);
+      dict->count++;
+      *_dictionarySlot(dict, dict->values[code], entries[code].length) = code + 1;
+   }
+
+   return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbEngineGetColumnChunk(ZdbTable* table, int chunk, int column, void** values, int* count)
+{
+   if (table == NULL || values == NULL || count == NULL)
+   {
+      /* Invalid parameters to call */
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   if (table->storage != ZDB_STORAGE_PAX)
+   {
+      /* Row-major tables have no contiguous column arrays */
+      return ZDB_RESULT_UNSUPPORTED;
+   }
+
+   if (chunk < 0 || chunk >= table->chunkCount || column < 0 || column >= table->columnCount)
+   {
+      /* Chunk or column is out of range for this table */
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   int remaining = table->rowCount - chunk * ZDB_ROW_CHUNKS;
+   *values = table->chunks[chunk] + ZDB_ROW_CHUNKS * table->layout.offsets[column];
+   *count = remaining < ZDB_ROW_CHUNKS ? remaining : ZDB_ROW_CHUNKS;
+
+   return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbEngineGatherColumn(ZdbTable* table, int column, int count, const int* rowIndexes, void* values)
+{
+   if (table == NULL || (count > 0 && (rowIndexes == NULL || values == NULL)))
+   {
+      /* Invalid parameters to call */
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   if (column < 0 || column >= table->columnCount || count < 0)
+   {
+      /* Column is out of range for this table */
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   int i;
+   switch (table->layout.tags[column])
+   {
+      case ZDB_LAYOUT_TAG_INT:
+      case ZDB_LAYOUT_TAG_FLOAT:
+      case ZDB_LAYOUT_TAG_BOOLEAN:
+      {
+         /* Four bytes each, read straight out of the chunk arrays or the rows */
+         uint32_t* out = values;
+         if (table->storage == ZDB_STORAGE_PAX)
+         {
+            size_t offset = ZDB_ROW_CHUNKS * table->layout.offsets[column];
+            for (i = 0; i < count; i++)
+            {
+               int r = rowIndexes[i];
+               out[i] = ((uint32_t*)(table->chunks[r / ZDB_ROW_CHUNKS] + offset))[r % ZDB_ROW_CHUNKS];
+            }
+         }
+         else
+         {
+            size_t offset = table->layout.offsets[column];
+            for (i = 0; i < count; i++)
+            {
+               memcpy(&out[i], ZdbEngineRowAt(table, rowIndexes[i])->_rowdata + offset, sizeof(uint32_t));
+            }
+         }
+         break;
+      }
+      case ZDB_LAYOUT_TAG_VARCHAR:
+      {
+         ZdbString* out = values;
+         for (i = 0; i < count; i++)
+         {
+            ZdbVarcharRef* ref = _fieldAddress(table, ZdbEngineRowAt(table, rowIndexes[i]), column);
+            out[i].chars = _resolveVarchar(table, ref);
+            out[i].length = ref->length;
+         }
+         break;
+      }
+      case ZDB_LAYOUT_TAG_DICTIONARY:
+      {
+         ZdbString* out = values;
+         ZdbDictionary* dictionary = table->dictionaries[column];
+         for (i = 0; i < count; i++)
+         {
+            uint32_t code = *(uint32_t*)_fieldAddress(table, ZdbEngineRowAt(table, rowIndexes[i]), column);
+            out[i].chars = dictionary->values[code];
+            out[i].length = dictionary->entries[code].length;
+         }
+         break;
+      }
+      default:
+      {
+         void** out = values;
+         for (i = 0; i < count; i++)
+         {
+            out[i] = _fieldAddress(table, ZdbEngineRowAt(table, rowIndexes[i]), column);
+         }
+         break;
+      }
+   }
+
+   return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbEngineGetZone(ZdbTable* table, int chunk, int column, ZdbZone* zone)
+{
+   if (table == NULL || zone == NULL)
+   {
+      return ZDB_RESULT_INVALID_NULL;
+   }
+
+   if (column < 0 || column >= table->columnCount || chunk < 0 || chunk * ZDB_ROW_CHUNKS >= table->rowCount)
+   {
+      return ZDB_RESULT_INVALID_OPERATION;
+   }
+
+   if (!_hasZone(table, column))
+   {
+      /* Only int, float and boolean columns are ordered cheaply enough to keep zones */
+      return ZDB_RESULT_UNSUPPORTED;
+   }
+
+   *zone = table->zones[chunk * table->columnCount + column];
+   if (table->newRows[chunk] > 0)
+   {
+      /* Rows that were never written hold zero */
+      int zero = 0;
+      _widenZone(zone, table->layout.tags[column], &zero);
+   }
+   return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbEngineGetRowLayout(ZdbTable* table, const ZdbRowLayout** layout)
+{
+   if (table == NULL || layout == NULL)
    {
       /* Invalid parameters to call */
       return ZDB_RESULT_INVALID_NULL;
    }
 
-   size_t offset = _calculateRowOffset(table->columns, column);
-   *value = row->data + offset;
+   *layout = &table->layout;
 
    return ZDB_RESULT_SUCCESS;
 }
@@ -361,7 +2416,7 @@ void ZdbPrintTable(ZdbTable* table)
 
    for (i = 0; i < table->rowCount; i++)
    {
-      ZdbPrintRow(table, table->rows[i], table->columnCount);
+      ZdbPrintRow(table, ZdbEngineRowAt(table, i), table->columnCount);
       printf("\n");
    }
 }
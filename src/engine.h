@@ -9,10 +9,17 @@
 #ifndef ENGINE_H
 #define ENGINE_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #define ZDB_LIMIT_VARCHAR       255
 #define ZDB_LIMIT_COLUMNS       32
 
 #define ZDB_ROW_CHUNKS          128
+#define ZDB_TOMBSTONE_WORDS     (ZDB_ROW_CHUNKS / 64)   /* Words of the tombstone bitmap that cover one chunk of rows */
+#define ZDB_SLAB_SIZE           (64 * 1024)     /* Bytes in each page that row slots are carved from */
+#define ZDB_STRING_PAGE_SIZE    (64 * 1024)     /* Bytes in each page of a table's string heap */
+#define ZDB_LIMIT_STRING_PAGES  (UINT32_MAX / ZDB_STRING_PAGE_SIZE)   /* Pages a ZdbVarcharRef offset can reach */
 #define ZDB_TABLE_CHUNKS        32
 
 #define ZDB_RESULT_SUCCESS              0       /* The operation completed successfully */
@@ -21,57 +28,257 @@
 #define ZDB_RESULT_INVALID_OPERATION    -3      /* The operation was invalid */
 #define ZDB_RESULT_INVALID_NULL         -4      /* Invalid use of NULL */
 #define ZDB_RESULT_UNSUPPORTED          -5      /* The attempted operation is not supported */
+#define ZDB_RESULT_NOT_FOUND            -6      /* The requested item does not exist */
+#define ZDB_RESULT_BUSY                 -7      /* The operation has to wait until the table is no longer being scanned */
+#define ZDB_RESULT_OUT_OF_MEMORY        -8      /* Memory for the operation couldn't be allocated */
+
+#define ZDB_STORAGE_ROW             0       /* Each row's fields are stored together */
+#define ZDB_STORAGE_PAX             1       /* Each chunk of ZDB_ROW_CHUNKS rows stores one contiguous array per column */
+
+#define ZDB_ROW_FLAG_NEW            0x1     /* Row has been inserted but never written */
+
+#define ZDB_LAYOUT_TAG_OTHER        0       /* Field of a user-defined type, only reachable through the type vtable */
+#define ZDB_LAYOUT_TAG_INT          1
+#define ZDB_LAYOUT_TAG_FLOAT        2
+#define ZDB_LAYOUT_TAG_BOOLEAN      3
+#define ZDB_LAYOUT_TAG_VARCHAR      4
+#define ZDB_LAYOUT_TAG_DICTIONARY   5       /* Dictionary encoded varchar, stored as a uint32_t code */
+
+#define ZDB_ENCODING_NONE           0       /* Values are stored as themselves */
+#define ZDB_ENCODING_DICTIONARY     1       /* Each distinct value is stored once per table; rows hold its code */
+
+#define ZDB_LAYOUT_MAX_ALIGNMENT    8       /* Fields are never aligned more strictly than this */
 
 typedef struct _ZdbType ZdbType;
+typedef struct _ZdbLog ZdbLog;
+typedef struct _ZdbCheckpoint ZdbCheckpoint;
+typedef struct _ZdbIndex ZdbIndex;
+typedef struct _ZdbTableStats ZdbTableStats;
+struct _ZdbDatabase;
 
 typedef struct
 {
     ZdbType* type;
     char name[ZDB_LIMIT_VARCHAR];
     int autoincrement;                     /* Whether values autoincrement */
+    int encoding;                          /* ZDB_ENCODING_* */
     void* lastInsertedValue;       /* Used mainly to track the last autoincrement number */
 } ZdbColumn;
 
+/* Rows hold no pointers, so a slot means the same thing wherever it is loaded */
 typedef struct
 {
-    void* data;
+    int index;                      /* Position of the row in its table */
+    int flags;                      /* ZDB_ROW_FLAG_* */
     
     /* Insert additional row properties here */
     
-    char _rowdata[0];               /* This MUST be the last member of the struct */
+    char _rowdata[0];               /* Field data of row-major rows.  This MUST be the last member of the struct */
 } ZdbRow;
 
 
+/* Precompiled description of where each field lives inside a row.  Built once by ZdbEngineCreateTable so that
+   addressing a field is a single add instead of a walk over all of the columns before it */
+typedef struct
+{
+    size_t rowSize;                             /* Bytes of field data in a row, padded to rowAlignment */
+    size_t rowAlignment;                        /* Strictest alignment required by any field */
+    size_t offsets[ZDB_LIMIT_COLUMNS];          /* Naturally aligned byte offset of each field */
+    size_t sizes[ZDB_LIMIT_COLUMNS];            /* Bytes each field takes up in the row */
+    size_t valueSizes[ZDB_LIMIT_COLUMNS];       /* Static size of a value of each field's type */
+    size_t alignments[ZDB_LIMIT_COLUMNS];       /* Alignment of each field */
+    int tags[ZDB_LIMIT_COLUMNS];                /* ZDB_LAYOUT_TAG_* for each field */
+} ZdbRowLayout;
+
+/* What a row stores for a varchar field.  The characters themselves live in the table's string heap so that a
+   row only pays for the strings it actually holds */
+typedef struct
+{
+    uint32_t length;                /* Characters in the string, not counting the terminator */
+    uint32_t offset;                /* Heap position: page * ZDB_STRING_PAGE_SIZE + byte within the page */
+} ZdbVarcharRef;
+
+/* A string handed out without copying.  The characters belong to the table and stay put until it is dropped */
+typedef struct
+{
+    const char* chars;
+    int length;                     /* Not counting the terminator */
+} ZdbString;
+
+/* Append-only storage for variable length values.  Pages never move, so values can be handed out without copying */
+typedef struct
+{
+    char** pages;
+    int pageCount;
+    size_t pageUsed;                /* Bytes used in the last page */
+    size_t bytesLive;               /* Bytes referenced by rows */
+    size_t bytesDead;               /* Bytes left behind when values were overwritten */
+    int mappedPageCount;            /* Leading pages that live in a database file mapping */
+} ZdbStringHeap;
+
+/* The distinct values of a dictionary encoded column.  Code 0 is always the empty string, so rows that were never
+   written decode to "" just like plain varchar fields */
+typedef struct
+{
+    int count;                      /* Number of codes handed out */
+    int capacity;
+    ZdbVarcharRef* entries;         /* Code -> value in the table's string heap */
+    char** values;                  /* Code -> resolved characters */
+    uint32_t* slots;                /* Open addressed hash of value -> code + 1, with 0 marking an empty slot */
+    int slotCount;                  /* Always a power of two */
+} ZdbDictionary;
+
+/* A large page of fixed-size row slots.  Slots are handed out front to back.  Compaction returns slots to the
+   allocator's free list, which hands them out before the slab tail.  Slabs themselves are only freed when the table
+   is dropped */
+typedef struct _ZdbSlab
+{
+    struct _ZdbSlab* next;          /* Previously filled slab */
+    size_t size;                    /* Bytes available in _slabdata */
+    size_t used;                    /* Bytes already handed out as slots */
+    
+    char _slabdata[0];              /* This MUST be the last member of the struct */
+} ZdbSlab;
+
+typedef struct
+{
+    size_t slotSize;                /* Bytes per row, including the ZdbRow header */
+    int slabCount;
+    ZdbSlab* slabs;                 /* Slab currently being filled, linked to the older ones */
+    ZdbRow** freeSlots;             /* Slots given back by compaction, handed out again before the slab tail */
+    int freeSlotCount;
+    int freeSlotCapacity;
+} ZdbRowAllocator;
+
+typedef struct
+{
+    int slabCount;                  /* Number of slabs allocated */
+    size_t bytesReserved;           /* Bytes obtained from the system for slabs, the row directory and strings */
+    size_t bytesUsed;               /* Bytes holding live rows, directory entries and strings */
+    size_t bytesWasted;             /* Bytes that can never be handed out: page tails, slot padding, dead strings */
+} ZdbAllocatorStats;
+
+/* Smallest and largest value of an int, float or boolean column over one chunk of rows, so scans can pass over
+   chunks that can't hold a match.  Overwritten and deleted values may still be counted, so a zone can be wider than
+   the rows in it but never narrower.  A zone no row has widened yet has min above max.  Rows inserted empty aren't
+   counted until their first update, so a row-at-a-time insert doesn't drag every zone down to zero */
+typedef union
+{
+    int i;                          /* Int and boolean columns */
+    float f;
+} ZdbZoneValue;
+
+typedef struct
+{
+    ZdbZoneValue min;
+    ZdbZoneValue max;
+} ZdbZone;
+
 typedef struct
 {
     char name[ZDB_LIMIT_VARCHAR];
+    struct _ZdbDatabase* db;        /* Database the table belongs to */
     int columnCount;
     int rowCount;
     int freeRowsLeft;
+    int storage;                    /* ZDB_STORAGE_* */
     
     ZdbColumn** columns;
-    ZdbRow** rows;
+    ZdbRow** rows;                  /* Slot of the row at each position.  Use ZdbEngineRowAt, as it can be NULL */
+    char* mappedRows;               /* Slots of a table opened from a file, back to back, until rows is built */
+    
+    /* PAX storage only: chunk i holds rows i*ZDB_ROW_CHUNKS onwards.  The array for column c starts at byte
+       ZDB_ROW_CHUNKS * layout.offsets[c] of the chunk */
+    char** chunks;
+    int chunkCount;
+    int mappedChunkCount;           /* Leading chunks that live in a database file mapping */
+    
+    /* One bit per row, set once the row has been deleted.  Bits for chunk i are words i * ZDB_TOMBSTONE_WORDS
+       onwards, so a scan can step over a wholly deleted chunk by checking a couple of words */
+    uint64_t* tombstones;
+    int deletedCount;               /* Deleted rows still holding a place in the directory */
+    int pinCount;                   /* Recordsets part way through a scan.  Compaction waits for them */
+    int compactRead;                /* Compaction pass in progress: next row to look at */
+    int compactWrite;               /* Compaction pass in progress: where the next live row goes */
+    int compactions;                /* Compaction steps that moved rows, after which positions from before are stale */
+
+    /* Zone of column c over chunk i of rows at zones[i * columnCount + c], for every chunk the directory can hold.
+       Only int, float and boolean columns keep zones */
+    ZdbZone* zones;
+    int* newRows;                   /* Rows in each chunk still flagged ZDB_ROW_FLAG_NEW, whose empty values aren't in the zones */
+
+    ZdbIndex** indexes;             /* Indexes on the table's columns, updated along with the rows */
+    int indexCount;
+    ZdbTableStats* stats;           /* What the columns hold, for the query planner.  NULL until the table is analyzed */
+    
+    ZdbRowLayout layout;
+    ZdbRowAllocator allocator;
+    ZdbStringHeap strings;
+    ZdbDictionary* dictionaries[ZDB_LIMIT_COLUMNS];    /* Set for dictionary encoded columns only */
 } ZdbTable;
 
-typedef struct
+/* Rows opened from a file sit in the mapping in order, so there is no directory to build until something appends or
+   moves a row */
+static inline ZdbRow* ZdbEngineRowAt(const ZdbTable* table, int rowIndex)
+{
+    if (table->rows != NULL)
+    {
+        return table->rows[rowIndex];
+    }
+    return (ZdbRow*)(table->mappedRows + (size_t)rowIndex * table->allocator.slotSize);
+}
+
+typedef struct _ZdbDatabase
 {
     char name[ZDB_LIMIT_VARCHAR];
     int tableCount;
     int freeTablesLeft;
     
     ZdbTable** tables;
+    
+    void* mapping;                  /* File the database was opened from, if any.  Row data may point into it */
+    size_t mappingSize;
+    
+    ZdbLog* log;                    /* Write-ahead log that changes are recorded in, if one is attached */
+    uint64_t logSequence;           /* Last log record already reflected in the tables */
+    ZdbCheckpoint* checkpoint;      /* State of background checkpoints, once one has been started */
 } ZdbDatabase;
 
 int ZdbEngineCreateColumn(char* name, ZdbType *type, int autoincrement, ZdbColumn** column);
+int ZdbEngineSetColumnEncoding(ZdbColumn* column, int encoding);
 int ZdbEngineCreateTable(ZdbDatabase* db, char* name, int columnCount, ZdbColumn** columnDefs, ZdbTable** table);
+int ZdbEngineCreateTableWithStorage(ZdbDatabase* db, char* name, int columnCount, ZdbColumn** columnDefs, int storage, ZdbTable** table);
 int ZdbEngineCreateDB(char* name, ZdbDatabase** database);
-int ZdbEngineDropTable(ZdbTable* table);
+int ZdbEngineDropTable(ZdbTable* table);     /* The table keeps its place in db->tables but loses its columns and isn't saved */
 int ZdbEngineDropDB(ZdbDatabase* db);
 int ZdbEngineInsertRow(ZdbTable* table, int columnCount, ZdbRow** row);
+int ZdbEngineReserveRows(ZdbTable* table, int rowCount);
+int ZdbEngineMapRows(ZdbTable* table, char* slots, int rowCount);    /* Takes rowCount slots laid out as they are in a file */
+int ZdbEngineInsertRows(ZdbTable* table, int rowCount, void** columns);
 int ZdbEngineGetRowDataSize(ZdbTable* table, int columnCount, size_t* size);
-int ZdbEngineUpdateRowValues(ZdbTable* table, ZdbRow* row, int valueCount, void** values);
+int ZdbEngineUpdateRowValues(ZdbTable* table, ZdbRow* row, int valueCount, void** values);   /* ZDB_RESULT_OUT_OF_MEMORY: the row was updated, but the table's indexes couldn't take it and were dropped */
+int ZdbEngineRestoreRowValues(ZdbTable* table, ZdbRow* row, int valueCount, void** values);  /* Takes autoincrement values as given; NULL values are skipped */
 int ZdbEngineUpdateRow(ZdbTable* table, ZdbRow* row, int valueCount, ...);
+int ZdbEngineDeleteRow(ZdbTable* table, ZdbRow* row);
+int ZdbEngineDeleteRows(ZdbTable* table, int count, const int* rowIndexes);
+int ZdbEngineIsRowDeleted(ZdbTable* table, int rowIndex);
+int ZdbEngineNextLiveRow(ZdbTable* table, int rowIndex);         /* First row at or after rowIndex that isn't deleted, or rowCount */
+int ZdbEngineCompactTable(ZdbTable* table, int maxRows);        /* Returns the deleted rows left to reclaim, or ZDB_RESULT_BUSY */
+void ZdbEnginePinTable(ZdbTable* table);
+void ZdbEngineUnpinTable(ZdbTable* table);
 int ZdbEngineGetValue(ZdbTable* table, ZdbRow* row, int column, void** value);
+int ZdbEngineGetValueCode(ZdbTable* table, ZdbRow* row, int column, uint32_t* code);
+int ZdbEngineLookupCode(ZdbTable* table, int column, const char* value, uint32_t* code);
+int ZdbEngineGetDictionary(ZdbTable* table, int column, int* count, char*** values);  /* Note: You do NOT own these strings! */
+int ZdbEngineLoadDictionary(ZdbTable* table, int column, int count, const ZdbVarcharRef* entries);
+int ZdbEngineGetColumnChunk(ZdbTable* table, int chunk, int column, void** values, int* count);   /* Deleted rows are included; check ZdbEngineIsRowDeleted */
+int ZdbEngineGetZone(ZdbTable* table, int chunk, int column, ZdbZone* zone);     /* Chunks are of ZDB_ROW_CHUNKS rows */
+
+/* Copies one column's values for the rows at rowIndexes into an array: int for int and boolean columns, float,
+   ZdbString for varchars, and a pointer to the value for other types */
+int ZdbEngineGatherColumn(ZdbTable* table, int column, int count, const int* rowIndexes, void* values);
+int ZdbEngineGetRowLayout(ZdbTable* table, const ZdbRowLayout** layout);
+int ZdbEngineGetAllocatorStats(ZdbTable* table, ZdbAllocatorStats* stats);
 
 /* TO BE RENAMED AND MOVED TO DESCRIBE MODULE */
 void ZdbPrintColumn(ZdbColumn* column);
@@ -0,0 +1,1429 @@
+//
+//  index.c
+//  ZombieSQL
+//
+//  A hash index keeps one group per distinct value, found by hashing the value, and a second table from row
+//  handle to the row's place in its group.  Adding or removing a row is then a couple of probes however many rows
+//  share its value.  Rows holding NaN are left out, since NaN equals nothing.  Indexes hold row handles rather than
+//  row indexes, so compaction never has to touch them.
+//
+//  A B+tree index orders entries by value and then by row handle.  Nodes are a few cache lines each, with keys
+//  kept apart from row handles so a search only reads keys.  Removing an entry never merges nodes; a tree that
+//  shrinks a lot keeps its shape until it is rebuilt.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "types.h"
+#include "index.h"
+#include "wal.h"
+
+#define ZDB_INDEX_MIN_SLOTS     64
+
+/*
+ * Hashing
+ */
+
+uint32_t _indexMix(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ull;
+    value ^= value >> 33;
+    return (uint32_t)value;
+}
+
+uint32_t _indexHashValue(ZdbIndex* index, void* value)
+{
+    switch (index->table->layout.tags[index->column])
+    {
+        case ZDB_LAYOUT_TAG_INT:
+        case ZDB_LAYOUT_TAG_BOOLEAN:
+            return _indexMix((uint32_t)*(int*)value);
+        case ZDB_LAYOUT_TAG_FLOAT:
+        {
+            /* Equal floats must hash the same, and 0.0 equals -0.0 */
+            float f = *(float*)value == 0.0f ? 0.0f : *(float*)value;
+            uint32_t bits;
+            memcpy(&bits, &f, sizeof(bits));
+            return _indexMix(bits);
+        }
+        default:
+        {
+            /* Varchar, plain or dictionary encoded.  Only the characters the type compares are hashed */
+            const char* s = value;
+            size_t length = strnlen(s, ZDB_LIMIT_VARCHAR);
+            uint32_t hash = 2166136261u;
+            for (size_t i = 0; i < length; i++)
+            {
+                hash ^= (unsigned char)s[i];
+                hash *= 16777619u;
+            }
+            return hash;
+        }
+    }
+}
+
+uint32_t _indexHashRow(ZdbRow* row)
+{
+    return _indexMix((uintptr_t)row);
+}
+
+/*
+ * Groups
+ */
+
+/* Finds the slot holding the group for value, or the empty slot where it would go */
+ZdbIndexGroup** _indexGroupSlot(ZdbIndex* index, void* value, uint32_t hash)
+{
+    ZdbType* type = index->table->columns[index->column]->type;
+    uint32_t mask = index->groupSlotCount - 1;
+    uint32_t i = hash & mask;
+
+    while (index->groups[i] != NULL)
+    {
+        ZdbIndexGroup* group = index->groups[i];
+        int result;
+        if (group->hash == hash && ZdbTypeCompare(type, group->key, value, &result) == ZDB_RESULT_SUCCESS && result == 0)
+        {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+
+    return &index->groups[i];
+}
+
+int _indexGrowGroups(ZdbIndex* index)
+{
+    int slotCount = index->groupSlotCount > 0 ? index->groupSlotCount * 2 : ZDB_INDEX_MIN_SLOTS;
+    ZdbIndexGroup** groups = calloc(slotCount, sizeof(ZdbIndexGroup*));
+    if (groups == NULL)
+    {
+        return ZDB_RESULT_OUT_OF_MEMORY;
+    }
+
+    uint32_t mask = slotCount - 1;
+    for (int i = 0; i < index->groupSlotCount; i++)
+    {
+        ZdbIndexGroup* group = index->groups[i];
+        if (group != NULL)
+        {
+            uint32_t j = group->hash & mask;
+            while (groups[j] != NULL)
+            {
+                j = (j + 1) & mask;
+            }
+            groups[j] = group;
+        }
+    }
+
+    free(index->groups);
+    index->groups = groups;
+    index->groupSlotCount = slotCount;
+    return ZDB_RESULT_SUCCESS;
+}
+
+ZdbIndexGroup* _indexCreateGroup(ZdbIndex* index, void* value, uint32_t hash)
+{
+    ZdbType* type = index->table->columns[index->column]->type;
+    size_t size;
+    if (ZdbTypeSizeof(type, value, &size) != ZDB_RESULT_SUCCESS)
+    {
+        return NULL;
+    }
+
+    /* Most groups of a unique column never hold more than one row, so that one lives in the group itself */
+    ZdbIndexGroup* group = malloc(sizeof(ZdbIndexGroup) + size);
+    if (group == NULL)
+    {
+        return NULL;
+    }
+
+    group->hash = hash;
+    group->count = 0;
+    group->capacity = 1;
+    group->rows = &group->firstRow;
+    if (ZdbTypeCopy(type, group->key, value) != ZDB_RESULT_SUCCESS)
+    {
+        free(group);
+        return NULL;
+    }
+
+    return group;
+}
+
+void _indexFreeGroup(ZdbIndexGroup* group)
+{
+    if (group->rows != &group->firstRow)
+    {
+        free(group->rows);
+    }
+    free(group);
+}
+
+/* Empties a slot, moving later groups in the same run back so that every group stays reachable from its home */
+void _indexRemoveGroupSlot(ZdbIndex* index, uint32_t i)
+{
+    uint32_t mask = index->groupSlotCount - 1;
+    uint32_t j = i;
+
+    index->groups[i] = NULL;
+    while (1)
+    {
+        j = (j + 1) & mask;
+        if (index->groups[j] == NULL)
+        {
+            break;
+        }
+
+        uint32_t home = index->groups[j]->hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            index->groups[i] = index->groups[j];
+            index->groups[j] = NULL;
+            i = j;
+        }
+    }
+
+    index->groupCount--;
+}
+
+/*
+ * Entries
+ */
+
+ZdbIndexEntry* _indexEntrySlot(ZdbIndex* index, ZdbRow* row)
+{
+    uint32_t mask = index->entrySlotCount - 1;
+    uint32_t i = _indexHashRow(row) & mask;
+
+    while (index->entries[i].row != NULL && index->entries[i].row != row)
+    {
+        i = (i + 1) & mask;
+    }
+
+    return &index->entries[i];
+}
+
+int _indexGrowEntries(ZdbIndex* index)
+{
+    int slotCount = index->entrySlotCount > 0 ? index->entrySlotCount * 2 : ZDB_INDEX_MIN_SLOTS;
+    ZdbIndexEntry* entries = calloc(slotCount, sizeof(ZdbIndexEntry));
+    if (entries == NULL)
+    {
+        return ZDB_RESULT_OUT_OF_MEMORY;
+    }
+
+    uint32_t mask = slotCount - 1;
+    for (int i = 0; i < index->entrySlotCount; i++)
+    {
+        if (index->entries[i].row != NULL)
+        {
+            uint32_t j = _indexHashRow(index->entries[i].row) & mask;
+            while (entries[j].row != NULL)
+            {
+                j = (j + 1) & mask;
+            }
+            entries[j] = index->entries[i];
+        }
+    }
+
+    free(index->entries);
+    index->entries = entries;
+    index->entrySlotCount = slotCount;
+    return ZDB_RESULT_SUCCESS;
+}
+
+void _indexRemoveEntry(ZdbIndex* index, ZdbIndexEntry* entry)
+{
+    uint32_t mask = index->entrySlotCount - 1;
+    uint32_t i = entry - index->entries;
+    uint32_t j = i;
+
+    index->entries[i].row = NULL;
+    while (1)
+    {
+        j = (j + 1) & mask;
+        if (index->entries[j].row == NULL)
+        {
+            break;
+        }
+
+        uint32_t home = _indexHashRow(index->entries[j].row) & mask;
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            index->entries[i] = index->entries[j];
+            index->entries[j].row = NULL;
+            i = j;
+        }
+    }
+
+    index->entryCount--;
+}
+
+/*
+ * B+tree
+ */
+
+int _btreeCompareKeys(ZdbIndex* index, ZdbIndexKey a, ZdbIndexKey b)
+{
+    switch (index->keyTag)
+    {
+        case ZDB_LAYOUT_TAG_INT:
+        case ZDB_LAYOUT_TAG_BOOLEAN:
+            return (a.i > b.i) - (a.i < b.i);
+        case ZDB_LAYOUT_TAG_FLOAT:
+            /* NaN goes below every number, as ORDER BY puts it, so the order is total; -0 and 0 compare equal */
+            if (isnan(a.f) || isnan(b.f))
+            {
+                return !isnan(a.f) - !isnan(b.f);
+            }
+            return (a.f > b.f) - (a.f < b.f);
+        default:
+        {
+            int result = 0;
+            ZdbTypeCompare(index->table->columns[index->column]->type, a.p, b.p, &result);
+            return result;
+        }
+    }
+}
+
+int _btreeCompare(ZdbIndex* index, ZdbIndexKey a, ZdbRow* aRow, ZdbIndexKey b, ZdbRow* bRow)
+{
+    int result = _btreeCompareKeys(index, a, b);
+    if (result != 0)
+    {
+        return result;
+    }
+
+    return ((uintptr_t)aRow > (uintptr_t)bRow) - ((uintptr_t)aRow < (uintptr_t)bRow);
+}
+
+int _btreeKeyIsCopy(ZdbIndex* index)
+{
+    return index->keyTag != ZDB_LAYOUT_TAG_INT && index->keyTag != ZDB_LAYOUT_TAG_BOOLEAN && index->keyTag != ZDB_LAYOUT_TAG_FLOAT;
+}
+
+/* Key for a value without copying it, good for searching only */
+ZdbIndexKey _btreeSearchKey(ZdbIndex* index, void* value)
+{
+    ZdbIndexKey key;
+    switch (index->keyTag)
+    {
+        case ZDB_LAYOUT_TAG_INT:
+        case ZDB_LAYOUT_TAG_BOOLEAN:
+            key.i = *(int*)value;
+            break;
+        case ZDB_LAYOUT_TAG_FLOAT:
+            key.f = *(float*)value;
+            break;
+        default:
+            key.p = value;
+            break;
+    }
+    return key;
+}
+
+/* Key the tree can keep.  Values of other types are copied, since the row's own field moves during compaction */
+int _btreeStoredKey(ZdbIndex* index, void* value, ZdbIndexKey* key)
+{
+    if (!_btreeKeyIsCopy(index))
+    {
+        *key = _btreeSearchKey(index, value);
+        return ZDB_RESULT_SUCCESS;
+    }
+
+    ZdbType* type = index->table->columns[index->column]->type;
+    size_t size;
+    int result = ZdbTypeSizeof(type, value, &size);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        return result;
+    }
+
+    key->p = malloc(size);
+    if (key->p == NULL)
+    {
+        return ZDB_RESULT_OUT_OF_MEMORY;
+    }
+
+    result = ZdbTypeCopy(type, key->p, value);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        free(key->p);
+    }
+    return result;
+}
+
+void _btreeFreeKey(ZdbIndex* index, ZdbIndexKey key)
+{
+    if (_btreeKeyIsCopy(index))
+    {
+        free(key.p);
+    }
+}
+
+ZdbBTreeNode* _btreeNewNode(int leaf)
+{
+    void* memory;
+    if (posix_memalign(&memory, 64, ZDB_BTREE_NODE_SIZE) != 0)
+    {
+        return NULL;
+    }
+
+    ZdbBTreeNode* node = memory;
+    node->leaf = leaf;
+    node->count = 0;
+    if (leaf)
+    {
+        node->u.leaf.next = NULL;
+    }
+    return node;
+}
+
+void _btreeFreeNode(ZdbIndex* index, ZdbBTreeNode* node)
+{
+    int i;
+    if (node->leaf)
+    {
+        for (i = 0; i < node->count; i++)
+        {
+            _btreeFreeKey(index, node->u.leaf.keys[i]);
+        }
+    }
+    else
+    {
+        for (i = 0; i < node->count; i++)
+        {
+            _btreeFreeKey(index, node->u.inner.keys[i]);
+        }
+        for (i = 0; i <= node->count; i++)
+        {
+            _btreeFreeNode(index, node->u.inner.children[i]);
+        }
+    }
+
+    free(node);
+}
+
+/* Number of keys in the node that come at or before the entry, i.e. the child to follow or the leaf position to
+   insert at */
+int _btreeUpperBound(ZdbIndex* index, ZdbIndexKey* keys, ZdbRow** rows, int count, ZdbIndexKey key, ZdbRow* row)
+{
+    int low = 0;
+    int high = count;
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (_btreeCompare(index, keys[middle], rows[middle], key, row) <= 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/* Number of keys in the node below key, or at or below it when inclusive is not set */
+int _btreeKeyBound(ZdbIndex* index, ZdbIndexKey* keys, int count, ZdbIndexKey key, int inclusive)
+{
+    int low = 0;
+    int high = count;
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        int result = _btreeCompareKeys(index, keys[middle], key);
+        if (result < 0 || (!inclusive && result == 0))
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+void _btreeLeafInsertAt(ZdbBTreeNode* leaf, int position, ZdbIndexKey key, ZdbRow* row)
+{
+    int move = leaf->count - position;
+    memmove(&leaf->u.leaf.keys[position + 1], &leaf->u.leaf.keys[position], move * sizeof(ZdbIndexKey));
+    memmove(&leaf->u.leaf.rows[position + 1], &leaf->u.leaf.rows[position], move * sizeof(ZdbRow*));
+    leaf->u.leaf.keys[position] = key;
+    leaf->u.leaf.rows[position] = row;
+    leaf->count++;
+}
+
+/* One of the nodes _btreeAdd keeps ready for splits */
+ZdbBTreeNode* _btreeTakeSpare(ZdbIndex* index, int leaf)
+{
+    ZdbBTreeNode* node = index->spares[--index->spareCount];
+    node->leaf = leaf;
+    node->count = 0;
+    if (leaf)
+    {
+        node->u.leaf.next = NULL;
+    }
+    return node;
+}
+
+/* Adds an entry under node.  When the node has to split, the new right half is returned along with the separator
+   that goes in the parent.  Splits take spare nodes, so the only thing that can fail is copying the separator, which
+   happens before the leaf changes */
+ZdbBTreeNode* _btreeInsert(ZdbIndex* index, ZdbBTreeNode* node, ZdbIndexKey key, ZdbRow* row,
+                           ZdbIndexKey* splitKey, ZdbRow** splitRow, int* result)
+{
+    if (node->leaf)
+    {
+        int position = _btreeUpperBound(index, node->u.leaf.keys, node->u.leaf.rows, node->count, key, row);
+        if (node->count < ZDB_BTREE_LEAF_KEYS)
+        {
+            _btreeLeafInsertAt(node, position, key, row);
+            return NULL;
+        }
+
+        /* Appending to the last leaf, as autoincrement values do, leaves the full leaf as it is rather than
+           leaving two half empty ones behind */
+        int keep = (position == node->count && node->u.leaf.next == NULL) ? node->count : (ZDB_BTREE_LEAF_KEYS + 1) / 2;
+
+        /* The separator is the right half's first entry: the new one when appending, otherwise the first moved */
+        ZdbIndexKey first = keep == ZDB_BTREE_LEAF_KEYS ? key : node->u.leaf.keys[keep];
+        *result = _btreeStoredKey(index, _btreeKeyIsCopy(index) ? first.p : (void*)&first, splitKey);
+        if (*result != ZDB_RESULT_SUCCESS)
+        {
+            return NULL;
+        }
+        *splitRow = keep == ZDB_BTREE_LEAF_KEYS ? row : node->u.leaf.rows[keep];
+
+        ZdbBTreeNode* right = _btreeTakeSpare(index, 1);
+        right->count = node->count - keep;
+        memcpy(right->u.leaf.keys, &node->u.leaf.keys[keep], right->count * sizeof(ZdbIndexKey));
+        memcpy(right->u.leaf.rows, &node->u.leaf.rows[keep], right->count * sizeof(ZdbRow*));
+        node->count = keep;
+        right->u.leaf.next = node->u.leaf.next;
+        node->u.leaf.next = right;
+
+        if (position <= keep && keep < ZDB_BTREE_LEAF_KEYS)
+        {
+            _btreeLeafInsertAt(node, position, key, row);
+        }
+        else
+        {
+            _btreeLeafInsertAt(right, position - keep, key, row);
+        }
+        return right;
+    }
+
+    int child = _btreeUpperBound(index, node->u.inner.keys, node->u.inner.rows, node->count, key, row);
+    ZdbIndexKey childKey;
+    ZdbRow* childRow;
+    ZdbBTreeNode* childSplit = _btreeInsert(index, node->u.inner.children[child], key, row, &childKey, &childRow, result);
+    if (childSplit == NULL)
+    {
+        return NULL;
+    }
+
+    /* Lay the node out with the new separator in place, one over size, then split it if it doesn't fit */
+    ZdbIndexKey keys[ZDB_BTREE_INNER_KEYS + 1];
+    ZdbRow* rows[ZDB_BTREE_INNER_KEYS + 1];
+    ZdbBTreeNode* children[ZDB_BTREE_INNER_KEYS + 2];
+    int count = node->count;
+    memcpy(keys, node->u.inner.keys, child * sizeof(ZdbIndexKey));
+    memcpy(rows, node->u.inner.rows, child * sizeof(ZdbRow*));
+    memcpy(children, node->u.inner.children, (child + 1) * sizeof(ZdbBTreeNode*));
+    keys[child] = childKey;
+    rows[child] = childRow;
+    children[child + 1] = childSplit;
+    memcpy(&keys[child + 1], &node->u.inner.keys[child], (count - child) * sizeof(ZdbIndexKey));
+    memcpy(&rows[child + 1], &node->u.inner.rows[child], (count - child) * sizeof(ZdbRow*));
+    memcpy(&children[child + 2], &node->u.inner.children[child + 1], (count - child) * sizeof(ZdbBTreeNode*));
+    count++;
+
+    if (count <= ZDB_BTREE_INNER_KEYS)
+    {
+        memcpy(node->u.inner.keys, keys, count * sizeof(ZdbIndexKey));
+        memcpy(node->u.inner.rows, rows, count * sizeof(ZdbRow*));
+        memcpy(node->u.inner.children, children, (count + 1) * sizeof(ZdbBTreeNode*));
+        node->count = count;
+        return NULL;
+    }
+
+    ZdbBTreeNode* right = _btreeTakeSpare(index, 0);
+
+    /* The middle separator moves up to the parent */
+    int middle = count / 2;
+    node->count = middle;
+    memcpy(node->u.inner.keys, keys, middle * sizeof(ZdbIndexKey));
+    memcpy(node->u.inner.rows, rows, middle * sizeof(ZdbRow*));
+    memcpy(node->u.inner.children, children, (middle + 1) * sizeof(ZdbBTreeNode*));
+
+    right->count = count - middle - 1;
+    memcpy(right->u.inner.keys, &keys[middle + 1], right->count * sizeof(ZdbIndexKey));
+    memcpy(right->u.inner.rows, &rows[middle + 1], right->count * sizeof(ZdbRow*));
+    memcpy(right->u.inner.children, &children[middle + 1], (right->count + 1) * sizeof(ZdbBTreeNode*));
+
+    *splitKey = keys[middle];
+    *splitRow = rows[middle];
+    return right;
+}
+
+int _btreeAdd(ZdbIndex* index, ZdbRow* row)
+{
+    /* An insert splits at most one node per level and then adds a root.  Those nodes are kept ready beforehand, so
+       running out of memory leaves the tree as it was */
+    while (index->spareCount <= index->depth)
+    {
+        ZdbBTreeNode* node = _btreeNewNode(0);
+        if (node == NULL)
+        {
+            return ZDB_RESULT_OUT_OF_MEMORY;
+        }
+        index->spares[index->spareCount++] = node;
+    }
+
+    void* value;
+    ZdbEngineGetValue(index->table, row, index->column, &value);
+
+    ZdbIndexKey key;
+    int result = _btreeStoredKey(index, value, &key);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        return result;
+    }
+
+    ZdbIndexKey splitKey;
+    ZdbRow* splitRow;
+    ZdbBTreeNode* split = _btreeInsert(index, index->root, key, row, &splitKey, &splitRow, &result);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        _btreeFreeKey(index, key);
+        return result;
+    }
+
+    if (split != NULL)
+    {
+        /* The root split, so the tree grows a level */
+        ZdbBTreeNode* root = _btreeTakeSpare(index, 0);
+        root->count = 1;
+        root->u.inner.keys[0] = splitKey;
+        root->u.inner.rows[0] = splitRow;
+        root->u.inner.children[0] = index->root;
+        root->u.inner.children[1] = split;
+        index->root = root;
+        index->depth++;
+    }
+
+    index->entryCount++;
+    return ZDB_RESULT_SUCCESS;
+}
+
+void _btreeRemove(ZdbIndex* index, ZdbRow* row)
+{
+    if (index->entryCount == 0)
+    {
+        return;
+    }
+
+    /* The row's value hasn't changed since it was added, so it leads back to the same entry */
+    void* value;
+    ZdbEngineGetValue(index->table, row, index->column, &value);
+    ZdbIndexKey key = _btreeSearchKey(index, value);
+
+    ZdbBTreeNode* node = index->root;
+    while (!node->leaf)
+    {
+        node = node->u.inner.children[_btreeUpperBound(index, node->u.inner.keys, node->u.inner.rows, node->count, key, row)];
+    }
+
+    int position = _btreeUpperBound(index, node->u.leaf.keys, node->u.leaf.rows, node->count, key, row) - 1;
+    if (position < 0 || node->u.leaf.rows[position] != row)
+    {
+        /* Not in the index */
+        return;
+    }
+
+    _btreeFreeKey(index, node->u.leaf.keys[position]);
+    int move = node->count - position - 1;
+    memmove(&node->u.leaf.keys[position], &node->u.leaf.keys[position + 1], move * sizeof(ZdbIndexKey));
+    memmove(&node->u.leaf.rows[position], &node->u.leaf.rows[position + 1], move * sizeof(ZdbRow*));
+    node->count--;
+    index->entryCount--;
+}
+
+typedef struct
+{
+    ZdbIndexKey key;
+    ZdbRow* row;
+} ZdbBTreeEntry;
+
+void _btreeMergeRuns(ZdbIndex* index, ZdbBTreeEntry* from, ZdbBTreeEntry* to, int start, int middle, int end)
+{
+    int i = start;
+    int j = middle;
+    for (int k = start; k < end; k++)
+    {
+        if (i < middle && (j >= end || _btreeCompare(index, from[i].key, from[i].row, from[j].key, from[j].row) <= 0))
+        {
+            to[k] = from[i++];
+        }
+        else
+        {
+            to[k] = from[j++];
+        }
+    }
+}
+
+/* Bottom up merge sort.  Returns whichever of the two arrays ends up holding the sorted entries */
+ZdbBTreeEntry* _btreeSortEntries(ZdbIndex* index, ZdbBTreeEntry* entries, ZdbBTreeEntry* spare, int count)
+{
+    for (int width = 1; width < count; width *= 2)
+    {
+        for (int start = 0; start < count; start += 2 * width)
+        {
+            int middle = start + width < count ? start + width : count;
+            int end = start + 2 * width < count ? start + 2 * width : count;
+            _btreeMergeRuns(index, entries, spare, start, middle, end);
+        }
+
+        ZdbBTreeEntry* swap = entries;
+        entries = spare;
+        spare = swap;
+    }
+
+    return entries;
+}
+
+/* Builds the tree bottom up from the rows already in the table: full leaves first, then each level of inner nodes
+   over the one below.  Rows that are already in key order, as a table loaded in order is, skip the sort */
+int _btreeBuild(ZdbIndex* index)
+{
+    ZdbTable* table = index->table;
+    int live = table->rowCount - table->deletedCount;
+    ZdbBTreeEntry* entries = malloc((live > 0 ? live : 1) * sizeof(ZdbBTreeEntry));
+    if (entries == NULL)
+    {
+        return ZDB_RESULT_OUT_OF_MEMORY;
+    }
+
+    int count = 0;
+    int sorted = 1;
+    int result = ZDB_RESULT_SUCCESS;
+    for (int i = ZdbEngineNextLiveRow(table, 0); i < table->rowCount; i = ZdbEngineNextLiveRow(table, i + 1))
+    {
+        void* value;
+        ZdbEngineGetValue(table, ZdbEngineRowAt(table, i), index->column, &value);
+        result = _btreeStoredKey(index, value, &entries[count].key);
+        if (result != ZDB_RESULT_SUCCESS)
+        {
+            break;
+        }
+        entries[count].row = ZdbEngineRowAt(table, i);
+
+        if (count > 0 && sorted &&
+            _btreeCompare(index, entries[count - 1].key, entries[count - 1].row, entries[count].key, entries[count].row) > 0)
+        {
+            sorted = 0;
+        }
+        count++;
+    }
+
+    ZdbBTreeEntry* ordered = entries;
+    ZdbBTreeEntry* spare = NULL;
+    if (result == ZDB_RESULT_SUCCESS && !sorted)
+    {
+        spare = malloc(count * sizeof(ZdbBTreeEntry));
+        if (spare == NULL)
+        {
+            result = ZDB_RESULT_OUT_OF_MEMORY;
+        }
+        else
+        {
+            ordered = _btreeSortEntries(index, entries, spare, count);
+        }
+    }
+
+    /* Every node the tree needs is allocated before any is filled in.  The leaves come first, then each level of
+       inner nodes, so the root is the last */
+    int leafCount = count > 0 ? (count + ZDB_BTREE_LEAF_KEYS - 1) / ZDB_BTREE_LEAF_KEYS : 1;
+    int nodeCount = leafCount;
+    for (int width = leafCount; width > 1; )
+    {
+        width = (width + ZDB_BTREE_INNER_KEYS) / (ZDB_BTREE_INNER_KEYS + 1);
+        nodeCount += width;
+    }
+
+    ZdbBTreeNode** nodes = NULL;
+    ZdbBTreeEntry* lowest = NULL;
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        nodes = calloc(nodeCount, sizeof(ZdbBTreeNode*));
+        lowest = malloc(leafCount * sizeof(ZdbBTreeEntry));
+        result = nodes != NULL && lowest != NULL ? ZDB_RESULT_SUCCESS : ZDB_RESULT_OUT_OF_MEMORY;
+    }
+    for (int i = 0; i < nodeCount && result == ZDB_RESULT_SUCCESS; i++)
+    {
+        nodes[i] = _btreeNewNode(i < leafCount);
+        if (nodes[i] == NULL)
+        {
+            result = ZDB_RESULT_OUT_OF_MEMORY;
+        }
+    }
+
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        ZdbBTreeNode* previous = NULL;
+        for (int i = 0; i < leafCount; i++)
+        {
+            ZdbBTreeNode* leaf = nodes[i];
+            leaf->count = count - i * ZDB_BTREE_LEAF_KEYS < ZDB_BTREE_LEAF_KEYS ? count - i * ZDB_BTREE_LEAF_KEYS : ZDB_BTREE_LEAF_KEYS;
+            for (int j = 0; j < leaf->count; j++)
+            {
+                leaf->u.leaf.keys[j] = ordered[i * ZDB_BTREE_LEAF_KEYS + j].key;
+                leaf->u.leaf.rows[j] = ordered[i * ZDB_BTREE_LEAF_KEYS + j].row;
+            }
+            if (previous != NULL)
+            {
+                previous->u.leaf.next = leaf;
+            }
+            previous = leaf;
+
+            if (leaf->count > 0)
+            {
+                lowest[i] = ordered[i * ZDB_BTREE_LEAF_KEYS];
+            }
+        }
+    }
+
+    /* Each node of the level being built, with the smallest entry under it for the level above to separate on */
+    ZdbBTreeNode** level = nodes;
+    int levelCount = leafCount;
+    int depth = 1;
+    while (result == ZDB_RESULT_SUCCESS && levelCount > 1)
+    {
+        ZdbBTreeNode** parents = level + levelCount;
+        int parentCount = (levelCount + ZDB_BTREE_INNER_KEYS) / (ZDB_BTREE_INNER_KEYS + 1);
+        for (int i = 0; i < parentCount && result == ZDB_RESULT_SUCCESS; i++)
+        {
+            ZdbBTreeNode* parent = parents[i];
+            int first = i * (ZDB_BTREE_INNER_KEYS + 1);
+            int children = levelCount - first < ZDB_BTREE_INNER_KEYS + 1 ? levelCount - first : ZDB_BTREE_INNER_KEYS + 1;
+
+            /* The count only takes in separators that were copied, so a failure part way can free them */
+            parent->u.inner.children[0] = level[first];
+            for (int j = 1; j < children && result == ZDB_RESULT_SUCCESS; j++)
+            {
+                parent->u.inner.children[j] = level[first + j];
+                void* value = _btreeKeyIsCopy(index) ? lowest[first + j].key.p : (void*)&lowest[first + j].key;
+                result = _btreeStoredKey(index, value, &parent->u.inner.keys[j - 1]);
+                if (result == ZDB_RESULT_SUCCESS)
+                {
+                    parent->u.inner.rows[j - 1] = lowest[first + j].row;
+                    parent->count = j;
+                }
+            }
+
+            lowest[i] = lowest[first];
+        }
+        level = parents;
+        levelCount = parentCount;
+        depth++;
+    }
+
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        /* Leaf keys are still the entries' to free; separators belong to their inner node */
+        for (int i = 0; nodes != NULL && i < nodeCount; i++)
+        {
+            if (nodes[i] != NULL && !nodes[i]->leaf)
+            {
+                for (int j = 0; j < nodes[i]->count; j++)
+                {
+                    _btreeFreeKey(index, nodes[i]->u.inner.keys[j]);
+                }
+            }
+            free(nodes[i]);
+        }
+        for (int i = 0; i < count; i++)
+        {
+            _btreeFreeKey(index, entries[i].key);
+        }
+        free(nodes);
+        free(lowest);
+        free(entries);
+        free(spare);
+        return result;
+    }
+
+    index->root = nodes[nodeCount - 1];
+    index->entryCount = count;
+    index->depth = depth;
+
+    free(nodes);
+    free(lowest);
+    free(entries);
+    free(spare);
+    return ZDB_RESULT_SUCCESS;
+}
+
+int _btreeFindRange(ZdbIndex* index, void* low, int lowInclusive, void* high, int highInclusive, int* count, ZdbRow*** rows,
+                    int* capacity)
+{
+    ZdbIndexKey lowKey = low != NULL ? _btreeSearchKey(index, low) : (ZdbIndexKey){ 0 };
+    ZdbIndexKey highKey = high != NULL ? _btreeSearchKey(index, high) : (ZdbIndexKey){ 0 };
+
+    /* Down to the leaf holding the first entry at or past the low bound */
+    ZdbBTreeNode* node = index->root;
+    while (!node->leaf)
+    {
+        int child = low != NULL ? _btreeKeyBound(index, node->u.inner.keys, node->count, lowKey, lowInclusive) : 0;
+        node = node->u.inner.children[child];
+    }
+    int position = low != NULL ? _btreeKeyBound(index, node->u.leaf.keys, node->count, lowKey, lowInclusive) : 0;
+
+    int found = 0;
+    ZdbRow** result = *rows;
+    if (*capacity == 0)
+    {
+        result = malloc(64 * sizeof(ZdbRow*));
+        if (result == NULL)
+        {
+            return ZDB_RESULT_OUT_OF_MEMORY;
+        }
+        *rows = result;
+        *capacity = 64;
+    }
+
+    for (; node != NULL; node = node->u.leaf.next, position = 0)
+    {
+        for (; position < node->count; position++)
+        {
+            if (high != NULL)
+            {
+                int compare = _btreeCompareKeys(index, node->u.leaf.keys[position], highKey);
+                if (compare > 0 || (compare == 0 && !highInclusive))
+                {
+                    node = NULL;
+                    break;
+                }
+            }
+
+            if (found == *capacity)
+            {
+                ZdbRow** grown = realloc(result, 2 * *capacity * sizeof(ZdbRow*));
+                if (grown == NULL)
+                {
+                    return ZDB_RESULT_OUT_OF_MEMORY;
+                }
+                *rows = result = grown;
+                *capacity *= 2;
+            }
+            result[found++] = node->u.leaf.rows[position];
+        }
+
+        if (node == NULL)
+        {
+            break;
+        }
+    }
+
+    *count = found;
+    return ZDB_RESULT_SUCCESS;
+}
+
+/*
+ * Maintenance
+ */
+
+int _hashAdd(ZdbIndex* index, ZdbRow* row)
+{
+    void* value;
+    ZdbEngineGetValue(index->table, row, index->column, &value);
+    if (index->table->layout.tags[index->column] == ZDB_LAYOUT_TAG_FLOAT && isnan(*(float*)value))
+    {
+        /* NaN equals nothing, itself included, so no lookup could find the row */
+        return ZDB_RESULT_SUCCESS;
+    }
+
+    /* Keep both tables at most half full */
+    if ((index->groupCount + 1) * 2 > index->groupSlotCount && _indexGrowGroups(index) != ZDB_RESULT_SUCCESS)
+    {
+        return ZDB_RESULT_OUT_OF_MEMORY;
+    }
+    if ((index->entryCount + 1) * 2 > index->entrySlotCount && _indexGrowEntries(index) != ZDB_RESULT_SUCCESS)
+    {
+        return ZDB_RESULT_OUT_OF_MEMORY;
+    }
+
+    uint32_t hash = _indexHashValue(index, value);
+
+    ZdbIndexGroup** slot = _indexGroupSlot(index, value, hash);
+    if (*slot == NULL)
+    {
+        *slot = _indexCreateGroup(index, value, hash);
+        if (*slot == NULL)
+        {
+            return ZDB_RESULT_OUT_OF_MEMORY;
+        }
+        index->groupCount++;
+    }
+
+    ZdbIndexGroup* group = *slot;
+    if (group->count == group->capacity)
+    {
+        int capacity = group->capacity * 2;
+        ZdbRow** rows = malloc(capacity * sizeof(ZdbRow*));
+        if (rows == NULL)
+        {
+            return ZDB_RESULT_OUT_OF_MEMORY;
+        }
+        memcpy(rows, group->rows, group->count * sizeof(ZdbRow*));
+        if (group->rows != &group->firstRow)
+        {
+            free(group->rows);
+        }
+        group->rows = rows;
+        group->capacity = capacity;
+    }
+
+    ZdbIndexEntry* entry = _indexEntrySlot(index, row);
+    entry->row = row;
+    entry->position = group->count;
+    index->entryCount++;
+
+    group->rows[group->count++] = row;
+    return ZDB_RESULT_SUCCESS;
+}
+
+void _hashRemove(ZdbIndex* index, ZdbRow* row)
+{
+    if (index->entryCount == 0)
+    {
+        return;
+    }
+
+    ZdbIndexEntry* entry = _indexEntrySlot(index, row);
+    if (entry->row == NULL)
+    {
+        /* Not in the index */
+        return;
+    }
+    int position = entry->position;
+    _indexRemoveEntry(index, entry);
+
+    /* The row's value hasn't changed since it was added, so it leads back to the same group */
+    void* value;
+    ZdbEngineGetValue(index->table, row, index->column, &value);
+    ZdbIndexGroup** slot = _indexGroupSlot(index, value, _indexHashValue(index, value));
+    ZdbIndexGroup* group = *slot;
+    if (group == NULL)
+    {
+        /* The value was changed behind the index's back */
+        return;
+    }
+
+    /* Fill the hole with the group's last row */
+    group->count--;
+    if (position < group->count)
+    {
+        ZdbRow* moved = group->rows[group->count];
+        group->rows[position] = moved;
+        _indexEntrySlot(index, moved)->position = position;
+    }
+
+    if (group->count == 0)
+    {
+        _indexFreeGroup(group);
+        _indexRemoveGroupSlot(index, slot - index->groups);
+    }
+}
+
+/* Frees what the index holds, leaving it empty */
+void _indexClear(ZdbIndex* index)
+{
+    for (int i = 0; i < index->groupSlotCount; i++)
+    {
+        if (index->groups[i] != NULL)
+        {
+            _indexFreeGroup(index->groups[i]);
+        }
+    }
+
+    if (index->root != NULL)
+    {
+        _btreeFreeNode(index, index->root);
+    }
+    for (int i = 0; i < index->spareCount; i++)
+    {
+        free(index->spares[i]);
+    }
+
+    free(index->groups);
+    free(index->entries);
+
+    index->groups = NULL;
+    index->groupSlotCount = 0;
+    index->groupCount = 0;
+    index->entries = NULL;
+    index->entrySlotCount = 0;
+    index->entryCount = 0;
+    index->root = NULL;
+    index->depth = 0;
+    index->spareCount = 0;
+}
+
+void _indexFree(ZdbIndex* index)
+{
+    _indexClear(index);
+    free(index);
+}
+
+void _indexRemove(ZdbIndex* index, ZdbRow* row)
+{
+    if (index->pending)
+    {
+        return;
+    }
+
+    if (index->type == ZDB_INDEX_HASH)
+    {
+        _hashRemove(index, row);
+    }
+    else
+    {
+        _btreeRemove(index, row);
+    }
+}
+
+int ZdbIndexAddRow(ZdbTable* table, ZdbRow* row)
+{
+    for (int i = 0; i < table->indexCount; i++)
+    {
+        ZdbIndex* index = table->indexes[i];
+        if (index->pending)
+        {
+            /* It takes in every row when it is built */
+            continue;
+        }
+
+        int result = index->type == ZDB_INDEX_HASH ? _hashAdd(index, row) : _btreeAdd(index, row);
+        if (result != ZDB_RESULT_SUCCESS)
+        {
+            /* Take the row back out of the indexes before this one, so it is in none of them */
+            while (--i >= 0)
+            {
+                _indexRemove(table->indexes[i], row);
+            }
+            return result;
+        }
+    }
+
+    return ZDB_RESULT_SUCCESS;
+}
+
+void ZdbIndexRemoveRow(ZdbTable* table, ZdbRow* row)
+{
+    for (int i = 0; i < table->indexCount; i++)
+    {
+        _indexRemove(table->indexes[i], row);
+    }
+}
+
+void ZdbIndexFreeAll(ZdbTable* table)
+{
+    for (int i = 0; i < table->indexCount; i++)
+    {
+        _indexFree(table->indexes[i]);
+    }
+
+    free(table->indexes);
+    table->indexes = NULL;
+    table->indexCount = 0;
+}
+
+/* Fills an empty index with the table's live rows.  On failure the index is left empty */
+int _indexBuild(ZdbIndex* index)
+{
+    ZdbTable* table = index->table;
+    int result = ZDB_RESULT_SUCCESS;
+    if (index->type == ZDB_INDEX_BTREE)
+    {
+        result = _btreeBuild(index);
+    }
+    else
+    {
+        /* Size the row table for the whole table up front */
+        int live = table->rowCount - table->deletedCount;
+        while (result == ZDB_RESULT_SUCCESS && index->entrySlotCount < live * 2)
+        {
+            result = _indexGrowEntries(index) == ZDB_RESULT_SUCCESS ? ZDB_RESULT_SUCCESS : ZDB_RESULT_OUT_OF_MEMORY;
+        }
+
+        for (int i = ZdbEngineNextLiveRow(table, 0); i < table->rowCount && result == ZDB_RESULT_SUCCESS;
+             i = ZdbEngineNextLiveRow(table, i + 1))
+        {
+            result = _hashAdd(index, ZdbEngineRowAt(table, i));
+        }
+    }
+
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        _indexClear(index);
+    }
+    return result;
+}
+
+ZdbIndex* _indexFind(ZdbTable* table, int column, int type)
+{
+    for (int i = 0; i < table->indexCount; i++)
+    {
+        if (table->indexes[i]->column == column && table->indexes[i]->type == type)
+        {
+            return table->indexes[i];
+        }
+    }
+
+    return NULL;
+}
+
+int _indexAdd(ZdbTable* table, int column, int type, int build)
+{
+    if (column < 0 || column >= table->columnCount)
+    {
+        /* Column is out of range for this table */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    if (type != ZDB_INDEX_HASH && type != ZDB_INDEX_BTREE)
+    {
+        /* Unknown kind of index */
+        return ZDB_RESULT_UNSUPPORTED;
+    }
+
+    ZdbType* columnType = table->columns[column]->type;
+    if ((type == ZDB_INDEX_HASH && table->layout.tags[column] == ZDB_LAYOUT_TAG_OTHER) ||
+        (type == ZDB_INDEX_BTREE && (!ZdbTypeSupportsCompare(columnType) || !ZdbTypeSupportsCopy(columnType))))
+    {
+        /* User-defined types have no way to hash their values, and ordering needs a compare */
+        return ZDB_RESULT_UNSUPPORTED;
+    }
+
+    if (_indexFind(table, column, type) != NULL)
+    {
+        /* Already indexed */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    ZdbIndex* index = calloc(1, sizeof(ZdbIndex));
+    ZdbIndex** indexes = realloc(table->indexes, (table->indexCount + 1) * sizeof(ZdbIndex*));
+    if (index == NULL || indexes == NULL)
+    {
+        free(index);
+        return ZDB_RESULT_OUT_OF_MEMORY;
+    }
+    table->indexes = indexes;
+
+    index->type = type;
+    index->column = column;
+    index->table = table;
+    index->keyTag = table->layout.tags[column];
+    index->pending = !build;
+
+    if (build)
+    {
+        int result = _indexBuild(index);
+        if (result != ZDB_RESULT_SUCCESS)
+        {
+            _indexFree(index);
+            return result;
+        }
+    }
+
+    table->indexes[table->indexCount++] = index;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbIndexCreate(ZdbTable* table, int column, int type)
+{
+    return _indexAdd(table, column, type, 1);
+}
+
+int ZdbIndexDefer(ZdbTable* table, int column, int type)
+{
+    return _indexAdd(table, column, type, 0);
+}
+
+/*
+ * Public functions
+ */
+
+int ZdbEngineCreateIndex(ZdbTable* table, int column, int type)
+{
+    if (table == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    ZdbLog* log = table->db != NULL ? table->db->log : NULL;
+    if (log == NULL)
+    {
+        return ZdbIndexCreate(table, column, type);
+    }
+
+    ZdbLogLock(log);
+    uint64_t sequence = 0;
+    int result = ZdbIndexCreate(table, column, type);
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        sequence = ZdbLogCreateIndex(log, table, column, type);
+    }
+    ZdbLogUnlock(log);
+
+    if (result == ZDB_RESULT_SUCCESS && ZdbLogIsAutocommit(log))
+    {
+        return ZdbLogWait(log, sequence);
+    }
+
+    return result;
+}
+
+int ZdbEngineGetIndex(ZdbTable* table, int column, int type, ZdbIndex** index)
+{
+    if (table == NULL || index == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    ZdbIndex* found = _indexFind(table, column, type);
+    if (found == NULL)
+    {
+        return ZDB_RESULT_NOT_FOUND;
+    }
+
+    if (found->pending)
+    {
+        /* Opened from a file and asked for at last.  If there isn't the memory, it stays pending */
+        int result = _indexBuild(found);
+        if (result != ZDB_RESULT_SUCCESS)
+        {
+            return result;
+        }
+        found->pending = 0;
+    }
+
+    *index = found;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int _compareRowHandles(const void* a, const void* b)
+{
+    return (*(ZdbRow* const*)a)->index - (*(ZdbRow* const*)b)->index;
+}
+
+int ZdbIndexFind(ZdbIndex* index, void* value, int* count, ZdbRow*** rows)
+{
+    int capacity = 0;
+    if (rows != NULL)
+    {
+        *rows = NULL;
+    }
+
+    return ZdbIndexFindInto(index, value, count, rows, &capacity);
+}
+
+int ZdbIndexFindRange(ZdbIndex* index, void* low, int lowInclusive, void* high, int highInclusive, int* count, ZdbRow*** rows)
+{
+    int capacity = 0;
+    if (rows != NULL)
+    {
+        *rows = NULL;
+    }
+
+    return ZdbIndexFindRangeInto(index, low, lowInclusive, high, highInclusive, count, rows, &capacity);
+}
+
+int ZdbIndexFindInto(ZdbIndex* index, void* value, int* count, ZdbRow*** rows, int* capacity)
+{
+    if (index == NULL || value == NULL || count == NULL || rows == NULL || capacity == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (index->type == ZDB_INDEX_BTREE)
+    {
+        if (index->keyTag == ZDB_LAYOUT_TAG_FLOAT && isnan(*(float*)value))
+        {
+            /* NaN has its place in the tree but equals nothing */
+            *count = 0;
+            return ZDB_RESULT_SUCCESS;
+        }
+
+        /* Equal keys are kept in handle order, so put them back in table order */
+        int result = _btreeFindRange(index, value, 1, value, 1, count, rows, capacity);
+        if (result == ZDB_RESULT_SUCCESS)
+        {
+            qsort(*rows, *count, sizeof(ZdbRow*), _compareRowHandles);
+        }
+        return result;
+    }
+
+    *count = 0;
+    if (index->groupCount == 0)
+    {
+        return ZDB_RESULT_SUCCESS;
+    }
+
+    ZdbIndexGroup* group = *_indexGroupSlot(index, value, _indexHashValue(index, value));
+    if (group == NULL)
+    {
+        /* No row holds the value */
+        return ZDB_RESULT_SUCCESS;
+    }
+
+    if (group->count > *capacity)
+    {
+        ZdbRow** grown = realloc(*rows, group->count * sizeof(ZdbRow*));
+        if (grown == NULL)
+        {
+            return ZDB_RESULT_OUT_OF_MEMORY;
+        }
+        *rows = grown;
+        *capacity = group->count;
+    }
+
+    memcpy(*rows, group->rows, group->count * sizeof(ZdbRow*));
+    if (group->count > 1)
+    {
+        qsort(*rows, group->count, sizeof(ZdbRow*), _compareRowHandles);
+    }
+    *count = group->count;
+
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbIndexFindRangeInto(ZdbIndex* index, void* low, int lowInclusive, void* high, int highInclusive, int* count,
+                          ZdbRow*** rows, int* capacity)
+{
+    if (index == NULL || count == NULL || rows == NULL || capacity == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (index->type != ZDB_INDEX_BTREE)
+    {
+        /* Hash indexes have no order */
+        return ZDB_RESULT_UNSUPPORTED;
+    }
+
+    return _btreeFindRange(index, low, lowInclusive, high, highInclusive, count, rows, capacity);
+}
@@ -0,0 +1,120 @@
+//
+//  index.h
+//  ZombieSQL
+//
+//  Secondary indexes on a single column, kept up to date by the engine as rows change.
+//
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include "engine.h"
+
+#define ZDB_INDEX_HASH          1       /* Equality lookups in constant time */
+#define ZDB_INDEX_BTREE         2       /* Ordered, for range conditions */
+
+#define ZDB_BTREE_NODE_SIZE     512     /* Eight cache lines, allocated on a cache line boundary */
+#define ZDB_BTREE_LEAF_KEYS     31
+#define ZDB_BTREE_INNER_KEYS    20
+#define ZDB_BTREE_MAX_DEPTH     16      /* Split inner nodes keep at least 10 children, so this covers 10^15 entries */
+
+/* Every row whose indexed value is the same is kept in one group */
+typedef struct
+{
+    uint32_t hash;
+    int count;
+    int capacity;
+    ZdbRow** rows;                  /* Row handles, which stay valid when the table is compacted */
+    ZdbRow* firstRow;               /* Where rows points while the group has a single row */
+
+    char key[0];                    /* Copy of the value the rows share.  This MUST be the last member of the struct */
+} ZdbIndexGroup;
+
+/* A B+tree key.  Int, boolean and float values are held in place; anything else is a copy of the value, which
+   is compared through its type */
+typedef union
+{
+    int i;
+    float f;
+    void* p;
+} ZdbIndexKey;
+
+/* Entries are ordered by key, then by row handle, so every entry is distinct and can be found again to remove it */
+typedef struct _ZdbBTreeNode
+{
+    int leaf;
+    int count;                      /* Keys in the node */
+    union
+    {
+        struct
+        {
+            ZdbIndexKey keys[ZDB_BTREE_LEAF_KEYS];
+            ZdbRow* rows[ZDB_BTREE_LEAF_KEYS];
+            struct _ZdbBTreeNode* next;     /* Leaf holding the next keys up */
+        } leaf;
+        struct
+        {
+            ZdbIndexKey keys[ZDB_BTREE_INNER_KEYS];         /* Separator i is the smallest entry under child i+1 */
+            ZdbRow* rows[ZDB_BTREE_INNER_KEYS];
+            struct _ZdbBTreeNode* children[ZDB_BTREE_INNER_KEYS + 1];
+        } inner;
+    } u;
+} ZdbBTreeNode;
+
+/* Where a row sits in its group, so it can be removed without searching the group */
+typedef struct
+{
+    ZdbRow* row;
+    int position;
+} ZdbIndexEntry;
+
+struct _ZdbIndex
+{
+    int type;                       /* ZDB_INDEX_* */
+    int column;
+    ZdbTable* table;
+    int pending;                    /* Not built yet, so changes to rows pass it by.  ZdbEngineGetIndex builds it */
+
+    ZdbIndexGroup** groups;         /* Open addressed by value hash, NULL marking an empty slot */
+    int groupSlotCount;             /* Always a power of two */
+    int groupCount;
+
+    ZdbIndexEntry* entries;         /* Open addressed by row handle, row NULL marking an empty slot */
+    int entrySlotCount;             /* Always a power of two */
+    int entryCount;                 /* Rows in the index, of either kind */
+
+    ZdbBTreeNode* root;             /* B+tree only */
+    int depth;                      /* Levels in the tree.  Removals leave it as it was, so it may be more */
+    ZdbBTreeNode* spares[ZDB_BTREE_MAX_DEPTH + 1];  /* Nodes kept ready for the splits of the next insert */
+    int spareCount;
+    int keyTag;                     /* ZDB_LAYOUT_TAG_* of the column, which decides how keys are held */
+};
+
+/* Builds an index over the rows already in the table.  Columns of user-defined types can have a B+tree index as
+   long as their type compares values, but not a hash index */
+int ZdbEngineCreateIndex(ZdbTable* table, int column, int type);
+int ZdbEngineGetIndex(ZdbTable* table, int column, int type, ZdbIndex** index);
+
+/* Finds the live rows holding value.  The rows come back in table order, and the array is the caller's to free */
+int ZdbIndexFind(ZdbIndex* index, void* value, int* count, ZdbRow*** rows);
+
+/* B+tree only.  Finds the live rows between the bounds, in key order; a NULL bound leaves that end open.  Float keys
+   order NaN below every number and -0 with 0, so a range open at the bottom takes in NaN.  ZdbIndexFind of NaN
+   finds nothing, NaN equalling nothing */
+int ZdbIndexFindRange(ZdbIndex* index, void* low, int lowInclusive, void* high, int highInclusive, int* count, ZdbRow*** rows);
+
+/* The same, but into *rows, an array of *capacity handles that is only reallocated when the rows don't fit.  A NULL
+   array with a capacity of 0 starts a new one.  The array stays the caller's either way */
+int ZdbIndexFindInto(ZdbIndex* index, void* value, int* count, ZdbRow*** rows, int* capacity);
+int ZdbIndexFindRangeInto(ZdbIndex* index, void* low, int lowInclusive, void* high, int highInclusive, int* count,
+                          ZdbRow*** rows, int* capacity);
+
+/* Used by the engine around every change to a row's values.  When an index can't take the row, ZdbIndexAddRow leaves
+   it out of every index and returns ZDB_RESULT_OUT_OF_MEMORY */
+int ZdbIndexAddRow(ZdbTable* table, ZdbRow* row);
+void ZdbIndexRemoveRow(ZdbTable* table, ZdbRow* row);
+void ZdbIndexFreeAll(ZdbTable* table);
+int ZdbIndexCreate(ZdbTable* table, int column, int type);       /* Builds the index without logging it */
+int ZdbIndexDefer(ZdbTable* table, int column, int type);        /* Adds the index unbuilt, for opening a file */
+
+#endif // INDEX_H
@@ -0,0 +1,427 @@
+//
+//  kernel.c
+//  ZombieSQL
+//
+//  Every kernel has a scalar version.  On x86 there are SSE2 and AVX2 versions as well, and the widest one the
+//  CPU supports is picked the first time a kernel runs.  Vector versions compare 4 or 8 values at a time and turn
+//  the comparison into bits with a movemask, so a mask word is filled by 16 or 8 steps; the few values left over
+//  at the end go through the scalar loop.  The reductions want 64-bit integer lanes and integer min and max,
+//  which SSE2 doesn't have, so they come in scalar and AVX2 versions only.
+//
+
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include "kernel.h"
+#include "query.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ZDB_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+#define ZDB_KERNEL_SCALAR   0
+#define ZDB_KERNEL_SSE2     1
+#define ZDB_KERNEL_AVX2     2
+
+/* Sets the bits for values[start] onwards one value at a time */
+#define SCALAR_LOOP(start, test)                                            \
+    for (int i = (start); i < count; i++)                                   \
+    {                                                                       \
+        mask[i / 64] |= (uint64_t)(test) << (i % 64);                       \
+    }
+
+/*
+ * Scalar
+ */
+
+void _compareIntScalar(int op, const int* values, int start, int count, int operand, uint64_t* mask)
+{
+    switch (op)
+    {
+        case ZDB_QUERY_CONDITION_EQ:  SCALAR_LOOP(start, values[i] == operand); break;
+        case ZDB_QUERY_CONDITION_NE:  SCALAR_LOOP(start, values[i] != operand); break;
+        case ZDB_QUERY_CONDITION_LT:  SCALAR_LOOP(start, values[i] < operand); break;
+        case ZDB_QUERY_CONDITION_LTE: SCALAR_LOOP(start, values[i] <= operand); break;
+        case ZDB_QUERY_CONDITION_GT:  SCALAR_LOOP(start, values[i] > operand); break;
+        case ZDB_QUERY_CONDITION_GTE: SCALAR_LOOP(start, values[i] >= operand); break;
+    }
+}
+
+/* Written with negations where the float type's compare would treat NaN as smaller than the operand */
+void _compareFloatScalar(int op, const float* values, int start, int count, float operand, uint64_t* mask)
+{
+    switch (op)
+    {
+        case ZDB_QUERY_CONDITION_EQ:  SCALAR_LOOP(start, values[i] == operand); break;
+        case ZDB_QUERY_CONDITION_NE:  SCALAR_LOOP(start, !(values[i] == operand)); break;
+        case ZDB_QUERY_CONDITION_LT:  SCALAR_LOOP(start, !(values[i] >= operand)); break;
+        case ZDB_QUERY_CONDITION_LTE: SCALAR_LOOP(start, !(values[i] > operand)); break;
+        case ZDB_QUERY_CONDITION_GT:  SCALAR_LOOP(start, values[i] > operand); break;
+        case ZDB_QUERY_CONDITION_GTE: SCALAR_LOOP(start, values[i] >= operand); break;
+    }
+}
+
+#define SELECTED(i)     ((mask[(i) / 64] >> ((i) % 64)) & 1)
+
+int64_t _sumIntScalar(const int* values, int start, int count, const uint64_t* mask)
+{
+    int64_t sum = 0;
+    for (int i = start; i < count; i++)
+    {
+        if (SELECTED(i))
+            sum += values[i];
+    }
+    return sum;
+}
+
+double _sumFloatScalar(const float* values, int start, int count, const uint64_t* mask)
+{
+    double sum = 0;
+    for (int i = start; i < count; i++)
+    {
+        if (SELECTED(i))
+            sum += values[i];
+    }
+    return sum;
+}
+
+void _minMaxIntScalar(const int* values, int start, int count, const uint64_t* mask, int* min, int* max)
+{
+    for (int i = start; i < count; i++)
+    {
+        if (SELECTED(i))
+        {
+            *min = values[i] < *min ? values[i] : *min;
+            *max = values[i] > *max ? values[i] : *max;
+        }
+    }
+}
+
+int _minMaxFloatScalar(const float* values, int start, int count, const uint64_t* mask, float* min, float* max)
+{
+    int seen = 0;
+    for (int i = start; i < count; i++)
+    {
+        if (SELECTED(i) && !isnan(values[i]))
+        {
+            *min = values[i] < *min ? values[i] : *min;
+            *max = values[i] > *max ? values[i] : *max;
+            seen++;
+        }
+    }
+    return seen;
+}
+
+#ifdef ZDB_KERNEL_X86
+
+/*
+ * SSE2, four values per step
+ */
+
+#define SSE2_INT_LOOP(compare, flip)                                        \
+    for (; i + 4 <= count; i += 4)                                          \
+    {                                                                       \
+        __m128i x = _mm_loadu_si128((const __m128i*)(values + i));          \
+        int bits = _mm_movemask_ps(_mm_castsi128_ps(compare)) ^ (flip);     \
+        mask[i / 64] |= (uint64_t)bits << (i % 64);                         \
+    }
+
+__attribute__((target("sse2")))
+void _compareIntSse2(int op, const int* values, int count, int operand, uint64_t* mask)
+{
+    __m128i o = _mm_set1_epi32(operand);
+    int i = 0;
+    switch (op)
+    {
+        case ZDB_QUERY_CONDITION_EQ:  SSE2_INT_LOOP(_mm_cmpeq_epi32(x, o), 0); break;
+        case ZDB_QUERY_CONDITION_NE:  SSE2_INT_LOOP(_mm_cmpeq_epi32(x, o), 0xF); break;
+        case ZDB_QUERY_CONDITION_LT:  SSE2_INT_LOOP(_mm_cmplt_epi32(x, o), 0); break;
+        case ZDB_QUERY_CONDITION_LTE: SSE2_INT_LOOP(_mm_cmpgt_epi32(x, o), 0xF); break;
+        case ZDB_QUERY_CONDITION_GT:  SSE2_INT_LOOP(_mm_cmpgt_epi32(x, o), 0); break;
+        case ZDB_QUERY_CONDITION_GTE: SSE2_INT_LOOP(_mm_cmplt_epi32(x, o), 0xF); break;
+    }
+    _compareIntScalar(op, values, i, count, operand, mask);
+}
+
+#define SSE2_FLOAT_LOOP(compare)                                            \
+    for (; i + 4 <= count; i += 4)                                          \
+    {                                                                       \
+        __m128 x = _mm_loadu_ps(values + i);                                \
+        mask[i / 64] |= (uint64_t)_mm_movemask_ps(compare) << (i % 64);     \
+    }
+
+__attribute__((target("sse2")))
+void _compareFloatSse2(int op, const float* values, int count, float operand, uint64_t* mask)
+{
+    __m128 o = _mm_set1_ps(operand);
+    int i = 0;
+    switch (op)
+    {
+        case ZDB_QUERY_CONDITION_EQ:  SSE2_FLOAT_LOOP(_mm_cmpeq_ps(x, o)); break;
+        case ZDB_QUERY_CONDITION_NE:  SSE2_FLOAT_LOOP(_mm_cmpneq_ps(x, o)); break;
+        case ZDB_QUERY_CONDITION_LT:  SSE2_FLOAT_LOOP(_mm_cmpnge_ps(x, o)); break;
+        case ZDB_QUERY_CONDITION_LTE: SSE2_FLOAT_LOOP(_mm_cmpngt_ps(x, o)); break;
+        case ZDB_QUERY_CONDITION_GT:  SSE2_FLOAT_LOOP(_mm_cmpgt_ps(x, o)); break;
+        case ZDB_QUERY_CONDITION_GTE: SSE2_FLOAT_LOOP(_mm_cmpge_ps(x, o)); break;
+    }
+    _compareFloatScalar(op, values, i, count, operand, mask);
+}
+
+/*
+ * AVX2, eight values per step
+ */
+
+#define AVX2_INT_LOOP(compare, flip)                                        \
+    for (; i + 8 <= count; i += 8)                                          \
+    {                                                                       \
+        __m256i x = _mm256_loadu_si256((const __m256i*)(values + i));       \
+        int bits = _mm256_movemask_ps(_mm256_castsi256_ps(compare)) ^ (flip); \
+        mask[i / 64] |= (uint64_t)bits << (i % 64);                         \
+    }
+
+__attribute__((target("avx2")))
+void _compareIntAvx2(int op, const int* values, int count, int operand, uint64_t* mask)
+{
+    __m256i o = _mm256_set1_epi32(operand);
+    int i = 0;
+    switch (op)
+    {
+        case ZDB_QUERY_CONDITION_EQ:  AVX2_INT_LOOP(_mm256_cmpeq_epi32(x, o), 0); break;
+        case ZDB_QUERY_CONDITION_NE:  AVX2_INT_LOOP(_mm256_cmpeq_epi32(x, o), 0xFF); break;
+        case ZDB_QUERY_CONDITION_LT:  AVX2_INT_LOOP(_mm256_cmpgt_epi32(o, x), 0); break;
+        case ZDB_QUERY_CONDITION_LTE: AVX2_INT_LOOP(_mm256_cmpgt_epi32(x, o), 0xFF); break;
+        case ZDB_QUERY_CONDITION_GT:  AVX2_INT_LOOP(_mm256_cmpgt_epi32(x, o), 0); break;
+        case ZDB_QUERY_CONDITION_GTE: AVX2_INT_LOOP(_mm256_cmpgt_epi32(o, x), 0xFF); break;
+    }
+    _compareIntScalar(op, values, i, count, operand, mask);
+}
+
+#define AVX2_FLOAT_LOOP(predicate)                                          \
+    for (; i + 8 <= count; i += 8)                                          \
+    {                                                                       \
+        __m256 x = _mm256_loadu_ps(values + i);                             \
+        int bits = _mm256_movemask_ps(_mm256_cmp_ps(x, o, predicate));      \
+        mask[i / 64] |= (uint64_t)bits << (i % 64);                         \
+    }
+
+__attribute__((target("avx2")))
+void _compareFloatAvx2(int op, const float* values, int count, float operand, uint64_t* mask)
+{
+    __m256 o = _mm256_set1_ps(operand);
+    int i = 0;
+    switch (op)
+    {
+        case ZDB_QUERY_CONDITION_EQ:  AVX2_FLOAT_LOOP(_CMP_EQ_OQ); break;
+        case ZDB_QUERY_CONDITION_NE:  AVX2_FLOAT_LOOP(_CMP_NEQ_UQ); break;
+        case ZDB_QUERY_CONDITION_LT:  AVX2_FLOAT_LOOP(_CMP_NGE_UQ); break;
+        case ZDB_QUERY_CONDITION_LTE: AVX2_FLOAT_LOOP(_CMP_NGT_UQ); break;
+        case ZDB_QUERY_CONDITION_GT:  AVX2_FLOAT_LOOP(_CMP_GT_OQ); break;
+        case ZDB_QUERY_CONDITION_GTE: AVX2_FLOAT_LOOP(_CMP_GE_OQ); break;
+    }
+    _compareFloatScalar(op, values, i, count, operand, mask);
+}
+
+/* The eight mask bits for values[i] onwards, spread out to all-ones or all-zeros lanes */
+#define AVX2_LANES(i)                                                                                           \
+    _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((int)(mask[(i) / 64] >> ((i) % 64)) & 0xFF), bit), bit)
+
+__attribute__((target("avx2")))
+int64_t _sumIntAvx2(const int* values, int count, const uint64_t* mask)
+{
+    const __m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256i sum = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i x = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(values + i)), AVX2_LANES(i));
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(x)));
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(x, 1)));
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, sum);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + _sumIntScalar(values, i, count, mask);
+}
+
+__attribute__((target("avx2")))
+double _sumFloatAvx2(const float* values, int count, const uint64_t* mask)
+{
+    const __m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256d low = _mm256_setzero_pd();
+    __m256d high = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 x = _mm256_and_ps(_mm256_loadu_ps(values + i), _mm256_castsi256_ps(AVX2_LANES(i)));
+        low = _mm256_add_pd(low, _mm256_cvtps_pd(_mm256_castps256_ps128(x)));
+        high = _mm256_add_pd(high, _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)));
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(low, high));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + _sumFloatScalar(values, i, count, mask);
+}
+
+__attribute__((target("avx2")))
+void _minMaxIntAvx2(const int* values, int count, const uint64_t* mask, int* min, int* max)
+{
+    const __m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i highest = _mm256_set1_epi32(INT_MAX);
+    const __m256i lowest = _mm256_set1_epi32(INT_MIN);
+    __m256i low = _mm256_set1_epi32(*min);
+    __m256i high = _mm256_set1_epi32(*max);
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        /* Values that aren't selected become ones that can't change the result */
+        __m256i x = _mm256_loadu_si256((const __m256i*)(values + i));
+        __m256i lanes = AVX2_LANES(i);
+        low = _mm256_min_epi32(low, _mm256_blendv_epi8(highest, x, lanes));
+        high = _mm256_max_epi32(high, _mm256_blendv_epi8(lowest, x, lanes));
+    }
+
+    int lows[8], highs[8];
+    _mm256_storeu_si256((__m256i*)lows, low);
+    _mm256_storeu_si256((__m256i*)highs, high);
+    for (int j = 0; j < 8; j++)
+    {
+        *min = lows[j] < *min ? lows[j] : *min;
+        *max = highs[j] > *max ? highs[j] : *max;
+    }
+    _minMaxIntScalar(values, i, count, mask, min, max);
+}
+
+__attribute__((target("avx2")))
+int _minMaxFloatAvx2(const float* values, int count, const uint64_t* mask, float* min, float* max)
+{
+    const __m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256 highest = _mm256_set1_ps(INFINITY);
+    const __m256 lowest = _mm256_set1_ps(-INFINITY);
+    __m256 low = _mm256_set1_ps(*min);
+    __m256 high = _mm256_set1_ps(*max);
+    int seen = 0;
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(values + i);
+        __m256 use = _mm256_and_ps(_mm256_castsi256_ps(AVX2_LANES(i)), _mm256_cmp_ps(x, x, _CMP_ORD_Q));
+        low = _mm256_min_ps(low, _mm256_blendv_ps(highest, x, use));
+        high = _mm256_max_ps(high, _mm256_blendv_ps(lowest, x, use));
+        seen += __builtin_popcount(_mm256_movemask_ps(use));
+    }
+
+    float lows[8], highs[8];
+    _mm256_storeu_ps(lows, low);
+    _mm256_storeu_ps(highs, high);
+    for (int j = 0; j < 8; j++)
+    {
+        *min = lows[j] < *min ? lows[j] : *min;
+        *max = highs[j] > *max ? highs[j] : *max;
+    }
+    return seen + _minMaxFloatScalar(values, i, count, mask, min, max);
+}
+
+#endif
+
+/*
+ * Dispatch
+ */
+
+int _kernelLevel()
+{
+    static int level = -1;
+    if (level < 0)
+    {
+#ifdef ZDB_KERNEL_X86
+        level = __builtin_cpu_supports("avx2") ? ZDB_KERNEL_AVX2 : __builtin_cpu_supports("sse2") ? ZDB_KERNEL_SSE2 : ZDB_KERNEL_SCALAR;
+#else
+        level = ZDB_KERNEL_SCALAR;
+#endif
+    }
+    return level;
+}
+
+void ZdbKernelCompareInt(int op, const int* values, int count, int operand, uint64_t* mask)
+{
+    memset(mask, 0, (count + 63) / 64 * sizeof(uint64_t));
+
+#ifdef ZDB_KERNEL_X86
+    switch (_kernelLevel())
+    {
+        case ZDB_KERNEL_AVX2:
+            _compareIntAvx2(op, values, count, operand, mask);
+            return;
+        case ZDB_KERNEL_SSE2:
+            _compareIntSse2(op, values, count, operand, mask);
+            return;
+    }
+#endif
+
+    _compareIntScalar(op, values, 0, count, operand, mask);
+}
+
+void ZdbKernelCompareFloat(int op, const float* values, int count, float operand, uint64_t* mask)
+{
+    memset(mask, 0, (count + 63) / 64 * sizeof(uint64_t));
+
+#ifdef ZDB_KERNEL_X86
+    switch (_kernelLevel())
+    {
+        case ZDB_KERNEL_AVX2:
+            _compareFloatAvx2(op, values, count, operand, mask);
+            return;
+        case ZDB_KERNEL_SSE2:
+            _compareFloatSse2(op, values, count, operand, mask);
+            return;
+    }
+#endif
+
+    _compareFloatScalar(op, values, 0, count, operand, mask);
+}
+
+int64_t ZdbKernelSumInt(const int* values, int count, const uint64_t* mask)
+{
+#ifdef ZDB_KERNEL_X86
+    if (_kernelLevel() == ZDB_KERNEL_AVX2)
+        return _sumIntAvx2(values, count, mask);
+#endif
+    return _sumIntScalar(values, 0, count, mask);
+}
+
+double ZdbKernelSumFloat(const float* values, int count, const uint64_t* mask)
+{
+#ifdef ZDB_KERNEL_X86
+    if (_kernelLevel() == ZDB_KERNEL_AVX2)
+        return _sumFloatAvx2(values, count, mask);
+#endif
+    return _sumFloatScalar(values, 0, count, mask);
+}
+
+void ZdbKernelMinMaxInt(const int* values, int count, const uint64_t* mask, int* min, int* max)
+{
+#ifdef ZDB_KERNEL_X86
+    if (_kernelLevel() == ZDB_KERNEL_AVX2)
+    {
+        _minMaxIntAvx2(values, count, mask, min, max);
+        return;
+    }
+#endif
+    _minMaxIntScalar(values, 0, count, mask, min, max);
+}
+
+int ZdbKernelMinMaxFloat(const float* values, int count, const uint64_t* mask, float* min, float* max)
+{
+#ifdef ZDB_KERNEL_X86
+    if (_kernelLevel() == ZDB_KERNEL_AVX2)
+        return _minMaxFloatAvx2(values, count, mask, min, max);
+#endif
+    return _minMaxFloatScalar(values, 0, count, mask, min, max);
+}
+
+const char* ZdbKernelName()
+{
+    static const char* names[] = { "scalar", "sse2", "avx2" };
+    return names[_kernelLevel()];
+}
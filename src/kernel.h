@@ -0,0 +1,30 @@
+//
+//  kernel.h
+//  ZombieSQL
+//
+//  Predicate kernels that compare a run of column values against one operand and set a bit for each match.
+//
+
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include <stdint.h>
+
+/* Each kernel sets bit i of mask when values[i] OP operand holds, where OP is a ZDB_QUERY_CONDITION_* comparison
+   from EQ to GTE.  mask must hold (count + 63) / 64 words; bits past count are cleared.  Floats compare the way
+   the float type does: NaN is unequal to everything, and a value compared with NaN, or NaN compared with a value,
+   counts as the smaller of the two */
+void ZdbKernelCompareInt(int op, const int* values, int count, int operand, uint64_t* mask);
+void ZdbKernelCompareFloat(int op, const float* values, int count, float operand, uint64_t* mask);
+
+/* Reductions over the values whose bit is set in mask, laid out as above.  Min and max update the running values
+   passed in.  Float sums are accumulated in double; the float min and max pass over NaN and return how many values
+   they looked at */
+int64_t ZdbKernelSumInt(const int* values, int count, const uint64_t* mask);
+double ZdbKernelSumFloat(const float* values, int count, const uint64_t* mask);
+void ZdbKernelMinMaxInt(const int* values, int count, const uint64_t* mask, int* min, int* max);
+int ZdbKernelMinMaxFloat(const float* values, int count, const uint64_t* mask, float* min, float* max);
+
+const char* ZdbKernelName();        /* Which instruction set the kernels run on: "avx2", "sse2" or "scalar" */
+
+#endif // KERNEL_H
@@ -6,9 +6,14 @@
 //  Copyright 2011 GreatFoundry. All rights reserved.
 //
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 
 #include "zdb.h"
 
@@ -29,9 +34,9 @@ void CreateTestRow(ZdbTable* table, char* name, char* age, char* salary, char* a
     TEST_PASS();
 }
 
-ZdbDatabase* CreateTestDatabase()
+ZdbDatabase* CreateTestDatabase(int storage)
 {
-    TEST_START("CreateTestDatabase");
+    TEST_START(storage == ZDB_STORAGE_PAX ? "CreateTestDatabase (PAX)" : "CreateTestDatabase");
 
     ZdbDatabase* db = NULL;
     TEST_ASSERT("ZdbEngineCreateDB", !ZdbEngineCreateDB("Company", &db));
@@ -44,7 +49,7 @@ ZdbDatabase* CreateTestDatabase()
     TEST_ASSERT("Create Active Column", !ZdbEngineCreateColumn("Active", ZdbStandardTypes->booleanType, 0, &(columns[4])));
 
     ZdbTable* t = NULL;
-    TEST_ASSERT("Create Employeees Table", !ZdbEngineCreateTable(db, "Employees", 5, columns, &t));
+    TEST_ASSERT("Create Employeees Table", !ZdbEngineCreateTableWithStorage(db, "Employees", 5, columns, storage, &t));
 
     CreateTestRow(t, "Breckin", "30", "34000.0", "1");
     CreateTestRow(t, "Bob", "22", "15600.0", "1");
@@ -153,7 +158,12 @@ void TestTypeSystem()
     size_t size;
     TEST_ASSERT("sizeof", !ZdbTypeSizeof(ZdbStandardTypes->intType, NULL, &size));
     TEST_ASSERT("sizeof check", size == sizeof(int));
-    TEST_ASSERT("sizeof unsupported", ZdbTypeSizeof(ZdbStandardTypes->intType, &a, &size) == ZDB_RESULT_UNSUPPORTED);
+    TEST_ASSERT("sizeof value", !ZdbTypeSizeof(ZdbStandardTypes->intType, &a, &size));
+    TEST_ASSERT("sizeof value check", size == sizeof(int));
+    TEST_ASSERT("varchar sizeof", !ZdbTypeSizeof(ZdbStandardTypes->varcharType, NULL, &size));
+    TEST_ASSERT("varchar sizeof check", size == ZDB_LIMIT_VARCHAR);
+    TEST_ASSERT("varchar sizeof value", !ZdbTypeSizeof(ZdbStandardTypes->varcharType, "Bob", &size));
+    TEST_ASSERT("varchar sizeof value check", size == 4);
 
     // Test From String
     TEST_ASSERT("from string", !ZdbTypeFromString(ZdbStandardTypes->intType, "42", &a));
@@ -173,6 +183,12 @@ void TestTypeSystem()
     TEST_ASSERT("next value", !ZdbTypeNextValue(ZdbStandardTypes->intType, &a, &b));
     TEST_ASSERT("next value check", b == 43);
 
+    // Test type IDs
+    TEST_ASSERT("int id", ZdbTypeGetId(ZdbStandardTypes->intType) == ZDB_TYPE_ID_INT);
+    TEST_ASSERT("float id", ZdbTypeGetId(ZdbStandardTypes->floatType) == ZDB_TYPE_ID_FLOAT);
+    TEST_ASSERT("boolean id", ZdbTypeGetId(ZdbStandardTypes->booleanType) == ZDB_TYPE_ID_BOOLEAN);
+    TEST_ASSERT("varchar id", ZdbTypeGetId(ZdbStandardTypes->varcharType) == ZDB_TYPE_ID_VARCHAR);
+
     TestTypeCopyValue();
 
     TEST_PASS();
@@ -268,158 +284,3932 @@ void TestOneConditionQuery(ZdbDatabase* db, int column, ZdbQueryConditionType qu
     TEST_PASS();
 }
 
-void UpdateRowTestHelper(ZdbDatabase* db, int table, int queryColumn, const char* queryValue, int updateColumn, void* updateValue)
+void TestRowLayout(ZdbDatabase* db)
 {
-    /* Most of this code will likely turn into the Update command code */
+    TEST_START("row layout");
 
+    const ZdbRowLayout* layout;
+    TEST_ASSERT("get layout", !ZdbEngineGetRowLayout(db->tables[0], &layout));
 
-    ZdbType* queryColumnType = db->tables[table]->columns[queryColumn]->type;
-    ZdbType* updateColumnType = db->tables[table]->columns[updateColumn]->type;
+    /* ID, Name, Age, Salary, Active: the int fields after the varchar must be realigned */
+    TEST_ASSERT("id offset", layout->offsets[0] == 0);
+    TEST_ASSERT("name offset", layout->offsets[1] == sizeof(int));
+    TEST_ASSERT("name tag", layout->tags[1] == ZDB_LAYOUT_TAG_VARCHAR);
+    TEST_ASSERT("name out of line", layout->sizes[1] == sizeof(ZdbVarcharRef));
 
-    /* Get some names of things to make diagnostic messages less painful */
-    char tableName[ZDB_LIMIT_VARCHAR], columnName[ZDB_LIMIT_VARCHAR], originalValueString[ZDB_LIMIT_VARCHAR], updateValueString[ZDB_LIMIT_VARCHAR], testName[ZDB_LIMIT_VARCHAR];
+    int i;
+    for (i = 0; i < db->tables[0]->columnCount; i++)
+    {
+        TEST_ASSERT("field aligned", layout->offsets[i] % layout->alignments[i] == 0);
+        TEST_ASSERT("fields in order", i == 0 || layout->offsets[i] >= layout->offsets[i-1] + layout->sizes[i-1]);
+    }
 
-    strcpy(tableName, db->tables[table]->name);
-    strcpy(columnName, db->tables[table]->columns[updateColumn]->name);
-    size_t length = ZDB_LIMIT_VARCHAR;
-    ZdbTypeToString(updateColumnType, updateValue, &length, updateValueString);
+    TEST_ASSERT("age aligned", layout->offsets[2] % sizeof(int) == 0);
+    TEST_ASSERT("row padded", layout->rowSize % layout->rowAlignment == 0);
 
-    sprintf(testName, "Update %s(%s) [QUERY]", tableName, columnName);
-    TEST_START(testName);
+    TEST_PASS();
+}
+
+void TestRowAllocator()
+{
+    TEST_START("row allocator");
+
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Slabs", &db));
+
+    ZdbColumn* columns[2];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Score", ZdbStandardTypes->floatType, 0, &columns[1]));
+
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTable(db, "Scores", 2, columns, &t));
+
+    /* Enough rows to span several slabs and several directory resizes */
+    int i;
+    for (i = 0; i < 10000; i++)
+    {
+        ZdbRow* r;
+        TEST_ASSERT("insert row", !ZdbEngineInsertRow(t, 2, &r));
+        TEST_ASSERT("update row", ZdbEngineUpdateRow(t, r, 2, NULL, "1.5") == 1);
+        TEST_ASSERT("slot aligned", ((size_t)r) % sizeof(void*) == 0);
+    }
+
+    for (i = 0; i < t->rowCount; i++)
+    {
+        int* id;
+        TEST_ASSERT("get value", !ZdbEngineGetValue(t, ZdbEngineRowAt(t, i), 0, (void**)&id));
+        TEST_ASSERT("rows intact", *id == i);
+    }
+
+    ZdbAllocatorStats stats;
+    TEST_ASSERT("stats", !ZdbEngineGetAllocatorStats(t, &stats));
+    TEST_ASSERT("several slabs", stats.slabCount > 1);
+    TEST_ASSERT("far fewer slabs than rows", stats.slabCount < t->rowCount / 100);
+    TEST_ASSERT("used fits in reserved", stats.bytesUsed + stats.bytesWasted <= stats.bytesReserved);
 
+    ZdbEngineDropDB(db);
+    TEST_PASS();
+}
+
+void TestStringHeap(ZdbDatabase* db)
+{
+    TEST_START("string heap");
+
+    ZdbTable* t = db->tables[0];
+    char* name1;
+    char* name2;
+    TEST_ASSERT("get value", !ZdbEngineGetValue(t, ZdbEngineRowAt(t, 0), 1, (void**)&name1));
+    TEST_ASSERT("get value again", !ZdbEngineGetValue(t, ZdbEngineRowAt(t, 0), 1, (void**)&name2));
+    TEST_ASSERT("zero copy", name1 == name2);
+    TEST_ASSERT("value", !strcmp(name1, "Breckin"));
+
+    /* Strings only take what they need from the heap */
+    TEST_ASSERT("compact", t->strings.bytesLive == strlen("Breckin") + strlen("Bob") + strlen("Jane") + strlen("John") + 4);
+
+    /* Rewriting a row in place doesn't leave its strings behind */
+    void* values[5];
+    int i;
+    for (i = 0; i < 5; i++)
+    {
+        TEST_ASSERT("get value", !ZdbEngineGetValue(t, ZdbEngineRowAt(t, 2), i, &values[i]));
+    }
+    TEST_ASSERT("rewrite row", ZdbEngineUpdateRowValues(t, ZdbEngineRowAt(t, 2), 5, values) == 1);
+    TEST_ASSERT("no dead bytes", t->strings.bytesDead == 0);
+
+    ZdbRecordset* rs;
     ZdbQuery* q;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    TEST_ASSERT("next", ZdbQueryNextResult(rs));
+    TEST_ASSERT("get string", !ZdbQueryGetString(rs, 1, &name2));
+    TEST_ASSERT("query zero copy", name1 == name2);
+    ZdbQueryFree(q);
+
+    TEST_PASS();
+}
+
+int CountQueryResults(ZdbQuery* q)
+{
     ZdbRecordset* rs;
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+
+    int count = 0;
+    while (ZdbQueryNextResult(rs))
+    {
+        count++;
+    }
+
+    return count;
+}
+
+void TestDictionaryEncoding()
+{
+    TEST_START("dictionary encoding");
+
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Dictionary", &db));
+
+    ZdbColumn* columns[2];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Department", ZdbStandardTypes->varcharType, 0, &columns[1]));
+    TEST_ASSERT("int can't be encoded", ZdbEngineSetColumnEncoding(columns[0], ZDB_ENCODING_DICTIONARY) == ZDB_RESULT_UNSUPPORTED);
+    TEST_ASSERT("encode", !ZdbEngineSetColumnEncoding(columns[1], ZDB_ENCODING_DICTIONARY));
+
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTable(db, "Staff", 2, columns, &t));
+    TEST_ASSERT("code field", t->layout.sizes[1] == sizeof(uint32_t));
+
+    const char* departments[] = { "Sales", "Engineering", "Legal", "Sales", "Engineering", "Sales" };
+    int i;
+    for (i = 0; i < 600; i++)
+    {
+        ZdbRow* r;
+        TEST_ASSERT("insert row", !ZdbEngineInsertRow(t, 2, &r));
+        TEST_ASSERT("update row", ZdbEngineUpdateRow(t, r, 2, NULL, departments[i % 6]) == 1);
+    }
+
+    int count;
+    char** values;
+    TEST_ASSERT("get dictionary", !ZdbEngineGetDictionary(t, 1, &count, &values));
+    TEST_ASSERT("distinct values", count == 4);     /* Including the empty string */
+    TEST_ASSERT("empty code", !strcmp(values[0], ""));
+
+    uint32_t code;
+    char* value;
+    TEST_ASSERT("get code", !ZdbEngineGetValueCode(t, ZdbEngineRowAt(t, 1), 1, &code));
+    TEST_ASSERT("get value", !ZdbEngineGetValue(t, ZdbEngineRowAt(t, 1), 1, (void**)&value));
+    TEST_ASSERT("decodes", value == values[code] && !strcmp(value, "Engineering"));
+    TEST_ASSERT("lookup", !ZdbEngineLookupCode(t, 1, "Engineering", &code) && value == values[code]);
+    TEST_ASSERT("lookup missing", ZdbEngineLookupCode(t, 1, "Marketing", &code) == ZDB_RESULT_NOT_FOUND);
+
+    ZdbQuery* q;
     TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
-    TEST_ASSERT("add table", !ZdbQueryAddTable(q, db->tables[table]));
-    TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_EQ, queryColumn, queryColumnType, queryValue));
-    TEST_ASSERT("execute query", !ZdbQueryExecute(q, &rs));
-    TEST_ASSERT("has results", ZdbQueryNextResult(rs));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_EQ, 1, ZdbStandardTypes->varcharType, "Sales"));
+    TEST_ASSERT("eq count", CountQueryResults(q) == 300);
+    TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_NE, 1, ZdbStandardTypes->varcharType, "Sales"));
+    TEST_ASSERT("ne count", CountQueryResults(q) == 300);
+    TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_EQ, 1, ZdbStandardTypes->varcharType, "Marketing"));
+    TEST_ASSERT("missing eq count", CountQueryResults(q) == 0);
+    ZdbQueryFree(q);
 
-    /* Get the current value so we can print it*/
-    void* originalValue;
-    length = ZDB_LIMIT_VARCHAR;
-    TEST_ASSERT("get value", !ZdbQueryGetValue(rs, updateColumn, updateColumnType, &originalValue));
-    TEST_ASSERT("to string", !ZdbTypeToString(updateColumnType, originalValue, &length, originalValueString));
+    const char* in[] = { "Legal", "Engineering", "Marketing" };
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("add in condition", !ZdbQueryAddInCondition(q, 1, ZdbStandardTypes->varcharType, 3, in));
+    TEST_ASSERT("in count", CountQueryResults(q) == 300);
+    ZdbQueryFree(q);
+
+    /* IN on a plain column compares values */
+    const char* ids[] = { "1", "5", "1000" };
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("add in condition", !ZdbQueryAddInCondition(q, 0, ZdbStandardTypes->intType, 3, ids));
+    TEST_ASSERT("in count", CountQueryResults(q) == 2);
+    ZdbQueryFree(q);
 
+    ZdbEngineDropDB(db);
     TEST_PASS();
+}
 
-    sprintf(testName, "Update %s => %s", originalValueString, updateValueString);
-    TEST_START(testName);
+void TestBulkInsert(int storage)
+{
+    TEST_START(storage == ZDB_STORAGE_PAX ? "bulk insert (PAX)" : "bulk insert");
 
-    int rowId = -1;
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Bulk", &db));
 
-    /* Collect the values for this row as a string */
-    void** values = calloc(db->tables[table]->columnCount, sizeof(void*));
+    ZdbColumn* columns[4];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Name", ZdbStandardTypes->varcharType, 0, &columns[1]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Salary", ZdbStandardTypes->floatType, 0, &columns[2]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Team", ZdbStandardTypes->varcharType, 0, &columns[3]));
+    TEST_ASSERT("encode", !ZdbEngineSetColumnEncoding(columns[3], ZDB_ENCODING_DICTIONARY));
+
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "People", 4, columns, storage, &t));
+
+    /* One row through the string path, so the batch has to carry on from its autoincrement value */
+    ZdbRow* r;
+    TEST_ASSERT("insert row", !ZdbEngineInsertRow(t, 4, &r));
+    TEST_ASSERT("update row", ZdbEngineUpdateRow(t, r, 4, NULL, "First", "1.0", "Red") == 1);
 
+    int batch = 300;
+    char* names[300];
+    float salaries[300];
+    char* teams[300];
     int i;
-    for (i = 0; i < db->tables[table]->columnCount; i++)
+    for (i = 0; i < batch; i++)
     {
-        void* value;
-        ZdbType* thisType = db->tables[table]->columns[i]->type;
-        TEST_ASSERT("get value", !ZdbQueryGetValue(rs, i, thisType, &value));
+        names[i] = (i % 2) ? "Odd" : "Even";
+        salaries[i] = (float)i;
+        teams[i] = (i % 3) ? "Blue" : "Red";
+    }
 
-        if (rowId == -1 && db->tables[table]->columns[i]->autoincrement)
-        {
-            /* For our test DB, we can assume the first auto increment column is an
-              int row id that matches the row index */
-            rowId = *(int*)value;
-        }
+    void* values[4] = { NULL, names, salaries, teams };
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(t, batch, values) == batch);
+    TEST_ASSERT("row count", t->rowCount == batch + 1);
 
-        if (i == updateColumn)
-        {
-            values[i] = updateValue;
-        }
-        else
+    void* missing[4] = { NULL, names, NULL, teams };
+    TEST_ASSERT("all values needed", ZdbEngineInsertRows(t, batch, missing) == ZDB_RESULT_VALUE_ERROR);
+
+    for (i = 0; i < batch; i++)
+    {
+        int* id;
+        char* name;
+        float* salary;
+        char* team;
+        TEST_ASSERT("get id", !ZdbEngineGetValue(t, ZdbEngineRowAt(t, i + 1), 0, (void**)&id));
+        TEST_ASSERT("get name", !ZdbEngineGetValue(t, ZdbEngineRowAt(t, i + 1), 1, (void**)&name));
+        TEST_ASSERT("get salary", !ZdbEngineGetValue(t, ZdbEngineRowAt(t, i + 1), 2, (void**)&salary));
+        TEST_ASSERT("get team", !ZdbEngineGetValue(t, ZdbEngineRowAt(t, i + 1), 3, (void**)&team));
+        TEST_ASSERT("autoincrement", *id == i + 1);
+        TEST_ASSERT("name", !strcmp(name, names[i]));
+        TEST_ASSERT("salary", *salary == salaries[i]);
+        TEST_ASSERT("team", !strcmp(team, teams[i]));
+    }
+
+    /* Row at a time inserts pick up after the batch */
+    TEST_ASSERT("insert row", !ZdbEngineInsertRow(t, 4, &r));
+    TEST_ASSERT("update row", ZdbEngineUpdateRow(t, r, 4, NULL, "Last", "2.0", "Blue") == 1);
+    int* id;
+    TEST_ASSERT("get id", !ZdbEngineGetValue(t, r, 0, (void**)&id));
+    TEST_ASSERT("autoincrement continues", *id == batch + 1);
+
+    ZdbEngineDropDB(db);
+    TEST_PASS();
+}
+
+void AssertTablesEqual(ZdbTable* expected, ZdbTable* actual)
+{
+    TEST_ASSERT("table name", !strcmp(expected->name, actual->name));
+    TEST_ASSERT("column count", expected->columnCount == actual->columnCount);
+    TEST_ASSERT("row count", expected->rowCount == actual->rowCount);
+    TEST_ASSERT("storage", expected->storage == actual->storage);
+    TEST_ASSERT("deleted count", expected->deletedCount == actual->deletedCount);
+
+    int i, j;
+    for (i = 0; i < expected->columnCount; i++)
+    {
+        TEST_ASSERT("column name", !strcmp(expected->columns[i]->name, actual->columns[i]->name));
+        TEST_ASSERT("column type", expected->columns[i]->type == actual->columns[i]->type);
+        TEST_ASSERT("column encoding", expected->columns[i]->encoding == actual->columns[i]->encoding);
+    }
+
+    for (i = 0; i < expected->rowCount; i++)
+    {
+        TEST_ASSERT("same tombstone", ZdbEngineIsRowDeleted(expected, i) == ZdbEngineIsRowDeleted(actual, i));
+        for (j = 0; j < expected->columnCount; j++)
         {
-            values[i] = value;
+            void* v1;
+            void* v2;
+            int result;
+            TEST_ASSERT("get value", !ZdbEngineGetValue(expected, ZdbEngineRowAt(expected, i), j, &v1));
+            TEST_ASSERT("get loaded value", !ZdbEngineGetValue(actual, ZdbEngineRowAt(actual, i), j, &v2));
+            TEST_ASSERT("compare", !ZdbTypeCompare(expected->columns[j]->type, v1, v2, &result));
+            TEST_ASSERT("same value", result == 0);
         }
     }
+}
 
+void TestPersistence(int storage)
+{
+    TEST_START(storage == ZDB_STORAGE_PAX ? "persistence (PAX)" : "persistence");
 
-    ZdbRow* row = db->tables[table]->rows[rowId];
-    TEST_ASSERT("update row values", ZdbEngineUpdateRowValues(db->tables[table], row, db->tables[table]->columnCount, values) == 1);
+    const char* path = "zsql-test.db";
+    ZdbDatabase* db = CreateTestDatabase(storage);
 
-    void* updatedValue;
-    TEST_ASSERT("get value", !ZdbQueryGetValue(rs, updateColumn, updateColumnType, &updatedValue));
-    int result = 0;
-    TEST_ASSERT("type compare", !ZdbTypeCompare(updateColumnType, updateValue, updatedValue, &result));
-    TEST_ASSERT("update check", result == 0);
+    /* A second table with a dictionary and enough rows to need several chunks and string pages */
+    ZdbColumn* columns[3];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("City", ZdbStandardTypes->varcharType, 0, &columns[1]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Note", ZdbStandardTypes->varcharType, 0, &columns[2]));
+    TEST_ASSERT("encode", !ZdbEngineSetColumnEncoding(columns[1], ZDB_ENCODING_DICTIONARY));
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "Visits", 3, columns, storage, &t));
 
-    free(values);
+    int i;
+    char note[64];
+    for (i = 0; i < 5000; i++)
+    {
+        ZdbRow* r;
+        sprintf(note, "visit number %d, which needs a fair few characters", i);
+        TEST_ASSERT("insert row", !ZdbEngineInsertRow(t, 3, &r));
+        TEST_ASSERT("update row", ZdbEngineUpdateRow(t, r, 3, NULL, (i % 3) ? "Paris" : "Oslo", note) == 1);
+    }
+
+    TEST_ASSERT("save", !ZdbEngineSaveDB(db, path));
+
+    ZdbDatabase* loaded;
+    TEST_ASSERT("open", !ZdbEngineOpenDB(path, &loaded));
+    TEST_ASSERT("db name", !strcmp(db->name, loaded->name));
+    TEST_ASSERT("table count", db->tableCount == loaded->tableCount);
+    for (i = 0; i < db->tableCount; i++)
+    {
+        AssertTablesEqual(db->tables[i], loaded->tables[i]);
+    }
+
+    /* Loaded tables carry on as normal: autoincrement continues, dictionaries are shared, rows can be changed */
+    ZdbTable* lt = loaded->tables[1];
+    ZdbRow* r;
+    int* id;
+    TEST_ASSERT("no directory", lt->rows == NULL && ZdbEngineRowAt(lt, 4999) == (ZdbRow*)(lt->mappedRows + 4999 * lt->allocator.slotSize));
+    TEST_ASSERT("insert row", !ZdbEngineInsertRow(lt, 3, &r));
+    TEST_ASSERT("directory built", lt->rows != NULL && ZdbEngineRowAt(lt, 5000) == r && ZdbEngineRowAt(lt, 4999)->index == 4999);
+    TEST_ASSERT("update row", ZdbEngineUpdateRow(lt, r, 3, NULL, "Oslo", "new") == 1);
+    TEST_ASSERT("get id", !ZdbEngineGetValue(lt, r, 0, (void**)&id));
+    TEST_ASSERT("autoincrement continues", *id == 5000);
+
+    uint32_t code1, code2;
+    TEST_ASSERT("get code", !ZdbEngineGetValueCode(lt, r, 1, &code1));
+    TEST_ASSERT("get code", !ZdbEngineGetValueCode(lt, ZdbEngineRowAt(lt, 0), 1, &code2));
+    TEST_ASSERT("dictionary restored", code1 == code2);
+
+    TEST_ASSERT("update loaded row", ZdbEngineUpdateRow(loaded->tables[0], ZdbEngineRowAt(loaded->tables[0], 1), 5, NULL, "Robert", "23", "15600.0", "1") == 1);
+    char* name;
+    TEST_ASSERT("get name", !ZdbEngineGetValue(loaded->tables[0], ZdbEngineRowAt(loaded->tables[0], 1), 1, (void**)&name));
+    TEST_ASSERT("updated", !strcmp(name, "Robert"));
+
+    /* Changes stay in memory until the database is saved again */
+    ZdbDatabase* reloaded;
+    TEST_ASSERT("reopen", !ZdbEngineOpenDB(path, &reloaded));
+    AssertTablesEqual(db->tables[0], reloaded->tables[0]);
+    ZdbEngineDropDB(reloaded);
+
+    TEST_ASSERT("save over", !ZdbEngineSaveDB(loaded, path));
+    TEST_ASSERT("reopen", !ZdbEngineOpenDB(path, &reloaded));
+    AssertTablesEqual(loaded->tables[0], reloaded->tables[0]);
+    AssertTablesEqual(loaded->tables[1], reloaded->tables[1]);
+    ZdbEngineDropDB(reloaded);
+
+    /* Dropped tables aren't saved, and the tables after them move up */
+    ZdbTable* scratch;
+    ZdbTable* kept;
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(loaded, "Scratch", 1, columns, storage, &scratch));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Note", ZdbStandardTypes->varcharType, 0, &columns[1]));
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(loaded, "Kept", 2, columns, storage, &kept));
+    for (i = 0; i < 100; i++)
+    {
+        TEST_ASSERT("insert row", !ZdbEngineInsertRow(scratch, 1, &r));
+        TEST_ASSERT("insert row", !ZdbEngineInsertRow(kept, 2, &r));
+        TEST_ASSERT("update row", ZdbEngineUpdateRow(kept, r, 2, NULL, "kept") == 1);
+    }
+    TEST_ASSERT("drop", !ZdbEngineDropTable(scratch));
+    TEST_ASSERT("drop again", ZdbEngineDropTable(scratch) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("save after drop", !ZdbEngineSaveDB(loaded, path));
+    TEST_ASSERT("reopen after drop", !ZdbEngineOpenDB(path, &reloaded));
+    TEST_ASSERT("dropped table gone", reloaded->tableCount == 3 && !strcmp(reloaded->tables[2]->name, "Kept"));
+    AssertTablesEqual(loaded->tables[1], reloaded->tables[1]);
+    AssertTablesEqual(kept, reloaded->tables[2]);
+    ZdbEngineDropDB(reloaded);
+
+    TEST_ASSERT("missing file", ZdbEngineOpenDB("zsql-missing.db", &reloaded) == ZDB_RESULT_NOT_FOUND);
+
+    ZdbEngineDropDB(loaded);
+    ZdbEngineDropDB(db);
+    remove(path);
 
-    ZdbQueryFree(q);
     TEST_PASS();
 }
 
-void TestBasicRowUpdate(ZdbDatabase* db)
+void TestWriteAheadLog(int storage)
 {
+    TEST_START(storage == ZDB_STORAGE_PAX ? "write-ahead log (PAX)" : "write-ahead log");
 
-    /* Legal wants Bob's official name changed to Robert in the DB */
-    int i = 1;
-    UpdateRowTestHelper(db, 0, 0, "1", 1, "Robert");
+    const char* dbPath = "zsql-test-wal.db";
+    const char* logPath = "zsql-test.wal";
+    remove(dbPath);
+    remove(logPath);
 
-    /* John gets rehired */
-    i = 3;
-    int active = 1;
-    UpdateRowTestHelper(db, 0, 0, "3", 4, &active);
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Logged", &db));
+    TEST_ASSERT("attach log", !ZdbEngineAttachLog(db, logPath, NULL));
+    TEST_ASSERT("one log only", ZdbEngineAttachLog(db, logPath, NULL) == ZDB_RESULT_INVALID_OPERATION);
 
-    /* Jane got older */
-    i = 2;
-    int age = 46;
-    UpdateRowTestHelper(db, 0, 0, "2", 2, &age);
+    ZdbColumn* columns[4];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("City", ZdbStandardTypes->varcharType, 0, &columns[1]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Note", ZdbStandardTypes->varcharType, 0, &columns[2]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Score", ZdbStandardTypes->floatType, 0, &columns[3]));
+    TEST_ASSERT("encode", !ZdbEngineSetColumnEncoding(columns[1], ZDB_ENCODING_DICTIONARY));
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "Visits", 4, columns, storage, &t));
 
-    /* And I got a raise! */
-    i = 0;
-    float salary = 80000;
-    UpdateRowTestHelper(db, 0, 0, "0", 3, &salary);
+    int i;
+    char note[64];
+    ZdbRow* r;
+    for (i = 0; i < 300; i++)
+    {
+        sprintf(note, "visit %d", i);
+        TEST_ASSERT("insert row", !ZdbEngineInsertRow(t, 4, &r));
+        TEST_ASSERT("update row", ZdbEngineUpdateRow(t, r, 4, NULL, (i % 3) ? "Paris" : "Oslo", note, "1.5") == 1);
+    }
 
-}
+    /* The image covers everything so far; only what follows should be replayed on top of it */
+    TEST_ASSERT("save", !ZdbEngineSaveDB(db, dbPath));
 
+    for (i = 0; i < 200; i++)
+    {
+        sprintf(note, "late visit %d", i);
+        TEST_ASSERT("insert row", !ZdbEngineInsertRow(t, 4, &r));
+        TEST_ASSERT("update row", ZdbEngineUpdateRow(t, r, 4, NULL, "Rome", note, "2.5") == 1);
+    }
+    TEST_ASSERT("update old row", ZdbEngineUpdateRow(t, ZdbEngineRowAt(t, 5), 4, NULL, "Lima", "changed", "9.0") == 1);
 
-int main (int argc, const char * argv[])
-{
-    if (ZdbTypeInitialize() != ZDB_RESULT_SUCCESS)
+    char* cities[1000];
+    char* notes[1000];
+    float scores[1000];
+    for (i = 0; i < 1000; i++)
     {
-        printf("Could not initialize type system\n");
+        cities[i] = (i % 2) ? "Oslo" : "Kyiv";
+        notes[i] = (i % 5) ? "bulk" : "bulk, but longer";
+        scores[i] = (float)i;
     }
+    void* values[4] = { NULL, cities, notes, scores };
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(t, 1000, values) == 1000);
 
-    TestTypeSystem();
+    /* A batch with a missing value is turned away whole, and there is nothing to log */
+    int rowCount = t->rowCount;
+    size_t stringBytes = t->strings.bytesLive;
+    notes[700] = NULL;
+    TEST_ASSERT("missing value", ZdbEngineInsertRows(t, 1000, values) == ZDB_RESULT_INVALID_NULL);
+    notes[700] = "bulk";
+    cities[900] = NULL;
+    TEST_ASSERT("missing code", ZdbEngineInsertRows(t, 1000, values) == ZDB_RESULT_INVALID_NULL);
+    cities[900] = "Oslo";
+    TEST_ASSERT("rows taken back", t->rowCount == rowCount && t->deletedCount == 0);
+    TEST_ASSERT("strings taken back", t->strings.bytesLive == stringBytes);
 
-    ZdbDatabase* db = CreateTestDatabase();
+    /* One row is left empty */
+    TEST_ASSERT("insert row", !ZdbEngineInsertRow(t, 4, &r));
+    TEST_ASSERT("commit", !ZdbEngineCommit(db));
 
-    TestBasicQuery(db);
+    ZdbLogStats stats;
+    TEST_ASSERT("log stats", !ZdbEngineGetLogStats(db, &stats));
+    TEST_ASSERT("records", stats.records == 1 + 600 + 400 + 1 + 1 + 1);
+    TEST_ASSERT("synced", stats.syncs > 0 && stats.bytes > 0);
+    TEST_ASSERT("detach", !ZdbEngineDetachLog(db));
+    TEST_ASSERT("not attached", ZdbEngineGetLogStats(db, &stats) == ZDB_RESULT_NOT_FOUND);
 
-    /* EQ */
-    TestOneConditionQuery(db, 0, ZDB_QUERY_CONDITION_EQ, "1", ZdbStandardTypes->intType, "1", 1);
-    TestOneConditionQuery(db, 1, ZDB_QUERY_CONDITION_EQ, "Jane", ZdbStandardTypes->varcharType, "Jane", 1);
-    TestOneConditionQuery(db, 2, ZDB_QUERY_CONDITION_EQ, "30", ZdbStandardTypes->intType, "30", 1);
-    TestOneConditionQuery(db, 3, ZDB_QUERY_CONDITION_EQ, "34000.000000", ZdbStandardTypes->floatType, "34000.000000", 1);
-    TestOneConditionQuery(db, 4, ZDB_QUERY_CONDITION_EQ, "0", ZdbStandardTypes->booleanType, "0", 1);
-    TestOneConditionQuery(db, 4, ZDB_QUERY_CONDITION_EQ, "1", ZdbStandardTypes->booleanType, "1", 3);
+    /* A crash part way through writing a record leaves a torn tail, which is dropped */
+    FILE* f = fopen(logPath, "ab");
+    TEST_ASSERT("open log", f != NULL);
+    fwrite("torn record", 1, 11, f);
+    fclose(f);
 
-    /* NE */
-    TestOneConditionQuery(db, 4, ZDB_QUERY_CONDITION_NE, "0", ZdbStandardTypes->booleanType, "1", 3);
+    /* With no image, the whole log is replayed, table definitions included */
+    ZdbDatabase* replayed;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Logged", &replayed));
+    TEST_ASSERT("replay log", !ZdbEngineAttachLog(replayed, logPath, NULL));
+    TEST_ASSERT("log stats", !ZdbEngineGetLogStats(replayed, &stats));
+    TEST_ASSERT("replayed all", stats.replayed == 1 + 600 + 400 + 1 + 1 + 1);
+    TEST_ASSERT("table count", replayed->tableCount == 1);
+    AssertTablesEqual(t, replayed->tables[0]);
+    ZdbEngineDropDB(replayed);
 
-    /* LT */
-    TestOneConditionQuery(db, 2, ZDB_QUERY_CONDITION_LT, "30", ZdbStandardTypes->intType, "22", 1);
-    TestOneConditionQuery(db, 1, ZDB_QUERY_CONDITION_LT, "Breckin", ZdbStandardTypes->varcharType, "Bob", 1);
+    /* Opening the image and attaching the log replays only what came after the save */
+    ZdbDatabase* recovered;
+    TEST_ASSERT("open", !ZdbEngineOpenDB(dbPath, &recovered));
+    TEST_ASSERT("recover", !ZdbEngineAttachLog(recovered, logPath, NULL));
+    TEST_ASSERT("log stats", !ZdbEngineGetLogStats(recovered, &stats));
+    TEST_ASSERT("replayed tail", stats.replayed == 400 + 1 + 1 + 1);
+    AssertTablesEqual(t, recovered->tables[0]);
 
-    /* GT */
-    TestOneConditionQuery(db, 3, ZDB_QUERY_CONDITION_GT, "45000.0", ZdbStandardTypes->floatType, "95600.000000", 1);
-    TestOneConditionQuery(db, 4, ZDB_QUERY_CONDITION_GT, "0", ZdbStandardTypes->booleanType, "1", 3);
+    int* id;
+    ZdbTable* rt = recovered->tables[0];
+    TEST_ASSERT("insert row", !ZdbEngineInsertRow(rt, 4, &r));
+    TEST_ASSERT("update row", ZdbEngineUpdateRow(rt, r, 4, NULL, "Oslo", "after", "0.0") == 1);
+    TEST_ASSERT("get id", !ZdbEngineGetValue(rt, r, 0, (void**)&id));
+    TEST_ASSERT("autoincrement continues", *id == 1500);
+    ZdbEngineDropDB(recovered);
 
-    /* LTE */
-    TestOneConditionQuery(db, 2, ZDB_QUERY_CONDITION_LTE, "22", ZdbStandardTypes->intType, "22", 1);
-    TestOneConditionQuery(db, 0, ZDB_QUERY_CONDITION_LTE, "-1", ZdbStandardTypes->intType, "-1", 0);
+    /* Changes made after recovery are logged as well */
+    TEST_ASSERT("open", !ZdbEngineOpenDB(dbPath, &recovered));
+    TEST_ASSERT("recover", !ZdbEngineAttachLog(recovered, logPath, NULL));
+    TEST_ASSERT("row count", recovered->tables[0]->rowCount == t->rowCount + 1);
+    ZdbEngineDropDB(recovered);
 
-    /* GTE */
-    TestOneConditionQuery(db, 2, ZDB_QUERY_CONDITION_GTE, "45", ZdbStandardTypes->intType, "45", 1);
-    TestOneConditionQuery(db, 4, ZDB_QUERY_CONDITION_GTE, "1", ZdbStandardTypes->booleanType, "1", 3);
+    /* A drop is logged too, so records after it number the tables the way the next save will */
+    remove(logPath);
+    ZdbDatabase* dropping;
+    ZdbTable* tables[3];
+    void* scoreValues[2] = { NULL, scores };
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Dropping", &dropping));
+    TEST_ASSERT("attach log", !ZdbEngineAttachLog(dropping, logPath, NULL));
+    for (i = 0; i < 3; i++)
+    {
+        TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+        TEST_ASSERT("create column", !ZdbEngineCreateColumn("Score", ZdbStandardTypes->floatType, 0, &columns[1]));
+        TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(dropping, i == 1 ? "Dropped" : "Kept", 2, columns, storage, &tables[i]));
+        TEST_ASSERT("insert rows", ZdbEngineInsertRows(tables[i], 10, scoreValues) == 10);
+    }
+    TEST_ASSERT("save", !ZdbEngineSaveDB(dropping, dbPath));
+    TEST_ASSERT("drop", !ZdbEngineDropTable(tables[1]));
+    scoreValues[1] = scores + 10;
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(tables[2], 20, scoreValues) == 20);
+    TEST_ASSERT("commit", !ZdbEngineCommit(dropping));
+
+    TEST_ASSERT("open", !ZdbEngineOpenDB(dbPath, &recovered));
+    TEST_ASSERT("recover", !ZdbEngineAttachLog(recovered, logPath, NULL));
+    TEST_ASSERT("drop replayed", recovered->tables[1]->columns == NULL);
+    AssertTablesEqual(tables[0], recovered->tables[0]);
+    AssertTablesEqual(tables[2], recovered->tables[2]);
+    ZdbEngineDropDB(recovered);
+
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Dropping", &replayed));
+    TEST_ASSERT("replay log", !ZdbEngineAttachLog(replayed, logPath, NULL));
+    TEST_ASSERT("drop replayed", replayed->tables[1]->columns == NULL);
+    AssertTablesEqual(tables[2], replayed->tables[2]);
+    ZdbEngineDropDB(replayed);
+
+    /* Saved after the drop, the image leaves the dropped table out and the log carries on from there */
+    TEST_ASSERT("save after drop", !ZdbEngineSaveDB(dropping, dbPath));
+    scoreValues[1] = scores + 30;
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(tables[2], 5, scoreValues) == 5);
+    TEST_ASSERT("commit", !ZdbEngineCommit(dropping));
+    TEST_ASSERT("open", !ZdbEngineOpenDB(dbPath, &recovered));
+    TEST_ASSERT("tables", recovered->tableCount == 2);
+    TEST_ASSERT("recover", !ZdbEngineAttachLog(recovered, logPath, NULL));
+    AssertTablesEqual(tables[2], recovered->tables[1]);
+    ZdbEngineDropDB(recovered);
+    ZdbEngineDropDB(dropping);
+
+    ZdbEngineDropDB(db);
+    remove(dbPath);
+    remove(logPath);
+
+    TEST_PASS();
+}
+
+void TestCheckpoint(int storage)
+{
+    TEST_START(storage == ZDB_STORAGE_PAX ? "checkpoint (PAX)" : "checkpoint");
+
+    const char* dbPath = "zsql-test-checkpoint.db";
+    const char* logPath = "zsql-test-checkpoint.wal";
+    remove(dbPath);
+    remove(logPath);
 
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Checkpointed", &db));
+    TEST_ASSERT("attach log", !ZdbEngineAttachLog(db, logPath, NULL));
 
-    TestBasicRowUpdate(db);
+    ZdbColumn* columns[2];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Name", ZdbStandardTypes->varcharType, 0, &columns[1]));
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "Items", 2, columns, storage, &t));
+
+    char* names[2000];
+    int i;
+    for (i = 0; i < 2000; i++)
+    {
+        names[i] = (i % 2) ? "odd" : "even";
+    }
+    void* values[2] = { NULL, names };
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(t, 2000, values) == 2000);
+
+    ZdbCheckpointStats stats;
+    TEST_ASSERT("no checkpoints yet", !ZdbEngineGetCheckpointStats(db, &stats) && stats.checkpoints == 0);
+
+    /* The table keeps changing while the checkpoint is written */
+    TEST_ASSERT("checkpoint", !ZdbEngineCheckpoint(db, dbPath));
+    for (i = 0; i < 500; i++)
+    {
+        ZdbRow* r;
+        TEST_ASSERT("insert row", !ZdbEngineInsertRow(t, 2, &r));
+        TEST_ASSERT("update row", ZdbEngineUpdateRow(t, r, 2, NULL, "during") == 1);
+    }
+    TEST_ASSERT("update old row", ZdbEngineUpdateRow(t, ZdbEngineRowAt(t, 0), 2, NULL, "changed") == 1);
+    TEST_ASSERT("wait", !ZdbEngineWaitCheckpoint(db));
+
+    TEST_ASSERT("stats", !ZdbEngineGetCheckpointStats(db, &stats));
+    TEST_ASSERT("completed", stats.checkpoints == 1 && stats.failures == 0);
+    TEST_ASSERT("bytes written", stats.lastBytes > 0 && stats.totalBytes == stats.lastBytes);
+    TEST_ASSERT("log truncated", stats.logBytesTruncated > 0);
+    TEST_ASSERT("sequence", stats.lastSequence == 3);
+    TEST_ASSERT("timings", stats.lastPause >= 0 && stats.lastPause <= stats.lastDuration);
+
+    /* The snapshot is the table as it was when the checkpoint started */
+    ZdbDatabase* snapshot;
+    TEST_ASSERT("open snapshot", !ZdbEngineOpenDB(dbPath, &snapshot));
+    TEST_ASSERT("snapshot rows", snapshot->tables[0]->rowCount == 2000);
+    char* name;
+    TEST_ASSERT("get name", !ZdbEngineGetValue(snapshot->tables[0], ZdbEngineRowAt(snapshot->tables[0], 0), 1, (void**)&name));
+    TEST_ASSERT("snapshot value", !strcmp(name, "even"));
+    ZdbEngineDropDB(snapshot);
+
+    TEST_ASSERT("detach", !ZdbEngineDetachLog(db));
+
+    /* The log only holds what happened after the checkpoint, so it can't stand on its own any more */
+    ZdbDatabase* recovered;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Checkpointed", &recovered));
+    TEST_ASSERT("log needs its image", ZdbEngineAttachLog(recovered, logPath, NULL) == ZDB_RESULT_INVALID_OPERATION);
+    ZdbEngineDropDB(recovered);
+
+    ZdbLogStats logStats;
+    TEST_ASSERT("open", !ZdbEngineOpenDB(dbPath, &recovered));
+    TEST_ASSERT("recover", !ZdbEngineAttachLog(recovered, logPath, NULL));
+    TEST_ASSERT("log stats", !ZdbEngineGetLogStats(recovered, &logStats));
+    TEST_ASSERT("replayed tail", logStats.replayed == 1001);
+    AssertTablesEqual(t, recovered->tables[0]);
+    ZdbEngineDropDB(recovered);
 
     ZdbEngineDropDB(db);
+    remove(dbPath);
+    remove(logPath);
+
+    TEST_PASS();
+}
+
+void TestDeleteAndCompact(int storage)
+{
+    TEST_START(storage == ZDB_STORAGE_PAX ? "delete and compact (PAX)" : "delete and compact");
+
+    const char* dbPath = "zsql-test-delete.db";
+    const char* logPath = "zsql-test-delete.wal";
+    remove(dbPath);
+    remove(logPath);
+
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Deletes", &db));
+    TEST_ASSERT("attach log", !ZdbEngineAttachLog(db, logPath, NULL));
+
+    ZdbColumn* columns[3];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Bucket", ZdbStandardTypes->intType, 0, &columns[1]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Note", ZdbStandardTypes->varcharType, 0, &columns[2]));
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "Things", 3, columns, storage, &t));
+
+    int i;
+    char bucket[16];
+    char note[64];
+    ZdbRow* r;
+    for (i = 0; i < 1000; i++)
+    {
+        sprintf(bucket, "%d", i % 10);
+        sprintf(note, "thing %d", i);
+        TEST_ASSERT("insert row", !ZdbEngineInsertRow(t, 3, &r));
+        TEST_ASSERT("update row", ZdbEngineUpdateRow(t, r, 3, NULL, bucket, note) == 1);
+    }
+
+    /* A single row, then everything in one bucket, then all of the second chunk */
+    ZdbRow* kept = ZdbEngineRowAt(t, 999);
+    TEST_ASSERT("delete row", ZdbEngineDeleteRow(t, ZdbEngineRowAt(t, 3)) == 1);
+    TEST_ASSERT("delete again", ZdbEngineDeleteRow(t, ZdbEngineRowAt(t, 3)) == 0);
+    TEST_ASSERT("deleted", ZdbEngineIsRowDeleted(t, 3) && !ZdbEngineIsRowDeleted(t, 4));
+    TEST_ASSERT("no update", ZdbEngineUpdateRow(t, ZdbEngineRowAt(t, 3), 3, NULL, "1", "x") == ZDB_RESULT_NOT_FOUND);
+
+    ZdbQuery* q;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_EQ, 1, ZdbStandardTypes->intType, "7"));
+    TEST_ASSERT("delete by condition", ZdbQueryDelete(q) == 100);
+    ZdbQueryFree(q);
+
+    int chunkRows[ZDB_ROW_CHUNKS];
+    for (i = 0; i < ZDB_ROW_CHUNKS; i++)
+    {
+        chunkRows[i] = ZDB_ROW_CHUNKS + i;
+    }
+    TEST_ASSERT("delete chunk", ZdbEngineDeleteRows(t, ZDB_ROW_CHUNKS, chunkRows) == ZDB_ROW_CHUNKS - ZDB_ROW_CHUNKS / 10);
+    TEST_ASSERT("bad index", ZdbEngineDeleteRows(t, 1, (int[]){ 1000 }) == ZDB_RESULT_INVALID_OPERATION);
+
+    int live = 1000 - 1 - 100 - (ZDB_ROW_CHUNKS - ZDB_ROW_CHUNKS / 10);
+    TEST_ASSERT("deleted count", t->deletedCount == 1000 - live);
+    TEST_ASSERT("next live row", ZdbEngineNextLiveRow(t, ZDB_ROW_CHUNKS) == 2 * ZDB_ROW_CHUNKS);
+    TEST_ASSERT("next live row at end", ZdbEngineNextLiveRow(t, 997) == 998 && ZdbEngineNextLiveRow(t, 1000) == 1000);
+
+    /* Scans step over deleted rows, and compaction waits until they are done */
+    ZdbRecordset* rs;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    int count = 0;
+    int lastId = -1;
+    while (ZdbQueryNextResult(rs))
+    {
+        int id, b;
+        TEST_ASSERT("get id", !ZdbQueryGetInt(rs, 0, &id));
+        TEST_ASSERT("get bucket", !ZdbQueryGetInt(rs, 1, &b));
+        TEST_ASSERT("live row", id != 3 && b != 7 && (id < ZDB_ROW_CHUNKS || id >= 2 * ZDB_ROW_CHUNKS));
+        TEST_ASSERT("in order", id > lastId);
+        lastId = id;
+        if (count++ == 0)
+        {
+            TEST_ASSERT("busy while scanning", ZdbEngineCompactTable(t, 1000) == ZDB_RESULT_BUSY);
+        }
+    }
+    TEST_ASSERT("scan count", count == live);
+    TEST_ASSERT("done scanning", t->pinCount == 0);
+
+    /* An unfinished recordset holds the table until its query is freed */
+    ZdbRecordset* unfinished;
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &unfinished));
+    TEST_ASSERT("next", ZdbQueryNextResult(unfinished));
+    TEST_ASSERT("busy", ZdbEngineCompactTable(t, 1000) == ZDB_RESULT_BUSY);
+    ZdbQueryFree(q);
+    TEST_ASSERT("unpinned", t->pinCount == 0);
+
+    /* Saved with tombstones, and half way through a compaction pass */
+    TEST_ASSERT("compact step", ZdbEngineCompactTable(t, 100) == 1000 - live);
+    TEST_ASSERT("save", !ZdbEngineSaveDB(db, dbPath));
+    ZdbDatabase* loaded;
+    TEST_ASSERT("open", !ZdbEngineOpenDB(dbPath, &loaded));
+    AssertTablesEqual(t, loaded->tables[0]);
+    TEST_ASSERT("finish compaction", ZdbEngineCompactTable(loaded->tables[0], 10000) == 0);
+    ZdbEngineDropDB(loaded);
+
+    /* Compact in small steps; the table stays readable in between */
+    int steps = 0;
+    int left;
+    while ((left = ZdbEngineCompactTable(t, 64)) > 0)
+    {
+        steps++;
+        TEST_ASSERT("row count", t->rowCount - t->deletedCount == live);
+    }
+    TEST_ASSERT("compacted", left == 0 && steps > 1 && t->rowCount == live);
+
+    int* id;
+    int* b;
+    lastId = -1;
+    for (i = 0; i < t->rowCount; i++)
+    {
+        TEST_ASSERT("live", !ZdbEngineIsRowDeleted(t, i));
+        TEST_ASSERT("get id", !ZdbEngineGetValue(t, ZdbEngineRowAt(t, i), 0, (void**)&id));
+        TEST_ASSERT("get bucket", !ZdbEngineGetValue(t, ZdbEngineRowAt(t, i), 1, (void**)&b));
+        TEST_ASSERT("order kept", *id > lastId && *b == *id % 10 && *b != 7);
+        lastId = *id;
+    }
+
+    /* Row handles follow their rows */
+    TEST_ASSERT("handle index", kept->index == live - 1);
+    TEST_ASSERT("get id", !ZdbEngineGetValue(t, kept, 0, (void**)&id));
+    TEST_ASSERT("handle value", *id == 999);
+
+    /* Freed slots are reused, but ids are not */
+    ZdbAllocatorStats stats;
+    TEST_ASSERT("allocator stats", !ZdbEngineGetAllocatorStats(t, &stats));
+    TEST_ASSERT("insert row", !ZdbEngineInsertRow(t, 3, &r));
+    TEST_ASSERT("update row", ZdbEngineUpdateRow(t, r, 3, NULL, "1", "new") == 1);
+    TEST_ASSERT("get id", !ZdbEngineGetValue(t, r, 0, (void**)&id));
+    TEST_ASSERT("autoincrement continues", *id == 1000);
+    char* text;
+    TEST_ASSERT("get note", !ZdbEngineGetValue(t, r, 2, (void**)&text));
+    TEST_ASSERT("fresh row", !strcmp(text, "new"));
+    TEST_ASSERT("commit", !ZdbEngineCommit(db));
+
+    /* Deletes and compaction steps replay to the same table */
+    ZdbDatabase* replayed;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Deletes", &replayed));
+    TEST_ASSERT("replay log", !ZdbEngineAttachLog(replayed, "zsql-test-delete.wal", NULL));
+    AssertTablesEqual(t, replayed->tables[0]);
+    ZdbEngineDropDB(replayed);
+
+    /* Deleted rows at the very start of the table are reclaimed too */
+    int leading[10];
+    int before = t->rowCount;
+    for (i = 0; i < 10; i++)
+    {
+        leading[i] = i;
+    }
+    TEST_ASSERT("get id", !ZdbEngineGetValue(t, ZdbEngineRowAt(t, 10), 0, (void**)&id));
+    int firstKept = *id;
+    TEST_ASSERT("allocator stats", !ZdbEngineGetAllocatorStats(t, &stats));
+    size_t usedBefore = stats.bytesUsed;
+    TEST_ASSERT("delete leading rows", ZdbEngineDeleteRows(t, 10, leading) == 10);
+    TEST_ASSERT("compact", ZdbEngineCompactTable(t, 10000) == 0);
+    TEST_ASSERT("leading rows reclaimed", t->rowCount == before - 10 && t->deletedCount == 0);
+    TEST_ASSERT("get id", !ZdbEngineGetValue(t, ZdbEngineRowAt(t, 0), 0, (void**)&id));
+    TEST_ASSERT("first row", *id == firstKept);
+    TEST_ASSERT("allocator stats", !ZdbEngineGetAllocatorStats(t, &stats));
+    TEST_ASSERT("slots freed", stats.bytesUsed < usedBefore);
+
+    ZdbEngineDropDB(db);
+    remove(dbPath);
+    remove(logPath);
+
+    TEST_PASS();
+}
+
+int CountEqualRows(ZdbDatabase* db, ZdbTable* table, int column, ZdbType* type, const char* value, int* firstId)
+{
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, table));
+    TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_EQ, column, type, value));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+
+    int count = 0;
+    int lastId = -1;
+    while (ZdbQueryNextResult(rs))
+    {
+        int id;
+        TEST_ASSERT("get id", !ZdbQueryGetInt(rs, 0, &id));
+        TEST_ASSERT("table order", id > lastId);
+        if (count++ == 0 && firstId != NULL)
+        {
+            *firstId = id;
+        }
+        lastId = id;
+    }
+
+    ZdbQueryFree(q);
+    return count;
+}
+
+void TestHashIndex(int storage)
+{
+    TEST_START(storage == ZDB_STORAGE_PAX ? "hash index (PAX)" : "hash index");
+
+    const char* dbPath = "zsql-test-index.db";
+    const char* logPath = "zsql-test-index.wal";
+    remove(dbPath);
+    remove(logPath);
+
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Indexed", &db));
+    TEST_ASSERT("attach log", !ZdbEngineAttachLog(db, logPath, NULL));
+
+    ZdbColumn* columns[4];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("City", ZdbStandardTypes->varcharType, 0, &columns[1]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Name", ZdbStandardTypes->varcharType, 0, &columns[2]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Score", ZdbStandardTypes->floatType, 0, &columns[3]));
+    TEST_ASSERT("encode", !ZdbEngineSetColumnEncoding(columns[1], ZDB_ENCODING_DICTIONARY));
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "People", 4, columns, storage, &t));
+
+    /* Rows from before the index is built and rows added after it are both found */
+    int i;
+    char name[64];
+    ZdbRow* r;
+    const char* cities[] = { "Oslo", "Lima", "Rome", "Kyiv" };
+    for (i = 0; i < 600; i++)
+    {
+        sprintf(name, "person %d", i);
+        TEST_ASSERT("insert row", !ZdbEngineInsertRow(t, 4, &r));
+        TEST_ASSERT("update row", ZdbEngineUpdateRow(t, r, 4, NULL, cities[i % 4], name, (i % 2) ? "0.0" : "1.5") == 1);
+    }
+
+    TEST_ASSERT("create index", !ZdbEngineCreateIndex(t, 0, ZDB_INDEX_HASH));
+    TEST_ASSERT("create index", !ZdbEngineCreateIndex(t, 1, ZDB_INDEX_HASH));
+    TEST_ASSERT("create index", !ZdbEngineCreateIndex(t, 2, ZDB_INDEX_HASH));
+    TEST_ASSERT("create index", !ZdbEngineCreateIndex(t, 3, ZDB_INDEX_HASH));
+    TEST_ASSERT("index exists", ZdbEngineCreateIndex(t, 0, ZDB_INDEX_HASH) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("bad column", ZdbEngineCreateIndex(t, 4, ZDB_INDEX_HASH) == ZDB_RESULT_INVALID_OPERATION);
+
+    char* names[400];
+    const char* cityValues[400];
+    float scores[400];
+    for (i = 0; i < 400; i++)
+    {
+        names[i] = "bulk";
+        cityValues[i] = cities[i % 4];
+        scores[i] = (i % 2) ? -0.0f : 1.5f;
+    }
+    void* values[4] = { NULL, cityValues, names, scores };
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(t, 400, values) == 400);
+
+    int firstId;
+    TEST_ASSERT("find id", CountEqualRows(db, t, 0, ZdbStandardTypes->intType, "123", &firstId) == 1 && firstId == 123);
+    TEST_ASSERT("find bulk id", CountEqualRows(db, t, 0, ZdbStandardTypes->intType, "999", &firstId) == 1 && firstId == 999);
+    TEST_ASSERT("missing id", CountEqualRows(db, t, 0, ZdbStandardTypes->intType, "1000", NULL) == 0);
+    TEST_ASSERT("find city", CountEqualRows(db, t, 1, ZdbStandardTypes->varcharType, "Rome", &firstId) == 250 && firstId == 2);
+    TEST_ASSERT("find name", CountEqualRows(db, t, 2, ZdbStandardTypes->varcharType, "person 7", &firstId) == 1 && firstId == 7);
+    TEST_ASSERT("find bulk name", CountEqualRows(db, t, 2, ZdbStandardTypes->varcharType, "bulk", NULL) == 400);
+    TEST_ASSERT("zero equals minus zero", CountEqualRows(db, t, 3, ZdbStandardTypes->floatType, "-0.0", NULL) == 500);
+
+    /* Updates move rows between values; an empty new row is indexed under empty values */
+    TEST_ASSERT("update row", ZdbEngineUpdateRow(t, ZdbEngineRowAt(t, 2), 3, NULL, "Oslo", "renamed") == 1);
+    TEST_ASSERT("moved from", CountEqualRows(db, t, 1, ZdbStandardTypes->varcharType, "Rome", &firstId) == 249 && firstId == 6);
+    TEST_ASSERT("moved to", CountEqualRows(db, t, 2, ZdbStandardTypes->varcharType, "renamed", &firstId) == 1 && firstId == 2);
+    TEST_ASSERT("old name", CountEqualRows(db, t, 2, ZdbStandardTypes->varcharType, "person 2", NULL) == 0);
+    TEST_ASSERT("insert row", !ZdbEngineInsertRow(t, 4, &r));
+    TEST_ASSERT("empty row", CountEqualRows(db, t, 2, ZdbStandardTypes->varcharType, "", &firstId) == 1);
+
+    /* Rows changed or deleted while a recordset is part way through are skipped */
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_EQ, 1, ZdbStandardTypes->varcharType, "Lima"));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    TEST_ASSERT("delete row", ZdbEngineDeleteRow(t, ZdbEngineRowAt(t, 1)) == 1);
+    TEST_ASSERT("update row", ZdbEngineUpdateRow(t, ZdbEngineRowAt(t, 5), 2, NULL, "Kyiv") == 1);
+    int id;
+    TEST_ASSERT("next", ZdbQueryNextResult(rs));
+    TEST_ASSERT("skipped", !ZdbQueryGetInt(rs, 0, &id) && id == 9);
+    ZdbQueryFree(q);
+
+    /* Handles survive compaction */
+    int evens[300];
+    for (i = 0; i < 300; i++)
+    {
+        evens[i] = i * 2;
+    }
+    TEST_ASSERT("delete rows", ZdbEngineDeleteRows(t, 300, evens) == 300);
+    TEST_ASSERT("compact", ZdbEngineCompactTable(t, 100000) == 0);
+    TEST_ASSERT("deleted id", CountEqualRows(db, t, 0, ZdbStandardTypes->intType, "122", NULL) == 0);
+    TEST_ASSERT("moved id", CountEqualRows(db, t, 0, ZdbStandardTypes->intType, "123", &firstId) == 1 && firstId == 123);
+    TEST_ASSERT("moved city", CountEqualRows(db, t, 1, ZdbStandardTypes->varcharType, "Lima", NULL) == 248);
+    TEST_ASSERT("commit", !ZdbEngineCommit(db));
+
+    /* Saved files and the log both bring the indexes back */
+    ZdbIndex* index;
+    TEST_ASSERT("save", !ZdbEngineSaveDB(db, dbPath));
+    ZdbDatabase* loaded;
+    TEST_ASSERT("open", !ZdbEngineOpenDB(dbPath, &loaded));
+    /* Opening builds no index; the first query that asks for one builds it, taking in rows added since */
+    TEST_ASSERT("index pending", loaded->tables[0]->indexCount == 4 && loaded->tables[0]->indexes[1]->pending);
+    ZdbRow* added;
+    TEST_ASSERT("insert row", !ZdbEngineInsertRow(loaded->tables[0], 4, &added));
+    TEST_ASSERT("update row", ZdbEngineUpdateRow(loaded->tables[0], added, 4, NULL, "Lima", "added", "2.5") == 1);
+    TEST_ASSERT("index loaded", !ZdbEngineGetIndex(loaded->tables[0], 1, ZDB_INDEX_HASH, &index) && !index->pending);
+    TEST_ASSERT("loaded city", CountEqualRows(loaded, loaded->tables[0], 1, ZdbStandardTypes->varcharType, "Lima", NULL) == 249);
+    TEST_ASSERT("delete row", ZdbEngineDeleteRow(loaded->tables[0], added) == 1);
+    TEST_ASSERT("loaded city", CountEqualRows(loaded, loaded->tables[0], 1, ZdbStandardTypes->varcharType, "Lima", NULL) == 248);
+    ZdbEngineDropDB(loaded);
+
+    ZdbDatabase* replayed;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Indexed", &replayed));
+    TEST_ASSERT("replay log", !ZdbEngineAttachLog(replayed, logPath, NULL));
+    TEST_ASSERT("index replayed", !ZdbEngineGetIndex(replayed->tables[0], 0, ZDB_INDEX_HASH, &index));
+    TEST_ASSERT("replayed id", CountEqualRows(replayed, replayed->tables[0], 0, ZdbStandardTypes->intType, "123", &firstId) == 1 && firstId == 123);
+    ZdbEngineDropDB(replayed);
+
+    /* NaN equals nothing, so rows holding it stay out of the index as they come and go */
+    ZdbDatabase* floats;
+    ZdbTable* ft;
+    ZdbColumn* readingColumns[2];
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Floats", &floats));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &readingColumns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Reading", ZdbStandardTypes->floatType, 0, &readingColumns[1]));
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(floats, "Readings", 2, readingColumns, storage, &ft));
+    float readings[4] = { 0.0f / 0.0f, 1.0f, 0.0f / 0.0f, -0.0f };
+    void* readingValues[2] = { NULL, readings };
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(ft, 4, readingValues) == 4);
+    TEST_ASSERT("float index", !ZdbEngineCreateIndex(ft, 1, ZDB_INDEX_HASH));
+    TEST_ASSERT("nan matches nothing", CountEqualRows(floats, ft, 1, ZdbStandardTypes->floatType, "nan", NULL) == 0);
+    TEST_ASSERT("zero matches -0", CountEqualRows(floats, ft, 1, ZdbStandardTypes->floatType, "0", NULL) == 1);
+    TEST_ASSERT("delete nan", ZdbEngineDeleteRow(ft, ZdbEngineRowAt(ft, 0)) == 1);
+    TEST_ASSERT("update to nan", ZdbEngineUpdateRow(ft, ZdbEngineRowAt(ft, 1), 2, NULL, "nan") == 1);
+    TEST_ASSERT("one gone", CountEqualRows(floats, ft, 1, ZdbStandardTypes->floatType, "1", NULL) == 0);
+    TEST_ASSERT("update from nan", ZdbEngineUpdateRow(ft, ZdbEngineRowAt(ft, 2), 2, NULL, "1") == 1);
+    TEST_ASSERT("one back", CountEqualRows(floats, ft, 1, ZdbStandardTypes->floatType, "1", NULL) == 1);
+    TEST_ASSERT("delete updated", ZdbEngineDeleteRow(ft, ZdbEngineRowAt(ft, 1)) == 1);
+    TEST_ASSERT("nan still nothing", CountEqualRows(floats, ft, 1, ZdbStandardTypes->floatType, "nan", NULL) == 0);
+    ZdbEngineDropDB(floats);
+
+    ZdbEngineDropDB(db);
+    remove(dbPath);
+    remove(logPath);
+
+    TEST_PASS();
+}
+
+int CountRangeRows(ZdbDatabase* db, ZdbTable* table, int column, ZdbQueryConditionType conditionType, ZdbType* type, const char* value)
+{
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, table));
+    TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, conditionType, column, type, value));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+
+    /* Ranges over a B+tree come back in key order */
+    int count = 0;
+    void* last = NULL;
+    while (ZdbQueryNextResult(rs))
+    {
+        void* current;
+        int result = 0;
+        TEST_ASSERT("get value", !ZdbQueryGetValue(rs, column, type, &current));
+        TEST_ASSERT("key order", last == NULL || (!ZdbTypeCompare(type, last, current, &result) && result <= 0));
+        last = current;
+        count++;
+    }
+
+    ZdbQueryFree(q);
+    return count;
+}
+
+/* Counts the rows matching the condition and marks their IDs, which must be below idCount */
+int MarkMatchingIds(ZdbDatabase* db, ZdbTable* table, ZdbQueryConditionType conditionType, int column, ZdbType* type,
+                    const char* value, char* marks, int idCount)
+{
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, table));
+    TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, conditionType, column, type, value));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+
+    int count = 0;
+    memset(marks, 0, idCount);
+    while (ZdbQueryNextResult(rs))
+    {
+        int id;
+        TEST_ASSERT("get id", !ZdbQueryGetInt(rs, 0, &id) && id >= 0 && id < idCount && !marks[id]);
+        marks[id] = 1;
+        count++;
+    }
+
+    ZdbQueryFree(q);
+    return count;
+}
+
+void TestBTreeIndex(int storage)
+{
+    TEST_START(storage == ZDB_STORAGE_PAX ? "B+tree index (PAX)" : "B+tree index");
+
+    const char* dbPath = "zsql-test-btree.db";
+    const char* logPath = "zsql-test-btree.wal";
+    remove(dbPath);
+    remove(logPath);
+
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Ordered", &db));
+    TEST_ASSERT("attach log", !ZdbEngineAttachLog(db, logPath, NULL));
+
+    ZdbColumn* columns[4];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Age", ZdbStandardTypes->intType, 0, &columns[1]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Name", ZdbStandardTypes->varcharType, 0, &columns[2]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Score", ZdbStandardTypes->floatType, 0, &columns[3]));
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "People", 4, columns, storage, &t));
+
+    /* Ages come in no particular order, so building that index sorts; IDs are already in order */
+    int i;
+    char age[16], name[64], score[16];
+    ZdbRow* r;
+    for (i = 0; i < 600; i++)
+    {
+        sprintf(age, "%d", (i * 37) % 100);
+        sprintf(name, "name %03d", i % 500);
+        sprintf(score, "%d", i % 50 - 25);
+        TEST_ASSERT("insert row", !ZdbEngineInsertRow(t, 4, &r));
+        TEST_ASSERT("update row", ZdbEngineUpdateRow(t, r, 4, NULL, age, name, score) == 1);
+    }
+
+    TEST_ASSERT("create index", !ZdbEngineCreateIndex(t, 0, ZDB_INDEX_BTREE));
+    TEST_ASSERT("create index", !ZdbEngineCreateIndex(t, 1, ZDB_INDEX_BTREE));
+    TEST_ASSERT("create index", !ZdbEngineCreateIndex(t, 2, ZDB_INDEX_BTREE));
+    TEST_ASSERT("create index", !ZdbEngineCreateIndex(t, 3, ZDB_INDEX_BTREE));
+    TEST_ASSERT("both kinds", !ZdbEngineCreateIndex(t, 1, ZDB_INDEX_HASH));
+    TEST_ASSERT("index exists", ZdbEngineCreateIndex(t, 1, ZDB_INDEX_BTREE) == ZDB_RESULT_INVALID_OPERATION);
+
+    int ages[400];
+    char* names[400];
+    char nameValues[400][16];
+    float scores[400];
+    for (i = 600; i < 1000; i++)
+    {
+        ages[i - 600] = (i * 37) % 100;
+        sprintf(nameValues[i - 600], "name %03d", i % 500);
+        names[i - 600] = nameValues[i - 600];
+        scores[i - 600] = (float)(i % 50 - 25);
+    }
+    void* values[4] = { NULL, ages, names, scores };
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(t, 400, values) == 400);
+
+    ZdbType* intType = ZdbStandardTypes->intType;
+    ZdbType* varcharType = ZdbStandardTypes->varcharType;
+    ZdbType* floatType = ZdbStandardTypes->floatType;
+    int firstId;
+    TEST_ASSERT("less than", CountRangeRows(db, t, 1, ZDB_QUERY_CONDITION_LT, intType, "10") == 100);
+    TEST_ASSERT("at most", CountRangeRows(db, t, 1, ZDB_QUERY_CONDITION_LTE, intType, "10") == 110);
+    TEST_ASSERT("more than", CountRangeRows(db, t, 1, ZDB_QUERY_CONDITION_GT, intType, "89") == 100);
+    TEST_ASSERT("at least", CountRangeRows(db, t, 1, ZDB_QUERY_CONDITION_GTE, intType, "0") == 1000);
+    TEST_ASSERT("past the end", CountRangeRows(db, t, 1, ZDB_QUERY_CONDITION_GT, intType, "99") == 0);
+    TEST_ASSERT("id range", CountRangeRows(db, t, 0, ZDB_QUERY_CONDITION_GT, intType, "990") == 9);
+    TEST_ASSERT("name range", CountRangeRows(db, t, 2, ZDB_QUERY_CONDITION_LT, varcharType, "name 010") == 20);
+    TEST_ASSERT("score range", CountRangeRows(db, t, 3, ZDB_QUERY_CONDITION_LT, floatType, "0") == 500);
+    TEST_ASSERT("equal", CountEqualRows(db, t, 2, varcharType, "name 042", &firstId) == 2 && firstId == 42);
+
+    /* Updates move entries, and an empty new row is indexed under empty values */
+    TEST_ASSERT("update row", ZdbEngineUpdateRow(t, ZdbEngineRowAt(t, 0), 2, NULL, "200") == 1);
+    TEST_ASSERT("moved up", CountRangeRows(db, t, 1, ZDB_QUERY_CONDITION_GT, intType, "100") == 1);
+    TEST_ASSERT("moved from", CountRangeRows(db, t, 1, ZDB_QUERY_CONDITION_LT, intType, "10") == 99);
+    TEST_ASSERT("insert row", !ZdbEngineInsertRow(t, 4, &r));
+    TEST_ASSERT("empty row", CountRangeRows(db, t, 2, ZDB_QUERY_CONDITION_LT, varcharType, "a") == 1);
+
+    /* Handles survive compaction.  The odd rows are left, along with the empty row's zero ID and age and empty name */
+    int evens[500];
+    for (i = 0; i < 500; i++)
+    {
+        evens[i] = i * 2;
+    }
+    TEST_ASSERT("delete rows", ZdbEngineDeleteRows(t, 500, evens) == 500);
+    TEST_ASSERT("compact", ZdbEngineCompactTable(t, 100000) == 0);
+    TEST_ASSERT("deleted range", CountRangeRows(db, t, 0, ZDB_QUERY_CONDITION_LTE, intType, "10") == 6);
+    TEST_ASSERT("moved range", CountRangeRows(db, t, 1, ZDB_QUERY_CONDITION_LT, intType, "10") == 51);
+    TEST_ASSERT("moved equal", CountEqualRows(db, t, 0, intType, "123", &firstId) == 1 && firstId == 123);
+    TEST_ASSERT("commit", !ZdbEngineCommit(db));
+
+    /* Saved files and the log both bring the indexes back */
+    ZdbIndex* index;
+    TEST_ASSERT("save", !ZdbEngineSaveDB(db, dbPath));
+    ZdbDatabase* loaded;
+    TEST_ASSERT("open", !ZdbEngineOpenDB(dbPath, &loaded));
+    TEST_ASSERT("index loaded", !ZdbEngineGetIndex(loaded->tables[0], 2, ZDB_INDEX_BTREE, &index));
+    TEST_ASSERT("loaded range", CountRangeRows(loaded, loaded->tables[0], 2, ZDB_QUERY_CONDITION_LT, varcharType, "name 010") == 11);
+    ZdbEngineDropDB(loaded);
+
+    ZdbDatabase* replayed;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Ordered", &replayed));
+    TEST_ASSERT("replay log", !ZdbEngineAttachLog(replayed, logPath, NULL));
+    TEST_ASSERT("index replayed", !ZdbEngineGetIndex(replayed->tables[0], 1, ZDB_INDEX_BTREE, &index));
+    TEST_ASSERT("replayed range", CountRangeRows(replayed, replayed->tables[0], 1, ZDB_QUERY_CONDITION_LT, intType, "10") == 51);
+    ZdbEngineDropDB(replayed);
+
+    ZdbEngineDropDB(db);
+    /* Float keys order NaN below every number and -0 with 0, so the tree agrees with a scan of a twin table */
+    ZdbDatabase* floats;
+    ZdbTable* indexed;
+    ZdbTable* twin;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Floats", &floats));
+    for (i = 0; i < 2; i++)
+    {
+        TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+        TEST_ASSERT("create column", !ZdbEngineCreateColumn("Reading", ZdbStandardTypes->floatType, 0, &columns[1]));
+        TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(floats, i ? "Twin" : "Indexed", 2, columns, storage,
+                                                                     i ? &twin : &indexed));
+    }
+
+    int readingCount = 3000;
+    float* readings = malloc(readingCount * sizeof(float));
+    uint32_t seed = 12345;
+    for (i = 0; i < readingCount; i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        int pick = (seed >> 8) % 400;
+        readings[i] = pick < 4 ? 0.0f / 0.0f : pick < 8 ? -0.0f : (pick % 160) * 0.25f - 20.0f;
+    }
+
+    /* Most rows are there when the tree is built, the rest are added to it */
+    void* readingValues[2] = { NULL, readings };
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(indexed, 2000, readingValues) == 2000);
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(twin, 2000, readingValues) == 2000);
+    TEST_ASSERT("float index", !ZdbEngineCreateIndex(indexed, 1, ZDB_INDEX_BTREE));
+    readingValues[1] = readings + 2000;
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(indexed, readingCount - 2000, readingValues) == readingCount - 2000);
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(twin, readingCount - 2000, readingValues) == readingCount - 2000);
+    for (i = 0; i < readingCount; i += 7)
+    {
+        TEST_ASSERT("update row", ZdbEngineUpdateRow(indexed, ZdbEngineRowAt(indexed, i), 2, NULL, i % 2 ? "nan" : "16.75") == 1);
+        TEST_ASSERT("update row", ZdbEngineUpdateRow(twin, ZdbEngineRowAt(twin, i), 2, NULL, i % 2 ? "nan" : "16.75") == 1);
+    }
+
+    const char* bounds[] = { "nan", "0", "-0", "16.75", "-20", "19.75", "3.1", "-100", "100" };
+    ZdbQueryConditionType comparisons[] = { ZDB_QUERY_CONDITION_EQ, ZDB_QUERY_CONDITION_LT, ZDB_QUERY_CONDITION_LTE,
+                                            ZDB_QUERY_CONDITION_GT, ZDB_QUERY_CONDITION_GTE };
+    char* expectedIds = malloc(readingCount);
+    char* foundIds = malloc(readingCount);
+    for (int b = 0; b < 9; b++)
+    {
+        for (int c = 0; c < 5; c++)
+        {
+            int expected = MarkMatchingIds(floats, twin, comparisons[c], 1, ZdbStandardTypes->floatType, bounds[b],
+                                           expectedIds, readingCount);
+            int found = MarkMatchingIds(floats, indexed, comparisons[c], 1, ZdbStandardTypes->floatType, bounds[b],
+                                        foundIds, readingCount);
+            TEST_ASSERT("float count", found == expected);
+            TEST_ASSERT("float rows", !memcmp(foundIds, expectedIds, readingCount));
+        }
+    }
+    TEST_ASSERT("some equal", MarkMatchingIds(floats, indexed, ZDB_QUERY_CONDITION_EQ, 1, ZdbStandardTypes->floatType,
+                                              "16.75", foundIds, readingCount) > readingCount / 14);
+
+    ZdbIndex* floatIndex;
+    int found;
+    ZdbRow** foundRows;
+    float nan = 0.0f / 0.0f;
+    TEST_ASSERT("get index", !ZdbEngineGetIndex(indexed, 1, ZDB_INDEX_BTREE, &floatIndex));
+    TEST_ASSERT("find nan", !ZdbIndexFind(floatIndex, &nan, &found, &foundRows) && found == 0);
+    free(foundRows);
+
+    free(readings);
+    free(expectedIds);
+    free(foundIds);
+    ZdbEngineDropDB(floats);
+
+    remove(dbPath);
+    remove(logPath);
+
+    TEST_PASS();
+}
+
+int CountMatchingRows(ZdbDatabase* db, ZdbTable* table, int column, ZdbQueryConditionType conditionType, ZdbType* type, const char* value)
+{
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, table));
+    TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, conditionType, column, type, value));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+
+    int count = 0;
+    while (ZdbQueryNextResult(rs))
+    {
+        count++;
+    }
+
+    ZdbQueryFree(q);
+    return count;
+}
+
+void TestZoneMaps(int storage)
+{
+    TEST_START(storage == ZDB_STORAGE_PAX ? "zone maps (PAX)" : "zone maps");
+
+    const char* dbPath = "zsql-test-zones.db";
+    remove(dbPath);
+
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Zoned", &db));
+
+    ZdbColumn* columns[3];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Reading", ZdbStandardTypes->floatType, 0, &columns[1]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Name", ZdbStandardTypes->varcharType, 0, &columns[2]));
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "Readings", 3, columns, storage, &t));
+
+    /* IDs climb, so each chunk holds its own narrow range.  Readings cycle through the same range in every chunk */
+    int i;
+    char reading[16];
+    ZdbRow* r;
+    for (i = 0; i < 200; i++)
+    {
+        sprintf(reading, "%d", i % 10);
+        TEST_ASSERT("insert row", !ZdbEngineInsertRow(t, 3, &r));
+        TEST_ASSERT("update row", ZdbEngineUpdateRow(t, r, 3, NULL, reading, "sensor") == 1);
+    }
+
+    float readings[800];
+    char* names[800];
+    for (i = 0; i < 800; i++)
+    {
+        readings[i] = (float)((200 + i) % 10);
+        names[i] = "sensor";
+    }
+    void* values[3] = { NULL, readings, names };
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(t, 800, values) == 800);
+
+    ZdbZone zone;
+    TEST_ASSERT("get zone", !ZdbEngineGetZone(t, 1, 0, &zone));
+    TEST_ASSERT("id zone", zone.min.i == ZDB_ROW_CHUNKS && zone.max.i == 2 * ZDB_ROW_CHUNKS - 1);
+    TEST_ASSERT("get zone", !ZdbEngineGetZone(t, 7, 1, &zone));
+    TEST_ASSERT("reading zone", zone.min.f == 0.0f && zone.max.f == 9.0f);
+    TEST_ASSERT("last chunk", !ZdbEngineGetZone(t, 7, 0, &zone) && zone.max.i == 999);
+    TEST_ASSERT("past the end", ZdbEngineGetZone(t, 8, 0, &zone) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("no zone", ZdbEngineGetZone(t, 0, 2, &zone) == ZDB_RESULT_UNSUPPORTED);
+
+    /* Skipped chunks never hide a match */
+    ZdbType* intType = ZdbStandardTypes->intType;
+    ZdbType* floatType = ZdbStandardTypes->floatType;
+    TEST_ASSERT("recent", CountMatchingRows(db, t, 0, ZDB_QUERY_CONDITION_GTE, intType, "990") == 10);
+    TEST_ASSERT("early", CountMatchingRows(db, t, 0, ZDB_QUERY_CONDITION_LT, intType, "5") == 5);
+    TEST_ASSERT("one", CountMatchingRows(db, t, 0, ZDB_QUERY_CONDITION_EQ, intType, "500") == 1);
+    TEST_ASSERT("none", CountMatchingRows(db, t, 0, ZDB_QUERY_CONDITION_GT, intType, "999") == 0);
+    TEST_ASSERT("reading", CountMatchingRows(db, t, 1, ZDB_QUERY_CONDITION_GT, floatType, "8.5") == 100);
+
+    /* Updates widen the zone; the old value may linger until compaction */
+    TEST_ASSERT("update row", ZdbEngineUpdateRow(t, ZdbEngineRowAt(t, 300), 2, NULL, "-40") == 1);
+    TEST_ASSERT("widened", !ZdbEngineGetZone(t, 2, 1, &zone) && zone.min.f == -40.0f);
+    TEST_ASSERT("updated", CountMatchingRows(db, t, 1, ZDB_QUERY_CONDITION_LT, floatType, "-1") == 1);
+    const char* list[] = { "-40", "20" };
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("add condition", !ZdbQueryAddInCondition(q, 1, floatType, 2, list));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    TEST_ASSERT("in list", ZdbQueryNextResult(rs));
+    TEST_ASSERT("only one", !ZdbQueryNextResult(rs));
+    ZdbQueryFree(q);
+
+    /* Compaction narrows the zones of the chunks it rewrites, and empties the ones it gives back */
+    int deleted[500];
+    for (i = 0; i < 500; i++)
+    {
+        deleted[i] = i;
+    }
+    TEST_ASSERT("delete rows", ZdbEngineDeleteRows(t, 500, deleted) == 500);
+    TEST_ASSERT("still wide", !ZdbEngineGetZone(t, 0, 0, &zone) && zone.min.i == 0);
+    TEST_ASSERT("compact", ZdbEngineCompactTable(t, 100000) == 0);
+    TEST_ASSERT("narrowed", !ZdbEngineGetZone(t, 0, 0, &zone) && zone.min.i == 500 && zone.max.i == 500 + ZDB_ROW_CHUNKS - 1);
+    TEST_ASSERT("narrowed last", !ZdbEngineGetZone(t, 3, 0, &zone) && zone.min.i == 500 + 3 * ZDB_ROW_CHUNKS && zone.max.i == 999);
+    TEST_ASSERT("update gone", !ZdbEngineGetZone(t, 0, 1, &zone) && zone.min.f == 0.0f);
+    TEST_ASSERT("given back", ZdbEngineGetZone(t, 4, 0, &zone) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("recent", CountMatchingRows(db, t, 0, ZDB_QUERY_CONDITION_GTE, intType, "990") == 10);
+    TEST_ASSERT("deleted", CountMatchingRows(db, t, 0, ZDB_QUERY_CONDITION_LT, intType, "500") == 0);
+
+    /* Rows appended after compaction land in the emptied chunks */
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(t, 100, values) == 100);
+    TEST_ASSERT("appended", !ZdbEngineGetZone(t, 3, 0, &zone) && zone.min.i == 500 + 3 * ZDB_ROW_CHUNKS && zone.max.i == 1011);
+    TEST_ASSERT("appended chunk", !ZdbEngineGetZone(t, 4, 0, &zone) && zone.min.i == 1012 && zone.max.i == 1099);
+
+    /* A row inserted empty counts as zero until it is first written */
+    TEST_ASSERT("insert row", !ZdbEngineInsertRow(t, 3, &r));
+    TEST_ASSERT("empty row", !ZdbEngineGetZone(t, 4, 0, &zone) && zone.min.i == 0);
+    TEST_ASSERT("empty id", CountMatchingRows(db, t, 0, ZDB_QUERY_CONDITION_EQ, intType, "0") == 1);
+    TEST_ASSERT("update row", ZdbEngineUpdateRow(t, r, 3, NULL, "1", "sensor") == 1);
+    TEST_ASSERT("written", !ZdbEngineGetZone(t, 4, 0, &zone) && zone.min.i == 1012 && zone.max.i == 1100);
+
+    /* Saved files keep the zones */
+    TEST_ASSERT("save", !ZdbEngineSaveDB(db, dbPath));
+    ZdbDatabase* loaded;
+    TEST_ASSERT("open", !ZdbEngineOpenDB(dbPath, &loaded));
+    TEST_ASSERT("loaded zone", !ZdbEngineGetZone(loaded->tables[0], 1, 0, &zone) &&
+                               zone.min.i == 500 + ZDB_ROW_CHUNKS && zone.max.i == 500 + 2 * ZDB_ROW_CHUNKS - 1);
+    TEST_ASSERT("loaded", CountMatchingRows(loaded, loaded->tables[0], 0, ZDB_QUERY_CONDITION_GTE, intType, "990") == 111);
+    ZdbEngineDropDB(loaded);
+
+    ZdbEngineDropDB(db);
+    remove(dbPath);
+
+    TEST_PASS();
+}
+
+/* Runs the condition through ZdbQueryNextBatch and checks it returns the same rows ZdbQueryNextResult does */
+void CheckBatchesMatchResults(ZdbDatabase* db, ZdbTable* table, int column, ZdbQueryConditionType conditionType, ZdbType* type,
+                              const char* value, int maxRows)
+{
+    int expected[2000];
+    int expectedCount = 0;
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, table));
+    if (conditionType != ZDB_QUERY_CONDITION_NONE)
+    {
+        TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, conditionType, column, type, value));
+    }
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    while (ZdbQueryNextResult(rs))
+    {
+        TEST_ASSERT("get id", !ZdbQueryGetInt(rs, 0, &expected[expectedCount++]));
+    }
+
+    int count = 0;
+    ZdbQueryBatch batch;
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    int n;
+    while ((n = ZdbQueryNextBatch(rs, maxRows, &batch)) > 0)
+    {
+        TEST_ASSERT("batch size", n == batch.count && n <= maxRows);
+        for (int i = 0; i < batch.count; i++)
+        {
+            int* id;
+            TEST_ASSERT("get value", !ZdbEngineGetValue(table, ZdbEngineRowAt(table, batch.rows[i]), 0, (void**)&id));
+            TEST_ASSERT("same row", count < expectedCount && *id == expected[count]);
+            count++;
+        }
+    }
+    TEST_ASSERT("end of batches", n == 0);
+    TEST_ASSERT("same count", count == expectedCount);
+    ZdbQueryFree(q);
+}
+
+void TestQueryBatches(int storage)
+{
+    TEST_START(storage == ZDB_STORAGE_PAX ? "query batches (PAX)" : "query batches");
+
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Batches", &db));
+
+    ZdbColumn* columns[5];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Level", ZdbStandardTypes->intType, 0, &columns[1]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Reading", ZdbStandardTypes->floatType, 0, &columns[2]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Flag", ZdbStandardTypes->booleanType, 0, &columns[3]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("City", ZdbStandardTypes->varcharType, 0, &columns[4]));
+    TEST_ASSERT("encode", !ZdbEngineSetColumnEncoding(columns[4], ZDB_ENCODING_DICTIONARY));
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "Sensors", 5, columns, storage, &t));
+
+    /* An odd row count leaves a partial chunk and a partial kernel step at the end.  Some readings are NaN */
+    int i;
+    int levels[1001];
+    float readings[1001];
+    int flags[1001];
+    const char* cityNames[] = { "Oslo", "Lima", "Rome" };
+    char* cities[1001];
+    for (i = 0; i < 1001; i++)
+    {
+        levels[i] = (i * 7919) % 201 - 100;
+        readings[i] = (i % 97 == 0) ? 0.0f / 0.0f : (float)(i % 13) - 6.5f;
+        flags[i] = i % 3 == 0;
+        cities[i] = (char*)cityNames[i % 3];
+    }
+    void* values[5] = { NULL, levels, readings, flags, cities };
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(t, 1001, values) == 1001);
+
+    int deleted[100];
+    for (i = 0; i < 100; i++)
+    {
+        deleted[i] = i * 10 + 3;
+    }
+    TEST_ASSERT("delete rows", ZdbEngineDeleteRows(t, 100, deleted) == 100);
+
+    int sizes[] = { 1, 7, 64, ZDB_QUERY_BATCH_ROWS };
+    ZdbQueryConditionType comparisons[] = { ZDB_QUERY_CONDITION_EQ, ZDB_QUERY_CONDITION_NE, ZDB_QUERY_CONDITION_LT,
+                                            ZDB_QUERY_CONDITION_LTE, ZDB_QUERY_CONDITION_GT, ZDB_QUERY_CONDITION_GTE };
+    for (int s = 0; s < 4; s++)
+    {
+        CheckBatchesMatchResults(db, t, 0, ZDB_QUERY_CONDITION_NONE, NULL, NULL, sizes[s]);
+        for (int c = 0; c < 6; c++)
+        {
+            CheckBatchesMatchResults(db, t, 1, comparisons[c], ZdbStandardTypes->intType, "0", sizes[s]);
+            CheckBatchesMatchResults(db, t, 2, comparisons[c], ZdbStandardTypes->floatType, "-0.5", sizes[s]);
+            CheckBatchesMatchResults(db, t, 2, comparisons[c], ZdbStandardTypes->floatType, "nan", sizes[s]);
+            CheckBatchesMatchResults(db, t, 3, comparisons[c], ZdbStandardTypes->booleanType, "1", sizes[s]);
+            CheckBatchesMatchResults(db, t, 0, comparisons[c], ZdbStandardTypes->intType, "900", sizes[s]);
+        }
+        CheckBatchesMatchResults(db, t, 4, ZDB_QUERY_CONDITION_EQ, ZdbStandardTypes->varcharType, "Lima", sizes[s]);
+        CheckBatchesMatchResults(db, t, 4, ZDB_QUERY_CONDITION_NE, ZdbStandardTypes->varcharType, "Lima", sizes[s]);
+        CheckBatchesMatchResults(db, t, 4, ZDB_QUERY_CONDITION_EQ, ZdbStandardTypes->varcharType, "Kyiv", sizes[s]);
+        CheckBatchesMatchResults(db, t, 4, ZDB_QUERY_CONDITION_LT, ZdbStandardTypes->varcharType, "Oslo", sizes[s]);
+    }
+
+    /* A table shorter than one mask word leaves the chunk's second word to the scan */
+    ZdbTable* shortTable;
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Level", ZdbStandardTypes->intType, 0, &columns[1]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Reading", ZdbStandardTypes->floatType, 0, &columns[2]));
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "Short", 3, columns, storage, &shortTable));
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(shortTable, 40, values) == 40);
+    for (int c = 0; c < 6; c++)
+    {
+        CheckBatchesMatchResults(db, shortTable, 1, comparisons[c], ZdbStandardTypes->intType, "0", ZDB_QUERY_BATCH_ROWS);
+        CheckBatchesMatchResults(db, shortTable, 2, comparisons[c], ZdbStandardTypes->floatType, "-0.5", ZDB_QUERY_BATCH_ROWS);
+    }
+
+    /* Indexed recordsets hand out their rows in batches too */
+    TEST_ASSERT("create index", !ZdbEngineCreateIndex(t, 1, ZDB_INDEX_HASH));
+    CheckBatchesMatchResults(db, t, 1, ZDB_QUERY_CONDITION_EQ, ZdbStandardTypes->intType, "5", 2);
+
+    /* Batches and single results share a position */
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    ZdbQueryBatch batch;
+    int id;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_GTE, 0, ZdbStandardTypes->intType, "500"));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    TEST_ASSERT("batch", ZdbQueryNextBatch(rs, 5, &batch) == 5);
+    TEST_ASSERT("next", ZdbQueryNextResult(rs) && !ZdbQueryGetInt(rs, 0, &id) && id == 506);
+    TEST_ASSERT("batch", ZdbQueryNextBatch(rs, 8, &batch) == 8);
+    TEST_ASSERT("at last row", !ZdbQueryGetInt(rs, 0, &id) && id == 515);     /* 513 was deleted */
+    TEST_ASSERT("bad size", ZdbQueryNextBatch(rs, 0, &batch) == ZDB_RESULT_INVALID_OPERATION);
+    ZdbQueryFree(q);
+
+    ZdbEngineDropDB(db);
+
+    TEST_PASS();
+}
+
+/* IDs of the rows matching one condition, scanned with the given threads */
+int CollectIds(ZdbDatabase* db, ZdbTable* table, int column, ZdbQueryConditionType conditionType, ZdbType* type,
+               const char* value, int threads, int ordered, int* ids)
+{
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, table));
+    if (conditionType != ZDB_QUERY_CONDITION_NONE)
+    {
+        TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, conditionType, column, type, value));
+    }
+    TEST_ASSERT("set parallel", !ZdbQuerySetParallel(q, threads, ordered));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+
+    int count = 0;
+    while (ZdbQueryNextResult(rs))
+    {
+        TEST_ASSERT("get id", !ZdbQueryGetInt(rs, 0, &ids[count++]));
+    }
+
+    ZdbQueryFree(q);
+    return count;
+}
+
+int CompareInts(const void* a, const void* b)
+{
+    return *(const int*)a - *(const int*)b;
+}
+
+void CheckParallelMatchesSequential(ZdbDatabase* db, ZdbTable* table, int column, ZdbQueryConditionType conditionType,
+                                    ZdbType* type, const char* value)
+{
+    int* expected = malloc(table->rowCount * sizeof(int));
+    int* ids = malloc(table->rowCount * sizeof(int));
+    int expectedCount = CollectIds(db, table, column, conditionType, type, value, 1, 1, expected);
+
+    int threads[] = { 2, 3, 0, 16 };
+    for (int t = 0; t < 4; t++)
+    {
+        int count = CollectIds(db, table, column, conditionType, type, value, threads[t], 1, ids);
+        TEST_ASSERT("ordered count", count == expectedCount);
+        TEST_ASSERT("ordered rows", !memcmp(ids, expected, count * sizeof(int)));
+
+        count = CollectIds(db, table, column, conditionType, type, value, threads[t], 0, ids);
+        TEST_ASSERT("unordered count", count == expectedCount);
+        qsort(ids, count, sizeof(int), CompareInts);
+        TEST_ASSERT("unordered rows", !memcmp(ids, expected, count * sizeof(int)));
+    }
+
+    free(expected);
+    free(ids);
+}
+
+void TestParallelScan(int storage)
+{
+    TEST_START(storage == ZDB_STORAGE_PAX ? "parallel scan (PAX)" : "parallel scan");
+
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Parallel", &db));
+
+    ZdbColumn* columns[4];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Level", ZdbStandardTypes->intType, 0, &columns[1]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Reading", ZdbStandardTypes->floatType, 0, &columns[2]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Name", ZdbStandardTypes->varcharType, 0, &columns[3]));
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "Readings", 4, columns, storage, &t));
+
+    /* Enough rows for several morsels, the last of them partial */
+    int rowCount = ZDB_QUERY_MORSEL_CHUNKS * ZDB_ROW_CHUNKS * 6 + 1001;
+    int* levels = malloc(rowCount * sizeof(int));
+    float* readings = malloc(rowCount * sizeof(float));
+    char** names = malloc(rowCount * sizeof(char*));
+    const char* nameList[] = { "north", "south", "east", "west", "up" };
+    for (int i = 0; i < rowCount; i++)
+    {
+        levels[i] = (i * 7919) % 1000;
+        readings[i] = (i % 101 == 0) ? 0.0f / 0.0f : (float)(i % 17) - 8.0f;
+        names[i] = (char*)nameList[i % 5];
+    }
+    void* values[4] = { NULL, levels, readings, names };
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(t, rowCount, values) == rowCount);
+    free(levels);
+    free(readings);
+    free(names);
+
+    int deleted[1000];
+    for (int i = 0; i < 1000; i++)
+    {
+        deleted[i] = i * 11 + 5;
+    }
+    TEST_ASSERT("delete rows", ZdbEngineDeleteRows(t, 1000, deleted) == 1000);
+
+    CheckParallelMatchesSequential(db, t, 0, ZDB_QUERY_CONDITION_NONE, NULL, NULL);
+    CheckParallelMatchesSequential(db, t, 1, ZDB_QUERY_CONDITION_LT, ZdbStandardTypes->intType, "100");
+    CheckParallelMatchesSequential(db, t, 2, ZDB_QUERY_CONDITION_GTE, ZdbStandardTypes->floatType, "3");
+    CheckParallelMatchesSequential(db, t, 2, ZDB_QUERY_CONDITION_LT, ZdbStandardTypes->floatType, "nan");
+    CheckParallelMatchesSequential(db, t, 3, ZDB_QUERY_CONDITION_EQ, ZdbStandardTypes->varcharType, "east");
+    CheckParallelMatchesSequential(db, t, 0, ZDB_QUERY_CONDITION_GT, ZdbStandardTypes->intType, "40000");
+    CheckParallelMatchesSequential(db, t, 0, ZDB_QUERY_CONDITION_EQ, ZdbStandardTypes->intType, "-1");
+
+    /* Rows found by the scan but deleted before they are read are passed over, in batches as well */
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    ZdbQueryBatch batch;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_LT, 0, ZdbStandardTypes->intType, "100"));
+    TEST_ASSERT("bad threads", ZdbQuerySetParallel(q, -1, 1) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("set parallel", !ZdbQuerySetParallel(q, 4, 1));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    int before = CountMatchingRows(db, t, 0, ZDB_QUERY_CONDITION_LT, ZdbStandardTypes->intType, "100");
+    int victim = 50;
+    TEST_ASSERT("delete after scan", ZdbEngineDeleteRows(t, 1, &victim) == 1);
+    int count = 0;
+    int n;
+    while ((n = ZdbQueryNextBatch(rs, 7, &batch)) > 0)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            TEST_ASSERT("not deleted", batch.rows[i] != victim);
+        }
+        count += n;
+    }
+    TEST_ASSERT("batches", n == 0 && count == before - 1);
+    ZdbQueryFree(q);
+
+    ZdbEngineDropDB(db);
+
+    TEST_PASS();
+}
+
+/* Runs every aggregate over the rows matching the condition and checks them against the rows themselves */
+void CheckAggregates(ZdbDatabase* db, ZdbTable* table, int column, ZdbQueryConditionType conditionType, ZdbType* type,
+                     const char* value, int threads)
+{
+    /* Level, reading and flag, worked out from the rows a plain query returns */
+    double count = 0, sums[3] = { 0, 0, 0 }, mins[3], maxes[3], taken[3] = { 0, 0, 0 };
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, table));
+    if (conditionType != ZDB_QUERY_CONDITION_NONE)
+    {
+        TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, conditionType, column, type, value));
+    }
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    while (ZdbQueryNextResult(rs))
+    {
+        int level, flag;
+        float reading;
+        TEST_ASSERT("get level", !ZdbQueryGetInt(rs, 1, &level));
+        TEST_ASSERT("get reading", !ZdbQueryGetFloat(rs, 2, &reading));
+        TEST_ASSERT("get flag", !ZdbQueryGetBoolean(rs, 3, &flag));
+        double values[3] = { level, reading, flag };
+        for (int i = 0; i < 3; i++)
+        {
+            sums[i] += values[i];
+            if (!isnan(values[i]))
+            {
+                mins[i] = taken[i] == 0 || values[i] < mins[i] ? values[i] : mins[i];
+                maxes[i] = taken[i] == 0 || values[i] > maxes[i] ? values[i] : maxes[i];
+                taken[i]++;
+            }
+        }
+        count++;
+    }
+
+    TEST_ASSERT("set parallel", !ZdbQuerySetParallel(q, threads, 1));
+    TEST_ASSERT("count", !ZdbQueryAddAggregate(q, ZDB_AGG_COUNT, -1));
+    for (int c = 1; c <= 3; c++)
+    {
+        for (int function = ZDB_AGG_SUM; function <= ZDB_AGG_AVG; function++)
+        {
+            TEST_ASSERT("add aggregate", !ZdbQueryAddAggregate(q, function, c));
+        }
+    }
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    TEST_ASSERT("one row", ZdbQueryNextResult(rs));
+
+    double result;
+    TEST_ASSERT("get count", !ZdbQueryGetAggregate(rs, 0, &result) && result == count);
+    for (int c = 0; c < 3; c++)
+    {
+        int first = 1 + c * 4;
+        TEST_ASSERT("get sum", !ZdbQueryGetAggregate(rs, first, &result));
+        TEST_ASSERT("sum", result == sums[c] || (isnan(result) && isnan(sums[c])));
+        if (taken[c] == 0)
+        {
+            TEST_ASSERT("no min", ZdbQueryGetAggregate(rs, first + 1, &result) == ZDB_RESULT_NOT_FOUND);
+            TEST_ASSERT("no max", ZdbQueryGetAggregate(rs, first + 2, &result) == ZDB_RESULT_NOT_FOUND);
+        }
+        else
+        {
+            TEST_ASSERT("min", !ZdbQueryGetAggregate(rs, first + 1, &result) && result == mins[c]);
+            TEST_ASSERT("max", !ZdbQueryGetAggregate(rs, first + 2, &result) && result == maxes[c]);
+        }
+        if (count == 0)
+        {
+            TEST_ASSERT("no average", ZdbQueryGetAggregate(rs, first + 3, &result) == ZDB_RESULT_NOT_FOUND);
+        }
+        else
+        {
+            TEST_ASSERT("get average", !ZdbQueryGetAggregate(rs, first + 3, &result));
+            TEST_ASSERT("average", fabs(result - sums[c] / count) < 1e-9 || (isnan(result) && isnan(sums[c])));
+        }
+    }
+    TEST_ASSERT("no more rows", !ZdbQueryNextResult(rs));
+    ZdbQueryFree(q);
+}
+
+void TestAggregates(int storage)
+{
+    TEST_START(storage == ZDB_STORAGE_PAX ? "aggregates (PAX)" : "aggregates");
+
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Aggregates", &db));
+
+    ZdbColumn* columns[5];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Level", ZdbStandardTypes->intType, 0, &columns[1]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Reading", ZdbStandardTypes->floatType, 0, &columns[2]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Flag", ZdbStandardTypes->booleanType, 0, &columns[3]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Name", ZdbStandardTypes->varcharType, 0, &columns[4]));
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "Readings", 5, columns, storage, &t));
+
+    /* Several morsels, so parallel workers have partial aggregates to merge.  Readings are multiples of a quarter,
+       which keeps every sum exact whatever order it is added up in */
+    int rowCount = ZDB_QUERY_MORSEL_CHUNKS * ZDB_ROW_CHUNKS * 3 + 777;
+    int* levels = malloc(rowCount * sizeof(int));
+    float* readings = malloc(rowCount * sizeof(float));
+    int* flags = malloc(rowCount * sizeof(int));
+    char** names = malloc(rowCount * sizeof(char*));
+    for (int i = 0; i < rowCount; i++)
+    {
+        levels[i] = (i * 7919) % 100001 - 50000;
+        readings[i] = (float)((i * 31) % 4001 - 2000) / 4;
+        flags[i] = i % 3 == 0;
+        names[i] = "sensor";
+    }
+    void* values[5] = { NULL, levels, readings, flags, names };
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(t, rowCount, values) == rowCount);
+    free(levels);
+    free(readings);
+    free(flags);
+    free(names);
+
+    int deleted[500];
+    for (int i = 0; i < 500; i++)
+    {
+        deleted[i] = i * 13 + 1;
+    }
+    TEST_ASSERT("delete rows", ZdbEngineDeleteRows(t, 500, deleted) == 500);
+
+    int threads[] = { 1, 3 };
+    for (int i = 0; i < 2; i++)
+    {
+        CheckAggregates(db, t, 0, ZDB_QUERY_CONDITION_NONE, NULL, NULL, threads[i]);
+        CheckAggregates(db, t, 1, ZDB_QUERY_CONDITION_LT, ZdbStandardTypes->intType, "0", threads[i]);
+        CheckAggregates(db, t, 2, ZDB_QUERY_CONDITION_GTE, ZdbStandardTypes->floatType, "100.5", threads[i]);
+        CheckAggregates(db, t, 0, ZDB_QUERY_CONDITION_GT, ZdbStandardTypes->intType, "20000", threads[i]);
+        CheckAggregates(db, t, 0, ZDB_QUERY_CONDITION_EQ, ZdbStandardTypes->intType, "-1", threads[i]);
+    }
+
+    /* NaN makes a sum NaN but is passed over by min and max */
+    ZdbRow* row;
+    float nan = 0.0f / 0.0f;
+    int level = 5;
+    int flag = 1;
+    void* nanRow[5] = { NULL, &level, &nan, &flag, "odd" };
+    TEST_ASSERT("insert row", !ZdbEngineInsertRow(t, 5, &row));
+    TEST_ASSERT("update row", ZdbEngineUpdateRowValues(t, row, 5, nanRow) == 1);
+    CheckAggregates(db, t, 0, ZDB_QUERY_CONDITION_NONE, NULL, NULL, 1);
+    CheckAggregates(db, t, 0, ZDB_QUERY_CONDITION_NONE, NULL, NULL, 4);
+
+    /* Rows found through an index are aggregated one at a time */
+    TEST_ASSERT("create index", !ZdbEngineCreateIndex(t, 3, ZDB_INDEX_HASH));
+    CheckAggregates(db, t, 3, ZDB_QUERY_CONDITION_EQ, ZdbStandardTypes->booleanType, "1", 1);
+
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    double result;
+    int id;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("sum of varchar", ZdbQueryAddAggregate(q, ZDB_AGG_SUM, 4) == ZDB_RESULT_UNSUPPORTED);
+    TEST_ASSERT("bad function", ZdbQueryAddAggregate(q, 99, 1) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("bad column", ZdbQueryAddAggregate(q, ZDB_AGG_MAX, 9) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("count of varchar", !ZdbQueryAddAggregate(q, ZDB_AGG_COUNT, 4));
+    TEST_ASSERT("no delete", ZdbQueryDelete(q) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    TEST_ASSERT("no values", ZdbQueryGetInt(rs, 0, &id) == ZDB_RESULT_INVALID_OPERATION);
+    ZdbQueryBatch batch;
+    TEST_ASSERT("no batches", ZdbQueryNextBatch(rs, 16, &batch) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("bad aggregate", ZdbQueryGetAggregate(rs, 1, &result) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("count", !ZdbQueryGetAggregate(rs, 0, &result) && result == rowCount - 500 + 1);
+    ZdbQueryFree(q);
+
+    ZdbEngineDropDB(db);
+
+    TEST_PASS();
+}
+
+/* A group's keys as text, read the same way from a table row or a group row */
+typedef struct
+{
+    char key[128];
+    double count;
+    double levels;
+    double minReading;              /* NAN while the group has no reading to compare */
+    double maxId;
+} GroupResult;
+
+int CompareGroupResults(const void* a, const void* b)
+{
+    return strcmp(((const GroupResult*)a)->key, ((const GroupResult*)b)->key);
+}
+
+void FormatGroupKey(ZdbRecordset* rs, ZdbTable* table, int keyCount, const int* keys, char* text)
+{
+    text[0] = '\0';
+    for (int k = 0; k < keyCount; k++)
+    {
+        char value[ZDB_LIMIT_VARCHAR + 1];
+        ZdbType* type = table->columns[keys[k]]->type;
+        int i;
+        float f;
+        char* str;
+        if (type == ZdbStandardTypes->floatType)
+        {
+            TEST_ASSERT("get float key", !ZdbQueryGetFloat(rs, keys[k], &f));
+            sprintf(value, "%g", isnan(f) ? 0.0 / 0.0 : f + 0.0f);
+        }
+        else if (type == ZdbStandardTypes->varcharType)
+        {
+            TEST_ASSERT("get string key", !ZdbQueryGetString(rs, keys[k], &str));
+            sprintf(value, "%s", str);
+        }
+        else
+        {
+            TEST_ASSERT("get int key", !ZdbQueryGetValue(rs, keys[k], type, (void**)&str));
+            memcpy(&i, str, sizeof(int));
+            sprintf(value, "%d", i);
+        }
+        strcat(text, value);
+        strcat(text, "|");
+    }
+}
+
+/* Groups the rows matching the condition by keys, then works out the same groups from the rows themselves */
+void CheckGroups(ZdbDatabase* db, ZdbTable* table, int keyCount, const int* keys, ZdbQueryConditionType conditionType,
+                 int column, ZdbType* type, const char* value, int threads, size_t memory, int direct)
+{
+    GroupResult* expected = malloc((table->rowCount + 1) * sizeof(GroupResult));
+    GroupResult* found = malloc((table->rowCount + 1) * sizeof(GroupResult));
+    int expectedCount = 0, foundCount = 0;
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+
+    /* Each row is a group of one to begin with */
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, table));
+    if (conditionType != ZDB_QUERY_CONDITION_NONE)
+    {
+        TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, conditionType, column, type, value));
+    }
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    while (ZdbQueryNextResult(rs))
+    {
+        GroupResult* g = &expected[expectedCount++];
+        int id, level;
+        float reading;
+        FormatGroupKey(rs, table, keyCount, keys, g->key);
+        TEST_ASSERT("get id", !ZdbQueryGetInt(rs, 0, &id));
+        TEST_ASSERT("get level", !ZdbQueryGetInt(rs, 1, &level));
+        TEST_ASSERT("get reading", !ZdbQueryGetFloat(rs, 2, &reading));
+        g->count = 1;
+        g->levels = level;
+        g->minReading = reading;
+        g->maxId = id;
+    }
+    ZdbQueryFree(q);
+
+    qsort(expected, expectedCount, sizeof(GroupResult), CompareGroupResults);
+    int groupCount = 0;
+    for (int i = 0; i < expectedCount; i++)
+    {
+        GroupResult* g = &expected[groupCount];
+        if (i > 0 && !strcmp(expected[i].key, g->key))
+        {
+            g->count++;
+            g->levels += expected[i].levels;
+            g->minReading = isnan(g->minReading) || expected[i].minReading < g->minReading ? expected[i].minReading : g->minReading;
+            g->maxId = expected[i].maxId > g->maxId ? expected[i].maxId : g->maxId;
+        }
+        else
+        {
+            if (i > 0)
+            {
+                g = &expected[++groupCount];
+            }
+            *g = expected[i];
+        }
+    }
+    groupCount += expectedCount > 0;
+
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, table));
+    if (conditionType != ZDB_QUERY_CONDITION_NONE)
+    {
+        TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, conditionType, column, type, value));
+    }
+    for (int k = 0; k < keyCount; k++)
+    {
+        TEST_ASSERT("add group", !ZdbQueryAddGroup(q, keys[k]));
+    }
+    TEST_ASSERT("count", !ZdbQueryAddAggregate(q, ZDB_AGG_COUNT, -1));
+    TEST_ASSERT("sum", !ZdbQueryAddAggregate(q, ZDB_AGG_SUM, 1));
+    TEST_ASSERT("min", !ZdbQueryAddAggregate(q, ZDB_AGG_MIN, 2));
+    TEST_ASSERT("max", !ZdbQueryAddAggregate(q, ZDB_AGG_MAX, 0));
+    TEST_ASSERT("set parallel", !ZdbQuerySetParallel(q, threads, 1));
+    TEST_ASSERT("set memory", !ZdbQuerySetGroupMemory(q, memory));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    while (ZdbQueryNextResult(rs))
+    {
+        GroupResult* g = &found[foundCount++];
+        TEST_ASSERT("too many groups", foundCount <= groupCount);
+        FormatGroupKey(rs, table, keyCount, keys, g->key);
+        TEST_ASSERT("get count", !ZdbQueryGetAggregate(rs, 0, &g->count));
+        TEST_ASSERT("get sum", !ZdbQueryGetAggregate(rs, 1, &g->levels));
+        int result = ZdbQueryGetAggregate(rs, 2, &g->minReading);
+        TEST_ASSERT("get min", result == ZDB_RESULT_SUCCESS || result == ZDB_RESULT_NOT_FOUND);
+        g->minReading = result == ZDB_RESULT_NOT_FOUND ? 0.0 / 0.0 : g->minReading;
+        TEST_ASSERT("get max", !ZdbQueryGetAggregate(rs, 3, &g->maxId));
+    }
+
+    ZdbGroupStats stats;
+    TEST_ASSERT("get stats", !ZdbQueryGetGroupStats(rs, &stats));
+    TEST_ASSERT("groups counted", stats.groupCount == foundCount);
+    TEST_ASSERT("direct", stats.direct == direct);
+    TEST_ASSERT("memory used", stats.peakBytes > 0);
+    TEST_ASSERT("memory bounded", threads != 1 || stats.peakBytes <= memory);
+    TEST_ASSERT("several passes", memory == ZDB_QUERY_GROUP_MEMORY || foundCount < 1000 || stats.passes > 1);
+    ZdbQueryFree(q);
+
+    TEST_ASSERT("group count", foundCount == groupCount);
+    qsort(found, foundCount, sizeof(GroupResult), CompareGroupResults);
+    for (int i = 0; i < foundCount; i++)
+    {
+        TEST_ASSERT("group keys", !strcmp(found[i].key, expected[i].key));
+        TEST_ASSERT("group count", found[i].count == expected[i].count);
+        TEST_ASSERT("group sum", found[i].levels == expected[i].levels);
+        TEST_ASSERT("group min", found[i].minReading == expected[i].minReading ||
+                                 (isnan(found[i].minReading) && isnan(expected[i].minReading)));
+        TEST_ASSERT("group max", found[i].maxId == expected[i].maxId);
+    }
+
+    free(expected);
+    free(found);
+}
+
+void TestGroupBy(int storage)
+{
+    TEST_START(storage == ZDB_STORAGE_PAX ? "group by (PAX)" : "group by");
+
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Groups", &db));
+
+    ZdbColumn* columns[6];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Level", ZdbStandardTypes->intType, 0, &columns[1]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Reading", ZdbStandardTypes->floatType, 0, &columns[2]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Flag", ZdbStandardTypes->booleanType, 0, &columns[3]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Region", ZdbStandardTypes->varcharType, 0, &columns[4]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Name", ZdbStandardTypes->varcharType, 0, &columns[5]));
+    TEST_ASSERT("encode", !ZdbEngineSetColumnEncoding(columns[4], ZDB_ENCODING_DICTIONARY));
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "Readings", 6, columns, storage, &t));
+
+    int rowCount = ZDB_QUERY_MORSEL_CHUNKS * ZDB_ROW_CHUNKS * 2 + 333;
+    int* levels = malloc(rowCount * sizeof(int));
+    float* readings = malloc(rowCount * sizeof(float));
+    int* flags = malloc(rowCount * sizeof(int));
+    char** regions = malloc(rowCount * sizeof(char*));
+    char** names = malloc(rowCount * sizeof(char*));
+    const char* regionList[] = { "north", "south", "east", "west", "up" };
+    for (int i = 0; i < rowCount; i++)
+    {
+        levels[i] = (i * 7) % 9 - 4;
+        readings[i] = i % 50 == 0 ? 0.0f / 0.0f : i % 37 == 0 ? -0.0f : (float)(i % 23 - 11) / 2;
+        flags[i] = i % 3 == 0;
+        regions[i] = (char*)regionList[(i / 7) % 5];
+        names[i] = "sensor";
+    }
+    void* values[6] = { NULL, levels, readings, flags, regions, names };
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(t, rowCount, values) == rowCount);
+    free(levels);
+    free(readings);
+    free(flags);
+    free(regions);
+    free(names);
+
+    int deleted[400];
+    for (int i = 0; i < 400; i++)
+    {
+        deleted[i] = i * 17 + 3;
+    }
+    TEST_ASSERT("delete rows", ZdbEngineDeleteRows(t, 400, deleted) == 400);
+
+    int flag[] = { 3 };
+    int levelFlag[] = { 1, 3 };
+    int region[] = { 4 };
+    int reading[] = { 2 };
+    int id[] = { 0 };
+    int mixed[] = { 4, 2, 1 };
+    int threads[] = { 1, 3 };
+    for (int i = 0; i < 2; i++)
+    {
+        /* Booleans, small int ranges and dictionary codes go straight to their groups */
+        CheckGroups(db, t, 1, flag, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL, threads[i], ZDB_QUERY_GROUP_MEMORY, 1);
+        CheckGroups(db, t, 2, levelFlag, ZDB_QUERY_CONDITION_GTE, 2, ZdbStandardTypes->floatType, "0", threads[i], ZDB_QUERY_GROUP_MEMORY, 1);
+        CheckGroups(db, t, 1, region, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL, threads[i], ZDB_QUERY_GROUP_MEMORY, 1);
+
+        /* Floats are hashed, with -0 grouped along with 0 and NaN with NaN */
+        CheckGroups(db, t, 1, reading, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL, threads[i], ZDB_QUERY_GROUP_MEMORY, 0);
+        CheckGroups(db, t, 3, mixed, ZDB_QUERY_CONDITION_LT, 1, ZdbStandardTypes->intType, "2", threads[i], ZDB_QUERY_GROUP_MEMORY, 0);
+
+        /* Too many groups for the memory, so they are found a partition at a time */
+        CheckGroups(db, t, 1, id, ZDB_QUERY_CONDITION_GT, 0, ZdbStandardTypes->intType, "1000", threads[i], ZDB_QUERY_GROUP_MEMORY_MIN, 0);
+        CheckGroups(db, t, 1, id, ZDB_QUERY_CONDITION_EQ, 0, ZdbStandardTypes->intType, "-1", threads[i], ZDB_QUERY_GROUP_MEMORY_MIN, 0);
+
+        /* With the memory to spare, even the IDs' range is small enough to go straight to */
+        CheckGroups(db, t, 1, id, ZDB_QUERY_CONDITION_LTE, 0, ZdbStandardTypes->intType, "3000", threads[i], ZDB_QUERY_GROUP_MEMORY, 1);
+    }
+
+    /* Rows found through an index are grouped one at a time */
+    TEST_ASSERT("create index", !ZdbEngineCreateIndex(t, 3, ZDB_INDEX_HASH));
+    CheckGroups(db, t, 1, region, ZDB_QUERY_CONDITION_EQ, 3, ZdbStandardTypes->booleanType, "1", 1, ZDB_QUERY_GROUP_MEMORY, 1);
+    CheckGroups(db, t, 1, id, ZDB_QUERY_CONDITION_EQ, 3, ZdbStandardTypes->booleanType, "1", 1, ZDB_QUERY_GROUP_MEMORY_MIN, 0);
+
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    ZdbQueryBatch batch;
+    ZdbGroupStats stats;
+    double result;
+    int value;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("plain varchar", ZdbQueryAddGroup(q, 5) == ZDB_RESULT_UNSUPPORTED);
+    TEST_ASSERT("bad column", ZdbQueryAddGroup(q, 6) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("too little memory", ZdbQuerySetGroupMemory(q, 1000) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    TEST_ASSERT("not grouped", ZdbQueryGetGroupStats(rs, &stats) == ZDB_RESULT_INVALID_OPERATION);
+    for (int i = 0; i < ZDB_QUERY_GROUP_COLUMNS; i++)
+    {
+        TEST_ASSERT("add group", !ZdbQueryAddGroup(q, 3));
+    }
+    TEST_ASSERT("too many groups", ZdbQueryAddGroup(q, 1) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("no delete", ZdbQueryDelete(q) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    TEST_ASSERT("no group yet", ZdbQueryGetBoolean(rs, 3, &value) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("no batches", ZdbQueryNextBatch(rs, 16, &batch) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("first group", ZdbQueryNextResult(rs));
+    TEST_ASSERT("key", !ZdbQueryGetBoolean(rs, 3, &value) && value == 0);
+    TEST_ASSERT("not a key", ZdbQueryGetInt(rs, 1, &value) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("wrong type", ZdbQueryGetInt(rs, 3, &value) == ZDB_RESULT_INVALID_CAST);
+    TEST_ASSERT("no aggregates", ZdbQueryGetAggregate(rs, 0, &result) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("second group", ZdbQueryNextResult(rs));
+    TEST_ASSERT("key", !ZdbQueryGetBoolean(rs, 3, &value) && value == 1);
+    TEST_ASSERT("no more groups", !ZdbQueryNextResult(rs) && !ZdbQueryNextResult(rs));
+    ZdbQueryFree(q);
+
+    ZdbEngineDropDB(db);
+
+    TEST_PASS();
+}
+
+typedef struct
+{
+    int ids[2];
+} JoinedIds;
+
+int CompareJoinedIds(const void* a, const void* b)
+{
+    const JoinedIds* x = a;
+    const JoinedIds* y = b;
+    return x->ids[0] != y->ids[0] ? x->ids[0] - y->ids[0] : x->ids[1] - y->ids[1];
+}
+
+/* Fills ids and values with the ID and column value of each row of the table matching the condition */
+int CollectJoinRows(ZdbDatabase* db, ZdbTable* table, int column, ZdbQueryConditionType conditionType, int conditionColumn,
+                    ZdbType* type, const char* value, int* ids, void** values)
+{
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, table));
+    if (conditionType != ZDB_QUERY_CONDITION_NONE)
+    {
+        TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, conditionType, conditionColumn, type, value));
+    }
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    int count = 0;
+    while (ZdbQueryNextResult(rs))
+    {
+        TEST_ASSERT("get id", !ZdbQueryGetInt(rs, 0, &ids[count]));
+        TEST_ASSERT("get value", !ZdbQueryGetValue(rs, column, table->columns[column]->type, &values[count]));
+        count++;
+    }
+    ZdbQueryFree(q);
+    return count;
+}
+
+/* Joins the tables and checks the pairs against nested loops over the rows of each.  The first table's rows are
+   filtered by the condition */
+void CheckJoin(ZdbDatabase* db, ZdbTable* first, ZdbTable* second, int column, int otherColumn,
+               ZdbQueryConditionType conditionType, int conditionColumn, ZdbType* type, const char* value)
+{
+    int* firstIds = malloc(first->rowCount * sizeof(int));
+    int* secondIds = malloc(second->rowCount * sizeof(int));
+    void** firstValues = malloc(first->rowCount * sizeof(void*));
+    void** secondValues = malloc(second->rowCount * sizeof(void*));
+    int firstCount = CollectJoinRows(db, first, column, conditionType, conditionColumn, type, value, firstIds, firstValues);
+    int secondCount = CollectJoinRows(db, second, otherColumn, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL, secondIds, secondValues);
+
+    ZdbType* joinType = first->columns[column]->type;
+    int capacity = 1024, expectedCount = 0;
+    JoinedIds* expected = malloc(capacity * sizeof(JoinedIds));
+    for (int i = 0; i < firstCount; i++)
+    {
+        for (int j = 0; j < secondCount; j++)
+        {
+            int equal;
+            if (joinType == ZdbStandardTypes->floatType)
+                equal = *(float*)firstValues[i] == *(float*)secondValues[j];
+            else if (joinType == ZdbStandardTypes->varcharType)
+                equal = !strcmp(firstValues[i], secondValues[j]);
+            else
+                equal = *(int*)firstValues[i] == *(int*)secondValues[j];
+            if (equal)
+            {
+                if (expectedCount == capacity)
+                {
+                    capacity *= 2;
+                    expected = realloc(expected, capacity * sizeof(JoinedIds));
+                }
+                expected[expectedCount].ids[0] = firstIds[i];
+                expected[expectedCount].ids[1] = secondIds[j];
+                expectedCount++;
+            }
+        }
+    }
+
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, first));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, second));
+    TEST_ASSERT("add join", !ZdbQueryAddJoin(q, column, otherColumn));
+    if (conditionType != ZDB_QUERY_CONDITION_NONE)
+    {
+        TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, conditionType, conditionColumn, type, value));
+    }
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+
+    JoinedIds* found = malloc((expectedCount + 1) * sizeof(JoinedIds));
+    int foundCount = 0;
+    while (ZdbQueryNextResult(rs))
+    {
+        TEST_ASSERT("too many rows", foundCount < expectedCount);
+        TEST_ASSERT("first id", !ZdbQueryGetInt(rs, 0, &found[foundCount].ids[0]));
+        TEST_ASSERT("second id", !ZdbQueryGetInt(rs, first->columnCount, &found[foundCount].ids[1]));
+
+        /* The joined values really are equal */
+        void* value1;
+        void* value2;
+        TEST_ASSERT("first value", !ZdbQueryGetValue(rs, column, joinType, &value1));
+        TEST_ASSERT("second value", !ZdbQueryGetValue(rs, first->columnCount + otherColumn, joinType, &value2));
+        TEST_ASSERT("values equal", joinType == ZdbStandardTypes->varcharType ? !strcmp(value1, value2) :
+                                    !memcmp(value1, value2, sizeof(int)) || *(float*)value1 == *(float*)value2);
+        foundCount++;
+    }
+    TEST_ASSERT("no more rows", !ZdbQueryNextResult(rs));
+    ZdbQueryFree(q);
+
+    TEST_ASSERT("row count", foundCount == expectedCount);
+    qsort(expected, expectedCount, sizeof(JoinedIds), CompareJoinedIds);
+    qsort(found, foundCount, sizeof(JoinedIds), CompareJoinedIds);
+    TEST_ASSERT("rows", !memcmp(found, expected, foundCount * sizeof(JoinedIds)));
+
+    free(firstIds);
+    free(secondIds);
+    free(firstValues);
+    free(secondValues);
+    free(expected);
+    free(found);
+}
+
+void TestJoin(int storage)
+{
+    TEST_START(storage == ZDB_STORAGE_PAX ? "join (PAX)" : "join");
+
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Joins", &db));
+
+    ZdbColumn* columns[4];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Name", ZdbStandardTypes->varcharType, 0, &columns[1]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Region", ZdbStandardTypes->varcharType, 0, &columns[2]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Rating", ZdbStandardTypes->floatType, 0, &columns[3]));
+    TEST_ASSERT("encode", !ZdbEngineSetColumnEncoding(columns[2], ZDB_ENCODING_DICTIONARY));
+    ZdbTable* customers;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "Customers", 4, columns, storage, &customers));
+
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Customer", ZdbStandardTypes->intType, 0, &columns[1]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Region", ZdbStandardTypes->varcharType, 0, &columns[2]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Score", ZdbStandardTypes->floatType, 0, &columns[3]));
+    ZdbTable* orders;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "Orders", 4, columns, storage, &orders));
+
+    const char* regionList[] = { "north", "south", "east", "west", "up" };
+    int customerCount = 300;
+    char** names = malloc(customerCount * sizeof(char*));
+    char** regions = malloc(customerCount * sizeof(char*));
+    float* ratings = malloc(customerCount * sizeof(float));
+    for (int i = 0; i < customerCount; i++)
+    {
+        names[i] = "customer";
+        regions[i] = (char*)regionList[i % 4];
+        ratings[i] = i % 41 == 0 ? 0.0f / 0.0f : i % 13 == 0 ? -0.0f : (float)(i % 10);
+    }
+    void* customerValues[4] = { NULL, names, regions, ratings };
+    TEST_ASSERT("insert customers", ZdbEngineInsertRows(customers, customerCount, customerValues) == customerCount);
+    free(names);
+    free(regions);
+    free(ratings);
+
+    /* Some orders are for customers that don't exist */
+    int orderCount = ZDB_ROW_CHUNKS * 40 + 17;
+    int* customerIds = malloc(orderCount * sizeof(int));
+    char** orderRegions = malloc(orderCount * sizeof(char*));
+    float* scores = malloc(orderCount * sizeof(float));
+    for (int i = 0; i < orderCount; i++)
+    {
+        customerIds[i] = (i * 7919) % 350 + 1;
+        orderRegions[i] = (char*)regionList[(i / 3) % 5];
+        scores[i] = i % 97 == 0 ? 0.0f / 0.0f : i % 31 == 0 ? 0.0f : (float)(i % 1000);
+    }
+    void* orderValues[4] = { NULL, customerIds, orderRegions, scores };
+    TEST_ASSERT("insert orders", ZdbEngineInsertRows(orders, orderCount, orderValues) == orderCount);
+    free(customerIds);
+    free(orderRegions);
+    free(scores);
+
+    int deleted[100];
+    for (int i = 0; i < 100; i++)
+    {
+        deleted[i] = i * 43 + 2;
+    }
+    TEST_ASSERT("delete orders", ZdbEngineDeleteRows(orders, 100, deleted) == 100);
+    for (int i = 0; i < 20; i++)
+    {
+        deleted[i] = i * 11 + 5;
+    }
+    TEST_ASSERT("delete customers", ZdbEngineDeleteRows(customers, 20, deleted) == 20);
+
+    /* Either table can come first, and either can be the one filtered */
+    CheckJoin(db, orders, customers, 1, 0, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL);
+    CheckJoin(db, customers, orders, 0, 1, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL);
+    CheckJoin(db, orders, customers, 1, 0, ZDB_QUERY_CONDITION_GT, 3, ZdbStandardTypes->floatType, "500");
+    CheckJoin(db, customers, orders, 0, 1, ZDB_QUERY_CONDITION_GTE, 3, ZdbStandardTypes->floatType, "7");
+    CheckJoin(db, customers, orders, 0, 1, ZDB_QUERY_CONDITION_EQ, 0, ZdbStandardTypes->intType, "-1");
+
+    /* Floats join as they compare, so -0 meets 0 and NaN meets nothing.  Dictionary encoded strings meet plain ones */
+    CheckJoin(db, customers, orders, 3, 3, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL);
+    CheckJoin(db, customers, orders, 2, 2, ZDB_QUERY_CONDITION_LT, 0, ZdbStandardTypes->intType, "12");
+
+    /* Rows deleted part way through are passed over */
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    ZdbQueryBatch batch;
+    int id, before = 0, after = 0;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("no join yet", ZdbQueryAddJoin(q, 0, 0) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, orders));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, customers));
+    TEST_ASSERT("third table", ZdbQueryAddTable(q, orders) == ZDB_RESULT_UNSUPPORTED);
+    TEST_ASSERT("needs a join", ZdbQueryExecute(q, &rs) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("bad column", ZdbQueryAddJoin(q, 1, 4) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("mismatched types", ZdbQueryAddJoin(q, 1, 1) == ZDB_RESULT_INVALID_CAST);
+    TEST_ASSERT("add join", !ZdbQueryAddJoin(q, 1, 0));
+    TEST_ASSERT("one join", ZdbQueryAddJoin(q, 0, 0) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("no delete", ZdbQueryDelete(q) == ZDB_RESULT_UNSUPPORTED);
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    TEST_ASSERT("no batches", ZdbQueryNextBatch(rs, 16, &batch) == ZDB_RESULT_UNSUPPORTED);
+    TEST_ASSERT("bad column", ZdbQueryGetInt(rs, 8, &id) == ZDB_RESULT_INVALID_OPERATION);
+    int victim = 4;
+    int* victimId;
+    TEST_ASSERT("get victim", !ZdbEngineGetValue(customers, ZdbEngineRowAt(customers, victim), 0, (void**)&victimId));
+    TEST_ASSERT("delete customer", ZdbEngineDeleteRows(customers, 1, &victim) == 1);
+    while (ZdbQueryNextResult(rs))
+    {
+        TEST_ASSERT("get id", !ZdbQueryGetInt(rs, 4, &id));
+        TEST_ASSERT("deleted customer", id != *victimId);
+        after++;
+    }
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    while (ZdbQueryNextResult(rs))
+    {
+        before++;
+    }
+    TEST_ASSERT("same rows", before == after);
+    TEST_ASSERT("busy while joining", !ZdbQueryExecute(q, &rs) && ZdbEngineCompactTable(customers, 1000) == ZDB_RESULT_BUSY);
+    TEST_ASSERT("add aggregate", !ZdbQueryAddAggregate(q, ZDB_AGG_COUNT, -1));
+    TEST_ASSERT("no aggregates", ZdbQueryExecute(q, &rs) == ZDB_RESULT_UNSUPPORTED);
+    ZdbQueryFree(q);
+    TEST_ASSERT("compact", ZdbEngineCompactTable(customers, 1000) >= 0);
+
+    ZdbEngineDropDB(db);
+
+    TEST_PASS();
+}
+
+/* What CompareOrderedRows sorts by, since qsort can't pass it along */
+struct
+{
+    ZdbTable* table;
+    int count;
+    const int* columns;
+    const int* descending;
+} expectedOrder;
+
+/* Sorts row positions the way an ordered query should return them */
+int CompareOrderedRows(const void* a, const void* b)
+{
+    int row1 = *(const int*)a;
+    int row2 = *(const int*)b;
+    ZdbTable* table = expectedOrder.table;
+    for (int i = 0; i < expectedOrder.count; i++)
+    {
+        int column = expectedOrder.columns[i];
+        ZdbType* type = table->columns[column]->type;
+        void* value1;
+        void* value2;
+        ZdbEngineGetValue(table, ZdbEngineRowAt(table, row1), column, &value1);
+        ZdbEngineGetValue(table, ZdbEngineRowAt(table, row2), column, &value2);
+
+        int result;
+        if (type == ZdbStandardTypes->floatType)
+        {
+            float f1 = *(float*)value1, f2 = *(float*)value2;
+            result = isnan(f1) ? -!isnan(f2) : isnan(f2) ? 1 : (f1 > f2) - (f1 < f2);
+        }
+        else if (type == ZdbStandardTypes->varcharType)
+            result = strcmp(value1, value2);
+        else
+            result = (*(int*)value1 > *(int*)value2) - (*(int*)value1 < *(int*)value2);
+
+        if (result != 0)
+        {
+            return expectedOrder.descending[i] ? -result : result;
+        }
+    }
+    return (row1 > row2) - (row1 < row2);
+}
+
+/* Checks an ordered query's rows, read in batches of maxRows or one at a time when it's 0, against sorting the
+   unordered query's rows by hand */
+void CheckOrder(ZdbDatabase* db, ZdbTable* table, int count, const int* columns, const int* descending,
+                ZdbQueryConditionType conditionType, int column, ZdbType* type, const char* value,
+                int limit, int threads, size_t memory, int maxRows, ZdbSortStats* stats)
+{
+    int* expected = malloc((table->rowCount + 1) * sizeof(int));
+    int expectedCount = 0;
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    ZdbQueryBatch batch;
+
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, table));
+    if (conditionType != ZDB_QUERY_CONDITION_NONE)
+    {
+        TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, conditionType, column, type, value));
+    }
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    int batchCount;
+    while ((batchCount = ZdbQueryNextBatch(rs, ZDB_QUERY_BATCH_ROWS, &batch)) > 0)
+    {
+        memcpy(expected + expectedCount, batch.rows, batchCount * sizeof(int));
+        expectedCount += batchCount;
+    }
+    ZdbQueryFree(q);
+
+    expectedOrder.table = table;
+    expectedOrder.count = count;
+    expectedOrder.columns = columns;
+    expectedOrder.descending = descending;
+    qsort(expected, expectedCount, sizeof(int), CompareOrderedRows);
+    if (limit != ZDB_QUERY_NO_LIMIT && limit < expectedCount)
+    {
+        expectedCount = limit;
+    }
+
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, table));
+    if (conditionType != ZDB_QUERY_CONDITION_NONE)
+    {
+        TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, conditionType, column, type, value));
+    }
+    for (int i = 0; i < count; i++)
+    {
+        TEST_ASSERT("add order", !ZdbQueryAddOrder(q, columns[i], descending[i]));
+    }
+    TEST_ASSERT("set limit", !ZdbQuerySetLimit(q, limit));
+    TEST_ASSERT("set parallel", !ZdbQuerySetParallel(q, threads, 0));
+    TEST_ASSERT("set sort memory", !ZdbQuerySetSortMemory(q, memory));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+
+    int foundCount = 0;
+    if (maxRows > 0)
+    {
+        while ((batchCount = ZdbQueryNextBatch(rs, maxRows, &batch)) > 0)
+        {
+            TEST_ASSERT("too many rows", foundCount + batchCount <= expectedCount);
+            TEST_ASSERT("rows in order", !memcmp(batch.rows, expected + foundCount, batchCount * sizeof(int)));
+            foundCount += batchCount;
+        }
+    }
+    else
+    {
+        while (ZdbQueryNextResult(rs))
+        {
+            int id, *expectedId;
+            TEST_ASSERT("too many rows", foundCount < expectedCount);
+            TEST_ASSERT("get id", !ZdbQueryGetInt(rs, 0, &id));
+            TEST_ASSERT("get expected id", !ZdbEngineGetValue(table, ZdbEngineRowAt(table, expected[foundCount]), 0, (void**)&expectedId));
+            TEST_ASSERT("row in order", id == *expectedId);
+            foundCount++;
+        }
+    }
+    TEST_ASSERT("no more rows", !ZdbQueryNextResult(rs));
+    TEST_ASSERT("row count", foundCount == expectedCount);
+    TEST_ASSERT("sort stats", !ZdbQueryGetSortStats(rs, stats));
+    ZdbQueryFree(q);
+    free(expected);
+}
+
+void TestOrderBy(int storage)
+{
+    TEST_START(storage == ZDB_STORAGE_PAX ? "order by (PAX)" : "order by");
+
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Orders", &db));
+
+    ZdbColumn* columns[6];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Level", ZdbStandardTypes->intType, 0, &columns[1]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Reading", ZdbStandardTypes->floatType, 0, &columns[2]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Flag", ZdbStandardTypes->booleanType, 0, &columns[3]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Region", ZdbStandardTypes->varcharType, 0, &columns[4]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Name", ZdbStandardTypes->varcharType, 0, &columns[5]));
+    TEST_ASSERT("encode", !ZdbEngineSetColumnEncoding(columns[4], ZDB_ENCODING_DICTIONARY));
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "Readings", 6, columns, storage, &t));
+
+    /* Names share their first eight characters or more, so the sort has to look past its keys */
+    int rowCount = ZDB_QUERY_MORSEL_CHUNKS * ZDB_ROW_CHUNKS * 2 + 333;
+    int* levels = malloc(rowCount * sizeof(int));
+    float* readings = malloc(rowCount * sizeof(float));
+    int* flags = malloc(rowCount * sizeof(int));
+    char** regions = malloc(rowCount * sizeof(char*));
+    char** names = malloc(rowCount * sizeof(char*));
+    char (*nameBuffer)[32] = malloc(rowCount * sizeof(*nameBuffer));
+    const char* regionList[] = { "north", "south", "east", "west", "" };
+    for (int i = 0; i < rowCount; i++)
+    {
+        levels[i] = (i * 7919) % 1001 - 500;
+        readings[i] = i % 50 == 0 ? 0.0f / 0.0f : i % 37 == 0 ? -0.0f : (float)((i * 31) % 2000 - 1000) / 8;
+        flags[i] = i % 3 == 0;
+        regions[i] = (char*)regionList[(i / 7) % 5];
+        snprintf(nameBuffer[i], sizeof(*nameBuffer), i % 4 == 0 ? "sensor" : "sensor-%d", (i * 13) % 700);
+        names[i] = nameBuffer[i];
+    }
+    void* values[6] = { NULL, levels, readings, flags, regions, names };
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(t, rowCount, values) == rowCount);
+    free(levels);
+    free(readings);
+    free(flags);
+    free(regions);
+    free(names);
+    free(nameBuffer);
+
+    int deleted[400];
+    for (int i = 0; i < 400; i++)
+    {
+        deleted[i] = i * 17 + 3;
+    }
+    TEST_ASSERT("delete rows", ZdbEngineDeleteRows(t, 400, deleted) == 400);
+
+    int level[] = { 1 };
+    int reading[] = { 2 };
+    int flagReading[] = { 3, 2 };
+    int nameId[] = { 5, 0 };
+    int regionNameLevel[] = { 4, 5, 1 };
+    int up[] = { 0, 0, 0 };
+    int down[] = { 1, 1, 1 };
+    int mixed[] = { 0, 1, 0 };
+    ZdbSortStats stats;
+    int threads[] = { 1, 3 };
+    for (int i = 0; i < 2; i++)
+    {
+        /* Ties keep table order, NaN comes first and -0 ties with 0 */
+        CheckOrder(db, t, 1, level, up, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL,
+                   ZDB_QUERY_NO_LIMIT, threads[i], ZDB_QUERY_SORT_MEMORY, 0, &stats);
+        TEST_ASSERT("sorted in memory", !stats.topN && stats.runs == 0);
+        CheckOrder(db, t, 1, reading, down, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL,
+                   ZDB_QUERY_NO_LIMIT, threads[i], ZDB_QUERY_SORT_MEMORY, 100, &stats);
+        CheckOrder(db, t, 2, flagReading, mixed, ZDB_QUERY_CONDITION_GT, 1, ZdbStandardTypes->intType, "100",
+                   ZDB_QUERY_NO_LIMIT, threads[i], ZDB_QUERY_SORT_MEMORY, 0, &stats);
+        CheckOrder(db, t, 2, nameId, mixed, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL,
+                   ZDB_QUERY_NO_LIMIT, threads[i], ZDB_QUERY_SORT_MEMORY, ZDB_QUERY_BATCH_ROWS, &stats);
+        CheckOrder(db, t, 3, regionNameLevel, down, ZDB_QUERY_CONDITION_LT, 2, ZdbStandardTypes->floatType, "10",
+                   ZDB_QUERY_NO_LIMIT, threads[i], ZDB_QUERY_SORT_MEMORY, 0, &stats);
+
+        /* Limits that fit the sort memory keep a heap of the best rows */
+        CheckOrder(db, t, 1, reading, down, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL,
+                   25, threads[i], ZDB_QUERY_SORT_MEMORY, 0, &stats);
+        TEST_ASSERT("top n", stats.topN && stats.runs == 0);
+        CheckOrder(db, t, 2, nameId, up, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL,
+                   1000, threads[i], ZDB_QUERY_SORT_MEMORY, 64, &stats);
+        CheckOrder(db, t, 1, level, up, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL,
+                   0, threads[i], ZDB_QUERY_SORT_MEMORY, 0, &stats);
+        CheckOrder(db, t, 1, level, down, ZDB_QUERY_CONDITION_EQ, 3, ZdbStandardTypes->booleanType, "1",
+                   rowCount, threads[i], ZDB_QUERY_SORT_MEMORY, 0, &stats);
+
+        /* Past the sort memory, runs spill and are merged back, more than once if there are too many */
+        CheckOrder(db, t, 2, flagReading, up, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL,
+                   ZDB_QUERY_NO_LIMIT, threads[i], ZDB_QUERY_SORT_MEMORY_MIN, 0, &stats);
+        TEST_ASSERT("spilled", !stats.topN && stats.runs > 7 && stats.mergePasses == 1);
+        CheckOrder(db, t, 2, nameId, down, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL,
+                   ZDB_QUERY_NO_LIMIT, threads[i], ZDB_QUERY_SORT_MEMORY_MIN * 2, 500, &stats);
+        TEST_ASSERT("spilled", stats.runs > 1 && stats.mergePasses == 0);
+        CheckOrder(db, t, 1, level, up, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL,
+                   5000, threads[i], ZDB_QUERY_SORT_MEMORY_MIN, 0, &stats);
+        TEST_ASSERT("limit past the memory", !stats.topN && stats.runs > 1);
+    }
+
+    /* Ranges through an index come in key order, which the sort mustn't take for table order */
+    TEST_ASSERT("create index", !ZdbEngineCreateIndex(t, 1, ZDB_INDEX_BTREE));
+    CheckOrder(db, t, 1, flagReading, up, ZDB_QUERY_CONDITION_GTE, 1, ZdbStandardTypes->intType, "250",
+               ZDB_QUERY_NO_LIMIT, 1, ZDB_QUERY_SORT_MEMORY, 0, &stats);
+    CheckOrder(db, t, 1, nameId, up, ZDB_QUERY_CONDITION_LT, 1, ZdbStandardTypes->intType, "0",
+               10, 1, ZDB_QUERY_SORT_MEMORY, 0, &stats);
+
+    /* Rows deleted after the sort are passed over, whether or not it spilled */
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    size_t memories[] = { ZDB_QUERY_SORT_MEMORY, ZDB_QUERY_SORT_MEMORY_MIN };
+    for (int i = 0; i < 2; i++)
+    {
+        TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+        TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+        TEST_ASSERT("add order", !ZdbQueryAddOrder(q, 1, 1));
+        TEST_ASSERT("set sort memory", !ZdbQuerySetSortMemory(q, memories[i]));
+        TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+        int victim = 1000 + i;
+        int* victimId;
+        TEST_ASSERT("get victim", !ZdbEngineGetValue(t, ZdbEngineRowAt(t, victim), 0, (void**)&victimId));
+        int id, lastLevel = 500, level, count = 0;
+        int victimValue = *victimId;
+        TEST_ASSERT("delete row", ZdbEngineDeleteRows(t, 1, &victim) == 1);
+        while (ZdbQueryNextResult(rs))
+        {
+            TEST_ASSERT("get id", !ZdbQueryGetInt(rs, 0, &id));
+            TEST_ASSERT("get level", !ZdbQueryGetInt(rs, 1, &level));
+            TEST_ASSERT("deleted row", id != victimValue);
+            TEST_ASSERT("descending", level <= lastLevel);
+            lastLevel = level;
+            count++;
+        }
+        TEST_ASSERT("row count", count == rowCount - 401 - i);
+        ZdbQueryFree(q);
+    }
+
+    /* A sort that can't write its runs fails rather than dropping rows.  Files can't grow while the limit is 0, and
+       nothing may be printed until it is lifted */
+    int liveRows = rowCount - 402;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("add order", !ZdbQueryAddOrder(q, 1, 0));
+    TEST_ASSERT("set sort memory", !ZdbQuerySetSortMemory(q, ZDB_QUERY_SORT_MEMORY_MIN));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    struct rlimit fileLimit, noFiles;
+    fflush(stdout);
+    TEST_ASSERT("get file limit", !getrlimit(RLIMIT_FSIZE, &fileLimit));
+    noFiles = fileLimit;
+    noFiles.rlim_cur = 0;
+    void (*handler)(int) = signal(SIGXFSZ, SIG_IGN);
+    TEST_ASSERT("limit files", !setrlimit(RLIMIT_FSIZE, &noFiles));
+    ZdbRecordset* failed;
+    int executeResult = ZdbQueryExecute(q, &failed);
+    int reexecuteResult = ZdbQueryReexecute(rs);
+    TEST_ASSERT("lift limit", !setrlimit(RLIMIT_FSIZE, &fileLimit));
+    signal(SIGXFSZ, handler);
+    TEST_ASSERT("execute fails", executeResult == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("reexecute fails", reexecuteResult == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("no rows", !ZdbQueryNextResult(rs));
+    TEST_ASSERT("reexecute", !ZdbQueryReexecute(rs));
+    int count = 0;
+    while (ZdbQueryNextResult(rs))
+    {
+        count++;
+    }
+    TEST_ASSERT("every row", count == liveRows);
+    TEST_ASSERT("sort stats", !ZdbQueryGetSortStats(rs, &stats));
+    TEST_ASSERT("spilled", stats.runs > 1 && !stats.failed);
+    ZdbQueryFree(q);
+
+    /* Limits work without an order too, a row or a batch at a time */
+    ZdbQueryBatch batch;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("bad column", ZdbQueryAddOrder(q, 0, 0) == ZDB_RESULT_INVALID_NULL);
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("bad column", ZdbQueryAddOrder(q, 6, 0) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("bad limit", ZdbQuerySetLimit(q, -2) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("bad sort memory", ZdbQuerySetSortMemory(q, ZDB_QUERY_SORT_MEMORY_MIN - 1) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("set limit", !ZdbQuerySetLimit(q, 300));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    TEST_ASSERT("no sort stats", ZdbQueryGetSortStats(rs, &stats) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("first batch", ZdbQueryNextBatch(rs, 200, &batch) == 200);
+    TEST_ASSERT("one row", ZdbQueryNextResult(rs));
+    TEST_ASSERT("last batch", ZdbQueryNextBatch(rs, 200, &batch) == 99);
+    TEST_ASSERT("no more rows", ZdbQueryNextBatch(rs, 200, &batch) == 0 && !ZdbQueryNextResult(rs));
+    TEST_ASSERT("compact", ZdbEngineCompactTable(t, 1000) >= 0);
+
+    for (int i = 0; i < ZDB_QUERY_ORDER_COLUMNS; i++)
+    {
+        TEST_ASSERT("add order", !ZdbQueryAddOrder(q, i, 0));
+    }
+    TEST_ASSERT("too many orders", ZdbQueryAddOrder(q, 0, 0) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("add aggregate", !ZdbQueryAddAggregate(q, ZDB_AGG_COUNT, -1));
+    TEST_ASSERT("no aggregates", ZdbQueryExecute(q, &rs) == ZDB_RESULT_UNSUPPORTED);
+    ZdbQueryFree(q);
+
+    ZdbEngineDropDB(db);
+
+    TEST_PASS();
+}
+
+/* Reads one page of IDs, starting after the token if there is one, and returns how many there were.  The next
+   page's token is copied into token, or it's emptied once there are no rows left */
+int ReadPage(ZdbDatabase* db, ZdbTable* table, int count, const int* columns, const int* descending,
+             ZdbQueryConditionType conditionType, int column, ZdbType* type, const char* value,
+             int limit, int offset, int threads, int useBatches, char* token, int* ids)
+{
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    ZdbQueryBatch batch;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, table));
+    if (conditionType != ZDB_QUERY_CONDITION_NONE)
+    {
+        TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, conditionType, column, type, value));
+    }
+    for (int i = 0; i < count; i++)
+    {
+        TEST_ASSERT("add order", !ZdbQueryAddOrder(q, columns[i], descending[i]));
+    }
+    TEST_ASSERT("set limit", !ZdbQuerySetLimit(q, limit));
+    TEST_ASSERT("set offset", !ZdbQuerySetOffset(q, offset));
+    TEST_ASSERT("set cursor", !ZdbQuerySetCursor(q, token[0] != '\0' ? token : NULL));
+    TEST_ASSERT("set parallel", !ZdbQuerySetParallel(q, threads, 0));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+
+    int found = 0;
+    const char* next;
+    TEST_ASSERT("no cursor yet", ZdbQueryGetCursor(rs, &next) == ZDB_RESULT_NOT_FOUND);
+    if (useBatches)
+    {
+        int batchCount;
+        while ((batchCount = ZdbQueryNextBatch(rs, 7, &batch)) > 0)
+        {
+            for (int i = 0; i < batchCount; i++)
+            {
+                int* id;
+                TEST_ASSERT("get id", !ZdbEngineGetValue(table, ZdbEngineRowAt(table, batch.rows[i]), 0, (void**)&id));
+                ids[found++] = *id;
+            }
+        }
+    }
+    else
+    {
+        while (ZdbQueryNextResult(rs))
+        {
+            TEST_ASSERT("get id", !ZdbQueryGetInt(rs, 0, &ids[found++]));
+        }
+    }
+    TEST_ASSERT("page size", limit == ZDB_QUERY_NO_LIMIT || found <= limit);
+
+    int result = ZdbQueryGetCursor(rs, &next);
+    TEST_ASSERT("cursor", found > 0 ? result == ZDB_RESULT_SUCCESS : result == ZDB_RESULT_NOT_FOUND);
+    strcpy(token, found > 0 ? next : "");
+    ZdbQueryFree(q);
+    return found;
+}
+
+/* Pages through the query by cursor and by offset, checking both against reading it in one go */
+void CheckPages(ZdbDatabase* db, ZdbTable* table, int count, const int* columns, const int* descending,
+                ZdbQueryConditionType conditionType, int column, ZdbType* type, const char* value,
+                int pageSize, int threads, int useBatches)
+{
+    int* expected = malloc((table->rowCount + 1) * sizeof(int));
+    int* found = malloc((table->rowCount + pageSize) * sizeof(int));
+    char token[256] = "";
+    int expectedCount = ReadPage(db, table, count, columns, descending, conditionType, column, type, value,
+                                 ZDB_QUERY_NO_LIMIT, 0, 1, 0, token, expected);
+    if (count == 0)
+    {
+        /* Pages of unordered rows are in table order */
+        qsort(expected, expectedCount, sizeof(int), CompareInts);
+    }
+
+    int foundCount = 0, pageCount = 0;
+    token[0] = '\0';
+    do
+    {
+        pageCount = ReadPage(db, table, count, columns, descending, conditionType, column, type, value,
+                             pageSize, 0, threads, useBatches, token, found + foundCount);
+        foundCount += pageCount;
+        TEST_ASSERT("too many rows", foundCount <= expectedCount);
+    } while (pageCount == pageSize);
+    TEST_ASSERT("row count", foundCount == expectedCount);
+    TEST_ASSERT("pages by cursor", !memcmp(found, expected, foundCount * sizeof(int)));
+
+    foundCount = 0;
+    do
+    {
+        token[0] = '\0';
+        pageCount = ReadPage(db, table, count, columns, descending, conditionType, column, type, value,
+                             pageSize, foundCount, threads, useBatches, token, found + foundCount);
+        foundCount += pageCount;
+    } while (pageCount == pageSize);
+    TEST_ASSERT("row count", foundCount == expectedCount);
+    TEST_ASSERT("pages by offset", !memcmp(found, expected, foundCount * sizeof(int)));
+
+    free(expected);
+    free(found);
+}
+
+void TestPaging(int storage)
+{
+    TEST_START(storage == ZDB_STORAGE_PAX ? "paging (PAX)" : "paging");
+
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Pages", &db));
+
+    ZdbColumn* columns[4];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Level", ZdbStandardTypes->intType, 0, &columns[1]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Reading", ZdbStandardTypes->floatType, 0, &columns[2]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Name", ZdbStandardTypes->varcharType, 0, &columns[3]));
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "Readings", 4, columns, storage, &t));
+
+    int rowCount = ZDB_QUERY_MORSEL_CHUNKS * ZDB_ROW_CHUNKS * 2 + 333;
+    int* levels = malloc(rowCount * sizeof(int));
+    float* readings = malloc(rowCount * sizeof(float));
+    char** names = malloc(rowCount * sizeof(char*));
+    char (*nameBuffer)[32] = malloc(rowCount * sizeof(*nameBuffer));
+    for (int i = 0; i < rowCount; i++)
+    {
+        levels[i] = (i * 7919) % 201 - 100;
+        readings[i] = i % 50 == 0 ? 0.0f / 0.0f : (float)((i * 31) % 2000 - 1000) / 8;
+        snprintf(nameBuffer[i], sizeof(*nameBuffer), "sensor-%d", (i * 13) % 700);
+        names[i] = nameBuffer[i];
+    }
+    void* values[4] = { NULL, levels, readings, names };
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(t, rowCount, values) == rowCount);
+    free(levels);
+    free(readings);
+    free(names);
+    free(nameBuffer);
+
+    int deleted[400];
+    for (int i = 0; i < 400; i++)
+    {
+        deleted[i] = i * 17 + 3;
+    }
+    TEST_ASSERT("delete rows", ZdbEngineDeleteRows(t, 400, deleted) == 400);
+
+    int level[] = { 1 };
+    int readingName[] = { 2, 3 };
+    int name[] = { 3 };
+    int up[] = { 0, 0 };
+    int down[] = { 1, 1 };
+    int threads[] = { 1, 3 };
+    for (int i = 0; i < 2; i++)
+    {
+        /* Ties on the order values go by position, so pages neither repeat nor drop rows */
+        CheckPages(db, t, 0, NULL, NULL, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL, 2500, threads[i], 0);
+        CheckPages(db, t, 0, NULL, NULL, ZDB_QUERY_CONDITION_LT, 1, ZdbStandardTypes->intType, "-90", 97, threads[i], 1);
+        CheckPages(db, t, 1, level, down, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL, 1500, threads[i], 1);
+        CheckPages(db, t, 2, readingName, up, ZDB_QUERY_CONDITION_GT, 1, ZdbStandardTypes->intType, "50", 400, threads[i], 0);
+        CheckPages(db, t, 1, name, up, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL, 3000, threads[i], 0);
+    }
+
+    /* Ranges through an index come in table order once they're paged */
+    TEST_ASSERT("create index", !ZdbEngineCreateIndex(t, 1, ZDB_INDEX_BTREE));
+    CheckPages(db, t, 0, NULL, NULL, ZDB_QUERY_CONDITION_GTE, 1, ZdbStandardTypes->intType, "75", 211, 1, 0);
+    CheckPages(db, t, 1, name, down, ZDB_QUERY_CONDITION_LTE, 1, ZdbStandardTypes->intType, "-75", 211, 1, 1);
+
+    /* A row deleted between pages is simply left out */
+    int ids[500], orderedIds[500], more[500];
+    char token[256] = "", orderedToken[256] = "";
+    TEST_ASSERT("first page", ReadPage(db, t, 0, NULL, NULL, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL,
+                                       500, 0, 1, 0, token, ids) == 500);
+    TEST_ASSERT("ordered page", ReadPage(db, t, 1, level, up, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL,
+                                         500, 0, 1, 0, orderedToken, orderedIds) == 500);
+    int victim = 702;
+    int* victimId;
+    TEST_ASSERT("get victim", !ZdbEngineGetValue(t, ZdbEngineRowAt(t, victim), 0, (void**)&victimId));
+    int victimValue = *victimId;
+    TEST_ASSERT("delete row", ZdbEngineDeleteRows(t, 1, &victim) == 1);
+    TEST_ASSERT("next page", ReadPage(db, t, 0, NULL, NULL, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL,
+                                      500, 0, 1, 0, token, more) == 500);
+    TEST_ASSERT("pages follow on", more[0] > ids[499]);
+    for (int i = 0; i < 500; i++)
+    {
+        TEST_ASSERT("deleted row", more[i] != victimValue);
+    }
+
+    /* Ordered pages carry on past a deleted row as well */
+    TEST_ASSERT("ordered page", ReadPage(db, t, 1, level, up, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL,
+                                         500, 0, 1, 0, orderedToken, more) == 500);
+    for (int i = 0; i < 500; i++)
+    {
+        for (int j = 0; j < 500; j++)
+        {
+            TEST_ASSERT("no repeats", more[i] != orderedIds[j]);
+        }
+    }
+
+    /* Compaction moves rows, which leaves tokens stale, ordered or not: ties go by position */
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    const char* next;
+    TEST_ASSERT("compact", ZdbEngineCompactTable(t, rowCount) >= 0);
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("set cursor", !ZdbQuerySetCursor(q, token));
+    TEST_ASSERT("stale cursor", ZdbQueryExecute(q, &rs) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("wrong order", !ZdbQueryAddOrder(q, 2, 0) && ZdbQueryExecute(q, &rs) == ZDB_RESULT_INVALID_OPERATION);
+    ZdbQueryFree(q);
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("add order", !ZdbQueryAddOrder(q, 1, 0));
+    TEST_ASSERT("set cursor", !ZdbQuerySetCursor(q, orderedToken));
+    TEST_ASSERT("stale ordered cursor", ZdbQueryExecute(q, &rs) == ZDB_RESULT_INVALID_OPERATION);
+    ZdbQueryFree(q);
+
+    /* Rows tied on their order values and moved down by compaction could land at or before a token's position, so
+       it is turned down rather than let them be skipped; pages read afresh take in every row */
+    ZdbTable* ties;
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Age", ZdbStandardTypes->intType, 0, &columns[1]));
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "Ties", 2, columns, storage, &ties));
+    int ages[40];
+    for (int i = 0; i < 40; i++)
+    {
+        ages[i] = 30 + i % 4;
+    }
+    void* tieValues[2] = { NULL, ages };
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(ties, 40, tieValues) == 40);
+    char tieToken[256] = "";
+    TEST_ASSERT("tied page", ReadPage(db, ties, 1, level, up, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL,
+                                      5, 0, 1, 0, tieToken, ids) == 5);
+    int front[] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+    TEST_ASSERT("delete rows", ZdbEngineDeleteRows(ties, 8, front) == 8);
+    TEST_ASSERT("compact", ZdbEngineCompactTable(ties, 40) >= 0);
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, ties));
+    TEST_ASSERT("add order", !ZdbQueryAddOrder(q, 1, 0));
+    TEST_ASSERT("set limit", !ZdbQuerySetLimit(q, 5));
+    TEST_ASSERT("set cursor", !ZdbQuerySetCursor(q, tieToken));
+    TEST_ASSERT("stale tied cursor", ZdbQueryExecute(q, &rs) == ZDB_RESULT_INVALID_OPERATION);
+    ZdbQueryFree(q);
+    CheckPages(db, ties, 1, level, up, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL, 5, 1, 0);
+
+    /* The file keeps the table's compactions, so the token is still stale after a reopen, and one taken since is not */
+    char freshToken[256] = "";
+    TEST_ASSERT("fresh page", ReadPage(db, ties, 1, level, up, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL,
+                                       5, 0, 1, 0, freshToken, ids) == 5);
+    const char* path = "zsql-pages.db";
+    ZdbDatabase* loaded;
+    TEST_ASSERT("save", !ZdbEngineSaveDB(db, path));
+    TEST_ASSERT("open", !ZdbEngineOpenDB(path, &loaded));
+    ZdbTable* loadedTies = loaded->tables[1];
+    TEST_ASSERT("compactions kept", loadedTies->compactions == ties->compactions && ties->compactions > 0);
+    TEST_ASSERT("create query", !ZdbQueryCreate(loaded, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, loadedTies));
+    TEST_ASSERT("add order", !ZdbQueryAddOrder(q, 1, 0));
+    TEST_ASSERT("set cursor", !ZdbQuerySetCursor(q, tieToken));
+    TEST_ASSERT("stale after reopen", ZdbQueryExecute(q, &rs) == ZDB_RESULT_INVALID_OPERATION);
+    ZdbQueryFree(q);
+    TEST_ASSERT("page after reopen", ReadPage(loaded, loadedTies, 1, level, up, ZDB_QUERY_CONDITION_NONE, 0, NULL, NULL,
+                                              5, 0, 1, 0, freshToken, ids) == 5);
+    ZdbEngineDropDB(loaded);
+    remove(path);
+
+    /* Bad tokens and settings are turned down */
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("odd length", ZdbQuerySetCursor(q, "abc") == ZDB_RESULT_VALUE_ERROR);
+    TEST_ASSERT("not hex", ZdbQuerySetCursor(q, "zz") == ZDB_RESULT_VALUE_ERROR);
+    TEST_ASSERT("bad offset", ZdbQuerySetOffset(q, -1) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("truncated", !ZdbQuerySetCursor(q, "0100") && ZdbQueryExecute(q, &rs) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("negative row", !ZdbQuerySetCursor(q, "01000000000000000080") && ZdbQueryExecute(q, &rs) == ZDB_RESULT_VALUE_ERROR);
+    TEST_ASSERT("set cursor", !ZdbQuerySetCursor(q, token));
+    TEST_ASSERT("add aggregate", !ZdbQueryAddAggregate(q, ZDB_AGG_COUNT, -1));
+    TEST_ASSERT("no aggregates", ZdbQueryExecute(q, &rs) == ZDB_RESULT_UNSUPPORTED);
+    ZdbQueryFree(q);
+
+    /* A limit stops parallel scans early, and still returns the first rows in table order */
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("set parallel", !ZdbQuerySetParallel(q, 3, 0));
+    TEST_ASSERT("set limit", !ZdbQuerySetLimit(q, 10));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    for (int i = 0, row = -1; i < 10; i++)
+    {
+        int id, *expectedId;
+        row = ZdbEngineNextLiveRow(t, row + 1);
+        TEST_ASSERT("next row", ZdbQueryNextResult(rs));
+        TEST_ASSERT("get id", !ZdbQueryGetInt(rs, 0, &id));
+        TEST_ASSERT("expected id", !ZdbEngineGetValue(t, ZdbEngineRowAt(t, row), 0, (void**)&expectedId));
+        TEST_ASSERT("table order", id == *expectedId);
+    }
+    TEST_ASSERT("no more rows", !ZdbQueryNextResult(rs));
+    TEST_ASSERT("cursor", !ZdbQueryGetCursor(rs, &next));
+    ZdbQueryFree(q);
+
+    ZdbEngineDropDB(db);
+
+    TEST_PASS();
+}
+
+/* Prepares and runs a statement that doesn't return rows */
+int RunSql(ZdbSqlCache* cache, const char* sql)
+{
+    ZdbSqlStatement* statement;
+    int result = ZdbSqlPrepare(cache, sql, &statement);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        return result;
+    }
+
+    result = ZdbSqlExecute(statement, NULL, NULL);
+    ZdbSqlRelease(statement);
+    return result;
+}
+
+/* Runs a SELECT and returns how many rows it found, adding up an int column of them */
+int CountSql(ZdbSqlCache* cache, const char* sql, int column, int* sum)
+{
+    ZdbSqlStatement* statement;
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    TEST_ASSERT("prepare select", !ZdbSqlPrepare(cache, sql, &statement));
+    TEST_ASSERT("select", ZdbSqlGetStatementType(statement) == ZDB_SQL_SELECT);
+    TEST_ASSERT("execute select", !ZdbSqlExecute(statement, &q, &rs));
+    ZdbSqlRelease(statement);
+
+    int count = 0;
+    *sum = 0;
+    while (ZdbQueryNextResult(rs))
+    {
+        int value;
+        TEST_ASSERT("get int", !ZdbQueryGetInt(rs, column, &value));
+        *sum += value;
+        count++;
+    }
+    ZdbQueryFree(q);
+
+    return count;
+}
+
+void TestSql()
+{
+    TEST_START("SQL");
+
+    ZdbDatabase* db;
+    ZdbSqlCache* cache;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Sql", &db));
+    TEST_ASSERT("create cache", !ZdbSqlCreateCache(db, 8, &cache));
+
+    TEST_ASSERT("create table", !RunSql(cache, "CREATE TABLE People (ID int AUTOINCREMENT, Name varchar(40), "
+                                               "Age integer, Salary real, Active boolean);"));
+    TEST_ASSERT("table made", db->tableCount == 1 && db->tables[0]->columnCount == 5);
+    ZdbTable* t = db->tables[0];
+    TEST_ASSERT("autoincrement", t->columns[0]->autoincrement && t->columns[3]->type == ZdbStandardTypes->floatType);
+    TEST_ASSERT("create twice", RunSql(cache, "create table PEOPLE (A int)") == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("unknown type", RunSql(cache, "CREATE TABLE X (A blob)") == ZDB_RESULT_NOT_FOUND);
+    TEST_ASSERT("same column", RunSql(cache, "CREATE TABLE X (A int, a float)") == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("long varchar", RunSql(cache, "CREATE TABLE X (A varchar(300))") == ZDB_RESULT_VALUE_ERROR);
+
+    TEST_ASSERT("insert", RunSql(cache, "INSERT INTO people (name, age, salary, active) "
+                                        "VALUES ('O''Brien', 41, 52000.5, TRUE)") == 1);
+    TEST_ASSERT("insert all", RunSql(cache, "INSERT INTO People VALUES ('Ann', 29, -61000, false)") == 1);
+    TEST_ASSERT("insert some", RunSql(cache, "INSERT INTO \"People\" (Name) VALUES ('Temp')") == 1);
+    for (int i = 0; i < 100; i++)
+    {
+        char sql[128];
+        snprintf(sql, sizeof(sql), "INSERT INTO People (Name, Age) VALUES ('p%d', %d)", i, i);
+        TEST_ASSERT("insert many", RunSql(cache, sql) == 1);
+    }
+    TEST_ASSERT("rows", t->rowCount == 103);
+
+    TEST_ASSERT("autoincrement value", RunSql(cache, "INSERT INTO People (ID) VALUES (5)") == ZDB_RESULT_VALUE_ERROR);
+    TEST_ASSERT("string for int", RunSql(cache, "INSERT INTO People (Age) VALUES ('x')") == ZDB_RESULT_INVALID_CAST);
+    TEST_ASSERT("float for int", RunSql(cache, "INSERT INTO People (Age) VALUES (1.5)") == ZDB_RESULT_INVALID_CAST);
+    TEST_ASSERT("int overflow", RunSql(cache, "INSERT INTO People (Age) VALUES (99999999999)") == ZDB_RESULT_VALUE_ERROR);
+    TEST_ASSERT("too many values", RunSql(cache, "INSERT INTO People (Age) VALUES (1, 2)") == ZDB_RESULT_VALUE_ERROR);
+    TEST_ASSERT("unknown table", RunSql(cache, "SELECT * FROM Nobody") == ZDB_RESULT_NOT_FOUND);
+    TEST_ASSERT("unknown column", RunSql(cache, "SELECT Nope FROM People") == ZDB_RESULT_NOT_FOUND);
+    TEST_ASSERT("misspelt", RunSql(cache, "SELEC * FROM People") == ZDB_RESULT_VALUE_ERROR);
+    TEST_ASSERT("unclosed", RunSql(cache, "SELECT * FROM People WHERE Name = 'open") == ZDB_RESULT_VALUE_ERROR);
+    TEST_ASSERT("left over", RunSql(cache, "SELECT * FROM People People") == ZDB_RESULT_VALUE_ERROR);
+    TEST_ASSERT("and", RunSql(cache, "SELECT * FROM People WHERE Age > 1 AND Age < 5") == ZDB_RESULT_UNSUPPORTED);
+    TEST_ASSERT("rows unchanged", t->rowCount == 103);
+
+    ZdbSqlStatement* statement;
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    TEST_ASSERT("prepare", !ZdbSqlPrepare(cache, "select NAME, age from PEOPLE where Name = 'O''Brien'", &statement));
+    TEST_ASSERT("rows need a recordset", ZdbSqlExecute(statement, NULL, NULL) == ZDB_RESULT_INVALID_NULL);
+    TEST_ASSERT("execute", !ZdbSqlExecute(statement, &q, &rs));
+    ZdbQueryBatch batch;
+    TEST_ASSERT("batch", ZdbQueryNextBatch(rs, ZDB_QUERY_BATCH_ROWS, &batch) == 1);
+    TEST_ASSERT("projected", batch.columnCount == 2 &&
+                             !strcmp(((const ZdbString*)batch.columns[0])[0].chars, "O'Brien") &&
+                             ((int*)batch.columns[1])[0] == 41);
+    ZdbQueryFree(q);
+    TEST_ASSERT("execute again", !ZdbSqlExecute(statement, &q, &rs));
+    int id;
+    float salary;
+    TEST_ASSERT("next", ZdbQueryNextResult(rs));
+    TEST_ASSERT("table columns", !ZdbQueryGetInt(rs, 0, &id) && id == 0 && !ZdbQueryGetFloat(rs, 3, &salary) &&
+                                 salary == 52000.5f);
+    TEST_ASSERT("one row", !ZdbQueryNextResult(rs));
+    ZdbQueryFree(q);
+    ZdbSqlRelease(statement);
+
+    TEST_ASSERT("prepare", !ZdbSqlPrepare(cache, "SELECT * FROM People WHERE Age IN (29, 41, 7) ORDER BY Age DESC",
+                                          &statement));
+    TEST_ASSERT("execute", !ZdbSqlExecute(statement, &q, &rs));
+    int ages[6];
+    int count = 0;
+    while (ZdbQueryNextResult(rs) && count < 6)
+    {
+        TEST_ASSERT("get age", !ZdbQueryGetInt(rs, 2, &ages[count++]));
+    }
+    TEST_ASSERT("ordered", count == 5 && ages[0] == 41 && ages[1] == 41 && ages[2] == 29 && ages[3] == 29 &&
+                           ages[4] == 7);
+    ZdbQueryFree(q);
+    ZdbSqlRelease(statement);
+
+    int sum;
+    TEST_ASSERT("range", CountSql(cache, "SELECT ID FROM People WHERE Age >= 50", 2, &sum) == 50 && sum == 3725);
+    TEST_ASSERT("negative", CountSql(cache, "SELECT * FROM People WHERE Salary < -1.5e4", 2, &sum) == 1 && sum == 29);
+    TEST_ASSERT("boolean", CountSql(cache, "SELECT * FROM People WHERE Active = true", 2, &sum) == 1 && sum == 41);
+
+    /* Rows whose indexed value the update changes move within the index, but are still updated once */
+    TEST_ASSERT("create index", !ZdbEngineCreateIndex(t, 2, ZDB_INDEX_BTREE));
+    TEST_ASSERT("update", RunSql(cache, "UPDATE People SET Age = 30, Active = TRUE WHERE Name = 'Ann'") == 1);
+    TEST_ASSERT("updated", CountSql(cache, "SELECT * FROM People WHERE Active = 1", 2, &sum) == 2 && sum == 71);
+    TEST_ASSERT("kept", CountSql(cache, "SELECT * FROM People WHERE Salary = -61000", 2, &sum) == 1 && sum == 30);
+    TEST_ASSERT("update indexed", RunSql(cache, "UPDATE People SET Age = 200 WHERE Age < 10") == 11);
+    TEST_ASSERT("moved", CountSql(cache, "SELECT * FROM People WHERE Age = 200", 0, &sum) == 11);
+    TEST_ASSERT("set autoincrement", RunSql(cache, "UPDATE People SET ID = 1") == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("delete", RunSql(cache, "DELETE FROM People WHERE Name = 'Temp'") == 1);
+    TEST_ASSERT("deleted", CountSql(cache, "SELECT * FROM People", 2, &sum) == 102);
+
+    /* Spacing, case and a trailing semicolon don't change the plan */
+    ZdbSqlStats before;
+    ZdbSqlStats after;
+    TEST_ASSERT("stats", !ZdbSqlGetStats(cache, &before));
+    TEST_ASSERT("evicted", before.evictions > 0 && before.statementCount == 8);
+    CountSql(cache, "SELECT * FROM People", 2, &sum);
+    CountSql(cache, "  select *\n\tfrom   people ; ", 2, &sum);
+    TEST_ASSERT("quoted kept", CountSql(cache, "SELECT * FROM People WHERE Name = 'p10'", 2, &sum) == 1 &&
+                               CountSql(cache, "SELECT * FROM People WHERE Name = 'P10'", 2, &sum) == 0);
+    TEST_ASSERT("stats", !ZdbSqlGetStats(cache, &after));
+    TEST_ASSERT("hits", after.hits == before.hits + 2 && after.parses == before.parses + 2 &&
+                        after.lookups == before.lookups + 4);
+
+    TEST_ASSERT("prepare", !ZdbSqlPrepare(cache, "SELECT * FROM People", &statement));
+    TEST_ASSERT("release", !ZdbSqlRelease(statement));
+    TEST_ASSERT("release twice", ZdbSqlRelease(statement) == ZDB_RESULT_INVALID_OPERATION);
+
+    /* A statement the cache drops lives on until it is released, and one on a dropped table is looked at again */
+    TEST_ASSERT("hold", !ZdbSqlPrepare(cache, "DELETE FROM People WHERE Age = 200", &statement));
+    for (int i = 0; i < 8; i++)
+    {
+        char sql[64];
+        snprintf(sql, sizeof(sql), "SELECT * FROM People WHERE ID = %d", i);
+        CountSql(cache, sql, 2, &sum);
+    }
+    TEST_ASSERT("held", ZdbSqlExecute(statement, NULL, NULL) == 10);
+    TEST_ASSERT("release", !ZdbSqlRelease(statement));
+
+    TEST_ASSERT("hold", !ZdbSqlPrepare(cache, "SELECT * FROM People", &statement));
+    TEST_ASSERT("drop", !ZdbEngineDropTable(t));
+    TEST_ASSERT("dropped", ZdbSqlExecute(statement, &q, &rs) == ZDB_RESULT_NOT_FOUND);
+    TEST_ASSERT("gone", RunSql(cache, "SELECT * FROM People") == ZDB_RESULT_NOT_FOUND);
+    TEST_ASSERT("create again", !RunSql(cache, "CREATE TABLE People (ID int AUTOINCREMENT, Name varchar)"));
+    TEST_ASSERT("empty", CountSql(cache, "SELECT * FROM People", 0, &sum) == 0);
+    ZdbSqlRelease(statement);
+
+    TEST_ASSERT("free cache", !ZdbSqlFreeCache(cache));
+    ZdbEngineDropDB(db);
+
+    TEST_PASS();
+}
+
+int CountRecordset(ZdbRecordset* rs)
+{
+    int count = 0;
+    while (ZdbQueryNextResult(rs))
+    {
+        count++;
+    }
+    return count;
+}
+
+void TestBindings(int storage)
+{
+    TEST_START(storage == ZDB_STORAGE_PAX ? "bindings (PAX)" : "bindings");
+
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Bound", &db));
+
+    ZdbColumn* columns[5];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Team", ZdbStandardTypes->varcharType, 0, &columns[1]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Age", ZdbStandardTypes->intType, 0, &columns[2]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Score", ZdbStandardTypes->floatType, 0, &columns[3]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Active", ZdbStandardTypes->booleanType, 0, &columns[4]));
+    TEST_ASSERT("encode", !ZdbEngineSetColumnEncoding(columns[1], ZDB_ENCODING_DICTIONARY));
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "Players", 5, columns, storage, &t));
+
+    const char* teams[] = { "Red", "Green", "Blue", "Gold" };
+    int rowCount = 1000;
+    char** names = malloc(rowCount * sizeof(char*));
+    int* ages = malloc(rowCount * sizeof(int));
+    float* scores = malloc(rowCount * sizeof(float));
+    int* active = malloc(rowCount * sizeof(int));
+    for (int i = 0; i < rowCount; i++)
+    {
+        names[i] = (char*)teams[i % 4];
+        ages[i] = i % 50;
+        scores[i] = i * 0.5f;
+        active[i] = i % 3 == 0;
+    }
+    void* values[5] = { NULL, names, ages, scores, active };
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(t, rowCount, values) == rowCount);
+    free(names);
+    free(ages);
+    free(scores);
+    free(active);
+    TEST_ASSERT("hash index", !ZdbEngineCreateIndex(t, 0, ZDB_INDEX_HASH));
+    TEST_ASSERT("btree index", !ZdbEngineCreateIndex(t, 2, ZDB_INDEX_BTREE));
+
+    /* One query looks up every ID in turn, through the hash index, into the same recordset */
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    ZdbRecordset* first;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("placeholder", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_EQ, 0, ZdbStandardTypes->intType, NULL));
+    TEST_ASSERT("unbound", ZdbQueryExecute(q, &rs) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("unbound delete", ZdbQueryDelete(q) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("wrong type", ZdbQueryBindFloat(q, 0, 1.0f) == ZDB_RESULT_INVALID_CAST);
+    TEST_ASSERT("wrong type", ZdbQueryBindString(q, 0, "1") == ZDB_RESULT_INVALID_CAST);
+    TEST_ASSERT("no parameter", ZdbQueryBindInt(q, 1, 1) == ZDB_RESULT_NOT_FOUND);
+    TEST_ASSERT("still unbound", ZdbQueryExecute(q, &rs) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("bind", !ZdbQueryBindInt(q, 0, 0));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &first));
+    TEST_ASSERT("NULL recordset", ZdbQueryReexecute(NULL) == ZDB_RESULT_INVALID_NULL);
+    for (int id = 0; id < rowCount; id += 37)
+    {
+        int found;
+        float score;
+        TEST_ASSERT("bind", !ZdbQueryBindInt(q, 0, id));
+        TEST_ASSERT("reexecute", !ZdbQueryReexecute(first));
+        TEST_ASSERT("next", ZdbQueryNextResult(first));
+        TEST_ASSERT("found", !ZdbQueryGetInt(first, 0, &found) && found == id);
+        TEST_ASSERT("score", !ZdbQueryGetFloat(first, 3, &score) && score == id * 0.5f);
+        TEST_ASSERT("just one", !ZdbQueryNextResult(first));
+    }
+    TEST_ASSERT("bind missing", !ZdbQueryBindInt(q, 0, rowCount));
+    TEST_ASSERT("reexecute", !ZdbQueryReexecute(first));
+    TEST_ASSERT("none", !ZdbQueryNextResult(first));
+    ZdbQueryFree(q);
+
+    /* Literals can be rebound as well, and a recordset read halfway starts over */
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("literal", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_GT, 3, ZdbStandardTypes->floatType, "100"));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    TEST_ASSERT("literal rows", CountRecordset(rs) == 799);
+    TEST_ASSERT("rebind", !ZdbQueryBindFloat(q, 0, 400.0f));
+    TEST_ASSERT("reexecute", !ZdbQueryReexecute(rs));
+    TEST_ASSERT("read some", ZdbQueryNextResult(rs) && ZdbQueryNextResult(rs));
+    TEST_ASSERT("reexecute", !ZdbQueryReexecute(rs));
+    TEST_ASSERT("bound rows", CountRecordset(rs) == 199);
+    TEST_ASSERT("fresh execute agrees", CountQueryResults(q) == 199);
+    ZdbQueryFree(q);
+
+    /* Ranges through the B+tree, batched so the projected arrays are reused */
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("placeholder", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_LT, 2, ZdbStandardTypes->intType, NULL));
+    int projection[] = { 2 };
+    TEST_ASSERT("project", !ZdbQuerySetProjection(q, 1, projection));
+    TEST_ASSERT("bind", !ZdbQueryBindInt(q, 0, 10));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    int limits[] = { 10, 40, 0, 50 };
+    for (int i = 0; i < 4; i++)
+    {
+        TEST_ASSERT("bind", !ZdbQueryBindInt(q, 0, limits[i]));
+        TEST_ASSERT("reexecute", !ZdbQueryReexecute(rs));
+        int count = 0, below = 1, got;
+        ZdbQueryBatch batch;
+        while ((got = ZdbQueryNextBatch(rs, 64, &batch)) > 0)
+        {
+            for (int j = 0; j < got; j++)
+            {
+                below &= ((int*)batch.columns[0])[j] < limits[i];
+            }
+            count += got;
+        }
+        TEST_ASSERT("range rows", count == limits[i] * 20 && below);
+    }
+    ZdbQueryFree(q);
+
+    /* IN lists can mix placeholders with literals, here on a dictionary encoded column */
+    const char* strs[] = { "Red", NULL, NULL };
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("placeholders", !ZdbQueryAddInCondition(q, 1, ZdbStandardTypes->varcharType, 3, strs));
+    TEST_ASSERT("bind", !ZdbQueryBindString(q, 1, "Blue"));
+    TEST_ASSERT("one unbound", ZdbQueryExecute(q, &rs) == ZDB_RESULT_INVALID_OPERATION);
+    char tooLong[ZDB_LIMIT_VARCHAR + 1];
+    memset(tooLong, 'x', ZDB_LIMIT_VARCHAR);
+    tooLong[ZDB_LIMIT_VARCHAR] = '\0';
+    TEST_ASSERT("too long", ZdbQueryBindString(q, 2, tooLong) == ZDB_RESULT_VALUE_ERROR);
+    TEST_ASSERT("still one unbound", ZdbQueryExecute(q, &rs) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("no parameter", ZdbQueryBindString(q, 3, "Gold") == ZDB_RESULT_NOT_FOUND);
+    TEST_ASSERT("not in dictionary", !ZdbQueryBindString(q, 2, "Purple"));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    TEST_ASSERT("two teams", CountRecordset(rs) == 500);
+    TEST_ASSERT("rebind", !ZdbQueryBindString(q, 2, "Gold"));
+    TEST_ASSERT("reexecute", !ZdbQueryReexecute(rs));
+    TEST_ASSERT("three teams", CountRecordset(rs) == 750);
+    ZdbQueryFree(q);
+
+    /* Ints bind to booleans, and reexecuted aggregates start from nothing */
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("placeholder", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_EQ, 4, ZdbStandardTypes->booleanType, NULL));
+    TEST_ASSERT("add count", !ZdbQueryAddAggregate(q, ZDB_AGG_COUNT, 0));
+    TEST_ASSERT("add sum", !ZdbQueryAddAggregate(q, ZDB_AGG_SUM, 2));
+    TEST_ASSERT("bind", !ZdbQueryBindInt(q, 0, 5));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    double count, sum;
+    TEST_ASSERT("result", ZdbQueryNextResult(rs));
+    TEST_ASSERT("true rows", !ZdbQueryGetAggregate(rs, 0, &count) && count == 334);
+    TEST_ASSERT("rebind", !ZdbQueryBindInt(q, 0, 0));
+    TEST_ASSERT("reexecute", !ZdbQueryReexecute(rs));
+    TEST_ASSERT("result", ZdbQueryNextResult(rs));
+    TEST_ASSERT("false rows", !ZdbQueryGetAggregate(rs, 0, &count) && count == 666);
+    TEST_ASSERT("sum", !ZdbQueryGetAggregate(rs, 1, &sum) && sum == 16317);
+    TEST_ASSERT("one row", !ZdbQueryNextResult(rs));
+    ZdbQueryFree(q);
+
+    /* Sorted and grouped queries rebuild what they work in */
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("placeholder", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_EQ, 2, ZdbStandardTypes->intType, NULL));
+    TEST_ASSERT("add order", !ZdbQueryAddOrder(q, 0, 1));
+    TEST_ASSERT("set limit", !ZdbQuerySetLimit(q, 3));
+    TEST_ASSERT("bind", !ZdbQueryBindInt(q, 0, 7));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    for (int age = 7; age < 50; age += 14)
+    {
+        int id;
+        TEST_ASSERT("bind", !ZdbQueryBindInt(q, 0, age));
+        TEST_ASSERT("reexecute", !ZdbQueryReexecute(rs));
+        TEST_ASSERT("next", ZdbQueryNextResult(rs));
+        TEST_ASSERT("last id first", !ZdbQueryGetInt(rs, 0, &id) && id == 950 + age);
+        TEST_ASSERT("limited", CountRecordset(rs) == 2);
+    }
+    ZdbQueryFree(q);
+
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("placeholder", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_GTE, 2, ZdbStandardTypes->intType, NULL));
+    TEST_ASSERT("add group", !ZdbQueryAddGroup(q, 1));
+    TEST_ASSERT("add count", !ZdbQueryAddAggregate(q, ZDB_AGG_COUNT, 0));
+    TEST_ASSERT("bind", !ZdbQueryBindInt(q, 0, 0));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+    TEST_ASSERT("four groups", CountRecordset(rs) == 4);
+    TEST_ASSERT("rebind", !ZdbQueryBindInt(q, 0, 49));
+    TEST_ASSERT("reexecute", !ZdbQueryReexecute(rs));
+    int groups = 0;
+    while (ZdbQueryNextResult(rs))
+    {
+        TEST_ASSERT("group count", !ZdbQueryGetAggregate(rs, 0, &count) && count == 10);
+        groups++;
+    }
+    TEST_ASSERT("two groups", groups == 2);
+    ZdbQueryFree(q);
+
+    ZdbEngineDropDB(db);
+
+    TEST_PASS();
+}
+
+int NearlyEqual(double value, double expected, double tolerance)
+{
+    return value >= expected - tolerance && value <= expected + tolerance;
+}
+
+void TestStatistics(int storage)
+{
+    TEST_START(storage == ZDB_STORAGE_PAX ? "statistics (PAX)" : "statistics");
+
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Analyzed", &db));
+
+    ZdbColumn* columns[4];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Age", ZdbStandardTypes->intType, 0, &columns[1]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Score", ZdbStandardTypes->floatType, 0, &columns[2]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Team", ZdbStandardTypes->varcharType, 0, &columns[3]));
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "People", 4, columns, storage, &t));
+
+    char teams[8][8];
+    for (int i = 0; i < 8; i++)
+    {
+        sprintf(teams[i], "Team%d", i);
+    }
+    int rowCount = 20000;
+    int* ages = malloc(rowCount * sizeof(int));
+    float* scores = malloc(rowCount * sizeof(float));
+    char** names = malloc(rowCount * sizeof(char*));
+    for (int i = 0; i < rowCount; i++)
+    {
+        ages[i] = i % 100;
+        scores[i] = i * 0.25f;
+        names[i] = teams[i % 8];
+    }
+    void* values[4] = { NULL, ages, scores, names };
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(t, rowCount, values) == rowCount);
+    TEST_ASSERT("hash index", !ZdbEngineCreateIndex(t, 0, ZDB_INDEX_HASH));
+    TEST_ASSERT("btree index", !ZdbEngineCreateIndex(t, 1, ZDB_INDEX_BTREE));
+
+    /* Without stats an index is always taken */
+    const ZdbTableStats* stats;
+    TEST_ASSERT("not analyzed", ZdbEngineGetTableStats(t, &stats) == ZDB_RESULT_NOT_FOUND);
+    ZdbQuery* q;
+    ZdbQueryPlan plan;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("wide range", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_LT, 1, ZdbStandardTypes->intType, "90"));
+    TEST_ASSERT("plan", !ZdbQueryGetPlan(q, &plan));
+    TEST_ASSERT("index unanalyzed", plan.access == ZDB_QUERY_ACCESS_INDEX_SCAN && plan.column == 1);
+
+    TEST_ASSERT("analyze", !ZdbEngineAnalyzeTable(t));
+    TEST_ASSERT("stats", !ZdbEngineGetTableStats(t, &stats));
+    TEST_ASSERT("row count", stats->rowCount == rowCount && stats->insertedRows == 0);
+    TEST_ASSERT("distinct ids", NearlyEqual(ZdbStatsDistinct(&stats->columns[0]), rowCount, rowCount * 0.05));
+    TEST_ASSERT("distinct ages", NearlyEqual(ZdbStatsDistinct(&stats->columns[1]), 100, 5));
+    TEST_ASSERT("distinct teams", NearlyEqual(ZdbStatsDistinct(&stats->columns[3]), 8, 1));
+    TEST_ASSERT("no team histogram", stats->columns[3].bucketCount == 0);
+    int age = 7;
+    TEST_ASSERT("age equal", NearlyEqual(ZdbStatsEqualFraction(&stats->columns[1], &age), 0.01, 0.005));
+    age = 50;
+    TEST_ASSERT("age below", NearlyEqual(ZdbStatsBelowFraction(&stats->columns[1], &age, 0), 0.5, 0.02));
+    TEST_ASSERT("age to", NearlyEqual(ZdbStatsBelowFraction(&stats->columns[1], &age, 1), 0.51, 0.02));
+    age = -1;
+    TEST_ASSERT("below all", ZdbStatsBelowFraction(&stats->columns[1], &age, 1) == 0);
+    age = 1000;
+    TEST_ASSERT("above all", ZdbStatsEqualFraction(&stats->columns[1], &age) == 0);
+    TEST_ASSERT("above all", ZdbStatsBelowFraction(&stats->columns[1], &age, 0) == 1);
+    float score = 1250.0f;
+    TEST_ASSERT("score below", NearlyEqual(ZdbStatsBelowFraction(&stats->columns[2], &score, 0), 0.25, 0.02));
+    TEST_ASSERT("team equal", NearlyEqual(ZdbStatsEqualFraction(&stats->columns[3], "Team3"), 0.125, 0.02));
+
+    /* With them, a scan beats a B+tree range over most of the table, but not a narrow one or a hash lookup */
+    TEST_ASSERT("plan", !ZdbQueryGetPlan(q, &plan));
+    TEST_ASSERT("wide scan", plan.access == ZDB_QUERY_ACCESS_SCAN && plan.column == -1);
+    TEST_ASSERT("wide estimate", NearlyEqual(plan.estimatedRows, rowCount * 0.9, rowCount * 0.02));
+    TEST_ASSERT("wide rows", CountQueryResults(q) == rowCount * 9 / 10);
+    TEST_ASSERT("narrow range", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_EQ, 1, ZdbStandardTypes->intType, "7"));
+    TEST_ASSERT("plan", !ZdbQueryGetPlan(q, &plan));
+    TEST_ASSERT("replaced", plan.conditionCount == 1);
+    TEST_ASSERT("narrow index", plan.access == ZDB_QUERY_ACCESS_INDEX_SCAN && plan.column == 1);
+    TEST_ASSERT("narrow rows", CountQueryResults(q) == rowCount / 100);
+    ZdbQueryFree(q);
+
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("id", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_EQ, 0, ZdbStandardTypes->intType, "1234"));
+    TEST_ASSERT("plan", !ZdbQueryGetPlan(q, &plan));
+    TEST_ASSERT("lookup", plan.access == ZDB_QUERY_ACCESS_INDEX_LOOKUP && plan.column == 0);
+    TEST_ASSERT("lookup rows", CountQueryResults(q) == 1);
+    ZdbQueryFree(q);
+
+    /* Conditions on several columns all have to hold, and are checked most selective first */
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("age", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_LT, 1, ZdbStandardTypes->intType, "90"));
+    TEST_ASSERT("team", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_EQ, 3, ZdbStandardTypes->varcharType, "Team3"));
+    TEST_ASSERT("score", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_GT, 2, ZdbStandardTypes->floatType, "4000"));
+    TEST_ASSERT("plan", !ZdbQueryGetPlan(q, &plan));
+    TEST_ASSERT("scan", plan.access == ZDB_QUERY_ACCESS_SCAN);
+    TEST_ASSERT("conditions", plan.conditionCount == 3);
+    TEST_ASSERT("order", plan.conditionOrder[0] == 1 && plan.conditionOrder[1] == 2 && plan.conditionOrder[2] == 0);
+    int expected = 0;
+    for (int i = 0; i < rowCount; i++)
+    {
+        expected += ages[i] < 90 && i % 8 == 3 && scores[i] > 4000;
+    }
+    TEST_ASSERT("estimate", NearlyEqual(plan.estimatedRows, expected, expected * 0.2));
+    TEST_ASSERT("anded rows", CountQueryResults(q) == expected);
+
+    /* An index on one of them is tried first when it's cheap, and the rest checked on what it finds */
+    TEST_ASSERT("age", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_EQ, 1, ZdbStandardTypes->intType, "3"));
+    TEST_ASSERT("plan", !ZdbQueryGetPlan(q, &plan));
+    TEST_ASSERT("index", plan.access == ZDB_QUERY_ACCESS_INDEX_SCAN && plan.column == 1);
+    TEST_ASSERT("index first", plan.conditionOrder[0] == 0 && plan.conditionOrder[1] == 1);
+    expected = 0;
+    for (int i = 0; i < rowCount; i++)
+    {
+        expected += ages[i] == 3 && i % 8 == 3 && scores[i] > 4000;
+    }
+    TEST_ASSERT("indexed rows", CountQueryResults(q) == expected);
+    ZdbQueryFree(q);
+
+    /* Inserted rows are added to the stats as they are written, values past the histogram stretching its last bucket
+       until the table is analyzed again */
+    for (int i = 0; i < 1000; i++)
+    {
+        ages[i] = 500;
+    }
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(t, 1000, values) == 1000);
+    ZdbRow* r;
+    TEST_ASSERT("insert row", !ZdbEngineInsertRow(t, 4, &r));
+    TEST_ASSERT("not written yet", stats->rowCount == rowCount + 1000);
+    TEST_ASSERT("update row", ZdbEngineUpdateRow(t, r, 4, NULL, "500", "1.5", "Team9") == 1);
+    TEST_ASSERT("counted", stats->rowCount == rowCount + 1001 && stats->insertedRows == 1001);
+    age = 500;
+    TEST_ASSERT("new value", ZdbStatsEqualFraction(&stats->columns[1], &age) > 0.01);
+    TEST_ASSERT("new distinct", NearlyEqual(ZdbStatsDistinct(&stats->columns[3]), 9, 1));
+    TEST_ASSERT("new ids", NearlyEqual(ZdbStatsDistinct(&stats->columns[0]), rowCount + 1001, rowCount * 0.05));
+
+    TEST_ASSERT("analyze again", !ZdbEngineAnalyzeTable(t));
+    TEST_ASSERT("stats", !ZdbEngineGetTableStats(t, &stats));
+    TEST_ASSERT("fresh", stats->rowCount == rowCount + 1001 && stats->insertedRows == 0);
+    TEST_ASSERT("same value", NearlyEqual(ZdbStatsEqualFraction(&stats->columns[1], &age), 1001.0 / (rowCount + 1001), 0.01));
+
+    free(ages);
+    free(scores);
+    free(names);
+    ZdbEngineDropDB(db);
+
+    TEST_PASS();
+}
+
+/* Orders ints backwards, so only a query that compares through the type can get conditions on it right */
+int ReversedCompare(void* value1, void* value2, int* result)
+{
+    int a = *(int*)value1, b = *(int*)value2;
+    *result = a == b ? 0 : a < b ? 1 : -1;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ReversedSize(void* value, size_t* result) { *result = sizeof(int); return ZDB_RESULT_SUCCESS; }
+int ReversedCopy(void* dest, void* src) { *(int*)dest = *(int*)src; return ZDB_RESULT_SUCCESS; }
+int ReversedFromString(const char* str, void* result) { *(int*)result = str ? atoi(str) : 0; return ZDB_RESULT_SUCCESS; }
+int ReversedToString(void* value, size_t* length, char* result)
+{
+    *length = result ? snprintf(result, *length + 1, "%d", *(int*)value) : snprintf(NULL, 0, "%d", *(int*)value);
+    return ZDB_RESULT_SUCCESS;
+}
+
+/* A type whose values are too big for a chunk of them to ever be allocated */
+int HugeSize(void* value, size_t* result) { *result = (size_t)1 << (sizeof(size_t) * 8 - 9); return ZDB_RESULT_SUCCESS; }
+
+void TestChunkAllocationFailure()
+{
+    TEST_START("chunk allocation failure");
+
+    ZdbType* huge;
+    TEST_ASSERT("create type", !ZdbTypeCreate("huge", ReversedCompare, HugeSize, ReversedCopy, ReversedFromString,
+                                              ReversedToString, NULL, &huge));
+
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Chunks", &db));
+    ZdbColumn* columns[1];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Huge", huge, 0, &columns[0]));
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "Huge", 1, columns, ZDB_STORAGE_PAX, &t));
+
+    ZdbAllocatorStats before;
+    TEST_ASSERT("allocator stats", !ZdbEngineGetAllocatorStats(t, &before));
+
+    /* Every insert needs the first column chunk and fails for want of it, without holding on to a row slot */
+    int i;
+    for (i = 0; i < 3; i++)
+    {
+        ZdbRow* r;
+        TEST_ASSERT("insert fails", ZdbEngineInsertRow(t, 1, &r) != ZDB_RESULT_SUCCESS);
+    }
+    TEST_ASSERT("no rows", t->rowCount == 0 && t->chunkCount == 0);
+
+    ZdbAllocatorStats after;
+    TEST_ASSERT("allocator stats", !ZdbEngineGetAllocatorStats(t, &after));
+    TEST_ASSERT("no slab", after.slabCount == before.slabCount);
+    TEST_ASSERT("nothing used", after.bytesUsed == before.bytesUsed);
+    TEST_ASSERT("nothing wasted", after.bytesWasted == before.bytesWasted);
+
+    ZdbEngineDropDB(db);
+    TEST_PASS();
+}
+
+void TestUserTypeConditions()
+{
+    TEST_START("TestUserTypeConditions");
+
+    ZdbType* reversed;
+    TEST_ASSERT("create type", !ZdbTypeCreate("reversed", ReversedCompare, ReversedSize, ReversedCopy, ReversedFromString,
+                                              ReversedToString, NULL, &reversed));
+    TEST_ASSERT("user id", ZdbTypeGetId(reversed) == ZDB_TYPE_ID_USER);
+
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("UserTypes", &db));
+    ZdbColumn* columns[2];
+    TEST_ASSERT("int column", !ZdbEngineCreateColumn("Plain", ZdbStandardTypes->intType, 0, &columns[0]));
+    TEST_ASSERT("user column", !ZdbEngineCreateColumn("Reversed", reversed, 0, &columns[1]));
+    ZdbTable* table;
+    TEST_ASSERT("create table", !ZdbEngineCreateTable(db, "Numbers", 2, columns, &table));
+
+    int numbers[10];
+    for (int i = 0; i < 10; i++)
+    {
+        numbers[i] = i;
+    }
+    void* values[2] = { numbers, numbers };
+    TEST_ASSERT("insert", ZdbEngineInsertRows(table, 10, values) == 10);
+
+    /* The same values, ordered one way by the int predicates and the other way by the type's compare */
+    TEST_ASSERT("int lt", CountMatchingRows(db, table, 0, ZDB_QUERY_CONDITION_LT, ZdbStandardTypes->intType, "3") == 3);
+    TEST_ASSERT("user lt", CountMatchingRows(db, table, 1, ZDB_QUERY_CONDITION_LT, reversed, "3") == 6);
+    TEST_ASSERT("user gte", CountMatchingRows(db, table, 1, ZDB_QUERY_CONDITION_GTE, reversed, "3") == 4);
+    TEST_ASSERT("user eq", CountMatchingRows(db, table, 1, ZDB_QUERY_CONDITION_EQ, reversed, "7") == 1);
+    TEST_ASSERT("user ne", CountMatchingRows(db, table, 1, ZDB_QUERY_CONDITION_NE, reversed, "7") == 9);
+
+    const char* list[] = { "2", "5", "11" };
+    ZdbQuery* q;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, table));
+    TEST_ASSERT("add in condition", !ZdbQueryAddInCondition(q, 1, reversed, 3, list));
+    TEST_ASSERT("user in", CountQueryResults(q) == 2);
+    ZdbQueryFree(q);
+
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, table));
+    TEST_ASSERT("unknown condition", ZdbQueryAddCondition(q, 42, 0, ZdbStandardTypes->intType, "1") == ZDB_RESULT_INVALID_OPERATION);
+    ZdbQueryFree(q);
+
+    ZdbEngineDropDB(db);
+
+    TEST_PASS();
+}
+
+/* Reads every batch of the query and checks each projected value against the row it came from */
+int CheckProjectedBatches(ZdbQuery* q, ZdbTable* table, int count, const int* projection, int maxRows)
+{
+    ZdbRecordset* rs;
+    ZdbQueryBatch batch;
+    TEST_ASSERT("set projection", !ZdbQuerySetProjection(q, count, projection));
+    TEST_ASSERT("execute", !ZdbQueryExecute(q, &rs));
+
+    int rows = 0;
+    int n;
+    while ((n = ZdbQueryNextBatch(rs, maxRows, &batch)) > 0)
+    {
+        TEST_ASSERT("column count", batch.columnCount == count);
+        for (int c = 0; c < count; c++)
+        {
+            int column = projection[c];
+            int tag = table->layout.tags[column];
+            for (int i = 0; i < n; i++)
+            {
+                void* value;
+                TEST_ASSERT("get value", !ZdbEngineGetValue(table, ZdbEngineRowAt(table, batch.rows[i]), column, &value));
+                if (tag == ZDB_LAYOUT_TAG_VARCHAR || tag == ZDB_LAYOUT_TAG_DICTIONARY)
+                {
+                    const ZdbString* strings = batch.columns[c];
+                    TEST_ASSERT("string", !strcmp(strings[i].chars, value) && strings[i].length == (int)strlen(value));
+                }
+                else if (tag == ZDB_LAYOUT_TAG_OTHER)
+                {
+                    void* const* pointers = batch.columns[c];
+                    TEST_ASSERT("pointer", pointers[i] == value);
+                }
+                else
+                {
+                    const int* values = batch.columns[c];
+                    TEST_ASSERT("value", !memcmp(&values[i], value, sizeof(int)));
+                }
+            }
+        }
+        rows += n;
+    }
+
+    TEST_ASSERT("end of batches", n == 0);
+    return rows;
+}
+
+void TestProjection(int storage)
+{
+    TEST_START(storage == ZDB_STORAGE_PAX ? "projection (PAX)" : "projection");
+
+    ZdbType* reversed;
+    TEST_ASSERT("find type", !ZdbTypeFind("reversed", &reversed));
+
+    ZdbDatabase* db;
+    TEST_ASSERT("create db", !ZdbEngineCreateDB("Projection", &db));
+    ZdbColumn* columns[6];
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("ID", ZdbStandardTypes->intType, 1, &columns[0]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Name", ZdbStandardTypes->varcharType, 0, &columns[1]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Salary", ZdbStandardTypes->floatType, 0, &columns[2]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Active", ZdbStandardTypes->booleanType, 0, &columns[3]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("City", ZdbStandardTypes->varcharType, 0, &columns[4]));
+    TEST_ASSERT("create column", !ZdbEngineCreateColumn("Rank", reversed, 0, &columns[5]));
+    TEST_ASSERT("encode", !ZdbEngineSetColumnEncoding(columns[4], ZDB_ENCODING_DICTIONARY));
+    ZdbTable* t;
+    TEST_ASSERT("create table", !ZdbEngineCreateTableWithStorage(db, "Staff", 6, columns, storage, &t));
+
+    char nameBuffers[3000][16];
+    char* names[3000];
+    float salaries[3000];
+    int active[3000];
+    char* cities[3000];
+    int ranks[3000];
+    const char* cityNames[] = { "Oslo", "", "Lima", "Reykjavik" };
+    for (int i = 0; i < 3000; i++)
+    {
+        sprintf(nameBuffers[i], "name%d", i * 37 % 1000);
+        names[i] = nameBuffers[i];
+        salaries[i] = 1000.0f + i * 0.5f;
+        active[i] = i % 4 != 0;
+        cities[i] = (char*)cityNames[i % 4];
+        ranks[i] = 3000 - i;
+    }
+    void* values[6] = { NULL, names, salaries, active, cities, ranks };
+    TEST_ASSERT("insert rows", ZdbEngineInsertRows(t, 3000, values) == 3000);
+    int deleted[300];
+    for (int i = 0; i < 300; i++)
+    {
+        deleted[i] = i * 9 + 4;
+    }
+    TEST_ASSERT("delete rows", ZdbEngineDeleteRows(t, 300, deleted) == 300);
+
+    /* Columns in any order, including a user type, through a scan and through an index */
+    int projection[] = { 5, 2, 1, 0, 4, 3 };
+    ZdbQuery* q;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("bad column", ZdbQuerySetProjection(q, 1, (int[]){ 6 }) == ZDB_RESULT_INVALID_OPERATION);
+    TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_GTE, 2, ZdbStandardTypes->floatType, "1100"));
+    int expected = CountQueryResults(q);
+    TEST_ASSERT("scan", CheckProjectedBatches(q, t, 6, projection, 100) == expected);
+    TEST_ASSERT("one column", CheckProjectedBatches(q, t, 1, &projection[2], ZDB_QUERY_BATCH_ROWS) == expected);
+    TEST_ASSERT("no columns", CheckProjectedBatches(q, t, 0, NULL, 64) == expected);
+    ZdbQueryFree(q);
+
+    TEST_ASSERT("create index", !ZdbEngineCreateIndex(t, 3, ZDB_INDEX_HASH));
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, t));
+    TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_EQ, 3, ZdbStandardTypes->booleanType, "1"));
+    expected = CountQueryResults(q);
+    TEST_ASSERT("indexed", CheckProjectedBatches(q, t, 6, projection, 33) == expected);
+    ZdbQueryFree(q);
+
+    ZdbEngineDropDB(db);
+
+    TEST_PASS();
+}
+
+void TestConditionQueries(ZdbDatabase* db)
+{
+    /* EQ */
+    TestOneConditionQuery(db, 0, ZDB_QUERY_CONDITION_EQ, "1", ZdbStandardTypes->intType, "1", 1);
+    TestOneConditionQuery(db, 1, ZDB_QUERY_CONDITION_EQ, "Jane", ZdbStandardTypes->varcharType, "Jane", 1);
+    TestOneConditionQuery(db, 2, ZDB_QUERY_CONDITION_EQ, "30", ZdbStandardTypes->intType, "30", 1);
+    TestOneConditionQuery(db, 3, ZDB_QUERY_CONDITION_EQ, "34000.000000", ZdbStandardTypes->floatType, "34000.000000", 1);
+    TestOneConditionQuery(db, 4, ZDB_QUERY_CONDITION_EQ, "0", ZdbStandardTypes->booleanType, "0", 1);
+    TestOneConditionQuery(db, 4, ZDB_QUERY_CONDITION_EQ, "1", ZdbStandardTypes->booleanType, "1", 3);
+
+    /* NE */
+    TestOneConditionQuery(db, 4, ZDB_QUERY_CONDITION_NE, "0", ZdbStandardTypes->booleanType, "1", 3);
+
+    /* LT */
+    TestOneConditionQuery(db, 2, ZDB_QUERY_CONDITION_LT, "30", ZdbStandardTypes->intType, "22", 1);
+    TestOneConditionQuery(db, 1, ZDB_QUERY_CONDITION_LT, "Breckin", ZdbStandardTypes->varcharType, "Bob", 1);
+
+    /* GT */
+    TestOneConditionQuery(db, 3, ZDB_QUERY_CONDITION_GT, "45000.0", ZdbStandardTypes->floatType, "95600.000000", 1);
+    TestOneConditionQuery(db, 4, ZDB_QUERY_CONDITION_GT, "0", ZdbStandardTypes->booleanType, "1", 3);
+
+    /* LTE */
+    TestOneConditionQuery(db, 2, ZDB_QUERY_CONDITION_LTE, "22", ZdbStandardTypes->intType, "22", 1);
+    TestOneConditionQuery(db, 0, ZDB_QUERY_CONDITION_LTE, "-1", ZdbStandardTypes->intType, "-1", 0);
+
+    /* GTE */
+    TestOneConditionQuery(db, 2, ZDB_QUERY_CONDITION_GTE, "45", ZdbStandardTypes->intType, "45", 1);
+    TestOneConditionQuery(db, 4, ZDB_QUERY_CONDITION_GTE, "1", ZdbStandardTypes->booleanType, "1", 3);
+}
+
+void TestColumnChunks(ZdbDatabase* db)
+{
+    TEST_START("column chunks");
+
+    ZdbTable* t = db->tables[0];
+    void* values;
+    int count;
+
+    if (t->storage != ZDB_STORAGE_PAX)
+    {
+        TEST_ASSERT("row storage has no chunks", ZdbEngineGetColumnChunk(t, 0, 2, &values, &count) == ZDB_RESULT_UNSUPPORTED);
+        TEST_PASS();
+        return;
+    }
+
+    TEST_ASSERT("get chunk", !ZdbEngineGetColumnChunk(t, 0, 2, &values, &count));
+    TEST_ASSERT("chunk count", count == t->rowCount);
+
+    /* The Age column is a plain int array that matches what the row accessors see */
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        int* age;
+        TEST_ASSERT("get value", !ZdbEngineGetValue(t, ZdbEngineRowAt(t, i), 2, (void**)&age));
+        TEST_ASSERT("contiguous", age == ((int*)values) + i);
+    }
+
+    TEST_ASSERT("chunk out of range", ZdbEngineGetColumnChunk(t, 1, 2, &values, &count) == ZDB_RESULT_INVALID_OPERATION);
+
+    TEST_PASS();
+}
+
+void UpdateRowTestHelper(ZdbDatabase* db, int table, int queryColumn, const char* queryValue, int updateColumn, void* updateValue)
+{
+    /* Most of this code will likely turn into the Update command code */
+
+
+    ZdbType* queryColumnType = db->tables[table]->columns[queryColumn]->type;
+    ZdbType* updateColumnType = db->tables[table]->columns[updateColumn]->type;
+
+    /* Get some names of things to make diagnostic messages less painful */
+    char tableName[ZDB_LIMIT_VARCHAR], columnName[ZDB_LIMIT_VARCHAR], originalValueString[ZDB_LIMIT_VARCHAR], updateValueString[ZDB_LIMIT_VARCHAR], testName[ZDB_LIMIT_VARCHAR];
+
+    strcpy(tableName, db->tables[table]->name);
+    strcpy(columnName, db->tables[table]->columns[updateColumn]->name);
+    size_t length = ZDB_LIMIT_VARCHAR;
+    ZdbTypeToString(updateColumnType, updateValue, &length, updateValueString);
+
+    sprintf(testName, "Update %s(%s) [QUERY]", tableName, columnName);
+    TEST_START(testName);
+
+    ZdbQuery* q;
+    ZdbRecordset* rs;
+    TEST_ASSERT("create query", !ZdbQueryCreate(db, &q));
+    TEST_ASSERT("add table", !ZdbQueryAddTable(q, db->tables[table]));
+    TEST_ASSERT("add condition", !ZdbQueryAddCondition(q, ZDB_QUERY_CONDITION_EQ, queryColumn, queryColumnType, queryValue));
+    TEST_ASSERT("execute query", !ZdbQueryExecute(q, &rs));
+    TEST_ASSERT("has results", ZdbQueryNextResult(rs));
+
+    /* Get the current value so we can print it*/
+    void* originalValue;
+    length = ZDB_LIMIT_VARCHAR;
+    TEST_ASSERT("get value", !ZdbQueryGetValue(rs, updateColumn, updateColumnType, &originalValue));
+    TEST_ASSERT("to string", !ZdbTypeToString(updateColumnType, originalValue, &length, originalValueString));
+
+    TEST_PASS();
+
+    sprintf(testName, "Update %s => %s", originalValueString, updateValueString);
+    TEST_START(testName);
+
+    int rowId = -1;
+
+    /* Collect the values for this row as a string */
+    void** values = calloc(db->tables[table]->columnCount, sizeof(void*));
+
+    int i;
+    for (i = 0; i < db->tables[table]->columnCount; i++)
+    {
+        void* value;
+        ZdbType* thisType = db->tables[table]->columns[i]->type;
+        TEST_ASSERT("get value", !ZdbQueryGetValue(rs, i, thisType, &value));
+
+        if (rowId == -1 && db->tables[table]->columns[i]->autoincrement)
+        {
+            /* For our test DB, we can assume the first auto increment column is an
+              int row id that matches the row index */
+            rowId = *(int*)value;
+        }
+
+        if (i == updateColumn)
+        {
+            values[i] = updateValue;
+        }
+        else
+        {
+            values[i] = value;
+        }
+    }
+
+
+    ZdbRow* row = ZdbEngineRowAt(db->tables[table], rowId);
+    TEST_ASSERT("update row values", ZdbEngineUpdateRowValues(db->tables[table], row, db->tables[table]->columnCount, values) == 1);
+
+    void* updatedValue;
+    TEST_ASSERT("get value", !ZdbQueryGetValue(rs, updateColumn, updateColumnType, &updatedValue));
+    int result = 0;
+    TEST_ASSERT("type compare", !ZdbTypeCompare(updateColumnType, updateValue, updatedValue, &result));
+    TEST_ASSERT("update check", result == 0);
+
+    free(values);
+
+    ZdbQueryFree(q);
+    TEST_PASS();
+}
+
+void TestBasicRowUpdate(ZdbDatabase* db)
+{
+
+    /* Legal wants Bob's official name changed to Robert in the DB */
+    int i = 1;
+    UpdateRowTestHelper(db, 0, 0, "1", 1, "Robert");
+
+    /* John gets rehired */
+    i = 3;
+    int active = 1;
+    UpdateRowTestHelper(db, 0, 0, "3", 4, &active);
+
+    /* Jane got older */
+    i = 2;
+    int age = 46;
+    UpdateRowTestHelper(db, 0, 0, "2", 2, &age);
+
+    /* And I got a raise! */
+    i = 0;
+    float salary = 80000;
+    UpdateRowTestHelper(db, 0, 0, "0", 3, &salary);
+
+}
+
+
+int main (int argc, const char * argv[])
+{
+    if (ZdbTypeInitialize() != ZDB_RESULT_SUCCESS)
+    {
+        printf("Could not initialize type system\n");
+    }
+
+    TestTypeSystem();
+
+    int storage;
+    for (storage = ZDB_STORAGE_ROW; storage <= ZDB_STORAGE_PAX; storage++)
+    {
+        ZdbDatabase* db = CreateTestDatabase(storage);
+
+        TestRowLayout(db);
+        TestColumnChunks(db);
+        TestStringHeap(db);
+
+        TestBasicQuery(db);
+        TestConditionQueries(db);
+        TestBasicRowUpdate(db);
+
+        ZdbEngineDropDB(db);
+
+        TestBulkInsert(storage);
+        TestPersistence(storage);
+        TestWriteAheadLog(storage);
+        TestCheckpoint(storage);
+        TestDeleteAndCompact(storage);
+        TestHashIndex(storage);
+        TestBTreeIndex(storage);
+        TestZoneMaps(storage);
+        TestQueryBatches(storage);
+        TestParallelScan(storage);
+        TestAggregates(storage);
+        TestGroupBy(storage);
+        TestJoin(storage);
+        TestOrderBy(storage);
+        TestPaging(storage);
+        TestBindings(storage);
+        TestStatistics(storage);
+    }
+
+    TestRowAllocator();
+    TestDictionaryEncoding();
+    TestUserTypeConditions();
+    TestChunkAllocationFailure();
+    TestSql();
+
+    for (storage = ZDB_STORAGE_ROW; storage <= ZDB_STORAGE_PAX; storage++)
+    {
+        /* Uses the user-defined type that TestUserTypeConditions creates */
+        TestProjection(storage);
+    }
 
     return 0;
 }
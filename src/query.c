@@ -6,157 +6,4016 @@
 //  Copyright 2011 __MyCompanyName__. All rights reserved.
 //
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "types.h"
 
 #include "query.h"
+#include "index.h"
+#include "stats.h"
+#include "kernel.h"
+
+
+#define ZDB_QUERY_NO_CODE   UINT32_MAX      /* Code for a value that isn't in the column's dictionary */
+
+/* Costs the planner weighs access paths by, in rows checked by a scan */
+#define ZDB_QUERY_COST_ROW          1.0     /* Reading a row's value and checking it */
+#define ZDB_QUERY_COST_KERNEL_ROW   0.25    /* The same through a kernel, a chunk of values at a time */
+#define ZDB_QUERY_COST_INDEX_ROW    4.0     /* Finding a row through an index and checking the other conditions */
+#define ZDB_QUERY_COST_PROBE        20.0    /* Hashing a value and finding its group */
+#define ZDB_QUERY_COST_LEVEL        8.0     /* Searching a level of a B+tree */
 
+/* Shares of the rows conditions on tables without stats are taken to hold for */
+#define ZDB_QUERY_GUESS_EQUAL       0.1
+#define ZDB_QUERY_GUESS_RANGE       (1.0 / 3)
+#define ZDB_SORT_BLOCK      512             /* Entries read from or written to a spill file at a time */
+
+/* Decides a comparison between the condition's value and a row's value, which are both of the column's type */
+typedef int (*ZdbQueryPredicate)(ZdbType* type, void* value, void* rowValue);
 
 struct _ZdbQueryCondition
 {
     ZdbQueryConditionType type;
     int columnIndex;
+    ZdbType* columnType;
+    ZdbQueryPredicate predicate;    /* Picked for the column's type and the comparison when the condition is added.
+                                       IN: the equality predicate, tried against each value */
     void* value;
+    int valueCount;             /* IN: number of candidate values */
+    void** values;              /* IN: the candidate values */
+    int useCodes;               /* Column is dictionary encoded, so equality is decided on codes */
+    uint32_t code;              /* EQ/NE on codes: the value's code */
+    uint64_t* codeSet;          /* IN on codes: bitmap of candidate codes */
+    uint32_t codeSetSize;       /* IN on codes: number of codes the bitmap covers */
+    uint32_t codeSetCapacity;   /* IN on codes: words allocated for the bitmap */
+    unsigned char* unbound;     /* Placeholders: a flag for each value still to be bound, NULL if there are none */
+    int unboundCount;
 };
 
+typedef struct
+{
+    int function;               /* ZDB_AGG_* */
+    int column;
+} ZdbQueryAggregate;
+
+/* One aggregate's running values.  Partial states from parallel workers are merged */
+typedef struct
+{
+    int64_t count;              /* Values taken in, which for float min and max leaves out NaN */
+    int64_t intSum;
+    double floatSum;
+    int intMin;
+    int intMax;
+    float floatMin;
+    float floatMax;
+} ZdbAggregateState;
+
+/* A row of the build side of a join, chained to the others in its bucket */
+typedef struct
+{
+    uint64_t hash;
+    int row;                    /* Position of the row in its table */
+    int next;                   /* Next entry in the bucket, -1 at the end */
+} ZdbJoinEntry;
+
+/* Memory shared by every group table of a query */
+typedef struct
+{
+    size_t limit;
+    size_t used;                /* Changed atomically, as parallel workers grow their tables */
+    size_t peak;
+    int overflow;               /* Set once a table couldn't grow within the limit */
+} ZdbGroupBudget;
+
+/* Groups keyed by up to ZDB_QUERY_GROUP_COLUMNS four byte words.  A group's keys, aggregate states and row count
+   live at its number in arrays that are allocated ahead of the groups filling them */
+typedef struct
+{
+    ZdbGroupBudget* budget;
+    int keyCount;
+    int columns[ZDB_QUERY_GROUP_COLUMNS];
+    int tags[ZDB_QUERY_GROUP_COLUMNS];
+    int aggregateCount;
+    int direct;                 /* Small domain: a group's number is worked out from its keys, with no hashing */
+    int bases[ZDB_QUERY_GROUP_COLUMNS];     /* Direct: smallest value of each key */
+    int sizes[ZDB_QUERY_GROUP_COLUMNS];     /* Direct: values each key can take */
+    int partitionBits;          /* Hashed: the top bits of a key's hash pick its partition... */
+    uint64_t partition;         /* ...and only keys in this one are taken */
+
+    uint64_t* slots;            /* Hashed: top half of the hash above group + 1, 0 for an empty slot */
+    int slotCount;              /* Always a power of two */
+    int32_t* keys;              /* keyCount words per group */
+    ZdbAggregateState* states;  /* aggregateCount states per group */
+    int64_t* rows;              /* Rows in each group.  Direct tables have a group for every key, most with none */
+    int groupCount;
+    int capacity;
+    size_t bytes;               /* Taken from the budget */
+} ZdbGroupTable;
+
+typedef struct
+{
+    int column;
+    int descending;
+} ZdbQueryOrder;
+
+/* A row to be sorted, with a key standing in for its first order column's value */
+typedef struct
+{
+    uint64_t key;
+    int row;                    /* Position of the row in its table */
+} ZdbSortEntry;
+
+/* A sorted run in the spill file, read back a block at a time while it's merged */
+typedef struct
+{
+    long start;                 /* Entry of the file the run starts at */
+    long count;
+    long read;                  /* Entries read into the buffer so far */
+    ZdbSortEntry* buffer;
+    int bufferCount;
+    int bufferPosition;         /* The run's next entry in the buffer */
+} ZdbSortRun;
+
+typedef struct
+{
+    ZdbSortEntry* entries;      /* Entries waiting to be sorted, or for top-N sorts a heap of the best so far */
+    int entryCount;
+    int entryCapacity;
+    int maxEntries;             /* Most entries held at once: the limit for top-N sorts, otherwise what fits the budget */
+    int topN;
+    int fanIn;                  /* Most runs merged at once */
+    FILE* file;                 /* Spilled runs, one after another */
+    ZdbSortRun* runs;
+    int runCount;
+    int runCapacity;
+    ZdbSortEntry* blocks;       /* Buffers of the runs being merged */
+    int* heap;                  /* Runs being merged, the one with the smallest next entry first */
+    int heapCount;
+    int spilledRuns;
+    int mergePasses;
+    int failed;                 /* A spill file couldn't be written or read back, so rows are missing */
+} ZdbSort;
+
 struct _ZdbQuery
 {
     ZdbDatabase* database;          /* The database this query will operate on */
     ZdbTable* table;                /* Query subject table */
-    ZdbQueryCondition condition;    /* The condition we will evaluate for each row */
+    ZdbTable* tables[ZDB_QUERY_TABLES];     /* Tables in the order they were added, the subject table first */
+    int tableCount;
+    int joined;                     /* The tables are joined on joinColumns */
+    int joinColumns[ZDB_QUERY_TABLES];
+    ZdbQueryCondition conditions[ZDB_QUERY_CONDITIONS];    /* Every one has to hold, in the order they were added */
+    int conditionCount;
+    ZdbQueryPlan plan;              /* How the last run found its rows, and the order it checked the conditions in */
+    ZdbIndex* accessIndex;          /* Index the plan finds rows through, NULL to scan */
+    int accessCondition;            /* The condition it answers */
+    ZdbRecordset* recordsets;       /* Recordsets created by this query, freed along with it */
+    int projection[ZDB_LIMIT_COLUMNS];      /* Columns batches are returned with */
+    int projectionCount;
+    ZdbQueryAggregate aggregates[ZDB_QUERY_AGGREGATES];
+    int aggregateCount;
+    int groups[ZDB_QUERY_GROUP_COLUMNS];    /* Columns the aggregates are grouped by */
+    int groupCount;
+    size_t groupMemory;             /* Most bytes the group tables can take up */
+    ZdbQueryOrder orders[ZDB_QUERY_ORDER_COLUMNS];  /* Columns the rows are sorted by, most significant first */
+    int orderCount;
+    size_t sortMemory;              /* Most bytes the sort can take up */
+    int limit;                      /* Most rows a recordset returns, ZDB_QUERY_NO_LIMIT for no limit */
+    int offset;                     /* Rows a recordset passes over before returning any */
+    unsigned char* cursor;          /* The decoded token of the row to start after, NULL to start at the beginning */
+    size_t cursorSize;
+    int cursorRow;                  /* Cursor: the row's position, and for ordered queries... */
+    uint64_t cursorKey;             /* ...its sort key and order values, worked out by ZdbQueryExecute */
+    ZdbZoneValue cursorNumbers[ZDB_QUERY_ORDER_COLUMNS];
+    void* cursorValues[ZDB_QUERY_ORDER_COLUMNS];
+    int threads;                    /* Threads that scan the table, 1 to scan it on the calling thread */
+    int ordered;                    /* Parallel scans merge their results back into table order */
 };
 
 struct _ZdbRecordset
 {
     ZdbQuery* query;            /* The query that created this recordset */
     int rowIndex;
+    int pinned;                 /* Holding off compaction of the table until the rows run out */
+    ZdbRecordset* next;
+
+    int indexed;                /* Rows were found through an index rather than by a scan */
+    ZdbRow** indexRows;         /* Indexed: the matching rows, in table order for equality and key order for ranges */
+    int indexRowCapacity;       /* Handles indexRows has room for, kept from one run to the next */
+    int indexRowCount;
+    int indexPosition;          /* Indexed: next row to return */
+
+    int zoneChunk;              /* Scans: last chunk whose zone was checked against the condition */
+
+    int scanned;                /* Rows were found up front by a parallel scan */
+    int* scanRows;              /* Scanned: positions of the matching rows in table->rows */
+    int scanRowCount;
+    int scanPosition;           /* Scanned: next row to return */
+
+    int sorted;                 /* Ordered queries: rows were sorted up front, into scanRows unless they spilled */
+    ZdbSort sort;               /* Sorted: the spilled runs still being merged */
+    int limit;                  /* The query's limit and offset when it was executed */
+    int offset;
+    int returned;               /* Rows returned so far, counted against the limit */
+    int skipped;                /* Rows passed over so far, counted against the offset */
+    int paged;                  /* A limit, offset or cursor: rows have to come in the same order every time */
+    int afterRow;               /* Unordered queries with a cursor: rows up to this position are passed over */
+    int lastRow;                /* Position of the last row returned, -1 before the first */
+    char* cursor;               /* Token for lastRow */
+    int finished;               /* The rows have run out, and the cursor was saved before compaction could move them */
+
+    int* selection;             /* Batches: rows of the last batch */
+    int selectionCapacity;
+    int gather[ZDB_ROW_CHUNKS];     /* Batches: a chunk of one column's values, copied out of row storage */
+
+    int projection[ZDB_LIMIT_COLUMNS];      /* Batches: the query's projection when it was executed */
+    int projectionCount;
+    void* projected[ZDB_LIMIT_COLUMNS];     /* Batches: each projected column's values for the last batch */
+    int projectedCapacity;
+
+    int aggregated;                 /* Aggregate and grouped queries: the rows are results rather than table rows */
+    ZdbAggregateState* aggregates;  /* Aggregate queries: the result row, one state per aggregate */
+    ZdbAggregateState aggregateStates[ZDB_QUERY_AGGREGATES];   /* Ungrouped: where aggregates points */
+    int aggregatePosition;          /* Ungrouped aggregate queries: 0 before the result row, 1 on it and 2 past it */
+
+    int grouped;                    /* Grouped queries: each result row is a group */
+    ZdbGroupBudget groupBudget;
+    ZdbGroupTable groupShape;       /* Grouped: what every table of the current pass is set up with */
+    ZdbGroupTable groups;           /* Grouped: the groups of the current pass */
+    int groupPosition;              /* Grouped: group being returned */
+    int groupPass;                  /* Grouped: partition the current pass finds the groups of */
+    int groupPasses;                /* Grouped: partitions the hash space is cut into */
+    int groupScans;                 /* Grouped: passes made over the rows, counting those started over */
+    int groupsReturned;
+    ZdbZoneValue groupKey[ZDB_QUERY_GROUP_COLUMNS];     /* Grouped: the keys of the current group */
+
+    int joined;                     /* Joins: each result row is a row of each table */
+    int joinRows[ZDB_QUERY_TABLES]; /* Joins: the current row of each table */
+    int buildSide;                  /* Joins: table the hash table was built on, the other being streamed past it */
+    ZdbJoinEntry* joinEntries;      /* Joins: the build side's matching rows, in table order */
+    int joinEntryCount;
+    int* joinBuckets;               /* Joins: first entry of each bucket, -1 for an empty one */
+    int joinBucketCount;            /* Always a power of two */
+    int joinEntry;                  /* Joins: next entry to compare the probe row with */
+    int probeChunk;                 /* Joins: chunk of the probe side being streamed */
+    uint64_t probeMask[ZDB_TOMBSTONE_WORDS];    /* Joins: its rows still to probe with */
+    uint64_t probeHash;
+    void* probeValue;               /* Joins: the probe row's join value */
+
 };
 
 /*
  * Internal functions
  */
 
-int _compareValues(ZdbType* type, void* value1, void* value2, ZdbQueryConditionType conditionType)
+int _compareValues(ZdbType* type, void* value1, void* value2)
 {
     int result = 0;
     ZdbTypeCompare(type, value1, value2, &result);
     return result;
 }
 
-int _matchesQuery(ZdbRecordset* recordset)
+/*
+ * Predicates
+ *
+ * The standard types compare their values directly.  Ints and floats share one set, written with negations so
+ * that NaN falls where the float type's compare puts it: a row holding NaN, or a condition on NaN, counts as the
+ * row being smaller.  Varchars compare with strcmp, and user-defined types go through their compare function
+ */
+
+#define DECLARE_VALUE_PREDICATES(name, type)                                                                    \
+    int _##name##Eq(ZdbType* t, void* v, void* r) { return *(type*)r == *(type*)v; }                            \
+    int _##name##Ne(ZdbType* t, void* v, void* r) { return !(*(type*)r == *(type*)v); }                         \
+    int _##name##Lt(ZdbType* t, void* v, void* r) { return !(*(type*)r >= *(type*)v); }                         \
+    int _##name##Lte(ZdbType* t, void* v, void* r) { return !(*(type*)r > *(type*)v); }                         \
+    int _##name##Gt(ZdbType* t, void* v, void* r) { return *(type*)r > *(type*)v; }                             \
+    int _##name##Gte(ZdbType* t, void* v, void* r) { return *(type*)r >= *(type*)v; }
+
+/* order is the value compared with the row value: negative when the value is smaller */
+#define DECLARE_ORDER_PREDICATES(name, order)                                                                   \
+    int _##name##Eq(ZdbType* t, void* v, void* r) { return (order) == 0; }                                      \
+    int _##name##Ne(ZdbType* t, void* v, void* r) { return (order) != 0; }                                      \
+    int _##name##Lt(ZdbType* t, void* v, void* r) { return (order) > 0; }                                       \
+    int _##name##Lte(ZdbType* t, void* v, void* r) { return (order) >= 0; }                                     \
+    int _##name##Gt(ZdbType* t, void* v, void* r) { return (order) < 0; }                                       \
+    int _##name##Gte(ZdbType* t, void* v, void* r) { return (order) <= 0; }
+
+#define PREDICATES(name) { _##name##Eq, _##name##Ne, _##name##Lt, _##name##Lte, _##name##Gt, _##name##Gte }
+
+DECLARE_VALUE_PREDICATES(int, int)
+DECLARE_VALUE_PREDICATES(float, float)
+DECLARE_ORDER_PREDICATES(varchar, strcmp((char*)v, (char*)r))
+DECLARE_ORDER_PREDICATES(user, _compareValues(t, v, r))
+
+/* Indexed by ZDB_TYPE_ID_*, then by condition type from EQ to GTE */
+static const ZdbQueryPredicate predicates[][ZDB_QUERY_CONDITION_GTE] =
+{
+    [ZDB_TYPE_ID_USER] = PREDICATES(user),
+    [ZDB_TYPE_ID_INT] = PREDICATES(int),
+    [ZDB_TYPE_ID_FLOAT] = PREDICATES(float),
+    [ZDB_TYPE_ID_BOOLEAN] = PREDICATES(int),
+    [ZDB_TYPE_ID_VARCHAR] = PREDICATES(varchar),
+};
+
+ZdbQueryPredicate _compilePredicate(ZdbType* type, ZdbQueryConditionType conditionType)
+{
+    if (conditionType == ZDB_QUERY_CONDITION_IN)
+    {
+        conditionType = ZDB_QUERY_CONDITION_EQ;
+    }
+    if (conditionType < ZDB_QUERY_CONDITION_EQ || conditionType > ZDB_QUERY_CONDITION_GTE)
+    {
+        return NULL;
+    }
+    return predicates[ZdbTypeGetId(type)][conditionType - ZDB_QUERY_CONDITION_EQ];
+}
+
+int _matchesCode(ZdbQuery* query, ZdbQueryCondition* condition, int rowIndex)
+{
+    ZdbTable* table = query->table;
+
+    uint32_t code;
+    ZdbEngineGetValueCode(table, ZdbEngineRowAt(table, rowIndex), condition->columnIndex, &code);
+
+    switch (condition->type)
+    {
+        case ZDB_QUERY_CONDITION_EQ:
+            return code == condition->code;
+        case ZDB_QUERY_CONDITION_NE:
+            return code != condition->code;
+        case ZDB_QUERY_CONDITION_IN:
+            return code < condition->codeSetSize && (condition->codeSet[code / 64] & (1ull << (code % 64)));
+    }
+
+    return 0;
+}
+
+int _matchesList(ZdbQueryCondition* condition, void* value)
 {
-    void* value1 = NULL;
-    void* value2 = NULL;
-    ZdbType* type;
+    for (int i = 0; i < condition->valueCount; i++)
+    {
+        if (condition->predicate(condition->columnType, condition->values[i], value))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
 
-    if (recordset->query->condition.type == ZDB_QUERY_CONDITION_NONE)
+/* Whether the row satisfies the condition.  Only reads the query and the table, so scan workers can share it */
+int _matchesCondition(ZdbQuery* query, ZdbQueryCondition* condition, int rowIndex)
+{
+    if (condition->type == ZDB_QUERY_CONDITION_NONE)
     {
         /* No condition, always match */
         return 1;
     }
 
-    value1 = recordset->query->condition.value;
-    type = recordset->query->table->columns[recordset->query->condition.columnIndex]->type;
+    if (condition->useCodes)
+    {
+        /* Equality on a dictionary encoded column never needs to look at the strings */
+        return _matchesCode(query, condition, rowIndex);
+    }
+
+    void* value;
+    ZdbEngineGetValue(query->table, ZdbEngineRowAt(query->table, rowIndex), condition->columnIndex, &value);
+
+    if (condition->type == ZDB_QUERY_CONDITION_IN)
+    {
+        return _matchesList(condition, value);
+    }
+
+    return condition->predicate(condition->columnType, condition->value, value);
+}
+
+/* Whether the row satisfies every condition, checked in the order the planner put them in */
+int _matchesRow(ZdbQuery* query, int rowIndex)
+{
+    for (int i = 0; i < query->plan.conditionCount; i++)
+    {
+        if (!_matchesCondition(query, &query->conditions[query->plan.conditionOrder[i]], rowIndex))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int _matchesQuery(ZdbRecordset* recordset)
+{
+    return _matchesRow(recordset->query, recordset->rowIndex);
+}
+
+/* Whether any value in the zone could satisfy the condition.  Comparisons are written so that NaN never rules a
+   chunk out */
+int _zoneMayMatch(ZdbQueryCondition* condition, int tag, const ZdbZone* zone, void* value)
+{
+    if (tag == ZDB_LAYOUT_TAG_FLOAT)
+    {
+        float v = *(float*)value;
+        switch (condition->type)
+        {
+            case ZDB_QUERY_CONDITION_EQ:
+                return !(v < zone->min.f || v > zone->max.f);
+            case ZDB_QUERY_CONDITION_NE:
+                return !(v == zone->min.f && v == zone->max.f);
+            case ZDB_QUERY_CONDITION_LT:
+                return !(zone->min.f >= v);
+            case ZDB_QUERY_CONDITION_LTE:
+                return !(zone->min.f > v);
+            case ZDB_QUERY_CONDITION_GT:
+                return !(zone->max.f <= v);
+            case ZDB_QUERY_CONDITION_GTE:
+                return !(zone->max.f < v);
+        }
+        return 1;
+    }
+
+    int v = *(int*)value;
+    switch (condition->type)
+    {
+        case ZDB_QUERY_CONDITION_EQ:
+            return v >= zone->min.i && v <= zone->max.i;
+        case ZDB_QUERY_CONDITION_NE:
+            return !(v == zone->min.i && v == zone->max.i);
+        case ZDB_QUERY_CONDITION_LT:
+            return zone->min.i < v;
+        case ZDB_QUERY_CONDITION_LTE:
+            return zone->min.i <= v;
+        case ZDB_QUERY_CONDITION_GT:
+            return zone->max.i > v;
+        case ZDB_QUERY_CONDITION_GTE:
+            return zone->max.i >= v;
+    }
+    return 1;
+}
+
+/* Whether the chunk's zone leaves any chance of a row in it satisfying the condition */
+int _conditionMayMatch(ZdbQuery* query, ZdbQueryCondition* condition, int chunk)
+{
+    ZdbTable* table = query->table;
+
+    ZdbZone zone;
+    if (condition->type == ZDB_QUERY_CONDITION_NONE ||
+        ZdbEngineGetZone(table, chunk, condition->columnIndex, &zone) != ZDB_RESULT_SUCCESS)
+    {
+        return 1;
+    }
+
+    int tag = table->layout.tags[condition->columnIndex];
+    if (condition->type != ZDB_QUERY_CONDITION_IN)
+    {
+        return _zoneMayMatch(condition, tag, &zone, condition->value);
+    }
+
+    /* IN: any one of the values could be in range */
+    ZdbQueryCondition equals = *condition;
+    equals.type = ZDB_QUERY_CONDITION_EQ;
+    for (int i = 0; i < condition->valueCount; i++)
+    {
+        if (_zoneMayMatch(&equals, tag, &zone, condition->values[i]))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Whether the chunk's zones leave any chance of a row in it matching the query */
+int _chunkMayMatch(ZdbQuery* query, int chunk)
+{
+    for (int i = 0; i < query->plan.conditionCount; i++)
+    {
+        if (!_conditionMayMatch(query, &query->conditions[query->plan.conditionOrder[i]], chunk))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void _freeCondition(ZdbQueryCondition* condition)
+{
+    free(condition->value);
+    for (int i = 0; i < condition->valueCount; i++)
+    {
+        free(condition->values[i]);
+    }
+    free(condition->values);
+    free(condition->codeSet);
+    free(condition->unbound);
+    memset(condition, 0, sizeof(ZdbQueryCondition));
+}
+
+int _hasConditionRoom(ZdbQuery* query, int column)
+{
+    for (int i = 0; i < query->conditionCount; i++)
+    {
+        if (query->conditions[i].columnIndex == column)
+        {
+            return 1;
+        }
+    }
+
+    return query->conditionCount < ZDB_QUERY_CONDITIONS;
+}
+
+/* The condition on the column, emptied to be given over to a new one, or else a new condition */
+ZdbQueryCondition* _takeCondition(ZdbQuery* query, int column)
+{
+    for (int i = 0; i < query->conditionCount; i++)
+    {
+        if (query->conditions[i].columnIndex == column)
+        {
+            _freeCondition(&query->conditions[i]);
+            return &query->conditions[i];
+        }
+    }
+
+    ZdbQueryCondition* condition = &query->conditions[query->conditionCount++];
+    memset(condition, 0, sizeof(ZdbQueryCondition));
+    return condition;
+}
+
+/* Flags the values the condition was given no string for, which have to be bound before it can be evaluated */
+void _markPlaceholders(ZdbQueryCondition* condition, int count, const char** strs)
+{
+    free(condition->unbound);
+    condition->unbound = NULL;
+    condition->unboundCount = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (strs[i] == NULL)
+        {
+            if (condition->unbound == NULL)
+            {
+                condition->unbound = calloc(count, 1);
+            }
+            condition->unbound[i] = 1;
+            condition->unboundCount++;
+        }
+    }
+}
+
+/* Finds the value a parameter is bound into, checking that it is of the type being bound.  Ints also go to
+   boolean columns */
+int _bindValue(ZdbQuery* query, int parameter, int typeId, ZdbQueryCondition** bound, void** value)
+{
+    if (query == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    /* Parameters are numbered on from one condition's values to the next */
+    ZdbQueryCondition* condition = NULL;
+    for (int i = 0; i < query->conditionCount && parameter >= 0 && condition == NULL; i++)
+    {
+        int count = query->conditions[i].type == ZDB_QUERY_CONDITION_IN ? query->conditions[i].valueCount :
+                    query->conditions[i].type != ZDB_QUERY_CONDITION_NONE;
+        if (parameter < count)
+        {
+            condition = &query->conditions[i];
+        }
+        else
+        {
+            parameter -= count;
+        }
+    }
+
+    if (condition == NULL)
+    {
+        /* No condition has such a value */
+        return ZDB_RESULT_NOT_FOUND;
+    }
+
+    int columnTypeId = ZdbTypeGetId(condition->columnType);
+    if (columnTypeId != typeId && (typeId != ZDB_TYPE_ID_INT || columnTypeId != ZDB_TYPE_ID_BOOLEAN))
+    {
+        /* The types do not match */
+        return ZDB_RESULT_INVALID_CAST;
+    }
+
+    if (condition->unbound != NULL && condition->unbound[parameter])
+    {
+        condition->unbound[parameter] = 0;
+        condition->unboundCount--;
+    }
+
+    *bound = condition;
+    *value = condition->type == ZDB_QUERY_CONDITION_IN ? condition->values[parameter] : condition->value;
+    return ZDB_RESULT_SUCCESS;
+}
+
+void _resolveConditionCodes(ZdbQuery* query, ZdbQueryCondition* condition)
+{
+    if (!condition->useCodes)
+    {
+        return;
+    }
+
+    if (condition->type != ZDB_QUERY_CONDITION_IN)
+    {
+        /* A value the dictionary has never seen can't equal any row */
+        if (ZdbEngineLookupCode(query->table, condition->columnIndex, condition->value, &condition->code) != ZDB_RESULT_SUCCESS)
+        {
+            condition->code = ZDB_QUERY_NO_CODE;
+        }
+        return;
+    }
+
+    /* Turn the list into a bitmap over the codes it can match.  Values that aren't in the dictionary can't match
+       anything and are simply left out */
+    int dictionaryCount;
+    char** dictionary;
+    ZdbEngineGetDictionary(query->table, condition->columnIndex, &dictionaryCount, &dictionary);
+
+    /* The bitmap is kept from one run to the next, and only grows with the dictionary */
+    uint32_t words = (dictionaryCount + 63) / 64;
+    if (words > condition->codeSetCapacity || condition->codeSet == NULL)
+    {
+        free(condition->codeSet);
+        condition->codeSetCapacity = words > 0 ? words : 1;
+        condition->codeSet = malloc(condition->codeSetCapacity * sizeof(uint64_t));
+    }
+    memset(condition->codeSet, 0, condition->codeSetCapacity * sizeof(uint64_t));
+    condition->codeSetSize = dictionaryCount;
+    for (int i = 0; i < condition->valueCount; i++)
+    {
+        uint32_t code;
+        if (ZdbEngineLookupCode(query->table, condition->columnIndex, condition->values[i], &code) == ZDB_RESULT_SUCCESS)
+        {
+            condition->codeSet[code / 64] |= 1ull << (code % 64);
+        }
+    }
+}
+
+/* Whether the condition can go through a kernel: a comparison on an int, float or boolean column, or equality on
+   dictionary codes */
+int _hasKernel(ZdbQuery* query, ZdbQueryCondition* condition)
+{
+    if (condition->type < ZDB_QUERY_CONDITION_EQ || condition->type > ZDB_QUERY_CONDITION_GTE)
+    {
+        return 0;
+    }
+
+    int tag = query->table->layout.tags[condition->columnIndex];
+    return tag == ZDB_LAYOUT_TAG_INT || tag == ZDB_LAYOUT_TAG_FLOAT || tag == ZDB_LAYOUT_TAG_BOOLEAN ||
+           (tag == ZDB_LAYOUT_TAG_DICTIONARY && condition->useCodes);
+}
+
+/* A four byte column's values for rows start onwards in the chunk.  PAX chunks already hold them in an array; row
+   storage has them copied out into gather, which holds a chunk */
+void* _chunkValues(ZdbQuery* query, int column, int start, int count, int* gather)
+{
+    ZdbTable* table = query->table;
+
+    if (table->storage == ZDB_STORAGE_PAX)
+    {
+        void* values;
+        int chunkCount;
+        ZdbEngineGetColumnChunk(table, start / ZDB_ROW_CHUNKS, column, &values, &chunkCount);
+        return values;
+    }
+
+    /* Every kernel column is four bytes wide */
+    size_t offset = table->layout.offsets[column];
+    for (int i = 0; i < count; i++)
+    {
+        memcpy(&gather[i], ZdbEngineRowAt(table, start + i)->_rowdata + offset, sizeof(int));
+    }
+    return gather;
+}
+
+/* Sets a bit in mask for each of the count rows from start, which begin a chunk, that match every condition.  The
+   conditions are checked in the planner's order, each only for the rows the ones before it left */
+void _matchChunk(ZdbQuery* query, int start, int count, int* gather, uint64_t* mask)
+{
+    ZdbTable* table = query->table;
+
+    for (int i = 0; i < ZDB_TOMBSTONE_WORDS; i++)
+    {
+        int bits = count - i * 64;
+        mask[i] = bits >= 64 ? ~0ull : bits > 0 ? (1ull << bits) - 1 : 0;
+    }
+
+    for (int c = 0; c < query->plan.conditionCount; c++)
+    {
+        ZdbQueryCondition* condition = &query->conditions[query->plan.conditionOrder[c]];
+        uint64_t left = 0;
+        for (int i = 0; i < ZDB_TOMBSTONE_WORDS; i++)
+        {
+            left |= mask[i];
+        }
+        if (left == 0)
+        {
+            /* No row is left to check */
+            return;
+        }
+
+        if (condition->type == ZDB_QUERY_CONDITION_NONE)
+        {
+            continue;
+        }
+
+        if (_hasKernel(query, condition))
+        {
+            /* Kernels only write the words that cover count rows */
+            uint64_t matches[ZDB_TOMBSTONE_WORDS];
+            memset(matches, 0, sizeof(matches));
+            void* values = _chunkValues(query, condition->columnIndex, start, count, gather);
+            int tag = table->layout.tags[condition->columnIndex];
+            if (tag == ZDB_LAYOUT_TAG_FLOAT)
+            {
+                ZdbKernelCompareFloat(condition->type, values, count, *(float*)condition->value, matches);
+            }
+            else
+            {
+                int operand = tag == ZDB_LAYOUT_TAG_DICTIONARY ? (int)condition->code : *(int*)condition->value;
+                ZdbKernelCompareInt(condition->type, values, count, operand, matches);
+            }
+            for (int i = 0; i < ZDB_TOMBSTONE_WORDS; i++)
+            {
+                mask[i] &= matches[i];
+            }
+            continue;
+        }
+
+        /* Anything else is checked a row at a time */
+        for (int i = 0; i < ZDB_TOMBSTONE_WORDS; i++)
+        {
+            for (uint64_t bits = mask[i]; bits != 0; bits &= bits - 1)
+            {
+                int row = start + i * 64 + __builtin_ctzll(bits);
+                if (ZdbEngineIsRowDeleted(table, row) || !_matchesCondition(query, condition, row))
+                {
+                    mask[i] &= ~(bits & -bits);
+                }
+            }
+        }
+    }
+}
+
+/* Sets a bit in mask for each live row of the chunk that matches the query.  Returns 0 without touching mask when
+   the chunk's zone rules the condition out */
+int _matchLiveRows(ZdbQuery* query, int chunk, int* gather, uint64_t* mask)
+{
+    ZdbTable* table = query->table;
+    if (!_chunkMayMatch(query, chunk))
+    {
+        return 0;
+    }
+
+    int start = chunk * ZDB_ROW_CHUNKS;
+    int rows = table->rowCount - start < ZDB_ROW_CHUNKS ? table->rowCount - start : ZDB_ROW_CHUNKS;
+    _matchChunk(query, start, rows, gather, mask);
+    for (int i = 0; i < ZDB_TOMBSTONE_WORDS; i++)
+    {
+        mask[i] &= ~table->tombstones[chunk * ZDB_TOMBSTONE_WORDS + i];
+    }
+    return 1;
+}
 
-    ZdbQueryGetValue(recordset, recordset->query->condition.columnIndex, type, &value2);
-    int result = _compareValues(type, value1, value2, recordset->query->condition.type);
+/*
+ * Aggregates
+ */
+
+void _initAggregates(ZdbQuery* query, ZdbAggregateState* states)
+{
+    for (int i = 0; i < query->aggregateCount; i++)
+    {
+        memset(&states[i], 0, sizeof(ZdbAggregateState));
+        states[i].intMin = INT_MAX;
+        states[i].intMax = INT_MIN;
+        states[i].floatMin = INFINITY;
+        states[i].floatMax = -INFINITY;
+    }
+}
+
+void _mergeAggregates(ZdbQuery* query, ZdbAggregateState* states, const ZdbAggregateState* partial)
+{
+    for (int i = 0; i < query->aggregateCount; i++)
+    {
+        states[i].count += partial[i].count;
+        states[i].intSum += partial[i].intSum;
+        states[i].floatSum += partial[i].floatSum;
+        states[i].intMin = partial[i].intMin < states[i].intMin ? partial[i].intMin : states[i].intMin;
+        states[i].intMax = partial[i].intMax > states[i].intMax ? partial[i].intMax : states[i].intMax;
+        states[i].floatMin = partial[i].floatMin < states[i].floatMin ? partial[i].floatMin : states[i].floatMin;
+        states[i].floatMax = partial[i].floatMax > states[i].floatMax ? partial[i].floatMax : states[i].floatMax;
+    }
+}
+
+/* Takes in the values whose bit is set in mask, of which there are matches */
+void _accumulate(ZdbQuery* query, int aggregate, ZdbAggregateState* state, void* values, int count,
+                 const uint64_t* mask, int matches)
+{
+    ZdbQueryAggregate* a = &query->aggregates[aggregate];
+    int isFloat = a->column >= 0 && query->table->layout.tags[a->column] == ZDB_LAYOUT_TAG_FLOAT;
+    switch (a->function)
+    {
+        case ZDB_AGG_SUM:
+        case ZDB_AGG_AVG:
+            if (isFloat)
+                state->floatSum += ZdbKernelSumFloat(values, count, mask);
+            else
+                state->intSum += ZdbKernelSumInt(values, count, mask);
+            state->count += matches;
+            break;
+        case ZDB_AGG_MIN:
+        case ZDB_AGG_MAX:
+            if (isFloat)
+            {
+                state->count += ZdbKernelMinMaxFloat(values, count, mask, &state->floatMin, &state->floatMax);
+            }
+            else
+            {
+                ZdbKernelMinMaxInt(values, count, mask, &state->intMin, &state->intMax);
+                state->count += matches;
+            }
+            break;
+        default:
+            state->count += matches;
+            break;
+    }
+}
+
+/* Aggregates the chunk's matching rows, a column at a time */
+void _aggregateChunk(ZdbQuery* query, int chunk, int* gather, ZdbAggregateState* states)
+{
+    uint64_t mask[ZDB_TOMBSTONE_WORDS];
+    if (!_matchLiveRows(query, chunk, gather, mask))
+    {
+        return;
+    }
+
+    int matches = 0;
+    for (int i = 0; i < ZDB_TOMBSTONE_WORDS; i++)
+    {
+        matches += __builtin_popcountll(mask[i]);
+    }
+    if (matches == 0)
+    {
+        return;
+    }
+
+    int start = chunk * ZDB_ROW_CHUNKS;
+    int rows = query->table->rowCount - start < ZDB_ROW_CHUNKS ? query->table->rowCount - start : ZDB_ROW_CHUNKS;
+    for (int i = 0; i < query->aggregateCount; i++)
+    {
+        void* values = NULL;
+        if (query->aggregates[i].function != ZDB_AGG_COUNT)
+        {
+            values = _chunkValues(query, query->aggregates[i].column, start, rows, gather);
+        }
+        _accumulate(query, i, &states[i], values, rows, mask, matches);
+    }
+}
+
+/* Aggregates one row, for rows found through an index */
+void _aggregateRow(ZdbQuery* query, int rowIndex, ZdbAggregateState* states)
+{
+    const uint64_t mask[1] = { 1 };
+    for (int i = 0; i < query->aggregateCount; i++)
+    {
+        void* value = NULL;
+        if (query->aggregates[i].function != ZDB_AGG_COUNT)
+        {
+            ZdbEngineGetValue(query->table, ZdbEngineRowAt(query->table, rowIndex), query->aggregates[i].column, &value);
+        }
+        _accumulate(query, i, &states[i], value, 1, mask, 1);
+    }
+}
+
+/*
+ * Grouping
+ *
+ * Groups are found through an open addressed hash table of their keys, held inline as four byte words: ints and
+ * booleans as themselves, floats by their bits and dictionary encoded varchars by their codes.  When every key has
+ * a small domain - dictionary codes, and ints and booleans whose zones span a short range - a group's number is
+ * worked out from its keys directly and nothing is hashed.
+ *
+ * Every table of a query draws on one memory budget.  A pass whose groups don't fit starts over with the hash space
+ * cut into twice as many partitions, keeping only the groups of its own partition; once they have all been returned
+ * the next partition is found by another pass
+ */
+
+#define ZDB_QUERY_GROUP_DIRECT      65536       /* Most groups a small domain can have */
+#define ZDB_QUERY_GROUP_PASSES      65536       /* Partitions after which the budget is given up on */
+#define ZDB_QUERY_GROUP_START       16          /* Groups a hashed table has room for to begin with */
+
+/* Takes bytes from the budget, failing if that would go over the limit unless the bytes have to be found anyway */
+int _takeGroupMemory(ZdbGroupBudget* budget, size_t bytes, int force)
+{
+    size_t used = __atomic_add_fetch(&budget->used, bytes, __ATOMIC_RELAXED);
+    if (used > budget->limit && !force)
+    {
+        __atomic_sub_fetch(&budget->used, bytes, __ATOMIC_RELAXED);
+        __atomic_store_n(&budget->overflow, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    size_t peak = __atomic_load_n(&budget->peak, __ATOMIC_RELAXED);
+    while (used > peak && !__atomic_compare_exchange_n(&budget->peak, &peak, used, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+    return 1;
+}
+
+uint64_t _hashGroupKey(const int32_t* key, int count)
+{
+    uint64_t hash = 0x9E3779B97F4A7C15ull;
+    for (int i = 0; i < count; i++)
+    {
+        hash = (hash ^ (uint32_t)key[i]) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+    }
+    hash *= 0xC4CEB9FE1A85EC53ull;
+    return hash ^ (hash >> 29);
+}
+
+/* The word a value is grouped by.  Floats that compare equal share one: -0 is 0, and every NaN is the same NaN */
+int32_t _groupKeyWord(int tag, int32_t word)
+{
+    if (tag == ZDB_LAYOUT_TAG_FLOAT)
+    {
+        float value;
+        memcpy(&value, &word, sizeof(float));
+        if (value == 0.0f)
+        {
+            return 0;
+        }
+        if (isnan(value))
+        {
+            return 0x7FC00000;
+        }
+    }
+    return word;
+}
+
+/* Whether the grouping can go straight to its groups, filling in each key's range in shape when it can */
+int _groupDomain(ZdbQuery* query, ZdbGroupTable* shape, size_t* groupCount)
+{
+    ZdbTable* table = query->table;
+    int chunkCount = (table->rowCount + ZDB_ROW_CHUNKS - 1) / ZDB_ROW_CHUNKS;
+    *groupCount = 1;
+    for (int k = 0; k < shape->keyCount; k++)
+    {
+        int column = shape->columns[k];
+        int64_t min = 0, max = 0;
+        if (shape->tags[k] == ZDB_LAYOUT_TAG_DICTIONARY)
+        {
+            max = table->dictionaries[column]->count - 1;
+        }
+        else if (shape->tags[k] == ZDB_LAYOUT_TAG_INT || shape->tags[k] == ZDB_LAYOUT_TAG_BOOLEAN)
+        {
+            /* Zones can be wider than their rows but never narrower.  Rows never written hold 0 */
+            int any = 0;
+            for (int chunk = 0; chunk < chunkCount; chunk++)
+            {
+                ZdbZone* zone = &table->zones[chunk * table->columnCount + column];
+                if (zone->min.i <= zone->max.i)
+                {
+                    min = !any || zone->min.i < min ? zone->min.i : min;
+                    max = !any || zone->max.i > max ? zone->max.i : max;
+                    any = 1;
+                }
+                if (table->newRows[chunk] > 0)
+                {
+                    min = !any || min > 0 ? 0 : min;
+                    max = !any || max < 0 ? 0 : max;
+                    any = 1;
+                }
+            }
+        }
+        else
+        {
+            return 0;
+        }
+
+        if (max - min + 1 > ZDB_QUERY_GROUP_DIRECT || (int64_t)*groupCount * (max - min + 1) > ZDB_QUERY_GROUP_DIRECT)
+        {
+            return 0;
+        }
+        shape->bases[k] = (int)min;
+        shape->sizes[k] = (int)(max - min + 1);
+        *groupCount *= (size_t)(max - min + 1);
+    }
+    return 1;
+}
+
+size_t _groupBytes(const ZdbGroupTable* groups, int capacity)
+{
+    return capacity * (groups->keyCount * sizeof(int32_t) + groups->aggregateCount * sizeof(ZdbAggregateState) + sizeof(int64_t));
+}
+
+void _initGroupStates(ZdbQuery* query, ZdbGroupTable* groups, int first, int end)
+{
+    for (int g = first; g < end; g++)
+    {
+        _initAggregates(query, groups->states + (size_t)g * groups->aggregateCount);
+    }
+}
+
+/* Sets up an empty table shaped like shape.  Its first arrays are always allocated, even past the budget's limit */
+void _initGroupTable(ZdbQuery* query, ZdbGroupTable* groups, const ZdbGroupTable* shape)
+{
+    *groups = *shape;
+    if (groups->direct)
+    {
+        groups->capacity = 1;
+        for (int k = 0; k < groups->keyCount; k++)
+        {
+            groups->capacity *= groups->sizes[k];
+        }
+        groups->groupCount = groups->capacity;
+        groups->slotCount = 0;
+    }
+    else
+    {
+        groups->capacity = ZDB_QUERY_GROUP_START;
+        groups->groupCount = 0;
+        groups->slotCount = ZDB_QUERY_GROUP_START * 2;
+    }
+
+    groups->bytes = _groupBytes(groups, groups->capacity) + groups->slotCount * sizeof(uint64_t);
+    _takeGroupMemory(groups->budget, groups->bytes, 1);
+    groups->slots = groups->slotCount > 0 ? calloc(groups->slotCount, sizeof(uint64_t)) : NULL;
+    groups->keys = groups->direct ? NULL : malloc(groups->capacity * groups->keyCount * sizeof(int32_t));
+    groups->states = malloc(groups->capacity * groups->aggregateCount * sizeof(ZdbAggregateState) + 1);
+    groups->rows = calloc(groups->capacity, sizeof(int64_t));
+    _initGroupStates(query, groups, 0, groups->capacity);
+}
+
+void _freeGroupTable(ZdbGroupTable* groups)
+{
+    if (groups->budget != NULL)
+    {
+        __atomic_sub_fetch(&groups->budget->used, groups->bytes, __ATOMIC_RELAXED);
+    }
+    free(groups->slots);
+    free(groups->keys);
+    free(groups->states);
+    free(groups->rows);
+    groups->slots = NULL;
+    groups->keys = NULL;
+    groups->states = NULL;
+    groups->rows = NULL;
+    groups->groupCount = 0;
+    groups->capacity = 0;
+    groups->slotCount = 0;
+    groups->bytes = 0;
+}
+
+/* The keys of group number group */
+void _groupKeys(const ZdbGroupTable* groups, int group, int32_t* key)
+{
+    if (!groups->direct)
+    {
+        memcpy(key, groups->keys + (size_t)group * groups->keyCount, groups->keyCount * sizeof(int32_t));
+        return;
+    }
+
+    /* The first key is the most significant, so direct groups come out in key order */
+    for (int k = groups->keyCount - 1; k >= 0; k--)
+    {
+        key[k] = groups->bases[k] + group % groups->sizes[k];
+        group /= groups->sizes[k];
+    }
+}
+
+/* Doubles the room for groups, or the hash slots once they are half full.  Returns 0 if the budget won't stretch */
+int _growGroupTable(ZdbQuery* query, ZdbGroupTable* groups)
+{
+    if (groups->groupCount == groups->capacity)
+    {
+        int capacity = groups->capacity * 2;
+        size_t bytes = _groupBytes(groups, capacity) - _groupBytes(groups, groups->capacity);
+        if (!_takeGroupMemory(groups->budget, bytes, 0))
+        {
+            return 0;
+        }
+        groups->bytes += bytes;
+        groups->keys = realloc(groups->keys, capacity * groups->keyCount * sizeof(int32_t));
+        groups->states = realloc(groups->states, capacity * groups->aggregateCount * sizeof(ZdbAggregateState) + 1);
+        groups->rows = realloc(groups->rows, capacity * sizeof(int64_t));
+        memset(groups->rows + groups->capacity, 0, (capacity - groups->capacity) * sizeof(int64_t));
+        _initGroupStates(query, groups, groups->capacity, capacity);
+        groups->capacity = capacity;
+    }
+
+    if (groups->groupCount * 2 >= groups->slotCount)
+    {
+        int slotCount = groups->slotCount * 2;
+        size_t bytes = groups->slotCount * sizeof(uint64_t);
+        if (!_takeGroupMemory(groups->budget, bytes, 0))
+        {
+            return 0;
+        }
+        groups->bytes += bytes;
+        free(groups->slots);
+        groups->slots = calloc(slotCount, sizeof(uint64_t));
+        groups->slotCount = slotCount;
+        for (int g = 0; g < groups->groupCount; g++)
+        {
+            uint64_t hash = _hashGroupKey(groups->keys + (size_t)g * groups->keyCount, groups->keyCount);
+            int slot = (int)(hash & (slotCount - 1));
+            while (groups->slots[slot] != 0)
+            {
+                slot = (slot + 1) & (slotCount - 1);
+            }
+            groups->slots[slot] = (hash & 0xFFFFFFFF00000000ull) | (uint64_t)(g + 1);
+        }
+    }
+
+    return 1;
+}
+
+#define ZDB_GROUP_OVERFLOW      -1      /* The group would have gone over the budget */
+#define ZDB_GROUP_ELSEWHERE     -2      /* The group belongs to another partition */
+
+/* The number of the group with these keys, added if it's new */
+int _findGroup(ZdbQuery* query, ZdbGroupTable* groups, const int32_t* key)
+{
+    if (groups->direct)
+    {
+        int group = 0;
+        for (int k = 0; k < groups->keyCount; k++)
+        {
+            group = group * groups->sizes[k] + (key[k] - groups->bases[k]);
+        }
+        return group;
+    }
+
+    uint64_t hash = _hashGroupKey(key, groups->keyCount);
+    if (groups->partitionBits > 0 && hash >> (64 - groups->partitionBits) != groups->partition)
+    {
+        return ZDB_GROUP_ELSEWHERE;
+    }
+
+    uint64_t tag = hash & 0xFFFFFFFF00000000ull;
+    int slot = (int)(hash & (groups->slotCount - 1));
+    while (groups->slots[slot] != 0)
+    {
+        uint64_t entry = groups->slots[slot];
+        int group = (int)(entry & 0xFFFFFFFF) - 1;
+        if ((entry & 0xFFFFFFFF00000000ull) == tag &&
+            memcmp(groups->keys + (size_t)group * groups->keyCount, key, groups->keyCount * sizeof(int32_t)) == 0)
+        {
+            return group;
+        }
+        slot = (slot + 1) & (groups->slotCount - 1);
+    }
+
+    if (groups->groupCount == groups->capacity || (groups->groupCount + 1) * 2 > groups->slotCount)
+    {
+        if (!_growGroupTable(query, groups))
+        {
+            return ZDB_GROUP_OVERFLOW;
+        }
+
+        /* The slots may have been rebuilt */
+        slot = (int)(hash & (groups->slotCount - 1));
+        while (groups->slots[slot] != 0)
+        {
+            slot = (slot + 1) & (groups->slotCount - 1);
+        }
+    }
+
+    int group = groups->groupCount++;
+    memcpy(groups->keys + (size_t)group * groups->keyCount, key, groups->keyCount * sizeof(int32_t));
+    groups->slots[slot] = tag | (uint64_t)(group + 1);
+    return group;
+}
+
+/* Takes one value into an aggregate's state, for grouped queries, which can't add up a chunk at a time */
+void _accumulateValue(ZdbQuery* query, int aggregate, ZdbAggregateState* state, const void* value)
+{
+    ZdbQueryAggregate* a = &query->aggregates[aggregate];
+    if (a->function == ZDB_AGG_COUNT)
+    {
+        state->count++;
+    }
+    else if (query->table->layout.tags[a->column] == ZDB_LAYOUT_TAG_FLOAT)
+    {
+        float f;
+        memcpy(&f, value, sizeof(float));
+        if (a->function == ZDB_AGG_SUM || a->function == ZDB_AGG_AVG)
+        {
+            state->floatSum += f;
+            state->count++;
+        }
+        else if (!isnan(f))
+        {
+            state->floatMin = f < state->floatMin ? f : state->floatMin;
+            state->floatMax = f > state->floatMax ? f : state->floatMax;
+            state->count++;
+        }
+    }
+    else
+    {
+        int i;
+        memcpy(&i, value, sizeof(int));
+        state->intSum += i;
+        state->intMin = i < state->intMin ? i : state->intMin;
+        state->intMax = i > state->intMax ? i : state->intMax;
+        state->count++;
+    }
+}
+
+/* Takes the values at found into the states of their groups, skipping rows whose group is elsewhere.  The choice
+   of accumulation is made once for the lot rather than a row at a time */
+void _accumulateGroups(ZdbQuery* query, int aggregate, ZdbGroupTable* groups, const int32_t* values, const int* found,
+                       const int* groupOf, int count)
+{
+    ZdbQueryAggregate* a = &query->aggregates[aggregate];
+    ZdbAggregateState* states = groups->states + aggregate;
+    int stride = groups->aggregateCount;
+    if (a->function == ZDB_AGG_COUNT)
+    {
+        for (int j = 0; j < count; j++)
+        {
+            if (groupOf[j] >= 0)
+                states[(size_t)groupOf[j] * stride].count++;
+        }
+    }
+    else if (query->table->layout.tags[a->column] == ZDB_LAYOUT_TAG_FLOAT &&
+             (a->function == ZDB_AGG_SUM || a->function == ZDB_AGG_AVG))
+    {
+        const float* floats = (const float*)values;
+        for (int j = 0; j < count; j++)
+        {
+            if (groupOf[j] >= 0)
+            {
+                ZdbAggregateState* state = &states[(size_t)groupOf[j] * stride];
+                state->floatSum += floats[found[j]];
+                state->count++;
+            }
+        }
+    }
+    else if (query->table->layout.tags[a->column] != ZDB_LAYOUT_TAG_FLOAT &&
+             (a->function == ZDB_AGG_SUM || a->function == ZDB_AGG_AVG))
+    {
+        for (int j = 0; j < count; j++)
+        {
+            if (groupOf[j] >= 0)
+            {
+                ZdbAggregateState* state = &states[(size_t)groupOf[j] * stride];
+                state->intSum += values[found[j]];
+                state->count++;
+            }
+        }
+    }
+    else
+    {
+        for (int j = 0; j < count; j++)
+        {
+            if (groupOf[j] >= 0)
+                _accumulateValue(query, aggregate, &states[(size_t)groupOf[j] * stride], &values[found[j]]);
+        }
+    }
+}
+
+/* Adds the chunk's matching rows to their groups.  Returns 0 if the groups ran out of memory */
+int _groupChunk(ZdbQuery* query, int chunk, int* gather, ZdbGroupTable* groups)
+{
+    uint64_t mask[ZDB_TOMBSTONE_WORDS];
+    if (!_matchLiveRows(query, chunk, gather, mask))
+    {
+        return 1;
+    }
+
+    int found[ZDB_ROW_CHUNKS];
+    int count = 0;
+    for (int i = 0; i < ZDB_TOMBSTONE_WORDS; i++)
+    {
+        while (mask[i] != 0)
+        {
+            found[count++] = i * 64 + __builtin_ctzll(mask[i]);
+            mask[i] &= mask[i] - 1;
+        }
+    }
+    if (count == 0)
+    {
+        return 1;
+    }
+
+    int start = chunk * ZDB_ROW_CHUNKS;
+    int rows = query->table->rowCount - start < ZDB_ROW_CHUNKS ? query->table->rowCount - start : ZDB_ROW_CHUNKS;
+    int groupOf[ZDB_ROW_CHUNKS];
+    if (groups->direct)
+    {
+        /* Direct keys are never floats, so their words need no tidying up */
+        memset(groupOf, 0, count * sizeof(int));
+        for (int k = 0; k < groups->keyCount; k++)
+        {
+            const int32_t* values = _chunkValues(query, groups->columns[k], start, rows, gather);
+            for (int j = 0; j < count; j++)
+            {
+                groupOf[j] = groupOf[j] * groups->sizes[k] + (values[found[j]] - groups->bases[k]);
+            }
+        }
+        for (int j = 0; j < count; j++)
+        {
+            groups->rows[groupOf[j]]++;
+        }
+    }
+    else
+    {
+        int32_t keys[ZDB_ROW_CHUNKS * ZDB_QUERY_GROUP_COLUMNS];
+        for (int k = 0; k < groups->keyCount; k++)
+        {
+            const int32_t* values = _chunkValues(query, groups->columns[k], start, rows, gather);
+            for (int j = 0; j < count; j++)
+            {
+                keys[j * groups->keyCount + k] = _groupKeyWord(groups->tags[k], values[found[j]]);
+            }
+        }
+
+        for (int j = 0; j < count; j++)
+        {
+            groupOf[j] = _findGroup(query, groups, keys + j * groups->keyCount);
+            if (groupOf[j] == ZDB_GROUP_OVERFLOW)
+            {
+                return 0;
+            }
+            if (groupOf[j] >= 0)
+            {
+                groups->rows[groupOf[j]]++;
+            }
+        }
+    }
+
+    for (int a = 0; a < groups->aggregateCount; a++)
+    {
+        const int32_t* values = NULL;
+        if (query->aggregates[a].function != ZDB_AGG_COUNT)
+        {
+            values = _chunkValues(query, query->aggregates[a].column, start, rows, gather);
+        }
+        _accumulateGroups(query, a, groups, values, found, groupOf, count);
+    }
+
+    return 1;
+}
+
+/* Adds one row to its group, for rows found through an index.  Returns 0 if the groups ran out of memory */
+int _groupRow(ZdbQuery* query, int rowIndex, ZdbGroupTable* groups)
+{
+    ZdbTable* table = query->table;
+    ZdbRow* row = ZdbEngineRowAt(table, rowIndex);
+    int32_t key[ZDB_QUERY_GROUP_COLUMNS];
+    for (int k = 0; k < groups->keyCount; k++)
+    {
+        if (groups->tags[k] == ZDB_LAYOUT_TAG_DICTIONARY)
+        {
+            uint32_t code;
+            ZdbEngineGetValueCode(table, row, groups->columns[k], &code);
+            key[k] = (int32_t)code;
+        }
+        else
+        {
+            void* value;
+            ZdbEngineGetValue(table, row, groups->columns[k], &value);
+            memcpy(&key[k], value, sizeof(int32_t));
+            key[k] = _groupKeyWord(groups->tags[k], key[k]);
+        }
+    }
+
+    int group = _findGroup(query, groups, key);
+    if (group < 0)
+    {
+        return group != ZDB_GROUP_OVERFLOW;
+    }
+
+    groups->rows[group]++;
+    for (int a = 0; a < groups->aggregateCount; a++)
+    {
+        void* value = NULL;
+        if (query->aggregates[a].function != ZDB_AGG_COUNT)
+        {
+            ZdbEngineGetValue(table, row, query->aggregates[a].column, &value);
+        }
+        _accumulateValue(query, a, groups->states + (size_t)group * groups->aggregateCount + a, value);
+    }
+    return 1;
+}
+
+/* Folds the groups of from into groups.  Returns 0 if they ran out of memory */
+int _mergeGroups(ZdbQuery* query, ZdbGroupTable* groups, const ZdbGroupTable* from)
+{
+    for (int g = 0; g < from->groupCount; g++)
+    {
+        if (from->rows[g] == 0)
+        {
+            continue;
+        }
+
+        int32_t key[ZDB_QUERY_GROUP_COLUMNS];
+        _groupKeys(from, g, key);
+        int group = _findGroup(query, groups, key);
+        if (group == ZDB_GROUP_OVERFLOW)
+        {
+            return 0;
+        }
+        groups->rows[group] += from->rows[g];
+        _mergeAggregates(query, groups->states + (size_t)group * groups->aggregateCount,
+                         from->states + (size_t)g * from->aggregateCount);
+    }
+    return 1;
+}
+
+/*
+ * Parallel scans
+ *
+ * The table is cut into morsels of ZDB_QUERY_MORSEL_CHUNKS chunks.  Each worker starts with an even share of them
+ * in its own queue and takes them from the front; a worker whose queue runs dry steals the back half of another
+ * one.  Matches are found a chunk at a time, the same way batches find them.  Ordered scans write each morsel's
+ * matches where its rows start and close up the gaps once every worker is done; unordered scans reserve room in
+ * one packed array as each morsel finishes.  Aggregate queries keep no rows: each worker aggregates into its own
+ * states or group table, and those are merged at the end.  Scans for a limited number of rows stop once they have
+ * them: unordered ones as soon as that many are found, ordered ones once the morsels finished from the first on
+ * hold that many
+ */
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    int next;                   /* Morsels next to end are still to be scanned */
+    int end;
+} ZdbScanQueue;
+
+typedef struct
+{
+    ZdbQuery* query;
+    int firstChunk;             /* Morsel m starts at chunk firstChunk + m * ZDB_QUERY_MORSEL_CHUNKS */
+    int firstRow;               /* Rows before it don't match */
+    int wanted;                 /* Matches the recordset can return, INT_MAX for every one */
+    int done;                   /* Set once enough matches are found, for workers to stop taking morsels */
+    int morselCount;
+    int workerCount;
+    ZdbScanQueue* queues;
+    int* rows;                  /* Matching rows.  Ordered: morsel m's from m * morselRows */
+    int* morselCounts;          /* Ordered: matches in each morsel, -1 until it's scanned */
+    int rowCount;               /* Unordered: matches so far, added to atomically */
+    ZdbAggregateState* states;  /* Aggregate queries: each worker's partial aggregates, one after another */
+    ZdbGroupTable* groups;      /* Grouped queries: each worker's groups */
+} ZdbParallelScan;
+
+typedef struct
+{
+    ZdbParallelScan* scan;
+    int id;
+    pthread_t thread;
+} ZdbScanWorker;
+
+#define ZDB_QUERY_MORSEL_ROWS   (ZDB_QUERY_MORSEL_CHUNKS * ZDB_ROW_CHUNKS)
+
+/* The next morsel for the worker, or -1 once every queue is empty */
+int _takeMorsel(ZdbParallelScan* scan, int worker)
+{
+    ZdbScanQueue* own = &scan->queues[worker];
+    pthread_mutex_lock(&own->lock);
+    int morsel = own->next < own->end ? own->next++ : -1;
+    pthread_mutex_unlock(&own->lock);
+    if (morsel >= 0)
+    {
+        return morsel;
+    }
+
+    for (int i = 1; i < scan->workerCount; i++)
+    {
+        ZdbScanQueue* victim = &scan->queues[(worker + i) % scan->workerCount];
+        pthread_mutex_lock(&victim->lock);
+        int first = victim->end - (victim->end - victim->next + 1) / 2;
+        int end = victim->end;
+        victim->end = first;
+        pthread_mutex_unlock(&victim->lock);
+
+        if (first < end)
+        {
+            /* Keep the first of the stolen morsels and queue the rest */
+            pthread_mutex_lock(&own->lock);
+            own->next = first + 1;
+            own->end = end;
+            pthread_mutex_unlock(&own->lock);
+            return first;
+        }
+    }
+
+    return -1;
+}
+
+/* Finds the morsel's matches and returns how many there were */
+int _scanMorsel(ZdbParallelScan* scan, int morsel, int* gather, int* found)
+{
+    ZdbTable* table = scan->query->table;
+    int chunkCount = (table->rowCount + ZDB_ROW_CHUNKS - 1) / ZDB_ROW_CHUNKS;
+    int firstChunk = scan->firstChunk + morsel * ZDB_QUERY_MORSEL_CHUNKS;
+    int endChunk = firstChunk + ZDB_QUERY_MORSEL_CHUNKS < chunkCount ? firstChunk + ZDB_QUERY_MORSEL_CHUNKS : chunkCount;
+
+    int count = 0;
+    for (int chunk = firstChunk; chunk < endChunk; chunk++)
+    {
+        uint64_t mask[ZDB_TOMBSTONE_WORDS];
+        if (!_matchLiveRows(scan->query, chunk, gather, mask))
+        {
+            continue;
+        }
+
+        for (int i = 0; i < ZDB_TOMBSTONE_WORDS; i++)
+        {
+            while (mask[i] != 0)
+            {
+                found[count] = chunk * ZDB_ROW_CHUNKS + i * 64 + __builtin_ctzll(mask[i]);
+                count += found[count] >= scan->firstRow;
+                mask[i] &= mask[i] - 1;
+            }
+        }
+    }
+
+    return count;
+}
+
+void* _scanWorkerMain(void* arg)
+{
+    ZdbScanWorker* worker = arg;
+    ZdbParallelScan* scan = worker->scan;
+    int gather[ZDB_ROW_CHUNKS];
+    int* found = scan->rows != NULL && scan->morselCounts == NULL ? malloc(ZDB_QUERY_MORSEL_ROWS * sizeof(int)) : NULL;
+
+    int morsel;
+    while (!__atomic_load_n(&scan->done, __ATOMIC_RELAXED) && (morsel = _takeMorsel(scan, worker->id)) >= 0)
+    {
+        if (scan->groups != NULL)
+        {
+            /* Once any worker's groups don't fit the pass is started over, so the rest of it can be skipped */
+            ZdbGroupTable* groups = &scan->groups[worker->id];
+            ZdbQuery* query = scan->query;
+            int chunkCount = (query->table->rowCount + ZDB_ROW_CHUNKS - 1) / ZDB_ROW_CHUNKS;
+            int endChunk = (morsel + 1) * ZDB_QUERY_MORSEL_CHUNKS < chunkCount ? (morsel + 1) * ZDB_QUERY_MORSEL_CHUNKS : chunkCount;
+            for (int chunk = morsel * ZDB_QUERY_MORSEL_CHUNKS;
+                 chunk < endChunk && !__atomic_load_n(&groups->budget->overflow, __ATOMIC_RELAXED); chunk++)
+            {
+                _groupChunk(query, chunk, gather, groups);
+            }
+        }
+        else if (scan->states != NULL)
+        {
+            ZdbQuery* query = scan->query;
+            int chunkCount = (query->table->rowCount + ZDB_ROW_CHUNKS - 1) / ZDB_ROW_CHUNKS;
+            int endChunk = (morsel + 1) * ZDB_QUERY_MORSEL_CHUNKS < chunkCount ? (morsel + 1) * ZDB_QUERY_MORSEL_CHUNKS : chunkCount;
+            for (int chunk = morsel * ZDB_QUERY_MORSEL_CHUNKS; chunk < endChunk; chunk++)
+            {
+                _aggregateChunk(query, chunk, gather, scan->states + worker->id * query->aggregateCount);
+            }
+        }
+        else if (scan->morselCounts != NULL)
+        {
+            int count = _scanMorsel(scan, morsel, gather, scan->rows + morsel * ZDB_QUERY_MORSEL_ROWS);
+            __atomic_store_n(&scan->morselCounts[morsel], count, __ATOMIC_RELEASE);
+
+            /* Enough once the unbroken run of finished morsels from the first holds the rows wanted */
+            long total = 0;
+            for (int m = 0; scan->wanted != INT_MAX && m < scan->morselCount; m++)
+            {
+                int matches = __atomic_load_n(&scan->morselCounts[m], __ATOMIC_ACQUIRE);
+                if (matches < 0)
+                {
+                    break;
+                }
+                total += matches;
+                if (total >= scan->wanted)
+                {
+                    __atomic_store_n(&scan->done, 1, __ATOMIC_RELAXED);
+                    break;
+                }
+            }
+        }
+        else
+        {
+            int count = _scanMorsel(scan, morsel, gather, found);
+            int at = __atomic_fetch_add(&scan->rowCount, count, __ATOMIC_RELAXED);
+            memcpy(scan->rows + at, found, count * sizeof(int));
+            if ((long)at + count >= scan->wanted)
+            {
+                __atomic_store_n(&scan->done, 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    free(found);
+    return NULL;
+}
+
+/* Finds every match with the query's threads, or for aggregate queries works out the recordset's aggregates or
+   the current pass's groups.  Returns 0, leaving the recordset to scan as usual, when the table is too small to
+   share out */
+int _parallelScan(ZdbRecordset* recordset)
+{
+    ZdbQuery* query = recordset->query;
+    ZdbTable* table = query->table;
+    int firstRow = recordset->afterRow + 1;
+    int firstChunk = firstRow / ZDB_ROW_CHUNKS;
+    int chunkCount = (table->rowCount + ZDB_ROW_CHUNKS - 1) / ZDB_ROW_CHUNKS - firstChunk;
+    int morselCount = chunkCount > 0 ? (chunkCount + ZDB_QUERY_MORSEL_CHUNKS - 1) / ZDB_QUERY_MORSEL_CHUNKS : 0;
+
+    int workerCount = query->threads > 0 ? query->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    workerCount = workerCount < morselCount ? workerCount : morselCount;
+    if (workerCount < 2)
+    {
+        return 0;
+    }
+
+    ZdbParallelScan scan;
+    scan.query = query;
+    scan.firstChunk = firstChunk;
+    scan.firstRow = firstRow;
+    scan.wanted = INT_MAX;
+    if (recordset->limit != ZDB_QUERY_NO_LIMIT && !recordset->sorted && !recordset->aggregated)
+    {
+        long wanted = (long)recordset->offset + recordset->limit;
+        scan.wanted = wanted < INT_MAX ? (int)wanted : INT_MAX;
+    }
+    scan.done = 0;
+    scan.morselCount = morselCount;
+    scan.workerCount = workerCount;
+    scan.queues = malloc(workerCount * sizeof(ZdbScanQueue));
+    int grouping = recordset->grouped;
+    int aggregating = recordset->aggregated && !grouping;
+    scan.rows = recordset->aggregated ? NULL : malloc(table->rowCount * sizeof(int));
+    scan.morselCounts = NULL;
+    if ((query->ordered || recordset->sorted || recordset->paged) && !recordset->aggregated)
+    {
+        scan.morselCounts = malloc(morselCount * sizeof(int));
+        memset(scan.morselCounts, 0xFF, morselCount * sizeof(int));
+    }
+    scan.rowCount = 0;
+    scan.states = aggregating ? malloc(workerCount * query->aggregateCount * sizeof(ZdbAggregateState)) : NULL;
+    scan.groups = grouping ? malloc(workerCount * sizeof(ZdbGroupTable)) : NULL;
+
+    ZdbScanWorker* workers = malloc(workerCount * sizeof(ZdbScanWorker));
+    int* started = calloc(workerCount, sizeof(int));
+    for (int i = 0; i < workerCount; i++)
+    {
+        pthread_mutex_init(&scan.queues[i].lock, NULL);
+        scan.queues[i].next = (int)((long)morselCount * i / workerCount);
+        scan.queues[i].end = (int)((long)morselCount * (i + 1) / workerCount);
+        workers[i].scan = &scan;
+        workers[i].id = i;
+        if (aggregating)
+        {
+            _initAggregates(query, scan.states + i * query->aggregateCount);
+        }
+        if (grouping)
+        {
+            _initGroupTable(query, &scan.groups[i], &recordset->groupShape);
+        }
+    }
+
+    /* The calling thread is worker 0.  Should a thread fail to start, its morsels are stolen by the others */
+    for (int i = 1; i < workerCount; i++)
+    {
+        started[i] = pthread_create(&workers[i].thread, NULL, _scanWorkerMain, &workers[i]) == 0;
+    }
+    _scanWorkerMain(&workers[0]);
+    for (int i = 1; i < workerCount; i++)
+    {
+        if (started[i])
+        {
+            pthread_join(workers[i].thread, NULL);
+        }
+    }
+
+    if (scan.morselCounts != NULL)
+    {
+        for (int m = 0; m < morselCount && scan.morselCounts[m] >= 0; m++)
+        {
+            memmove(scan.rows + scan.rowCount, scan.rows + m * ZDB_QUERY_MORSEL_ROWS, scan.morselCounts[m] * sizeof(int));
+            scan.rowCount += scan.morselCounts[m];
+        }
+    }
+
+    for (int i = 0; i < workerCount; i++)
+    {
+        pthread_mutex_destroy(&scan.queues[i].lock);
+    }
+    free(scan.queues);
+    free(scan.morselCounts);
+    free(workers);
+    free(started);
+
+    if (aggregating)
+    {
+        for (int i = 0; i < workerCount; i++)
+        {
+            _mergeAggregates(query, recordset->aggregates, scan.states + i * query->aggregateCount);
+        }
+        free(scan.states);
+        return 1;
+    }
+
+    if (grouping)
+    {
+        /* Worker 0's table takes in the others' groups */
+        recordset->groups = scan.groups[0];
+        for (int i = 1; i < workerCount; i++)
+        {
+            if (!__atomic_load_n(&recordset->groupBudget.overflow, __ATOMIC_RELAXED))
+            {
+                _mergeGroups(query, &recordset->groups, &scan.groups[i]);
+            }
+            _freeGroupTable(&scan.groups[i]);
+        }
+        free(scan.groups);
+        return 1;
+    }
+
+    recordset->scanned = 1;
+    recordset->scanRows = scan.rows;
+    recordset->scanRowCount = scan.rowCount;
+    recordset->scanPosition = 0;
+    return 1;
+}
+
+/* Works out the recordset's aggregates over every matching row */
+void _aggregate(ZdbRecordset* recordset)
+{
+    ZdbQuery* query = recordset->query;
+    ZdbTable* table = query->table;
+    recordset->aggregates = recordset->aggregateStates;
+    _initAggregates(query, recordset->aggregates);
+
+    if (recordset->indexed)
+    {
+        for (int i = 0; i < recordset->indexRowCount; i++)
+        {
+            int rowIndex = recordset->indexRows[i]->index;
+            if (!ZdbEngineIsRowDeleted(table, rowIndex) && _matchesRow(query, rowIndex))
+            {
+                _aggregateRow(query, rowIndex, recordset->aggregates);
+            }
+        }
+    }
+    else if (query->threads == 1 || !_parallelScan(recordset))
+    {
+        int chunkCount = (table->rowCount + ZDB_ROW_CHUNKS - 1) / ZDB_ROW_CHUNKS;
+        for (int chunk = 0; chunk < chunkCount; chunk++)
+        {
+            _aggregateChunk(query, chunk, recordset->gather, recordset->aggregates);
+        }
+    }
+
+    /* The rows aren't needed any more */
+    recordset->rowIndex = table->rowCount;
+    if (recordset->pinned)
+    {
+        recordset->pinned = 0;
+        ZdbEngineUnpinTable(table);
+    }
+}
+
+/* Finds the groups of the recordset's current pass, starting it over with more partitions while they don't fit */
+void _group(ZdbRecordset* recordset)
+{
+    ZdbQuery* query = recordset->query;
+    ZdbTable* table = query->table;
+    while (1)
+    {
+        recordset->groupScans++;
+        recordset->groupShape.partition = (uint64_t)recordset->groupPass;
+        recordset->groupShape.partitionBits = __builtin_ctz(recordset->groupPasses);
+
+        if (recordset->indexed)
+        {
+            _initGroupTable(query, &recordset->groups, &recordset->groupShape);
+            for (int i = 0; i < recordset->indexRowCount; i++)
+            {
+                int rowIndex = recordset->indexRows[i]->index;
+                if (!ZdbEngineIsRowDeleted(table, rowIndex) && _matchesRow(query, rowIndex) &&
+                    !_groupRow(query, rowIndex, &recordset->groups))
+                {
+                    break;
+                }
+            }
+        }
+        else if (query->threads == 1 || !_parallelScan(recordset))
+        {
+            _initGroupTable(query, &recordset->groups, &recordset->groupShape);
+            int chunkCount = (table->rowCount + ZDB_ROW_CHUNKS - 1) / ZDB_ROW_CHUNKS;
+            for (int chunk = 0; chunk < chunkCount; chunk++)
+            {
+                if (!_groupChunk(query, chunk, recordset->gather, &recordset->groups))
+                {
+                    break;
+                }
+            }
+        }
+
+        if (!recordset->groupBudget.overflow)
+        {
+            break;
+        }
+
+        /* Partition p of n is partitions 2p and 2p + 1 of 2n, so the groups already returned stay returned */
+        _freeGroupTable(&recordset->groups);
+        recordset->groupBudget.overflow = 0;
+        if (recordset->groupPasses < ZDB_QUERY_GROUP_PASSES)
+        {
+            recordset->groupPass *= 2;
+            recordset->groupPasses *= 2;
+        }
+        else
+        {
+            recordset->groupBudget.limit = SIZE_MAX;
+        }
+    }
+
+    recordset->groupPosition = -1;
+    if (recordset->groupPass + 1 == recordset->groupPasses)
+    {
+        /* The last pass is done with the rows */
+        recordset->rowIndex = table->rowCount;
+        if (recordset->pinned)
+        {
+            recordset->pinned = 0;
+            ZdbEngineUnpinTable(table);
+        }
+    }
+}
+
+/* Sets up the recordset of a grouped query and finds the groups of its first pass */
+void _startGroups(ZdbRecordset* recordset)
+{
+    ZdbQuery* query = recordset->query;
+    ZdbGroupTable* shape = &recordset->groupShape;
+    memset(shape, 0, sizeof(ZdbGroupTable));
+    shape->budget = &recordset->groupBudget;
+    shape->keyCount = query->groupCount;
+    shape->aggregateCount = query->aggregateCount;
+    for (int k = 0; k < query->groupCount; k++)
+    {
+        shape->columns[k] = query->groups[k];
+        shape->tags[k] = query->table->layout.tags[query->groups[k]];
+    }
+
+    recordset->groupBudget.limit = query->groupMemory;
+    recordset->groupBudget.used = 0;
+    recordset->groupBudget.peak = 0;
+    recordset->groupBudget.overflow = 0;
+
+    /* Every worker has its own copy of a direct table, so they all have to fit */
+    size_t groupCount;
+    int workers = query->threads > 0 ? query->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    shape->direct = _groupDomain(query, shape, &groupCount) &&
+                    _groupBytes(shape, (int)groupCount) * (workers > 0 ? workers : 1) <= query->groupMemory;
+
+    recordset->groupPass = 0;
+    recordset->groupPasses = 1;
+    recordset->groupScans = 0;
+    recordset->groupsReturned = 0;
+    _group(recordset);
+}
+
+int _nextGroup(ZdbRecordset* recordset)
+{
+    while (1)
+    {
+        ZdbGroupTable* groups = &recordset->groups;
+        while (++recordset->groupPosition < groups->groupCount)
+        {
+            if (groups->rows[recordset->groupPosition] > 0)
+            {
+                int32_t key[ZDB_QUERY_GROUP_COLUMNS];
+                _groupKeys(groups, recordset->groupPosition, key);
+                for (int k = 0; k < groups->keyCount; k++)
+                {
+                    recordset->groupKey[k].i = key[k];
+                }
+                recordset->aggregates = groups->states + (size_t)recordset->groupPosition * groups->aggregateCount;
+                recordset->groupsReturned++;
+                return 1;
+            }
+        }
+
+        recordset->aggregates = NULL;
+        _freeGroupTable(groups);
+        if (recordset->groupPass + 1 >= recordset->groupPasses)
+        {
+            return 0;
+        }
+        recordset->groupPass++;
+        _group(recordset);
+    }
+}
+
+/*
+ * Joins
+ *
+ * Equi-joins are hash joins.  The table with fewer live rows is the build side: its rows are hashed on their join
+ * value into chained buckets.  The other table is streamed past them a chunk at a time, each of its rows probing
+ * the bucket its value hashes to.  Results come in the probe side's table order, and for each probe row in the
+ * build side's.  Conditions are on the first table, so they filter whichever side that turns out to be
+ */
+
+/* Sets a bit in mask for each row of the chunk that takes part in the join: the first table's rows have to match
+   the query, and the second's only have to be live.  Returns 0, with mask cleared, when there are none */
+int _joinChunkRows(ZdbRecordset* recordset, int side, int chunk, uint64_t* mask)
+{
+    ZdbQuery* query = recordset->query;
+    ZdbTable* table = query->tables[side];
+    if (side == 0)
+    {
+        if (!_matchLiveRows(query, chunk, recordset->gather, mask))
+        {
+            memset(mask, 0, ZDB_TOMBSTONE_WORDS * sizeof(uint64_t));
+            return 0;
+        }
+    }
+    else
+    {
+        int rows = table->rowCount - chunk * ZDB_ROW_CHUNKS;
+        for (int i = 0; i < ZDB_TOMBSTONE_WORDS; i++)
+        {
+            int bits = rows - i * 64;
+            mask[i] = bits >= 64 ? ~0ull : bits > 0 ? (1ull << bits) - 1 : 0;
+            mask[i] &= ~table->tombstones[chunk * ZDB_TOMBSTONE_WORDS + i];
+        }
+    }
+
+    for (int i = 0; i < ZDB_TOMBSTONE_WORDS; i++)
+    {
+        if (mask[i] != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Join values hash the way they compare: -0 along with 0, and strings by their characters whether or not they
+   are dictionary encoded */
+uint64_t _hashJoinValue(int tag, const void* value)
+{
+    if (tag == ZDB_LAYOUT_TAG_VARCHAR || tag == ZDB_LAYOUT_TAG_DICTIONARY)
+    {
+        uint64_t hash = 0xCBF29CE484222325ull;
+        for (const unsigned char* c = value; *c != '\0'; c++)
+        {
+            hash = (hash ^ *c) * 0x100000001B3ull;
+        }
+        hash *= 0xC4CEB9FE1A85EC53ull;
+        return hash ^ (hash >> 29);
+    }
+
+    int32_t word;
+    memcpy(&word, value, sizeof(int32_t));
+    word = _groupKeyWord(tag, word);
+    return _hashGroupKey(&word, 1);
+}
+
+int _joinValuesEqual(int tag, const void* value1, const void* value2)
+{
+    switch (tag)
+    {
+        case ZDB_LAYOUT_TAG_FLOAT:
+            return *(const float*)value1 == *(const float*)value2;
+        case ZDB_LAYOUT_TAG_VARCHAR:
+        case ZDB_LAYOUT_TAG_DICTIONARY:
+            return strcmp(value1, value2) == 0;
+        default:
+            return *(const int*)value1 == *(const int*)value2;
+    }
+}
+
+/* A row's join value, or NULL if it can't equal anything */
+void* _joinValue(ZdbQuery* query, int side, int rowIndex)
+{
+    ZdbTable* table = query->tables[side];
+    int column = query->joinColumns[side];
+    void* value;
+    ZdbEngineGetValue(table, ZdbEngineRowAt(table, rowIndex), column, &value);
+    if (table->layout.tags[column] == ZDB_LAYOUT_TAG_FLOAT && isnan(*(float*)value))
+    {
+        return NULL;
+    }
+    return value;
+}
+
+void _unpinTables(ZdbRecordset* recordset)
+{
+    if (recordset->pinned)
+    {
+        recordset->pinned = 0;
+        ZdbEngineUnpinTable(recordset->query->table);
+        if (recordset->joined)
+        {
+            ZdbEngineUnpinTable(recordset->query->tables[1]);
+        }
+    }
+}
+
+/* Hashes the build side, ready for the probe side to be streamed past it */
+void _startJoin(ZdbRecordset* recordset)
+{
+    ZdbQuery* query = recordset->query;
+    int live[ZDB_QUERY_TABLES];
+    for (int side = 0; side < ZDB_QUERY_TABLES; side++)
+    {
+        live[side] = query->tables[side]->rowCount - query->tables[side]->deletedCount;
+    }
+    int build = live[1] < live[0];
+    ZdbTable* table = query->tables[build];
+    int tag = table->layout.tags[query->joinColumns[build]];
+
+    recordset->buildSide = build;
+    recordset->joinEntries = malloc((live[build] > 0 ? live[build] : 1) * sizeof(ZdbJoinEntry));
+    recordset->joinEntryCount = 0;
+    int chunkCount = (table->rowCount + ZDB_ROW_CHUNKS - 1) / ZDB_ROW_CHUNKS;
+    for (int chunk = 0; chunk < chunkCount; chunk++)
+    {
+        uint64_t mask[ZDB_TOMBSTONE_WORDS];
+        if (!_joinChunkRows(recordset, build, chunk, mask))
+        {
+            continue;
+        }
+
+        for (int i = 0; i < ZDB_TOMBSTONE_WORDS; i++)
+        {
+            while (mask[i] != 0)
+            {
+                int row = chunk * ZDB_ROW_CHUNKS + i * 64 + __builtin_ctzll(mask[i]);
+                mask[i] &= mask[i] - 1;
+                void* value = _joinValue(query, build, row);
+                if (value != NULL)
+                {
+                    ZdbJoinEntry* entry = &recordset->joinEntries[recordset->joinEntryCount++];
+                    entry->hash = _hashJoinValue(tag, value);
+                    entry->row = row;
+                }
+            }
+        }
+    }
+
+    /* Linked back to front, so each bucket's chain runs in table order */
+    recordset->joinBucketCount = 16;
+    while (recordset->joinBucketCount < recordset->joinEntryCount * 2)
+    {
+        recordset->joinBucketCount *= 2;
+    }
+    recordset->joinBuckets = malloc(recordset->joinBucketCount * sizeof(int));
+    memset(recordset->joinBuckets, 0xFF, recordset->joinBucketCount * sizeof(int));
+    for (int i = recordset->joinEntryCount - 1; i >= 0; i--)
+    {
+        int bucket = (int)(recordset->joinEntries[i].hash & (recordset->joinBucketCount - 1));
+        recordset->joinEntries[i].next = recordset->joinBuckets[bucket];
+        recordset->joinBuckets[bucket] = i;
+    }
+
+    /* Nothing to probe with an empty build side */
+    ZdbTable* probeTable = query->tables[1 - build];
+    recordset->probeChunk = recordset->joinEntryCount > 0 ? -1 : (probeTable->rowCount + ZDB_ROW_CHUNKS - 1) / ZDB_ROW_CHUNKS;
+    memset(recordset->probeMask, 0, sizeof(recordset->probeMask));
+    recordset->joinEntry = -1;
+}
+
+int _nextJoinedResult(ZdbRecordset* recordset)
+{
+    ZdbQuery* query = recordset->query;
+    int build = recordset->buildSide;
+    int probe = 1 - build;
+    ZdbTable* buildTable = query->tables[build];
+    ZdbTable* probeTable = query->tables[probe];
+    int buildTag = buildTable->layout.tags[query->joinColumns[build]];
+    int probeTag = probeTable->layout.tags[query->joinColumns[probe]];
+    int chunkCount = (probeTable->rowCount + ZDB_ROW_CHUNKS - 1) / ZDB_ROW_CHUNKS;
+
+    while (1)
+    {
+        /* Build rows deleted since they were hashed are passed over */
+        while (recordset->joinEntry >= 0)
+        {
+            ZdbJoinEntry* entry = &recordset->joinEntries[recordset->joinEntry];
+            recordset->joinEntry = entry->next;
+            if (entry->hash == recordset->probeHash && !ZdbEngineIsRowDeleted(buildTable, entry->row) &&
+                _joinValuesEqual(buildTag, _joinValue(query, build, entry->row), recordset->probeValue))
+            {
+                recordset->joinRows[build] = entry->row;
+                recordset->rowIndex = recordset->joinRows[0];
+                return 1;
+            }
+        }
+
+        int word = 0;
+        while (word < ZDB_TOMBSTONE_WORDS && recordset->probeMask[word] == 0)
+        {
+            word++;
+        }
+        if (word == ZDB_TOMBSTONE_WORDS)
+        {
+            if (recordset->probeChunk + 1 >= chunkCount)
+            {
+                /* No more rows */
+                recordset->probeChunk = chunkCount;
+                recordset->rowIndex = query->table->rowCount;
+                _unpinTables(recordset);
+                return 0;
+            }
+            _joinChunkRows(recordset, probe, ++recordset->probeChunk, recordset->probeMask);
+            continue;
+        }
+
+        int row = recordset->probeChunk * ZDB_ROW_CHUNKS + word * 64 + __builtin_ctzll(recordset->probeMask[word]);
+        recordset->probeMask[word] &= recordset->probeMask[word] - 1;
+        if (ZdbEngineIsRowDeleted(probeTable, row) || (recordset->probeValue = _joinValue(query, probe, row)) == NULL)
+        {
+            continue;
+        }
+        recordset->joinRows[probe] = row;
+        recordset->probeHash = _hashJoinValue(probeTag, recordset->probeValue);
+        recordset->joinEntry = recordset->joinBuckets[recordset->probeHash & (recordset->joinBucketCount - 1)];
+    }
+}
+
+/*
+ * Sorting
+ *
+ * Ordered queries sort (key, row) entries.  The key stands in for the row's first order column value, mapped to 64
+ * bits whose unsigned order is the query's order, so a radix sort on keys alone puts most entries in place.  Only
+ * runs of equal keys - strings that share their first eight bytes, or any ties when there are more order columns -
+ * are compared value by value, with a merge sort.  Rows that tie on every order column stay in table order.
+ *
+ * With a small enough limit, just the best entries so far are kept, in a heap.  Otherwise entries collect up to
+ * the sort memory; past it each full buffer is sorted and spilled as a run to a temporary file.  While there are
+ * more runs than can be merged at once they are merged into fewer, longer ones, and the last merge is made as the
+ * recordset's rows are read
+ */
+
+/* The row's key.  Ints flip their sign bit; floats flip every bit when negative and just the sign bit otherwise,
+   after -0 is made 0, with NaN below everything; strings take their first eight bytes.  User types share one key */
+uint64_t _sortKeyOf(int tag, const void* value, int descending)
+{
+    uint64_t key = 0;
+    switch (tag)
+    {
+        case ZDB_LAYOUT_TAG_INT:
+        case ZDB_LAYOUT_TAG_BOOLEAN:
+            key = (uint64_t)((uint32_t)*(const int*)value ^ 0x80000000u) << 32;
+            break;
+        case ZDB_LAYOUT_TAG_FLOAT:
+        {
+            float f = *(const float*)value;
+            uint32_t bits = 0;
+            if (!isnan(f))
+            {
+                f = f == 0.0f ? 0.0f : f;
+                memcpy(&bits, &f, sizeof(uint32_t));
+                bits = bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+            }
+            key = (uint64_t)bits << 32;
+            break;
+        }
+        case ZDB_LAYOUT_TAG_VARCHAR:
+        case ZDB_LAYOUT_TAG_DICTIONARY:
+        {
+            const unsigned char* c = value;
+            for (int i = 0; i < 8; i++)
+            {
+                key = key << 8 | *c;
+                c += *c != '\0';
+            }
+            break;
+        }
+    }
+    return descending ? ~key : key;
+}
+
+uint64_t _sortKey(ZdbQuery* query, int rowIndex)
+{
+    ZdbTable* table = query->table;
+    int column = query->orders[0].column;
+    void* value;
+    ZdbEngineGetValue(table, ZdbEngineRowAt(table, rowIndex), column, &value);
+    return _sortKeyOf(table->layout.tags[column], value, query->orders[0].descending);
+}
+
+/* Whether equal keys mean equal values of the first order column */
+int _sortKeyIsExact(ZdbQuery* query)
+{
+    int tag = query->table->layout.tags[query->orders[0].column];
+    return tag == ZDB_LAYOUT_TAG_INT || tag == ZDB_LAYOUT_TAG_BOOLEAN || tag == ZDB_LAYOUT_TAG_FLOAT;
+}
+
+int _compareOrderValues(ZdbTable* table, int column, void* value1, void* value2)
+{
+    switch (table->layout.tags[column])
+    {
+        case ZDB_LAYOUT_TAG_INT:
+        case ZDB_LAYOUT_TAG_BOOLEAN:
+            return (*(int*)value1 > *(int*)value2) - (*(int*)value1 < *(int*)value2);
+        case ZDB_LAYOUT_TAG_FLOAT:
+        {
+            /* NaNs are equal to each other and less than anything else */
+            float f1 = *(float*)value1;
+            float f2 = *(float*)value2;
+            if (isnan(f1) || isnan(f2))
+            {
+                return !isnan(f1) - !isnan(f2);
+            }
+            return (f1 > f2) - (f1 < f2);
+        }
+        case ZDB_LAYOUT_TAG_VARCHAR:
+        case ZDB_LAYOUT_TAG_DICTIONARY:
+            return strcmp(value1, value2);
+        default:
+            return _compareValues(table->columns[column]->type, value1, value2);
+    }
+}
+
+/* Orders two entries the way the query wants their rows, falling back on table order */
+int _compareSortEntries(ZdbQuery* query, const ZdbSortEntry* entry1, const ZdbSortEntry* entry2)
+{
+    if (entry1->key != entry2->key)
+    {
+        return entry1->key < entry2->key ? -1 : 1;
+    }
+
+    ZdbTable* table = query->table;
+    for (int i = _sortKeyIsExact(query); i < query->orderCount; i++)
+    {
+        int column = query->orders[i].column;
+        void* value1;
+        void* value2;
+        ZdbEngineGetValue(table, ZdbEngineRowAt(table, entry1->row), column, &value1);
+        ZdbEngineGetValue(table, ZdbEngineRowAt(table, entry2->row), column, &value2);
+        int result = _compareOrderValues(table, column, value1, value2);
+        if (result != 0)
+        {
+            return query->orders[i].descending ? -result : result;
+        }
+    }
+    return (entry1->row > entry2->row) - (entry1->row < entry2->row);
+}
+
+/* A stable merge sort, using scratch for as many entries */
+void _mergeSortEntries(ZdbQuery* query, ZdbSortEntry* entries, int count, ZdbSortEntry* scratch)
+{
+    if (count < 2)
+    {
+        return;
+    }
+
+    int half = count / 2;
+    _mergeSortEntries(query, entries, half, scratch);
+    _mergeSortEntries(query, entries + half, count - half, scratch);
+    if (_compareSortEntries(query, &entries[half - 1], &entries[half]) <= 0)
+    {
+        /* Already in order */
+        return;
+    }
+
+    memcpy(scratch, entries, half * sizeof(ZdbSortEntry));
+    int left = 0;
+    int right = half;
+    int out = 0;
+    while (left < half && right < count)
+    {
+        entries[out++] = _compareSortEntries(query, &entries[right], &scratch[left]) < 0 ? entries[right++] : scratch[left++];
+    }
+    memcpy(entries + out, scratch + left, (half - left) * sizeof(ZdbSortEntry));
+}
+
+/* A least significant digit first radix sort on the keys, a byte at a time.  Bytes every key shares are skipped,
+   so int and float keys, whose low half is always 0, take at most four passes.  Equal keys keep their order */
+void _radixSortEntries(ZdbSortEntry* entries, int count, ZdbSortEntry* scratch)
+{
+    int counts[8][256];
+    memset(counts, 0, sizeof(counts));
+    for (int i = 0; i < count; i++)
+    {
+        uint64_t key = entries[i].key;
+        for (int digit = 0; digit < 8; digit++)
+        {
+            counts[digit][(key >> (digit * 8)) & 0xFF]++;
+        }
+    }
+
+    ZdbSortEntry* from = entries;
+    ZdbSortEntry* to = scratch;
+    for (int digit = 0; digit < 8; digit++)
+    {
+        int shift = digit * 8;
+        if (counts[digit][(from[0].key >> shift) & 0xFF] == count)
+        {
+            continue;
+        }
+
+        int offsets[256];
+        int offset = 0;
+        for (int b = 0; b < 256; b++)
+        {
+            offsets[b] = offset;
+            offset += counts[digit][b];
+        }
+        for (int i = 0; i < count; i++)
+        {
+            to[offsets[(from[i].key >> shift) & 0xFF]++] = from[i];
+        }
+
+        ZdbSortEntry* swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != entries)
+    {
+        memcpy(entries, from, count * sizeof(ZdbSortEntry));
+    }
+}
+
+/* Puts the entries in the query's order.  They have to come in table order, which is what equal rows are left in */
+void _sortEntries(ZdbQuery* query, ZdbSortEntry* entries, int count)
+{
+    if (count < 2)
+    {
+        return;
+    }
+
+    ZdbSortEntry* scratch = malloc(count * sizeof(ZdbSortEntry));
+    if (query->table->layout.tags[query->orders[0].column] == ZDB_LAYOUT_TAG_OTHER)
+    {
+        /* User types have nothing to radix sort on */
+        _mergeSortEntries(query, entries, count, scratch);
+        free(scratch);
+        return;
+    }
+
+    _radixSortEntries(entries, count, scratch);
+    if (!_sortKeyIsExact(query) || query->orderCount > 1)
+    {
+        for (int start = 0; start < count; )
+        {
+            int end = start + 1;
+            while (end < count && entries[end].key == entries[start].key)
+            {
+                end++;
+            }
+            _mergeSortEntries(query, entries + start, end - start, scratch);
+            start = end;
+        }
+    }
+    free(scratch);
+}
+
+/* Sorts the entries held in memory and writes them to the end of the spill file as a new run.  Marks the sort as
+   failed if they can't all be written */
+void _spillRun(ZdbQuery* query, ZdbSort* sort)
+{
+    if (sort->failed)
+    {
+        /* The sort will be thrown away, so there's no point writing more runs */
+        sort->entryCount = 0;
+        return;
+    }
+
+    _sortEntries(query, sort->entries, sort->entryCount);
+
+    if (sort->runCount == sort->runCapacity)
+    {
+        sort->runCapacity = sort->runCapacity > 0 ? sort->runCapacity * 2 : 16;
+        sort->runs = realloc(sort->runs, sort->runCapacity * sizeof(ZdbSortRun));
+    }
+
+    ZdbSortRun* run = &sort->runs[sort->runCount++];
+    long end = fseek(sort->file, 0, SEEK_END) == 0 ? ftell(sort->file) : -1;
+    run->start = end / (long)sizeof(ZdbSortEntry);
+    run->count = sort->entryCount;
+    if (end < 0 || fwrite(sort->entries, sizeof(ZdbSortEntry), sort->entryCount, sort->file) != (size_t)sort->entryCount)
+    {
+        /* Out of disk space, or some other I/O error */
+        sort->failed = 1;
+    }
+    sort->entryCount = 0;
+    sort->spilledRuns++;
+}
+
+/* Reads the run's next block into its buffer.  Returns 0 once the run is used up, or if it can't be read back, in
+   which case the sort is marked as failed */
+int _readRun(ZdbSort* sort, ZdbSortRun* run)
+{
+    long count = run->count - run->read < ZDB_SORT_BLOCK ? run->count - run->read : ZDB_SORT_BLOCK;
+    if (count > 0 &&
+        (fseek(sort->file, (run->start + run->read) * (long)sizeof(ZdbSortEntry), SEEK_SET) != 0 ||
+         fread(run->buffer, sizeof(ZdbSortEntry), count, sort->file) != (size_t)count))
+    {
+        /* Seeking flushes what was last written, so this catches failed writes too */
+        sort->failed = 1;
+        count = 0;
+    }
+    run->read += count;
+    run->bufferCount = (int)count;
+    run->bufferPosition = 0;
+    return count > 0;
+}
+
+void _siftMergeHeap(ZdbQuery* query, ZdbSort* sort, int position)
+{
+    while (1)
+    {
+        int smallest = position;
+        for (int child = position * 2 + 1; child <= position * 2 + 2 && child < sort->heapCount; child++)
+        {
+            ZdbSortRun* run = &sort->runs[sort->heap[child]];
+            ZdbSortRun* best = &sort->runs[sort->heap[smallest]];
+            if (_compareSortEntries(query, &run->buffer[run->bufferPosition], &best->buffer[best->bufferPosition]) < 0)
+            {
+                smallest = child;
+            }
+        }
+        if (smallest == position)
+        {
+            return;
+        }
+
+        int swap = sort->heap[position];
+        sort->heap[position] = sort->heap[smallest];
+        sort->heap[smallest] = swap;
+        position = smallest;
+    }
+}
+
+/* Starts merging runs first to end - 1, reading each back through its own block of sort->blocks */
+void _startMerge(ZdbQuery* query, ZdbSort* sort, int first, int end)
+{
+    sort->heapCount = 0;
+    for (int i = first; i < end; i++)
+    {
+        ZdbSortRun* run = &sort->runs[i];
+        run->buffer = sort->blocks + (i - first) * ZDB_SORT_BLOCK;
+        run->read = 0;
+        if (_readRun(sort, run))
+        {
+            sort->heap[sort->heapCount++] = i;
+        }
+    }
+    for (int i = sort->heapCount / 2 - 1; i >= 0; i--)
+    {
+        _siftMergeHeap(query, sort, i);
+    }
+}
+
+/* Takes the smallest entry of the runs being merged.  Returns 0 once they are all used up */
+int _takeMerged(ZdbQuery* query, ZdbSort* sort, ZdbSortEntry* entry)
+{
+    if (sort->heapCount == 0)
+    {
+        return 0;
+    }
+
+    ZdbSortRun* run = &sort->runs[sort->heap[0]];
+    *entry = run->buffer[run->bufferPosition++];
+    if (run->bufferPosition == run->bufferCount && !_readRun(sort, run))
+    {
+        sort->heap[0] = sort->heap[--sort->heapCount];
+    }
+    _siftMergeHeap(query, sort, 0);
+    return 1;
+}
+
+/* Merges the runs a fan-in at a time into a new spill file, until there are few enough to merge in one go.  Stops
+   with the sort marked as failed if a run can't be read back or written out */
+void _mergeRuns(ZdbQuery* query, ZdbSort* sort)
+{
+    ZdbSortEntry* block = malloc(ZDB_SORT_BLOCK * sizeof(ZdbSortEntry));
+    while (sort->runCount > sort->fanIn && !sort->failed)
+    {
+        FILE* file = tmpfile();
+        if (file == NULL)
+        {
+            /* The last merge will just have to take them all */
+            break;
+        }
+
+        int runCount = 0;
+        long written = 0;
+        for (int first = 0; first < sort->runCount && !sort->failed; first += sort->fanIn)
+        {
+            int end = first + sort->fanIn < sort->runCount ? first + sort->fanIn : sort->runCount;
+            _startMerge(query, sort, first, end);
+
+            /* Runs are only read back after the ones before them, so the merged runs can take their places */
+            ZdbSortRun* merged = &sort->runs[runCount++];
+            long start = written;
+            int count = 0;
+            ZdbSortEntry entry;
+            while (_takeMerged(query, sort, &entry))
+            {
+                block[count++] = entry;
+                if (count == ZDB_SORT_BLOCK)
+                {
+                    if (fwrite(block, sizeof(ZdbSortEntry), count, file) != (size_t)count)
+                    {
+                        sort->failed = 1;
+                    }
+                    written += count;
+                    count = 0;
+                }
+            }
+            if (fwrite(block, sizeof(ZdbSortEntry), count, file) != (size_t)count)
+            {
+                sort->failed = 1;
+            }
+            written += count;
+            merged->start = start;
+            merged->count = written - start;
+        }
+
+        if (sort->failed || fflush(file) != 0)
+        {
+            /* The old file is closed along with the rest of the sort */
+            sort->failed = 1;
+            fclose(file);
+            break;
+        }
+
+        fclose(sort->file);
+        sort->file = file;
+        sort->runCount = runCount;
+        sort->mergePasses++;
+    }
+    free(block);
+}
+
+/* Orders the entry's row against the cursor's */
+int _compareToCursor(ZdbQuery* query, const ZdbSortEntry* entry)
+{
+    if (entry->key != query->cursorKey)
+    {
+        return entry->key < query->cursorKey ? -1 : 1;
+    }
+
+    ZdbTable* table = query->table;
+    for (int i = _sortKeyIsExact(query); i < query->orderCount; i++)
+    {
+        int column = query->orders[i].column;
+        void* value;
+        ZdbEngineGetValue(table, ZdbEngineRowAt(table, entry->row), column, &value);
+        int result = _compareOrderValues(table, column, value, query->cursorValues[i]);
+        if (result != 0)
+        {
+            return query->orders[i].descending ? -result : result;
+        }
+    }
+    return (entry->row > query->cursorRow) - (entry->row < query->cursorRow);
+}
+
+/* Takes the row into the sort, unless it comes before the cursor.  Top-N sorts keep the entries in a heap with the
+   worst of them on top, which the row replaces if it's better */
+void _sortRow(ZdbQuery* query, ZdbSort* sort, int rowIndex, uint64_t key)
+{
+    ZdbSortEntry entry;
+    entry.key = key;
+    entry.row = rowIndex;
+    if (query->cursor != NULL && _compareToCursor(query, &entry) <= 0)
+    {
+        return;
+    }
+
+    if (sort->topN)
+    {
+        int position;
+        if (sort->entryCount < sort->maxEntries)
+        {
+            position = sort->entryCount++;
+            while (position > 0 && _compareSortEntries(query, &sort->entries[(position - 1) / 2], &entry) < 0)
+            {
+                sort->entries[position] = sort->entries[(position - 1) / 2];
+                position = (position - 1) / 2;
+            }
+        }
+        else if (_compareSortEntries(query, &entry, &sort->entries[0]) < 0)
+        {
+            position = 0;
+            while (1)
+            {
+                int worst = position;
+                const ZdbSortEntry* worstEntry = &entry;
+                for (int child = position * 2 + 1; child <= position * 2 + 2 && child < sort->entryCount; child++)
+                {
+                    if (_compareSortEntries(query, &sort->entries[child], worstEntry) > 0)
+                    {
+                        worst = child;
+                        worstEntry = &sort->entries[child];
+                    }
+                }
+                if (worst == position)
+                {
+                    break;
+                }
+                sort->entries[position] = sort->entries[worst];
+                position = worst;
+            }
+        }
+        else
+        {
+            return;
+        }
+        sort->entries[position] = entry;
+        return;
+    }
+
+    if (sort->entryCount == sort->entryCapacity)
+    {
+        if (sort->entryCapacity < sort->maxEntries)
+        {
+            sort->entryCapacity = sort->entryCapacity < sort->maxEntries / 2 ? sort->entryCapacity * 2 : sort->maxEntries;
+            sort->entries = realloc(sort->entries, sort->entryCapacity * sizeof(ZdbSortEntry));
+        }
+        else if (sort->file != NULL || (sort->file = tmpfile()) != NULL)
+        {
+            _spillRun(query, sort);
+        }
+        else
+        {
+            /* Without a file to spill to, the sort has to stay in memory */
+            sort->maxEntries = sort->entryCapacity * 2;
+            sort->entryCapacity = sort->maxEntries;
+            sort->entries = realloc(sort->entries, sort->entryCapacity * sizeof(ZdbSortEntry));
+        }
+    }
+    sort->entries[sort->entryCount++] = entry;
+}
+
+int _compareRowIndexes(const void* a, const void* b)
+{
+    return (*(const int*)a > *(const int*)b) - (*(const int*)a < *(const int*)b);
+}
+
+int _compareRowPositions(const void* a, const void* b)
+{
+    return _compareRowIndexes(&(*(ZdbRow* const*)a)->index, &(*(ZdbRow* const*)b)->index);
+}
+
+/* Sorts the recordset's matching rows.  Sorts that fit in memory end up as scanRows, to be returned the way a
+   parallel scan's rows are; the others are left with their runs ready for the last merge.  Fails if the runs can't
+   be spilled or merged */
+int _sort(ZdbRecordset* recordset)
+{
+    ZdbQuery* query = recordset->query;
+    ZdbTable* table = query->table;
+    ZdbSort* sort = &recordset->sort;
+
+    /* Sorting needs scratch space as big as the entries */
+    size_t budget = query->sortMemory / (2 * sizeof(ZdbSortEntry));
+    sort->maxEntries = budget < INT_MAX / 2 ? (int)budget : INT_MAX / 2;
+    long wanted = (long)query->offset + query->limit;
+    sort->topN = query->limit != ZDB_QUERY_NO_LIMIT && wanted <= sort->maxEntries;
+    if (sort->topN)
+    {
+        sort->maxEntries = (int)wanted;
+    }
+    sort->entryCapacity = sort->topN || sort->maxEntries < 1024 ? sort->maxEntries : 1024;
+    sort->entries = malloc((sort->entryCapacity > 0 ? sort->entryCapacity : 1) * sizeof(ZdbSortEntry));
+    sort->fanIn = (int)(query->sortMemory / (ZDB_SORT_BLOCK * sizeof(ZdbSortEntry))) - 1;
+
+    if (sort->maxEntries == 0)
+    {
+        /* A limit of 0 */
+    }
+    else if (recordset->indexed)
+    {
+        /* Ranges come in key order, but the sort wants table order */
+        int* rows = malloc((recordset->indexRowCount > 0 ? recordset->indexRowCount : 1) * sizeof(int));
+        int count = 0;
+        for (int i = 0; i < recordset->indexRowCount; i++)
+        {
+            int rowIndex = recordset->indexRows[i]->index;
+            if (!ZdbEngineIsRowDeleted(table, rowIndex) && _matchesRow(query, rowIndex))
+            {
+                rows[count++] = rowIndex;
+            }
+        }
+        qsort(rows, count, sizeof(int), _compareRowIndexes);
+        for (int i = 0; i < count; i++)
+        {
+            _sortRow(query, sort, rows[i], _sortKey(query, rows[i]));
+        }
+        free(rows);
+    }
+    else if (query->threads != 1 && _parallelScan(recordset))
+    {
+        for (int i = 0; i < recordset->scanRowCount; i++)
+        {
+            int rowIndex = recordset->scanRows[i];
+            _sortRow(query, sort, rowIndex, _sortKey(query, rowIndex));
+        }
+        free(recordset->scanRows);
+        recordset->scanRows = NULL;
+    }
+    else
+    {
+        /* Four byte columns have their keys made from a chunk's values at a time */
+        int column = query->orders[0].column;
+        int tag = table->layout.tags[column];
+        int gathered = tag == ZDB_LAYOUT_TAG_INT || tag == ZDB_LAYOUT_TAG_FLOAT || tag == ZDB_LAYOUT_TAG_BOOLEAN;
+        int chunkCount = (table->rowCount + ZDB_ROW_CHUNKS - 1) / ZDB_ROW_CHUNKS;
+        for (int chunk = 0; chunk < chunkCount; chunk++)
+        {
+            uint64_t mask[ZDB_TOMBSTONE_WORDS];
+            if (!_matchLiveRows(query, chunk, recordset->gather, mask))
+            {
+                continue;
+            }
+
+            int start = chunk * ZDB_ROW_CHUNKS;
+            int count = table->rowCount - start < ZDB_ROW_CHUNKS ? table->rowCount - start : ZDB_ROW_CHUNKS;
+            const int32_t* values = gathered ? _chunkValues(query, column, start, count, recordset->gather) : NULL;
+            for (int i = 0; i < ZDB_TOMBSTONE_WORDS; i++)
+            {
+                while (mask[i] != 0)
+                {
+                    int offset = i * 64 + __builtin_ctzll(mask[i]);
+                    uint64_t key = gathered ? _sortKeyOf(tag, &values[offset], query->orders[0].descending) :
+                                              _sortKey(query, start + offset);
+                    _sortRow(query, sort, start + offset, key);
+                    mask[i] &= mask[i] - 1;
+                }
+            }
+        }
+    }
+
+    /* From here on the rows come from the sort, however they were found */
+    recordset->indexed = 0;
+    recordset->scanned = 1;
+    recordset->scanPosition = 0;
+    if (sort->runCount == 0)
+    {
+        if (sort->topN)
+        {
+            /* The heap isn't in table order, so ties are left to the full comparison */
+            ZdbSortEntry* scratch = malloc((sort->entryCount / 2 + 1) * sizeof(ZdbSortEntry));
+            _mergeSortEntries(query, sort->entries, sort->entryCount, scratch);
+            free(scratch);
+        }
+        else
+        {
+            _sortEntries(query, sort->entries, sort->entryCount);
+        }
+        recordset->scanRows = malloc((sort->entryCount > 0 ? sort->entryCount : 1) * sizeof(int));
+        for (int i = 0; i < sort->entryCount; i++)
+        {
+            recordset->scanRows[i] = sort->entries[i].row;
+        }
+        recordset->scanRowCount = sort->entryCount;
+        free(sort->entries);
+        sort->entries = NULL;
+        return ZDB_RESULT_SUCCESS;
+    }
+
+    if (sort->entryCount > 0)
+    {
+        _spillRun(query, sort);
+    }
+    free(sort->entries);
+    sort->entries = NULL;
+
+    sort->fanIn = sort->fanIn > 2 ? sort->fanIn : 2;
+    sort->blocks = malloc(sort->fanIn * ZDB_SORT_BLOCK * sizeof(ZdbSortEntry));
+    sort->heap = malloc(sort->fanIn * sizeof(int));
+    _mergeRuns(query, sort);
+    if (sort->failed)
+    {
+        /* A full disk or an I/O error would otherwise drop rows without a word */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    if (sort->runCount > sort->fanIn)
+    {
+        sort->blocks = realloc(sort->blocks, sort->runCount * ZDB_SORT_BLOCK * sizeof(ZdbSortEntry));
+        sort->heap = realloc(sort->heap, sort->runCount * sizeof(int));
+    }
+    _startMerge(query, sort, 0, sort->runCount);
+    return sort->failed ? ZDB_RESULT_INVALID_OPERATION : ZDB_RESULT_SUCCESS;
+}
+
+/* The next row of a sort that spilled, from the last merge of its runs */
+int _nextMergedResult(ZdbRecordset* recordset)
+{
+    ZdbQuery* query = recordset->query;
+    ZdbSortEntry entry;
+    while (_takeMerged(query, &recordset->sort, &entry))
+    {
+        /* Rows deleted since the sort are skipped */
+        if (!ZdbEngineIsRowDeleted(query->table, entry.row))
+        {
+            recordset->rowIndex = entry.row;
+            return 1;
+        }
+    }
+
+    recordset->rowIndex = query->table->rowCount;
+    _unpinTables(recordset);
+    return 0;
+}
+
+void _freeSort(ZdbSort* sort)
+{
+    if (sort->file != NULL)
+    {
+        fclose(sort->file);
+    }
+    free(sort->entries);
+    free(sort->runs);
+    free(sort->blocks);
+    free(sort->heap);
+}
+
+/*
+ * Cursors
+ *
+ * A cursor token spells out in hex the position of a recordset's last row: a version byte, the query's order
+ * columns with their directions, the table's compaction count and the row's position as four byte little-endian
+ * words, then the row's value of each order column - four bytes for numbers, the characters and a 0 for strings.
+ * Ordered queries sort only the rows past those values, ties going by position; unordered ones start scanning past
+ * the position.  Either way the position only holds until the table is next compacted
+ */
+
+#define ZDB_CURSOR_VERSION  1
+
+void _putCursorWord(unsigned char* bytes, uint32_t word)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        bytes[i] = (unsigned char)(word >> (i * 8));
+    }
+}
+
+uint32_t _getCursorWord(const unsigned char* bytes)
+{
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+/* Saves the token for the recordset's last row.  The row has to still be where it was returned */
+void _saveCursor(ZdbRecordset* recordset)
+{
+    ZdbQuery* query = recordset->query;
+    ZdbTable* table = query->table;
+    free(recordset->cursor);
+    recordset->cursor = NULL;
+    if (recordset->lastRow < 0 || recordset->aggregated || recordset->joined)
+    {
+        return;
+    }
+
+    size_t size = 2 + query->orderCount * 2 + 8;
+    void* values[ZDB_QUERY_ORDER_COLUMNS];
+    for (int i = 0; i < query->orderCount; i++)
+    {
+        int column = query->orders[i].column;
+        int tag = table->layout.tags[column];
+        if (tag == ZDB_LAYOUT_TAG_OTHER)
+        {
+            /* User types have no bytes to write down */
+            return;
+        }
+        ZdbEngineGetValue(table, ZdbEngineRowAt(table, recordset->lastRow), column, &values[i]);
+        size += tag == ZDB_LAYOUT_TAG_VARCHAR || tag == ZDB_LAYOUT_TAG_DICTIONARY ? strlen(values[i]) + 1 : 4;
+    }
+
+    unsigned char* bytes = malloc(size);
+    size_t at = 0;
+    bytes[at++] = ZDB_CURSOR_VERSION;
+    bytes[at++] = (unsigned char)query->orderCount;
+    for (int i = 0; i < query->orderCount; i++)
+    {
+        bytes[at++] = (unsigned char)query->orders[i].column;
+        bytes[at++] = (unsigned char)query->orders[i].descending;
+    }
+    _putCursorWord(bytes + at, (uint32_t)table->compactions);
+    _putCursorWord(bytes + at + 4, (uint32_t)recordset->lastRow);
+    at += 8;
+    for (int i = 0; i < query->orderCount; i++)
+    {
+        int tag = table->layout.tags[query->orders[i].column];
+        if (tag == ZDB_LAYOUT_TAG_VARCHAR || tag == ZDB_LAYOUT_TAG_DICTIONARY)
+        {
+            size_t length = strlen(values[i]) + 1;
+            memcpy(bytes + at, values[i], length);
+            at += length;
+        }
+        else
+        {
+            uint32_t word;
+            memcpy(&word, values[i], sizeof(uint32_t));
+            _putCursorWord(bytes + at, word);
+            at += 4;
+        }
+    }
+
+    static const char digits[] = "0123456789abcdef";
+    recordset->cursor = malloc(size * 2 + 1);
+    for (size_t i = 0; i < size; i++)
+    {
+        recordset->cursor[i * 2] = digits[bytes[i] >> 4];
+        recordset->cursor[i * 2 + 1] = digits[bytes[i] & 0xF];
+    }
+    recordset->cursor[size * 2] = '\0';
+    free(bytes);
+}
+
+/* Checks the query's cursor against its table and order, and reads the row it marks out of it */
+int _resolveCursor(ZdbQuery* query)
+{
+    ZdbTable* table = query->table;
+    const unsigned char* bytes = query->cursor;
+    size_t size = query->cursorSize;
+    size_t at = 2 + query->orderCount * 2 + 8;
+    if (size < 2 || bytes[0] != ZDB_CURSOR_VERSION || bytes[1] != query->orderCount || size < at)
+    {
+        /* From a query ordered some other way */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    for (int i = 0; i < query->orderCount; i++)
+    {
+        if (bytes[2 + i * 2] != query->orders[i].column || bytes[3 + i * 2] != query->orders[i].descending)
+        {
+            return ZDB_RESULT_INVALID_OPERATION;
+        }
+    }
+
+    int compactions = (int)_getCursorWord(bytes + at - 8);
+    query->cursorRow = (int)_getCursorWord(bytes + at - 4);
+    if (query->cursorRow < 0)
+    {
+        return ZDB_RESULT_VALUE_ERROR;
+    }
+    if (compactions != table->compactions)
+    {
+        /* The row has been moved, so its position no longer says where to start, or which ties come after it */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    for (int i = 0; i < query->orderCount; i++)
+    {
+        int tag = table->layout.tags[query->orders[i].column];
+        if (tag == ZDB_LAYOUT_TAG_VARCHAR || tag == ZDB_LAYOUT_TAG_DICTIONARY)
+        {
+            const unsigned char* end = memchr(bytes + at, '\0', size - at);
+            if (end == NULL)
+            {
+                return ZDB_RESULT_VALUE_ERROR;
+            }
+            query->cursorValues[i] = (void*)(bytes + at);
+            at = end - bytes + 1;
+        }
+        else if (tag != ZDB_LAYOUT_TAG_OTHER && size - at >= 4)
+        {
+            uint32_t word = _getCursorWord(bytes + at);
+            memcpy(&query->cursorNumbers[i], &word, sizeof(uint32_t));
+            query->cursorValues[i] = &query->cursorNumbers[i];
+            at += 4;
+        }
+        else
+        {
+            return ZDB_RESULT_VALUE_ERROR;
+        }
+    }
+
+    if (at != size)
+    {
+        return ZDB_RESULT_VALUE_ERROR;
+    }
+    if (query->orderCount > 0)
+    {
+        int tag = table->layout.tags[query->orders[0].column];
+        query->cursorKey = _sortKeyOf(tag, query->cursorValues[0], query->orders[0].descending);
+    }
+    return ZDB_RESULT_SUCCESS;
+}
+
+/* Ends the recordset's rows, saving the cursor while its last row is still in place */
+int _endResults(ZdbRecordset* recordset)
+{
+    if (!recordset->finished)
+    {
+        recordset->finished = 1;
+        _saveCursor(recordset);
+    }
+    recordset->rowIndex = recordset->query->table->rowCount;
+    _unpinTables(recordset);
+    return 0;
+}
+
+/*
+ * Planning
+ */
+
+/* Share of the table's rows the condition is expected to hold for.  Analyzed tables go by their stats; others get
+   the usual guesses */
+double _conditionSelectivity(ZdbQuery* query, ZdbQueryCondition* condition)
+{
+    if (condition->type == ZDB_QUERY_CONDITION_NONE)
+    {
+        return 1;
+    }
+
+    if (condition->useCodes && condition->type == ZDB_QUERY_CONDITION_EQ && condition->code == ZDB_QUERY_NO_CODE)
+    {
+        /* The dictionary has never held the value */
+        return 0;
+    }
+
+    ZdbTableStats* stats = query->table->stats;
+    double selectivity;
+    if (stats == NULL)
+    {
+        switch (condition->type)
+        {
+            case ZDB_QUERY_CONDITION_EQ:
+                return ZDB_QUERY_GUESS_EQUAL;
+            case ZDB_QUERY_CONDITION_NE:
+                return 1 - ZDB_QUERY_GUESS_EQUAL;
+            case ZDB_QUERY_CONDITION_IN:
+                selectivity = condition->valueCount * ZDB_QUERY_GUESS_EQUAL;
+                return selectivity < 1 ? selectivity : 1;
+        }
+        return ZDB_QUERY_GUESS_RANGE;
+    }
+
+    const ZdbColumnStats* column = &stats->columns[condition->columnIndex];
+    void* value = condition->value;
+    switch (condition->type)
+    {
+        case ZDB_QUERY_CONDITION_EQ:
+            selectivity = ZdbStatsEqualFraction(column, value);
+            break;
+        case ZDB_QUERY_CONDITION_NE:
+            selectivity = 1 - ZdbStatsEqualFraction(column, value);
+            break;
+        case ZDB_QUERY_CONDITION_LT:
+            selectivity = ZdbStatsBelowFraction(column, value, 0);
+            break;
+        case ZDB_QUERY_CONDITION_LTE:
+            selectivity = ZdbStatsBelowFraction(column, value, 1);
+            break;
+        case ZDB_QUERY_CONDITION_GT:
+            selectivity = 1 - ZdbStatsBelowFraction(column, value, 1);
+            break;
+        case ZDB_QUERY_CONDITION_GTE:
+            selectivity = 1 - ZdbStatsBelowFraction(column, value, 0);
+            break;
+        default:
+            selectivity = 0;
+            for (int i = 0; i < condition->valueCount; i++)
+            {
+                selectivity += ZdbStatsEqualFraction(column, condition->values[i]);
+            }
+            break;
+    }
+
+    return selectivity < 0 ? 0 : selectivity > 1 ? 1 : selectivity;
+}
+
+/* Levels a B+tree over this many rows has, leaves half full and inner nodes two thirds */
+int _btreeLevels(double rows)
+{
+    int levels = 1;
+    for (double nodes = rows / (ZDB_BTREE_LEAF_KEYS / 2); nodes > 1; nodes /= ZDB_BTREE_INNER_KEYS * 2 / 3)
+    {
+        levels++;
+    }
+    return levels;
+}
+
+/* What finding the condition's rows through the table's indexes would cost, the cheapest index going into *index.
+   Equality takes a hash index over a B+tree, and ranges need a B+tree.  Returns INFINITY if no index helps */
+double _indexCost(ZdbQuery* query, ZdbQueryCondition* condition, double rows, double selectivity, ZdbIndex** index,
+                  int* access)
+{
+    ZdbTable* table = query->table;
+    double fetched = rows * selectivity * ZDB_QUERY_COST_INDEX_ROW;
+    if (condition->value != NULL && table->layout.tags[condition->columnIndex] == ZDB_LAYOUT_TAG_FLOAT &&
+        isnan(*(float*)condition->value))
+    {
+        /* Conditions take every row to be below NaN, but an index keeps NaN below every number */
+        return INFINITY;
+    }
+
+    switch (condition->type)
+    {
+        case ZDB_QUERY_CONDITION_EQ:
+            if (ZdbEngineGetIndex(table, condition->columnIndex, ZDB_INDEX_HASH, index) == ZDB_RESULT_SUCCESS)
+            {
+                *access = ZDB_QUERY_ACCESS_INDEX_LOOKUP;
+                return ZDB_QUERY_COST_PROBE + fetched;
+            }
+            /* Fall through */
+        case ZDB_QUERY_CONDITION_LT:
+        case ZDB_QUERY_CONDITION_LTE:
+        case ZDB_QUERY_CONDITION_GT:
+        case ZDB_QUERY_CONDITION_GTE:
+            if (ZdbEngineGetIndex(table, condition->columnIndex, ZDB_INDEX_BTREE, index) == ZDB_RESULT_SUCCESS)
+            {
+                *access = ZDB_QUERY_ACCESS_INDEX_SCAN;
+                return ZDB_QUERY_COST_LEVEL * _btreeLevels(rows) + fetched;
+            }
+            break;
+    }
+
+    return INFINITY;
+}
+
+/* Orders the conditions by selectivity and chooses between scanning the table and going through an index for one
+   of them.  Without stats an index is always taken, as it always was */
+void _planQuery(ZdbQuery* query)
+{
+    ZdbQueryPlan* plan = &query->plan;
+    ZdbTable* table = query->table;
+    double rows = table->rowCount - table->deletedCount;
+
+    /* Most selective first, so that each condition is checked for as few rows as can be */
+    double selectivity[ZDB_QUERY_CONDITIONS];
+    plan->conditionCount = query->conditionCount;
+    plan->estimatedRows = rows;
+    for (int i = 0; i < query->conditionCount; i++)
+    {
+        selectivity[i] = _conditionSelectivity(query, &query->conditions[i]);
+        plan->estimatedRows *= selectivity[i];
+
+        int j = i;
+        for (; j > 0 && selectivity[plan->conditionOrder[j - 1]] > selectivity[i]; j--)
+        {
+            plan->conditionOrder[j] = plan->conditionOrder[j - 1];
+        }
+        plan->conditionOrder[j] = i;
+    }
+
+    /* The cheapest way in through an index.  Joins always stream the first table */
+    query->accessIndex = NULL;
+    query->accessCondition = 0;
+    double indexCost = INFINITY;
+    int access = ZDB_QUERY_ACCESS_SCAN;
+    for (int i = 0; i < query->conditionCount && !query->joined; i++)
+    {
+        ZdbIndex* index;
+        int indexAccess;
+        double cost = _indexCost(query, &query->conditions[i], rows, selectivity[i], &index, &indexAccess);
+        if (cost < indexCost)
+        {
+            indexCost = cost;
+            access = indexAccess;
+            query->accessIndex = index;
+            query->accessCondition = i;
+        }
+    }
+
+    /* A scan checks the first condition on every row, more cheaply through a kernel, shared out between the
+       threads.  Unordered scans with a limit stop once they have found enough rows */
+    ZdbQueryCondition* first = query->conditionCount > 0 ? &query->conditions[plan->conditionOrder[0]] : NULL;
+    double scanCost = rows * (first != NULL && _hasKernel(query, first) ? ZDB_QUERY_COST_KERNEL_ROW : ZDB_QUERY_COST_ROW);
+    if (query->accessIndex != NULL && query->threads != 1)
+    {
+        int workers = query->threads > 0 ? query->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        scanCost /= workers > 1 ? workers : 1;
+    }
+    if (query->limit != ZDB_QUERY_NO_LIMIT && query->orderCount == 0 && query->aggregateCount == 0 &&
+        query->groupCount == 0 && plan->estimatedRows > query->offset + query->limit)
+    {
+        scanCost *= (query->offset + query->limit + 1.0) / plan->estimatedRows;
+    }
+
+    if (query->accessIndex == NULL || (table->stats != NULL && scanCost <= indexCost))
+    {
+        query->accessIndex = NULL;
+        plan->access = ZDB_QUERY_ACCESS_SCAN;
+        plan->column = -1;
+        plan->cost = scanCost;
+        return;
+    }
+
+    /* The indexed condition is as good as checked, so it goes first */
+    plan->access = access;
+    plan->column = query->conditions[query->accessCondition].columnIndex;
+    plan->cost = indexCost;
+    int j = 0;
+    while (plan->conditionOrder[j] != query->accessCondition)
+    {
+        j++;
+    }
+    for (; j > 0; j--)
+    {
+        plan->conditionOrder[j] = plan->conditionOrder[j - 1];
+    }
+    plan->conditionOrder[0] = query->accessCondition;
+}
+
+/* Checks that the query can run and works out what it needs for this run: where a cursor leaves off, the codes
+   of values on dictionary encoded columns and how to find the rows */
+int _prepareRun(ZdbQuery* query)
+{
+    if (query->tableCount > 1 && !query->joined)
+    {
+        /* Tables can only be put together through a join */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    if (query->joined && (query->aggregateCount > 0 || query->groupCount > 0))
+    {
+        /* Joined rows can't be aggregated yet */
+        return ZDB_RESULT_UNSUPPORTED;
+    }
+
+    if ((query->orderCount > 0 || query->cursor != NULL) &&
+        (query->joined || query->aggregateCount > 0 || query->groupCount > 0))
+    {
+        /* Only table rows can be sorted or paged through yet */
+        return ZDB_RESULT_UNSUPPORTED;
+    }
+
+    if (query->cursor != NULL)
+    {
+        int result = _resolveCursor(query);
+        if (result != ZDB_RESULT_SUCCESS)
+        {
+            return result;
+        }
+    }
+
+    for (int i = 0; i < query->conditionCount; i++)
+    {
+        if (query->conditions[i].unboundCount > 0)
+        {
+            /* Placeholders have to be bound first */
+            return ZDB_RESULT_INVALID_OPERATION;
+        }
+    }
+
+    for (int i = 0; i < query->conditionCount; i++)
+    {
+        _resolveConditionCodes(query, &query->conditions[i]);
+    }
+
+    _planQuery(query);
+    return ZDB_RESULT_SUCCESS;
+}
+
+/* Runs the query into a recordset, whose buffers are either new or kept from its last run */
+int _startRecordset(ZdbRecordset* rs)
+{
+    ZdbQuery* query = rs->query;
+    rs->limit = query->limit;
+    rs->offset = query->offset;
+    rs->returned = 0;
+    rs->skipped = 0;
+    rs->paged = query->limit != ZDB_QUERY_NO_LIMIT || query->offset > 0 || query->cursor != NULL;
+    rs->afterRow = query->cursor != NULL && query->orderCount == 0 ? query->cursorRow : -1;
+    rs->lastRow = -1;
+    rs->cursor = NULL;
+    rs->finished = 0;
+    rs->rowIndex = rs->afterRow;
+    rs->zoneChunk = -1;
+
+    /* Compaction moves rows, so it waits until every recordset has finished with the table */
+    rs->pinned = 1;
+    ZdbEnginePinTable(query->table);
+    if (query->joined)
+    {
+        ZdbEnginePinTable(query->tables[1]);
+    }
+
+    /* The planner may have picked an index to go straight to the rows matching one of the conditions */
+    rs->indexed = 0;
+    rs->indexRowCount = 0;
+    rs->indexPosition = 0;
+    ZdbIndex* index = query->accessIndex;
+    ZdbQueryCondition* condition = &query->conditions[query->accessCondition];
+    if (index != NULL && condition->type == ZDB_QUERY_CONDITION_EQ)
+    {
+        rs->indexed = ZdbIndexFindInto(index, condition->value, &rs->indexRowCount, &rs->indexRows,
+                                       &rs->indexRowCapacity) == ZDB_RESULT_SUCCESS;
+    }
+    else if (index != NULL)
+    {
+        int below = condition->type == ZDB_QUERY_CONDITION_LT || condition->type == ZDB_QUERY_CONDITION_LTE;
+        int inclusive = condition->type == ZDB_QUERY_CONDITION_LTE || condition->type == ZDB_QUERY_CONDITION_GTE;
+        void* value = condition->value;
+        rs->indexed = ZdbIndexFindRangeInto(index, below ? NULL : value, inclusive, below ? value : NULL, inclusive,
+                                            &rs->indexRowCount, &rs->indexRows,
+                                            &rs->indexRowCapacity) == ZDB_RESULT_SUCCESS;
+        if (rs->indexed && rs->paged)
+        {
+            /* Pages are of rows in table order, however they were found */
+            qsort(rs->indexRows, rs->indexRowCount, sizeof(ZdbRow*), _compareRowPositions);
+        }
+    }
+
+    /* Anything else is a scan, which can be shared out between threads */
+    rs->scanned = 0;
+    rs->scanRowCount = 0;
+    rs->scanPosition = 0;
+    rs->aggregated = query->aggregateCount > 0 || query->groupCount > 0;
+    rs->aggregates = NULL;
+    rs->aggregatePosition = 0;
+    rs->grouped = query->groupCount > 0;
+    rs->joined = query->joined;
+    rs->sorted = query->orderCount > 0;
+    if (rs->joined)
+    {
+        _startJoin(rs);
+    }
+    else if (rs->grouped)
+    {
+        _startGroups(rs);
+    }
+    else if (rs->aggregated)
+    {
+        _aggregate(rs);
+    }
+    else if (rs->sorted)
+    {
+        return _sort(rs);
+    }
+    else if (!rs->indexed && !rs->joined && query->threads != 1)
+    {
+        _parallelScan(rs);
+    }
+
+    return ZDB_RESULT_SUCCESS;
+}
+
+/* Lets go of everything a recordset's last run found, keeping the buffers a new run can reuse */
+void _clearRecordset(ZdbRecordset* rs)
+{
+    _unpinTables(rs);
+    free(rs->joinEntries);
+    rs->joinEntries = NULL;
+    free(rs->joinBuckets);
+    rs->joinBuckets = NULL;
+    free(rs->scanRows);
+    rs->scanRows = NULL;
+    _freeSort(&rs->sort);
+    memset(&rs->sort, 0, sizeof(ZdbSort));
+    free(rs->cursor);
+    rs->cursor = NULL;
+    if (rs->grouped)
+    {
+        _freeGroupTable(&rs->groups);
+    }
+    memset(&rs->groups, 0, sizeof(ZdbGroupTable));
+    rs->aggregates = NULL;
+
+    /* Batches of other columns need arrays of other sizes */
+    ZdbQuery* query = rs->query;
+    if (rs->projectionCount != query->projectionCount ||
+        memcmp(rs->projection, query->projection, query->projectionCount * sizeof(int)) != 0)
+    {
+        for (int i = 0; i < rs->projectionCount; i++)
+        {
+            free(rs->projected[i]);
+            rs->projected[i] = NULL;
+        }
+        rs->projectedCapacity = 0;
+        memcpy(rs->projection, query->projection, query->projectionCount * sizeof(int));
+        rs->projectionCount = query->projectionCount;
+    }
+}
+
+/*
+ * Public functions
+ */
+
+int ZdbQueryCreate(ZdbDatabase* database, ZdbQuery** query)
+{
+    ZdbQuery* q = malloc(sizeof(ZdbQuery));
+    q->database = database;
+    q->table = NULL;
+    q->tableCount = 0;
+    q->joined = 0;
+    q->conditionCount = 0;          /* ALL rows */
+    memset(&q->plan, 0, sizeof(ZdbQueryPlan));
+    q->accessIndex = NULL;
+    q->accessCondition = 0;
+    q->recordsets = NULL;
+    q->projectionCount = 0;
+    q->aggregateCount = 0;
+    q->groupCount = 0;
+    q->groupMemory = ZDB_QUERY_GROUP_MEMORY;
+    q->orderCount = 0;
+    q->sortMemory = ZDB_QUERY_SORT_MEMORY;
+    q->limit = ZDB_QUERY_NO_LIMIT;
+    q->offset = 0;
+    q->cursor = NULL;
+    q->cursorSize = 0;
+    q->threads = 1;
+    q->ordered = 1;
+
+    *query = q;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQueryAddTable(ZdbQuery* query, ZdbTable* table)
+{
+    if (query->tableCount == ZDB_QUERY_TABLES)
+    {
+        /* Joins are between two tables */
+        return ZDB_RESULT_UNSUPPORTED;
+    }
+
+    query->tables[query->tableCount++] = table;
+    if (query->table == NULL)
+    {
+        query->table = table;
+    }
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQueryAddJoin(ZdbQuery* query, int column, int otherColumn)
+{
+    if (query == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (query->tableCount != 2 || query->joined)
+    {
+        /* Both tables have to be in the query, and they are joined on one pair of columns */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    ZdbTable* other = query->tables[1];
+    if (column < 0 || column >= query->table->columnCount || otherColumn < 0 || otherColumn >= other->columnCount)
+    {
+        /* The column index is out of range for its table */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    if (query->table->columns[column]->type != other->columns[otherColumn]->type)
+    {
+        /* Only values of the same type can be equal */
+        return ZDB_RESULT_INVALID_CAST;
+    }
+
+    if (query->table->layout.tags[column] == ZDB_LAYOUT_TAG_OTHER)
+    {
+        /* User-defined types can be compared but not hashed */
+        return ZDB_RESULT_UNSUPPORTED;
+    }
+
+    query->joinColumns[0] = column;
+    query->joinColumns[1] = otherColumn;
+    query->joined = 1;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQueryAddCondition(ZdbQuery* query, ZdbQueryConditionType type, int column, ZdbType* valueType, const char* str)
+{
+
+    if (query->database == NULL || query->table == NULL)
+    {
+        /* The query must be initialized and a table selected before adding a condition */
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (column < 0 || column >= query->table->columnCount)
+    {
+        /* The column index is out of range for this query */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    if (type < ZDB_QUERY_CONDITION_NONE || type > ZDB_QUERY_CONDITION_IN)
+    {
+        /* Not a condition the query knows how to evaluate */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    ZdbType* columnType = query->table->columns[column]->type;
+    if (columnType != valueType)
+    {
+        /* The types do not match */
+        return ZDB_RESULT_INVALID_CAST;
+    }
+
+    if (!_hasConditionRoom(query, column))
+    {
+        /* A new column's condition would be one too many */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    if (str == NULL && ZdbTypeGetId(valueType) == ZDB_TYPE_ID_USER)
+    {
+        /* Only values of the standard types can be bound */
+        return ZDB_RESULT_UNSUPPORTED;
+    }
+
+    /* A placeholder gets room for the value it will be bound to */
+    void* value;
+    if (ZdbTypeNewValue(valueType, str != NULL ? str : "", &value) != ZDB_RESULT_SUCCESS)
+    {
+        /* There was an error creating the value from the string */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    ZdbQueryCondition* condition = _takeCondition(query, column);
+    _markPlaceholders(condition, 1, &str);
+    condition->type = type;
+    condition->columnIndex = column;
+    condition->columnType = columnType;
+    condition->predicate = _compilePredicate(columnType, type);
+    condition->value = value;
+
+    /* Equality on a dictionary encoded column is decided on codes, which are looked up when the query runs */
+    condition->useCodes = query->table->layout.tags[column] == ZDB_LAYOUT_TAG_DICTIONARY &&
+                          (type == ZDB_QUERY_CONDITION_EQ || type == ZDB_QUERY_CONDITION_NE);
+
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQueryAddInCondition(ZdbQuery* query, int column, ZdbType* valueType, int count, const char** strs)
+{
+    if (query->database == NULL || query->table == NULL || strs == NULL)
+    {
+        /* The query must be initialized and a table selected before adding a condition */
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (column < 0 || column >= query->table->columnCount || count < 0)
+    {
+        /* The column index is out of range for this query */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    if (query->table->columns[column]->type != valueType)
+    {
+        /* The types do not match */
+        return ZDB_RESULT_INVALID_CAST;
+    }
+
+    if (!_hasConditionRoom(query, column))
+    {
+        /* A new column's condition would be one too many */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (strs[i] == NULL && ZdbTypeGetId(valueType) == ZDB_TYPE_ID_USER)
+        {
+            /* Only values of the standard types can be bound */
+            return ZDB_RESULT_UNSUPPORTED;
+        }
+    }
+
+    void** values = calloc(count, sizeof(void*));
+    for (int i = 0; i < count; i++)
+    {
+        if (ZdbTypeNewValue(valueType, strs[i] != NULL ? strs[i] : "", &values[i]) != ZDB_RESULT_SUCCESS)
+        {
+            /* There was an error creating the value from the string */
+            while (i-- > 0)
+            {
+                free(values[i]);
+            }
+            free(values);
+            return ZDB_RESULT_INVALID_OPERATION;
+        }
+    }
+
+    ZdbQueryCondition* condition = _takeCondition(query, column);
+    _markPlaceholders(condition, count, strs);
+    condition->type = ZDB_QUERY_CONDITION_IN;
+    condition->columnIndex = column;
+    condition->columnType = valueType;
+    condition->predicate = _compilePredicate(valueType, ZDB_QUERY_CONDITION_IN);
+    condition->valueCount = count;
+    condition->values = values;
+
+    condition->useCodes = query->table->layout.tags[column] == ZDB_LAYOUT_TAG_DICTIONARY;
+
+    return ZDB_RESULT_SUCCESS;
+}
+
+
+int ZdbQueryAddAggregate(ZdbQuery* query, int function, int column)
+{
+    if (query == NULL || query->table == NULL)
+    {
+        /* The query must have its table before aggregates can be added */
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (function < ZDB_AGG_COUNT || function > ZDB_AGG_AVG || query->aggregateCount == ZDB_QUERY_AGGREGATES)
+    {
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    if (function != ZDB_AGG_COUNT)
+    {
+        if (column < 0 || column >= query->table->columnCount)
+        {
+            /* The column index is out of range for this query */
+            return ZDB_RESULT_INVALID_OPERATION;
+        }
+
+        int tag = query->table->layout.tags[column];
+        if (tag != ZDB_LAYOUT_TAG_INT && tag != ZDB_LAYOUT_TAG_FLOAT && tag != ZDB_LAYOUT_TAG_BOOLEAN)
+        {
+            /* Only numbers can be added up or ordered here */
+            return ZDB_RESULT_UNSUPPORTED;
+        }
+    }
+
+    query->aggregates[query->aggregateCount].function = function;
+    query->aggregates[query->aggregateCount].column = column;
+    query->aggregateCount++;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQueryAddGroup(ZdbQuery* query, int column)
+{
+    if (query == NULL || query->table == NULL)
+    {
+        /* The query must have its table before it can be grouped */
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (column < 0 || column >= query->table->columnCount || query->groupCount == ZDB_QUERY_GROUP_COLUMNS)
+    {
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    int tag = query->table->layout.tags[column];
+    if (tag != ZDB_LAYOUT_TAG_INT && tag != ZDB_LAYOUT_TAG_FLOAT && tag != ZDB_LAYOUT_TAG_BOOLEAN &&
+        tag != ZDB_LAYOUT_TAG_DICTIONARY)
+    {
+        /* Groups are keyed by four byte values, which plain varchars and user-defined types don't have */
+        return ZDB_RESULT_UNSUPPORTED;
+    }
+
+    query->groups[query->groupCount++] = column;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQuerySetGroupMemory(ZdbQuery* query, size_t bytes)
+{
+    if (query == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (bytes < ZDB_QUERY_GROUP_MEMORY_MIN)
+    {
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    query->groupMemory = bytes;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQueryAddOrder(ZdbQuery* query, int column, int descending)
+{
+    if (query == NULL || query->table == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (column < 0 || column >= query->table->columnCount || query->orderCount == ZDB_QUERY_ORDER_COLUMNS)
+    {
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    query->orders[query->orderCount].column = column;
+    query->orders[query->orderCount].descending = descending != 0;
+    query->orderCount++;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQuerySetLimit(ZdbQuery* query, int limit)
+{
+    if (query == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (limit < 0 && limit != ZDB_QUERY_NO_LIMIT)
+    {
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    query->limit = limit;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQuerySetOffset(ZdbQuery* query, int offset)
+{
+    if (query == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (offset < 0)
+    {
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    query->offset = offset;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQuerySetCursor(ZdbQuery* query, const char* token)
+{
+    if (query == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    size_t length = token != NULL ? strlen(token) : 0;
+    if (length % 2 != 0)
+    {
+        return ZDB_RESULT_VALUE_ERROR;
+    }
+
+    unsigned char* bytes = NULL;
+    if (token != NULL)
+    {
+        bytes = malloc(length / 2 + 1);
+        for (size_t i = 0; i < length; i++)
+        {
+            char c = token[i];
+            int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+            if (digit < 0)
+            {
+                /* Not a token ZdbQueryGetCursor handed out */
+                free(bytes);
+                return ZDB_RESULT_VALUE_ERROR;
+            }
+            bytes[i / 2] = i % 2 == 0 ? (unsigned char)(digit << 4) : bytes[i / 2] | (unsigned char)digit;
+        }
+    }
+
+    free(query->cursor);
+    query->cursor = bytes;
+    query->cursorSize = length / 2;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQuerySetSortMemory(ZdbQuery* query, size_t bytes)
+{
+    if (query == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (bytes < ZDB_QUERY_SORT_MEMORY_MIN)
+    {
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    query->sortMemory = bytes;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQuerySetProjection(ZdbQuery* query, int count, const int* columns)
+{
+    if (query == NULL || query->table == NULL || (count > 0 && columns == NULL))
+    {
+        /* The query must have its table before columns can be picked from it */
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (count < 0 || count > ZDB_LIMIT_COLUMNS)
+    {
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (columns[i] < 0 || columns[i] >= query->table->columnCount)
+        {
+            /* The column index is out of range for this query */
+            return ZDB_RESULT_INVALID_OPERATION;
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        query->projection[i] = columns[i];
+    }
+    query->projectionCount = count;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQuerySetParallel(ZdbQuery* query, int threads, int ordered)
+{
+    if (query == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (threads < 0)
+    {
+        /* 0 already means one thread per CPU */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    query->threads = threads;
+    query->ordered = ordered != 0;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQueryExecute(ZdbQuery* query, ZdbRecordset** recordset)
+{
+    int result = _prepareRun(query);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        return result;
+    }
+
+    ZdbRecordset* rs = malloc(sizeof(ZdbRecordset));
+    rs->query = query;
+    rs->selection = NULL;
+    rs->selectionCapacity = 0;
+    memcpy(rs->projection, query->projection, query->projectionCount * sizeof(int));
+    rs->projectionCount = query->projectionCount;
+    memset(rs->projected, 0, sizeof(rs->projected));
+    rs->projectedCapacity = 0;
+    rs->indexRows = NULL;
+    rs->indexRowCapacity = 0;
+    rs->scanRows = NULL;
+    rs->cursor = NULL;
+    rs->joinEntries = NULL;
+    rs->joinBuckets = NULL;
+    memset(&rs->groups, 0, sizeof(ZdbGroupTable));
+    memset(&rs->sort, 0, sizeof(ZdbSort));
+
+    rs->next = query->recordsets;
+    query->recordsets = rs;
+
+    result = _startRecordset(rs);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        /* What's left of the recordset is freed with the query */
+        _clearRecordset(rs);
+        return result;
+    }
+
+    *recordset = rs;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQueryGetPlan(ZdbQuery* query, ZdbQueryPlan* plan)
+{
+    if (query == NULL || plan == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (query->table == NULL)
+    {
+        /* There is nothing to plan before the query has its table */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    int result = _prepareRun(query);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        return result;
+    }
+
+    *plan = query->plan;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQueryReexecute(ZdbRecordset* recordset)
+{
+    if (recordset == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    int result = _prepareRun(recordset->query);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        return result;
+    }
 
-    printf("RESULT!! %d %d %d\n", *(int*)value1, *(int*)value2, result);
-    switch(recordset->query->condition.type)
+    _clearRecordset(recordset);
+    result = _startRecordset(recordset);
+    if (result != ZDB_RESULT_SUCCESS)
     {
-        case ZDB_QUERY_CONDITION_EQ:
-            return result == 0;
-        case ZDB_QUERY_CONDITION_NE:
-            return result != 0;
-        case ZDB_QUERY_CONDITION_LT:
-            return result > 0;
-        case ZDB_QUERY_CONDITION_GT:
-            return result < 0;
-        case ZDB_QUERY_CONDITION_LTE:
-            return result >= 0;
-        case ZDB_QUERY_CONDITION_GTE:
-            return result <= 0;
+        /* The recordset is left with no rows */
+        _clearRecordset(recordset);
+        recordset->scanRowCount = 0;
+        return result;
     }
 
-    return result;
+    return ZDB_RESULT_SUCCESS;
 }
 
-/*
- * Public functions
- */
-
-int ZdbQueryCreate(ZdbDatabase* database, ZdbQuery** query)
+int ZdbQueryBindInt(ZdbQuery* query, int parameter, int value)
 {
-    ZdbQuery* q = malloc(sizeof(ZdbQuery));
-    q->database = database;
-    q->table = NULL;
-    q->condition.type = ZDB_QUERY_CONDITION_NONE;   /* ALL rows */
-    q->condition.value = NULL;
+    ZdbQueryCondition* condition;
+    void* slot;
+    int result = _bindValue(query, parameter, ZDB_TYPE_ID_INT, &condition, &slot);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        return result;
+    }
 
-    *query = q;
+    /* Booleans are ints that are either 0 or 1 */
+    *(int*)slot = ZdbTypeGetId(condition->columnType) == ZDB_TYPE_ID_BOOLEAN ? value != 0 : value;
     return ZDB_RESULT_SUCCESS;
 }
 
-int ZdbQueryAddTable(ZdbQuery* query, ZdbTable* table)
+int ZdbQueryBindFloat(ZdbQuery* query, int parameter, float value)
 {
-    if (query->table != NULL)
+    ZdbQueryCondition* condition;
+    void* slot;
+    int result = _bindValue(query, parameter, ZDB_TYPE_ID_FLOAT, &condition, &slot);
+    if (result != ZDB_RESULT_SUCCESS)
     {
-        // Multiple tables in query is not currently supported
-        return ZDB_RESULT_UNSUPPORTED;
+        return result;
     }
 
-    query->table = table;
+    *(float*)slot = value;
     return ZDB_RESULT_SUCCESS;
 }
 
-int ZdbQueryAddCondition(ZdbQuery* query, ZdbQueryConditionType type, int column, ZdbType* valueType, const char* str)
+int ZdbQueryBindString(ZdbQuery* query, int parameter, const char* value)
 {
-
-    if (query->database == NULL || query->table == NULL)
+    if (value == NULL)
     {
-        /* The query must be initialized and a table selected before adding a condition */
         return ZDB_RESULT_INVALID_NULL;
     }
 
-    if (column < 0 || column >= query->table->columnCount)
+    if (strlen(value) >= ZDB_LIMIT_VARCHAR)
     {
-        /* The column index is out of range for this query */
-        return ZDB_RESULT_INVALID_OPERATION;
+        /* Too long for a varchar, so it is left unbound */
+        return ZDB_RESULT_VALUE_ERROR;
     }
 
-    ZdbType* columnType = query->table->columns[column]->type;
-    if (columnType != valueType)
+    ZdbQueryCondition* condition;
+    void* slot;
+    int result = _bindValue(query, parameter, ZDB_TYPE_ID_VARCHAR, &condition, &slot);
+    if (result != ZDB_RESULT_SUCCESS)
     {
-        /* The types do not match */
-        return ZDB_RESULT_INVALID_CAST;
+        return result;
     }
 
-    void* value;
-    if (ZdbTypeNewValue(valueType, str, &value) != ZDB_RESULT_SUCCESS)
+    strcpy(slot, value);
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQueryDelete(ZdbQuery* query)
+{
+    if (query->joined)
     {
-        /* There was an error creating the value from the string */
-        return ZDB_RESULT_INVALID_OPERATION;
+        /* A joined row is a row of each table, so it isn't clear which one to delete */
+        return ZDB_RESULT_UNSUPPORTED;
     }
 
-    query->condition.type = type;
-    query->condition.columnIndex = column;
-    query->condition.value = value;
+    if (query->aggregateCount > 0 || query->groupCount > 0)
+    {
+        /* Aggregate queries don't return rows to delete */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
 
-    return ZDB_RESULT_SUCCESS;
-}
+    ZdbRecordset* recordset;
+    int result = ZdbQueryExecute(query, &recordset);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        return result;
+    }
 
+    /* Find every match first, then delete them in one go */
+    int count = 0;
+    int capacity = 256;
+    int* rowIndexes = malloc(capacity * sizeof(int));
+    while (ZdbQueryNextResult(recordset))
+    {
+        if (count == capacity)
+        {
+            capacity *= 2;
+            rowIndexes = realloc(rowIndexes, capacity * sizeof(int));
+        }
+        rowIndexes[count++] = recordset->rowIndex;
+    }
 
-int ZdbQueryExecute(ZdbQuery* query, ZdbRecordset** recordset)
-{
-    ZdbRecordset* rs = malloc(sizeof(recordset));
-    rs->query = query;
-    rs->rowIndex = -1;
+    result = ZdbEngineDeleteRows(query->table, count, rowIndexes);
+    free(rowIndexes);
 
-    *recordset = rs;
-    return ZDB_RESULT_SUCCESS;
+    return result;
 }
 
 int ZdbQueryFree(ZdbQuery* query)
@@ -167,9 +4026,33 @@ int ZdbQueryFree(ZdbQuery* query)
         return ZDB_RESULT_INVALID_NULL;
     }
 
-    if (query->condition.value)
+    for (int i = 0; i < query->conditionCount; i++)
+    {
+        _freeCondition(&query->conditions[i]);
+    }
+    free(query->cursor);
+
+    while (query->recordsets != NULL)
     {
-        free(query->condition.value);
+        ZdbRecordset* rs = query->recordsets;
+        query->recordsets = rs->next;
+        _unpinTables(rs);
+        free(rs->indexRows);
+        free(rs->joinEntries);
+        free(rs->joinBuckets);
+        free(rs->scanRows);
+        _freeSort(&rs->sort);
+        free(rs->cursor);
+        if (rs->grouped)
+        {
+            _freeGroupTable(&rs->groups);
+        }
+        free(rs->selection);
+        for (int i = 0; i < rs->projectionCount; i++)
+        {
+            free(rs->projected[i]);
+        }
+        free(rs);
     }
 
     free(query);
@@ -177,17 +4060,113 @@ int ZdbQueryFree(ZdbQuery* query)
     return ZDB_RESULT_SUCCESS;
 }
 
-int ZdbQueryNextResult(ZdbRecordset* recordset)
+int _nextIndexedResult(ZdbRecordset* recordset)
+{
+    ZdbTable* table = recordset->query->table;
+    while (recordset->indexPosition < recordset->indexRowCount)
+    {
+        /* Rows deleted or changed since the query ran are skipped.  The table is pinned, so the handles haven't
+           moved */
+        ZdbRow* row = recordset->indexRows[recordset->indexPosition++];
+        recordset->rowIndex = row->index;
+        if (row->index > recordset->afterRow && !ZdbEngineIsRowDeleted(table, row->index) && _matchesQuery(recordset))
+        {
+            return 1;
+        }
+    }
+
+    recordset->rowIndex = table->rowCount;
+    if (recordset->pinned)
+    {
+        recordset->pinned = 0;
+        ZdbEngineUnpinTable(table);
+    }
+    return 0;
+}
+
+int _nextScannedResult(ZdbRecordset* recordset)
+{
+    ZdbTable* table = recordset->query->table;
+    while (recordset->scanPosition < recordset->scanRowCount)
+    {
+        /* Rows deleted since the scan are skipped */
+        recordset->rowIndex = recordset->scanRows[recordset->scanPosition++];
+        if (!ZdbEngineIsRowDeleted(table, recordset->rowIndex))
+        {
+            return 1;
+        }
+    }
+
+    recordset->rowIndex = table->rowCount;
+    if (recordset->pinned)
+    {
+        recordset->pinned = 0;
+        ZdbEngineUnpinTable(table);
+    }
+    return 0;
+}
+
+int _nextResult(ZdbRecordset* recordset)
 {
+    if (recordset->sorted && recordset->sort.runCount > 0)
+    {
+        return _nextMergedResult(recordset);
+    }
+
+    if (recordset->joined)
+    {
+        return _nextJoinedResult(recordset);
+    }
+
+    if (recordset->grouped)
+    {
+        return _nextGroup(recordset);
+    }
+
+    if (recordset->aggregated)
+    {
+        /* Ungrouped aggregate queries have the one result row */
+        return recordset->aggregatePosition < 2 && ++recordset->aggregatePosition == 1;
+    }
+
+    if (recordset->indexed)
+    {
+        return _nextIndexedResult(recordset);
+    }
+
+    if (recordset->scanned)
+    {
+        return _nextScannedResult(recordset);
+    }
+
+    ZdbTable* table = recordset->query->table;
     while (1)
     {
-        ++recordset->rowIndex;
-        if (recordset->rowIndex >= recordset->query->table->rowCount)
+        /* Deleted rows are stepped over */
+        recordset->rowIndex = ZdbEngineNextLiveRow(table, recordset->rowIndex + 1);
+        if (recordset->rowIndex >= table->rowCount)
         {
             /* No more rows */
+            if (recordset->pinned)
+            {
+                recordset->pinned = 0;
+                ZdbEngineUnpinTable(table);
+            }
             return 0;
         }
 
+        /* Chunks whose zone rules out the condition are passed over whole */
+        int chunk = recordset->rowIndex / ZDB_ROW_CHUNKS;
+        if (chunk != recordset->zoneChunk)
+        {
+            recordset->zoneChunk = chunk;
+            if (!_chunkMayMatch(recordset->query, chunk))
+            {
+                recordset->rowIndex = (chunk + 1) * ZDB_ROW_CHUNKS - 1;
+                continue;
+            }
+        }
+
         if (_matchesQuery(recordset))
         {
             break;
@@ -198,22 +4177,235 @@ int ZdbQueryNextResult(ZdbRecordset* recordset)
     return 1;
 }
 
+int ZdbQueryNextResult(ZdbRecordset* recordset)
+{
+    for (; recordset->skipped < recordset->offset; recordset->skipped++)
+    {
+        if (!_nextResult(recordset))
+        {
+            return _endResults(recordset);
+        }
+    }
+
+    if ((recordset->limit != ZDB_QUERY_NO_LIMIT && recordset->returned >= recordset->limit) || !_nextResult(recordset))
+    {
+        /* Out of rows, or the limit has them run out early */
+        return _endResults(recordset);
+    }
+
+    recordset->returned++;
+    recordset->lastRow = recordset->rowIndex;
+    return 1;
+}
+
+/* Bytes each value of the column takes up in a projected batch */
+size_t _projectedSize(ZdbTable* table, int column)
+{
+    switch (table->layout.tags[column])
+    {
+        case ZDB_LAYOUT_TAG_INT:
+        case ZDB_LAYOUT_TAG_FLOAT:
+        case ZDB_LAYOUT_TAG_BOOLEAN:
+            return sizeof(int);
+        case ZDB_LAYOUT_TAG_VARCHAR:
+        case ZDB_LAYOUT_TAG_DICTIONARY:
+            return sizeof(ZdbString);
+    }
+    return sizeof(void*);
+}
+
+/* Fills in the projected columns for the rows of the batch.  Only those columns are read */
+int _projectBatch(ZdbRecordset* recordset, ZdbQueryBatch* batch)
+{
+    ZdbTable* table = recordset->query->table;
+    if (recordset->projectedCapacity < recordset->selectionCapacity)
+    {
+        for (int i = 0; i < recordset->projectionCount; i++)
+        {
+            size_t size = _projectedSize(table, recordset->projection[i]);
+            void* values = realloc(recordset->projected[i], recordset->selectionCapacity * size);
+            if (values == NULL)
+            {
+                return ZDB_RESULT_INVALID_OPERATION;
+            }
+            recordset->projected[i] = values;
+        }
+        recordset->projectedCapacity = recordset->selectionCapacity;
+    }
+
+    for (int i = 0; i < recordset->projectionCount; i++)
+    {
+        ZdbEngineGatherColumn(table, recordset->projection[i], batch->count, batch->rows, recordset->projected[i]);
+    }
+
+    batch->columnCount = recordset->projectionCount;
+    batch->columns = (const void* const*)recordset->projected;
+    return batch->count;
+}
+
+/* Batches of rows already found, through an index or a parallel scan */
+int _nextFoundBatch(ZdbRecordset* recordset, int maxRows)
+{
+    int count = 0;
+    while (count < maxRows && ZdbQueryNextResult(recordset))
+    {
+        recordset->selection[count++] = recordset->rowIndex;
+    }
+    return count;
+}
+
+int ZdbQueryNextBatch(ZdbRecordset* recordset, int maxRows, ZdbQueryBatch* batch)
+{
+    if (recordset == NULL || batch == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (maxRows <= 0 || recordset->aggregated)
+    {
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    if (recordset->joined)
+    {
+        /* Batches are of one table's rows */
+        return ZDB_RESULT_UNSUPPORTED;
+    }
+
+    if (maxRows > recordset->selectionCapacity)
+    {
+        int* selection = realloc(recordset->selection, maxRows * sizeof(int));
+        if (selection == NULL)
+        {
+            return ZDB_RESULT_INVALID_OPERATION;
+        }
+        recordset->selection = selection;
+        recordset->selectionCapacity = maxRows;
+    }
+
+    batch->rows = recordset->selection;
+    if (recordset->indexed || recordset->scanned)
+    {
+        batch->count = _nextFoundBatch(recordset, maxRows);
+        return _projectBatch(recordset, batch);
+    }
+
+    if (recordset->limit != ZDB_QUERY_NO_LIMIT && maxRows > recordset->limit - recordset->returned)
+    {
+        maxRows = recordset->limit - recordset->returned;
+    }
+
+    ZdbTable* table = recordset->query->table;
+    int count = 0;
+    int position = recordset->rowIndex + 1;
+    while (count < maxRows && position < table->rowCount)
+    {
+        int chunk = position / ZDB_ROW_CHUNKS;
+        int start = chunk * ZDB_ROW_CHUNKS;
+
+        recordset->zoneChunk = chunk;
+        uint64_t mask[ZDB_TOMBSTONE_WORDS];
+        if (!_matchLiveRows(recordset->query, chunk, recordset->gather, mask))
+        {
+            position = start + ZDB_ROW_CHUNKS;
+            continue;
+        }
+
+        /* Only the matches from position on, less any the offset still has to skip */
+        for (int i = 0; i < ZDB_TOMBSTONE_WORDS; i++)
+        {
+            int skip = position - start - i * 64;
+            mask[i] &= ~(skip >= 64 ? ~0ull : skip > 0 ? (1ull << skip) - 1 : 0);
+            while (mask[i] != 0 && recordset->skipped < recordset->offset)
+            {
+                int matches = __builtin_popcountll(mask[i]);
+                if (matches <= recordset->offset - recordset->skipped)
+                {
+                    recordset->skipped += matches;
+                    mask[i] = 0;
+                }
+                else
+                {
+                    recordset->skipped++;
+                    mask[i] &= mask[i] - 1;
+                }
+            }
+        }
+
+        for (int i = 0; i < ZDB_TOMBSTONE_WORDS && count < maxRows; i++)
+        {
+            while (mask[i] != 0 && count < maxRows)
+            {
+                recordset->selection[count++] = start + i * 64 + __builtin_ctzll(mask[i]);
+                mask[i] &= mask[i] - 1;
+            }
+        }
+
+        /* A full batch ends at its last row; the rest of the chunk is looked at again next time */
+        position = count == maxRows ? recordset->selection[count - 1] + 1 : start + ZDB_ROW_CHUNKS;
+    }
+
+    recordset->returned += count;
+    if (count > 0)
+    {
+        recordset->lastRow = recordset->selection[count - 1];
+    }
+    if (count == maxRows && count > 0)
+    {
+        recordset->rowIndex = recordset->selection[count - 1];
+    }
+    else
+    {
+        _endResults(recordset);
+    }
+
+    batch->count = count;
+    return _projectBatch(recordset, batch);
+}
+
 int ZdbQueryGetValue(ZdbRecordset* recordset, int column, ZdbType* type, void** value)
 {
-    if (column < 0 || column >= recordset->query->table->columnCount)
+    /* Joined rows number the second table's columns after the first's */
+    ZdbTable* table = recordset->query->table;
+    int rowIndex = recordset->rowIndex;
+    if (recordset->joined && column >= table->columnCount)
+    {
+        column -= table->columnCount;
+        table = recordset->query->tables[1];
+        rowIndex = recordset->joinRows[1];
+    }
+
+    if (column < 0 || column >= table->columnCount)
     {
         /* Invalid column specified */
         return ZDB_RESULT_INVALID_OPERATION;
     }
 
-    if (type != recordset->query->table->columns[column]->type)
+    if (type != table->columns[column]->type)
     {
         /* Attempt to cast result to an incompatible type */
         return ZDB_RESULT_INVALID_CAST;
     }
 
-    ZdbRow* resultRow = recordset->query->table->rows[recordset->rowIndex];
-    if (ZdbEngineGetValue(recordset->query->table, resultRow, column, value) != ZDB_RESULT_SUCCESS)
+    if (recordset->aggregated)
+    {
+        /* Result rows only hold the aggregates, and the keys of their group */
+        ZdbGroupTable* groups = &recordset->groups;
+        for (int k = 0; recordset->aggregates != NULL && k < groups->keyCount; k++)
+        {
+            if (groups->columns[k] == column)
+            {
+                if (groups->tags[k] == ZDB_LAYOUT_TAG_DICTIONARY)
+                    *value = recordset->query->table->dictionaries[column]->values[recordset->groupKey[k].i];
+                else
+                    *value = &recordset->groupKey[k];
+                return ZDB_RESULT_SUCCESS;
+            }
+        }
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    if (ZdbEngineGetValue(table, ZdbEngineRowAt(table, rowIndex), column, value) != ZDB_RESULT_SUCCESS)
     {
         /* Error getting the value for this row */
         return ZDB_RESULT_INVALID_OPERATION;
@@ -274,6 +4466,111 @@ int ZdbQueryGetFloat(ZdbRecordset* recordset, int column, float* value)
     return result;
 }
 
+int ZdbQueryGetAggregate(ZdbRecordset* recordset, int aggregate, double* value)
+{
+    if (recordset == NULL || value == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (recordset->aggregates == NULL || aggregate < 0 || aggregate >= recordset->query->aggregateCount)
+    {
+        /* Not an aggregate of this recordset's query */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    ZdbQueryAggregate* a = &recordset->query->aggregates[aggregate];
+    ZdbAggregateState* state = &recordset->aggregates[aggregate];
+    int isFloat = a->function != ZDB_AGG_COUNT && recordset->query->table->layout.tags[a->column] == ZDB_LAYOUT_TAG_FLOAT;
+    if (state->count == 0 && a->function != ZDB_AGG_COUNT && a->function != ZDB_AGG_SUM)
+    {
+        /* There's no smallest, largest or average of nothing */
+        return ZDB_RESULT_NOT_FOUND;
+    }
+
+    switch (a->function)
+    {
+        case ZDB_AGG_COUNT:
+            *value = (double)state->count;
+            break;
+        case ZDB_AGG_SUM:
+            *value = isFloat ? state->floatSum : (double)state->intSum;
+            break;
+        case ZDB_AGG_MIN:
+            *value = isFloat ? state->floatMin : state->intMin;
+            break;
+        case ZDB_AGG_MAX:
+            *value = isFloat ? state->floatMax : state->intMax;
+            break;
+        case ZDB_AGG_AVG:
+            *value = (isFloat ? state->floatSum : (double)state->intSum) / state->count;
+            break;
+    }
+
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQueryGetGroupStats(ZdbRecordset* recordset, ZdbGroupStats* stats)
+{
+    if (recordset == NULL || stats == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (!recordset->grouped)
+    {
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    stats->groupCount = recordset->groupsReturned;
+    stats->passes = recordset->groupScans;
+    stats->direct = recordset->groupShape.direct;
+    stats->peakBytes = recordset->groupBudget.peak;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQueryGetSortStats(ZdbRecordset* recordset, ZdbSortStats* stats)
+{
+    if (recordset == NULL || stats == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (!recordset->sorted)
+    {
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    stats->topN = recordset->sort.topN;
+    stats->runs = recordset->sort.spilledRuns;
+    stats->mergePasses = recordset->sort.mergePasses;
+    stats->failed = recordset->sort.failed;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbQueryGetCursor(ZdbRecordset* recordset, const char** token)
+{
+    if (recordset == NULL || token == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (recordset->aggregated || recordset->joined)
+    {
+        return ZDB_RESULT_UNSUPPORTED;
+    }
 
+    if (!recordset->finished)
+    {
+        /* The table is still pinned, so the last row hasn't moved */
+        _saveCursor(recordset);
+    }
 
+    if (recordset->cursor == NULL)
+    {
+        return recordset->lastRow < 0 ? ZDB_RESULT_NOT_FOUND : ZDB_RESULT_UNSUPPORTED;
+    }
 
+    *token = recordset->cursor;
+    return ZDB_RESULT_SUCCESS;
+}
@@ -18,6 +18,30 @@
 #define ZDB_QUERY_CONDITION_LTE     4       /* Less than or equal to */
 #define ZDB_QUERY_CONDITION_GT      5       /* Greater than */
 #define ZDB_QUERY_CONDITION_GTE     6       /* Greater than or equal to */
+#define ZDB_QUERY_CONDITION_IN      7       /* Equal to any one of a list of values */
+
+#define ZDB_AGG_COUNT               1       /* Matching rows.  The column is ignored */
+#define ZDB_AGG_SUM                 2
+#define ZDB_AGG_MIN                 3       /* Float columns pass over NaN */
+#define ZDB_AGG_MAX                 4
+#define ZDB_AGG_AVG                 5
+
+#define ZDB_QUERY_TABLES            2       /* Most tables one query can join */
+#define ZDB_QUERY_CONDITIONS        8       /* Most conditions one query can have, each on a column of its own */
+#define ZDB_QUERY_AGGREGATES        16      /* Most aggregates one query can compute */
+#define ZDB_QUERY_GROUP_COLUMNS     4       /* Most columns one query can group by */
+#define ZDB_QUERY_GROUP_MEMORY      (64 * 1024 * 1024)      /* Bytes a query's groups can take up, unless set otherwise */
+#define ZDB_QUERY_GROUP_MEMORY_MIN  (64 * 1024)
+#define ZDB_QUERY_ORDER_COLUMNS     4       /* Most columns one query can order by */
+#define ZDB_QUERY_SORT_MEMORY       (64 * 1024 * 1024)      /* Bytes a query's sort can take up, unless set otherwise */
+#define ZDB_QUERY_SORT_MEMORY_MIN   (64 * 1024)
+#define ZDB_QUERY_NO_LIMIT          -1
+#define ZDB_QUERY_BATCH_ROWS        1024    /* A good maxRows for ZdbQueryNextBatch */
+#define ZDB_QUERY_MORSEL_CHUNKS     64      /* Chunks of rows a parallel scan hands to a worker at a time */
+
+#define ZDB_QUERY_ACCESS_SCAN           0   /* Every row is read, passing over chunks the zones rule out */
+#define ZDB_QUERY_ACCESS_INDEX_SCAN     1   /* A B+tree finds the rows holding a value or a range of them */
+#define ZDB_QUERY_ACCESS_INDEX_LOOKUP   2   /* A hash index finds the rows holding a value */
 
 typedef int ZdbQueryConditionType;
 
@@ -25,18 +49,161 @@ typedef struct _ZdbQueryCondition ZdbQueryCondition;
 typedef struct _ZdbQuery ZdbQuery;
 typedef struct _ZdbRecordset ZdbRecordset;
 
+typedef struct
+{
+    int count;                      /* Matching rows in the batch */
+    const int* rows;                /* Their positions in the table, in table order unless the query is ordered.
+                                       Belongs to the recordset and is overwritten by its next batch */
+    int columnCount;                /* Projected columns, in the order ZdbQuerySetProjection was given them */
+    const void* const* columns;     /* columns[i] holds the batch's values of projected column i, laid out the way
+                                       ZdbEngineGatherColumn lays them out.  Belongs to the recordset, like rows */
+} ZdbQueryBatch;
+
+typedef struct
+{
+    int groupCount;                 /* Groups returned so far */
+    int passes;                     /* Passes made over the rows, counting any started over for want of memory */
+    int direct;                     /* The keys had a small enough domain to find groups without hashing */
+    size_t peakBytes;               /* Most memory the query's group tables held at once */
+} ZdbGroupStats;
+
+typedef struct
+{
+    int topN;                       /* The limit was small enough to keep just the best rows, in a heap */
+    int runs;                       /* Sorted runs spilled to temporary files */
+    int mergePasses;                /* Passes merging runs before the last, which is made as the rows are read */
+    int failed;                     /* The last merge couldn't read a run back, so rows after the last one returned are missing */
+} ZdbSortStats;
+
+typedef struct
+{
+    int access;                     /* ZDB_QUERY_ACCESS_* */
+    int column;                     /* Column of the condition the index answers, -1 for scans */
+    double estimatedRows;           /* Rows expected to match, taking the conditions to be independent */
+    double cost;                    /* Expected work, counted in rows checked by a scan */
+    int conditionCount;
+    int conditionOrder[ZDB_QUERY_CONDITIONS];   /* Conditions, numbered in the order they were added, in the order
+                                                   they are checked: the one the index answers, then the most
+                                                   selective first */
+} ZdbQueryPlan;
+
 int ZdbQueryCreate(ZdbDatabase* database, ZdbQuery** query);
 int ZdbQueryAddTable(ZdbQuery* query, ZdbTable* table);
+
+/* Joins the query's two tables on column of the first equalling otherColumn of the second, which must be of the
+   same type.  Each result row is then a pair of rows, one from each table; ZdbQueryGet* number the second table's
+   columns after the first's, so its column c is read as the first table's columnCount + c.  The table with fewer
+   live rows is hashed and the other streamed past it.  Conditions are on the first table.  Joined queries can't
+   be aggregated, grouped, deleted from or read in batches yet */
+int ZdbQueryAddJoin(ZdbQuery* query, int column, int otherColumn);
+
+/* Has the query return only rows whose column compares with the value str parses to, or equals one of strs.
+   Conditions on different columns must all hold, up to ZDB_QUERY_CONDITIONS of them; a condition on a column that
+   already has one replaces it.  A NULL str, or NULL among strs, leaves a placeholder to be given a value by
+   ZdbQueryBind* before the query is executed.  Parameters number the values of every condition in the order the
+   conditions were first added, so a query with one comparison has just parameter 0.  Columns of types made with
+   ZdbTypeCreate can't take placeholders */
 int ZdbQueryAddCondition(ZdbQuery* query, ZdbQueryConditionType type, int column, ZdbType* valueType, const char* str);
-int ZdbQueryExecute(ZdbQuery* query, ZdbRecordset** recordset);
+int ZdbQueryAddInCondition(ZdbQuery* query, int column, ZdbType* valueType, int count, const char** strs);
+
+/* Has the query compute an aggregate over its matching rows instead of returning them.  Sum, min, max and average
+   take int, float or boolean columns.  A query with aggregates works them all out in ZdbQueryExecute and returns a
+   single result row, whose values are read with ZdbQueryGetAggregate in the order the aggregates were added */
+int ZdbQueryAddAggregate(ZdbQuery* query, int function, int column);
+
+/* Has the query return one row per distinct combination of the grouped columns' values, in no particular order,
+   with its aggregates worked out over each group's rows.  Int, float, boolean and dictionary encoded varchar
+   columns can be grouped by; a group's keys are read with the usual ZdbQueryGet* functions and its aggregates
+   with ZdbQueryGetAggregate.  Floats that compare equal group together, and so do all NaNs */
+int ZdbQueryAddGroup(ZdbQuery* query, int column);
+
+/* Caps the memory a grouped query's groups take up.  Groups that don't fit are found a share of them at a time,
+   in further passes over the rows as the recordset runs out of groups */
+int ZdbQuerySetGroupMemory(ZdbQuery* query, size_t bytes);
+
+/* Orders the query's rows by a column of the first table, ascending or descending; columns added later break ties
+   among earlier ones, and rows that still tie come in table order.  NaN sorts below every other float and strings
+   compare bytewise.  Ordered queries are sorted in ZdbQueryExecute and can't be joined, aggregated or grouped yet */
+int ZdbQueryAddOrder(ZdbQuery* query, int column, int descending);
+
+/* Stops the recordset after this many rows, and its scan once it has found them.  An ordered query whose offset
+   and limit together fit its sort memory only ever keeps that many of the best rows rather than sorting them all.
+   A limit, offset or cursor has unordered parallel scans and B+tree ranges return rows in table order, so that
+   pages line up */
+int ZdbQuerySetLimit(ZdbQuery* query, int limit);
+
+/* Has the recordset pass over this many rows before returning any.  The skipped rows are still found, so deep
+   pages are better reached through a cursor */
+int ZdbQuerySetOffset(ZdbQuery* query, int offset);
+
+/* Has the recordset start after the row a token from ZdbQueryGetCursor marks, as though the rows up to it were
+   never there, so that a page costs the same however deep it is.  The query has to be ordered the way the one the
+   token came from was.  Ordered queries resume after the row's order values, ties going by position in the table;
+   unordered ones resume after its position alone.  Either way tokens go stale once compaction moves rows, from when
+   ZdbQueryExecute turns them down.  NULL starts from the first row again */
+int ZdbQuerySetCursor(ZdbQuery* query, const char* token);
+
+/* Caps the memory an ordered query's sort takes up.  Rows beyond it are sorted a buffer at a time and spilled to
+   temporary files, to be merged back as the recordset is read */
+int ZdbQuerySetSortMemory(ZdbQuery* query, size_t bytes);
+
+/* Columns whose values ZdbQueryNextBatch hands back as arrays, one per column.  Recordsets use the projection the
+   query had when they were executed; a count of 0 projects nothing */
+int ZdbQuerySetProjection(ZdbQuery* query, int count, const int* columns);
+
+/* Has ZdbQueryExecute scan the table with this many threads, 0 meaning one per online CPU.  Ordered results come
+   back in table order; unordered ones in the order the workers found them, which saves the merge.  Either way the
+   matching rows are all found while ZdbQueryExecute runs: rows deleted afterwards are passed over, but later
+   changes to the others aren't seen.  Conditions answered through an index don't scan and run as before */
+int ZdbQuerySetParallel(ZdbQuery* query, int threads, int ordered);
+
+int ZdbQueryExecute(ZdbQuery* query, ZdbRecordset** recordset);   /* The table can't be compacted until the recordset runs out of rows or the query is freed */
+
+/* Plans the query as ZdbQueryExecute would, without running it.  Each run orders the conditions by how many rows
+   they are expected to match, most selective first, and finds the rows through whichever of a scan or an index on
+   one of the conditions' columns looks cheapest.  Tables analyzed with ZdbEngineAnalyzeTable are costed from their
+   stats, so a scan can win over an index that would match most of the rows; on other tables an index is always
+   used.  Rows from a B+tree range come in key order, and from a scan in table order */
+int ZdbQueryGetPlan(ZdbQuery* query, ZdbQueryPlan* plan);
+
+/* Runs the query again into a recordset it executed before, with whatever values are bound now, and starts the
+   recordset over from its first row.  The arrays it found rows and batches in are kept for the new run, so index
+   lookups and plain scans allocate nothing; sorts, groups, joins and parallel scans still allocate what they work
+   in.  The query's other recordsets are left as they were */
+int ZdbQueryReexecute(ZdbRecordset* recordset);
+
+/* Give the condition's parameter a typed value without parsing or allocating, whether it was a placeholder or a
+   value of its own: ints for int and boolean columns, where anything but 0 is true, floats for float columns and
+   strings, shorter than ZDB_LIMIT_VARCHAR, for varchar columns.  Values stay bound until bound again.  Executing
+   with a placeholder left unbound is ZDB_RESULT_INVALID_OPERATION, binding the wrong type ZDB_RESULT_INVALID_CAST
+   and a parameter the condition doesn't have ZDB_RESULT_NOT_FOUND.  Recordsets still being read may see a new value
+   for the rows they have yet to check, so bind between runs */
+int ZdbQueryBindInt(ZdbQuery* query, int parameter, int value);
+int ZdbQueryBindFloat(ZdbQuery* query, int parameter, float value);
+int ZdbQueryBindString(ZdbQuery* query, int parameter, const char* value);
+int ZdbQueryDelete(ZdbQuery* query);    /* Deletes every row the query matches and returns how many there were */
 int ZdbQueryFree(ZdbQuery* query);
 
 int ZdbQueryNextResult(ZdbRecordset* recordset);
 
+/* Fills the batch with up to maxRows of the rows still to come, checking the condition a chunk at a time rather
+   than a row at a time.  Returns how many rows the batch holds, 0 once there are none left.  The recordset moves
+   to the last row of the batch, so batches and single results can be mixed */
+int ZdbQueryNextBatch(ZdbRecordset* recordset, int maxRows, ZdbQueryBatch* batch);
+
 int ZdbQueryGetValue(ZdbRecordset* recordset, int column, ZdbType* type, void** value);
 int ZdbQueryGetInt(ZdbRecordset* recordset, int column, int* value);
 int ZdbQueryGetBoolean(ZdbRecordset* recordset, int column, int* value);
 int ZdbQueryGetString(ZdbRecordset* recordset, int column, char** value);  /* Note: You do NOT own this string! */
 int ZdbQueryGetFloat(ZdbRecordset* recordset, int column, float* value);
 
+/* The token for the last row the recordset returned, ZDB_RESULT_NOT_FOUND if it hasn't returned any.  Tokens are
+   strings of hex digits, fit to be handed to a client and back.  Note: You do NOT own this string! */
+int ZdbQueryGetCursor(ZdbRecordset* recordset, const char** token);
+
+/* Integer sums are exact up to 2^53.  Min, max and average of no rows are ZDB_RESULT_NOT_FOUND */
+int ZdbQueryGetAggregate(ZdbRecordset* recordset, int aggregate, double* value);
+int ZdbQueryGetGroupStats(ZdbRecordset* recordset, ZdbGroupStats* stats);
+int ZdbQueryGetSortStats(ZdbRecordset* recordset, ZdbSortStats* stats);
+
 #endif // QUERY_H
@@ -0,0 +1,1441 @@
+//
+//  sql.c
+//  ZombieSQL
+//
+//  A hand-written lexer feeds a recursive descent parser with one function per statement.  Names are resolved
+//  against the database while parsing, so a plan holds tables, column numbers and parsed values rather than text,
+//  and running it is a matter of engine and query calls.  The cache keys plans on the statement's text with
+//  keywords and names lowered and spacing collapsed, finds them through a hash table and drops the least recently
+//  used once it is full.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "types.h"
+#include "sql.h"
+
+#define ZDB_SQL_TOKEN_END       0
+#define ZDB_SQL_TOKEN_WORD      1       /* Keyword or name */
+#define ZDB_SQL_TOKEN_NAME      2       /* "Quoted" name, quotes and all */
+#define ZDB_SQL_TOKEN_NUMBER    3
+#define ZDB_SQL_TOKEN_STRING    4       /* 'Quoted' string, quotes and all */
+#define ZDB_SQL_TOKEN_SYMBOL    5
+#define ZDB_SQL_TOKEN_INVALID   6       /* Something no rule accepts, so it ends up a syntax error */
+
+#define ZDB_SQL_LITERAL_NUMBER  1
+#define ZDB_SQL_LITERAL_STRING  2
+#define ZDB_SQL_LITERAL_BOOLEAN 3
+
+typedef struct
+{
+    int kind;                   /* ZDB_SQL_TOKEN_* */
+    const char* start;
+    int length;
+} ZdbSqlToken;
+
+/* CREATE TABLE: the table to make.  Columns are made afresh each time it runs, since the table keeps them */
+typedef struct
+{
+    char name[ZDB_LIMIT_VARCHAR];
+    int columnCount;
+    char columnNames[ZDB_LIMIT_COLUMNS][ZDB_LIMIT_VARCHAR];
+    ZdbType* types[ZDB_LIMIT_COLUMNS];
+    int autoincrement[ZDB_LIMIT_COLUMNS];
+} ZdbSqlTableDef;
+
+struct _ZdbSqlStatement
+{
+    int type;                       /* ZDB_SQL_* */
+    ZdbDatabase* database;
+    ZdbTable* table;                /* Table the statement works on.  CREATE TABLE: NULL */
+    ZdbSqlTableDef* definition;     /* CREATE TABLE: the table to make */
+
+    void* values[ZDB_LIMIT_COLUMNS];    /* INSERT, UPDATE: value for each column, NULL where none is written */
+    int valueCount;                 /* INSERT, UPDATE: columns up to the last one written */
+
+    int projection[ZDB_LIMIT_COLUMNS];  /* SELECT: columns selected */
+    int projectionCount;
+    int orders[ZDB_QUERY_ORDER_COLUMNS];    /* SELECT: columns ordered by, most significant first */
+    int descending[ZDB_QUERY_ORDER_COLUMNS];
+    int orderCount;
+
+    ZdbQueryConditionType condition;    /* ZDB_QUERY_CONDITION_NONE for every row */
+    int conditionColumn;
+    int conditionCount;             /* Literals the condition compares with, more than one only for IN */
+    const char* conditionValues[ZDB_SQL_IN_VALUES];
+    char* text;                     /* The literals, unquoted and one after another */
+    size_t textUsed;
+
+    ZdbSqlCache* cache;             /* Cache holding the statement, NULL once it has left */
+    char* key;                      /* Normalized text */
+    size_t keyLength;
+    uint64_t hash;
+    ZdbSqlStatement* chain;         /* Next statement in the hash bucket */
+    ZdbSqlStatement* newer;         /* Neighbours in order of use */
+    ZdbSqlStatement* older;
+    int references;                 /* Prepares not yet released */
+};
+
+struct _ZdbSqlCache
+{
+    ZdbDatabase* database;
+    int capacity;
+    ZdbSqlStatement** buckets;
+    int bucketCount;                /* Always a power of two */
+    ZdbSqlStatement* newest;
+    ZdbSqlStatement* oldest;
+    char* key;                      /* Room to normalize statements into, grown as longer ones come along */
+    size_t keyCapacity;
+    ZdbSqlStats stats;
+};
+
+typedef struct
+{
+    ZdbDatabase* database;
+    ZdbSqlStatement* statement;     /* Plan being built */
+    const char* position;           /* Where the token after this one starts */
+    ZdbSqlToken token;              /* Token being looked at */
+} ZdbSqlParser;
+
+//
+// Lexer
+//
+
+void _sqlNext(ZdbSqlParser* parser)
+{
+    const char* p = parser->position;
+    while (isspace((unsigned char)*p))
+    {
+        p++;
+    }
+
+    ZdbSqlToken* token = &parser->token;
+    token->start = p;
+    token->kind = ZDB_SQL_TOKEN_SYMBOL;
+
+    if (*p == '\0')
+    {
+        token->kind = ZDB_SQL_TOKEN_END;
+    }
+    else if (isalpha((unsigned char)*p) || *p == '_')
+    {
+        while (isalnum((unsigned char)*p) || *p == '_')
+        {
+            p++;
+        }
+        token->kind = ZDB_SQL_TOKEN_WORD;
+    }
+    else if (isdigit((unsigned char)*p) || (*p == '.' && isdigit((unsigned char)p[1])))
+    {
+        while (isdigit((unsigned char)*p))
+        {
+            p++;
+        }
+        if (*p == '.')
+        {
+            for (p++; isdigit((unsigned char)*p); p++);
+        }
+        if ((*p == 'e' || *p == 'E') &&
+            (isdigit((unsigned char)p[1]) || ((p[1] == '+' || p[1] == '-') && isdigit((unsigned char)p[2]))))
+        {
+            for (p += 2; isdigit((unsigned char)*p); p++);
+        }
+
+        /* A number run into a name, like 12abc, is neither */
+        token->kind = isalpha((unsigned char)*p) || *p == '_' ? ZDB_SQL_TOKEN_INVALID : ZDB_SQL_TOKEN_NUMBER;
+    }
+    else if (*p == '\'' || *p == '"')
+    {
+        char quote = *p++;
+        token->kind = quote == '\'' ? ZDB_SQL_TOKEN_STRING : ZDB_SQL_TOKEN_NAME;
+        for (;;)
+        {
+            if (*p == '\0')
+            {
+                /* Never closed */
+                token->kind = ZDB_SQL_TOKEN_INVALID;
+                break;
+            }
+            if (*p++ == quote)
+            {
+                if (*p != quote)
+                {
+                    break;
+                }
+                p++;    /* Doubled, so it stands for itself */
+            }
+        }
+    }
+    else if ((p[0] == '<' && (p[1] == '=' || p[1] == '>')) || ((p[0] == '>' || p[0] == '!') && p[1] == '='))
+    {
+        p += 2;
+    }
+    else if (strchr("(),=<>*;+-", *p) != NULL)
+    {
+        p++;
+    }
+    else
+    {
+        token->kind = ZDB_SQL_TOKEN_INVALID;
+        p++;
+    }
+
+    token->length = (int)(p - token->start);
+    parser->position = p;
+}
+
+int _sqlIsWord(ZdbSqlParser* parser, const char* word)
+{
+    return parser->token.kind == ZDB_SQL_TOKEN_WORD && parser->token.length == (int)strlen(word) &&
+           !strncasecmp(parser->token.start, word, parser->token.length);
+}
+
+int _sqlIsSymbol(ZdbSqlParser* parser, const char* symbol)
+{
+    return parser->token.kind == ZDB_SQL_TOKEN_SYMBOL && parser->token.length == (int)strlen(symbol) &&
+           !strncmp(parser->token.start, symbol, parser->token.length);
+}
+
+int _sqlAcceptWord(ZdbSqlParser* parser, const char* word)
+{
+    if (!_sqlIsWord(parser, word))
+    {
+        return 0;
+    }
+
+    _sqlNext(parser);
+    return 1;
+}
+
+int _sqlAcceptSymbol(ZdbSqlParser* parser, const char* symbol)
+{
+    if (!_sqlIsSymbol(parser, symbol))
+    {
+        return 0;
+    }
+
+    _sqlNext(parser);
+    return 1;
+}
+
+int _sqlExpectWord(ZdbSqlParser* parser, const char* word)
+{
+    return _sqlAcceptWord(parser, word) ? ZDB_RESULT_SUCCESS : ZDB_RESULT_VALUE_ERROR;
+}
+
+int _sqlExpectSymbol(ZdbSqlParser* parser, const char* symbol)
+{
+    return _sqlAcceptSymbol(parser, symbol) ? ZDB_RESULT_SUCCESS : ZDB_RESULT_VALUE_ERROR;
+}
+
+//
+// Parser
+//
+
+/* Reads a name, plain or quoted, into a buffer of ZDB_LIMIT_VARCHAR characters */
+int _sqlName(ZdbSqlParser* parser, char* name)
+{
+    ZdbSqlToken* token = &parser->token;
+    int length = 0;
+
+    if (token->kind == ZDB_SQL_TOKEN_WORD)
+    {
+        if (token->length >= ZDB_LIMIT_VARCHAR)
+        {
+            return ZDB_RESULT_VALUE_ERROR;
+        }
+        memcpy(name, token->start, token->length);
+        length = token->length;
+    }
+    else if (token->kind == ZDB_SQL_TOKEN_NAME)
+    {
+        for (int i = 1; i < token->length - 1; i++)
+        {
+            if (length == ZDB_LIMIT_VARCHAR - 1)
+            {
+                return ZDB_RESULT_VALUE_ERROR;
+            }
+            name[length++] = token->start[i];
+            i += token->start[i] == '"';
+        }
+    }
+    else
+    {
+        return ZDB_RESULT_VALUE_ERROR;
+    }
+
+    name[length] = '\0';
+    _sqlNext(parser);
+    return ZDB_RESULT_SUCCESS;
+}
+
+int _sqlFindTable(ZdbDatabase* db, const char* name, ZdbTable** table)
+{
+    for (int i = 0; i < db->tableCount; i++)
+    {
+        /* Dropped tables keep their place but lose their columns */
+        if (db->tables[i]->columns != NULL && !strcasecmp(db->tables[i]->name, name))
+        {
+            *table = db->tables[i];
+            return ZDB_RESULT_SUCCESS;
+        }
+    }
+
+    return ZDB_RESULT_NOT_FOUND;
+}
+
+int _sqlTable(ZdbSqlParser* parser, ZdbTable** table)
+{
+    char name[ZDB_LIMIT_VARCHAR];
+    int result = _sqlName(parser, name);
+    return result == ZDB_RESULT_SUCCESS ? _sqlFindTable(parser->database, name, table) : result;
+}
+
+int _sqlColumn(ZdbSqlParser* parser, int* column)
+{
+    char name[ZDB_LIMIT_VARCHAR];
+    int result = _sqlName(parser, name);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        return result;
+    }
+
+    ZdbTable* table = parser->statement->table;
+    for (int i = 0; i < table->columnCount; i++)
+    {
+        if (!strcasecmp(table->columns[i]->name, name))
+        {
+            *column = i;
+            return ZDB_RESULT_SUCCESS;
+        }
+    }
+
+    return ZDB_RESULT_NOT_FOUND;
+}
+
+/* Reads a literal into the statement's text as the string its type parses values from.  Returns its kind, or an
+   error */
+int _sqlLiteral(ZdbSqlParser* parser, const char** text)
+{
+    ZdbSqlStatement* statement = parser->statement;
+    char* start = statement->text + statement->textUsed;
+    char* out = start;
+    int kind;
+
+    int negative = _sqlAcceptSymbol(parser, "-");
+    int sign = negative || _sqlAcceptSymbol(parser, "+");
+    ZdbSqlToken* token = &parser->token;
+
+    if (token->kind == ZDB_SQL_TOKEN_NUMBER)
+    {
+        if (negative)
+        {
+            *out++ = '-';
+        }
+        memcpy(out, token->start, token->length);
+        out += token->length;
+        kind = ZDB_SQL_LITERAL_NUMBER;
+    }
+    else if (sign)
+    {
+        /* Only numbers take a sign */
+        return ZDB_RESULT_VALUE_ERROR;
+    }
+    else if (token->kind == ZDB_SQL_TOKEN_STRING)
+    {
+        for (int i = 1; i < token->length - 1; i++)
+        {
+            *out++ = token->start[i];
+            i += token->start[i] == '\'';
+        }
+        if (out - start >= ZDB_LIMIT_VARCHAR)
+        {
+            /* Wouldn't fit a varchar */
+            return ZDB_RESULT_VALUE_ERROR;
+        }
+        kind = ZDB_SQL_LITERAL_STRING;
+    }
+    else if (_sqlIsWord(parser, "true") || _sqlIsWord(parser, "false"))
+    {
+        *out++ = _sqlIsWord(parser, "true") ? '1' : '0';
+        kind = ZDB_SQL_LITERAL_BOOLEAN;
+    }
+    else
+    {
+        /* NULL included, since fields always hold a value */
+        return _sqlIsWord(parser, "null") ? ZDB_RESULT_UNSUPPORTED : ZDB_RESULT_VALUE_ERROR;
+    }
+
+    *out++ = '\0';
+    statement->textUsed = out - statement->text;
+    *text = start;
+
+    _sqlNext(parser);
+    return kind;
+}
+
+/* Checks that a literal of this kind is a value of the column's type.  Types made with ZdbTypeCreate are left to
+   parse whatever they are given */
+int _sqlCheckLiteral(ZdbTable* table, int column, int kind, const char* text)
+{
+    switch (ZdbTypeGetId(table->columns[column]->type))
+    {
+        case ZDB_TYPE_ID_INT:
+        {
+            if (kind != ZDB_SQL_LITERAL_NUMBER || strpbrk(text, ".eE") != NULL)
+            {
+                return ZDB_RESULT_INVALID_CAST;
+            }
+
+            errno = 0;
+            long value = strtol(text, NULL, 10);
+            return errno != 0 || value < INT_MIN || value > INT_MAX ? ZDB_RESULT_VALUE_ERROR : ZDB_RESULT_SUCCESS;
+        }
+
+        case ZDB_TYPE_ID_FLOAT:
+            return kind == ZDB_SQL_LITERAL_NUMBER ? ZDB_RESULT_SUCCESS : ZDB_RESULT_INVALID_CAST;
+
+        case ZDB_TYPE_ID_BOOLEAN:
+            return kind == ZDB_SQL_LITERAL_BOOLEAN || (kind == ZDB_SQL_LITERAL_NUMBER &&
+                   (!strcmp(text, "0") || !strcmp(text, "1"))) ? ZDB_RESULT_SUCCESS : ZDB_RESULT_INVALID_CAST;
+
+        case ZDB_TYPE_ID_VARCHAR:
+            return kind == ZDB_SQL_LITERAL_STRING ? ZDB_RESULT_SUCCESS : ZDB_RESULT_INVALID_CAST;
+    }
+
+    return ZDB_RESULT_SUCCESS;
+}
+
+/* Reads a literal for a column and parses it into a value of the column's type */
+int _sqlValue(ZdbSqlParser* parser, int column, void** value)
+{
+    const char* text;
+    int kind = _sqlLiteral(parser, &text);
+    if (kind < 0)
+    {
+        return kind;
+    }
+
+    ZdbTable* table = parser->statement->table;
+    int result = _sqlCheckLiteral(table, column, kind, text);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        return result;
+    }
+
+    return ZdbTypeNewValue(table->columns[column]->type, text, value);
+}
+
+int _sqlWhere(ZdbSqlParser* parser)
+{
+    ZdbSqlStatement* statement = parser->statement;
+    statement->condition = ZDB_QUERY_CONDITION_NONE;
+    if (!_sqlAcceptWord(parser, "where"))
+    {
+        return ZDB_RESULT_SUCCESS;
+    }
+
+    int result = _sqlColumn(parser, &statement->conditionColumn);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        return result;
+    }
+
+    int in = _sqlAcceptWord(parser, "in");
+    if (in)
+    {
+        result = _sqlExpectSymbol(parser, "(");
+        statement->condition = ZDB_QUERY_CONDITION_IN;
+    }
+    else if (_sqlAcceptSymbol(parser, "="))
+    {
+        statement->condition = ZDB_QUERY_CONDITION_EQ;
+    }
+    else if (_sqlAcceptSymbol(parser, "<>") || _sqlAcceptSymbol(parser, "!="))
+    {
+        statement->condition = ZDB_QUERY_CONDITION_NE;
+    }
+    else if (_sqlAcceptSymbol(parser, "<="))
+    {
+        statement->condition = ZDB_QUERY_CONDITION_LTE;
+    }
+    else if (_sqlAcceptSymbol(parser, ">="))
+    {
+        statement->condition = ZDB_QUERY_CONDITION_GTE;
+    }
+    else if (_sqlAcceptSymbol(parser, "<"))
+    {
+        statement->condition = ZDB_QUERY_CONDITION_LT;
+    }
+    else if (_sqlAcceptSymbol(parser, ">"))
+    {
+        statement->condition = ZDB_QUERY_CONDITION_GT;
+    }
+    else
+    {
+        result = ZDB_RESULT_VALUE_ERROR;
+    }
+
+    do
+    {
+        if (result != ZDB_RESULT_SUCCESS)
+        {
+            return result;
+        }
+
+        if (statement->conditionCount == ZDB_SQL_IN_VALUES)
+        {
+            return ZDB_RESULT_UNSUPPORTED;
+        }
+
+        const char** text = &statement->conditionValues[statement->conditionCount++];
+        int kind = _sqlLiteral(parser, text);
+        result = kind < 0 ? kind : _sqlCheckLiteral(statement->table, statement->conditionColumn, kind, *text);
+    }
+    while (in && _sqlAcceptSymbol(parser, ","));
+
+    if (result == ZDB_RESULT_SUCCESS && in)
+    {
+        result = _sqlExpectSymbol(parser, ")");
+    }
+
+    if (result == ZDB_RESULT_SUCCESS && (_sqlIsWord(parser, "and") || _sqlIsWord(parser, "or")))
+    {
+        /* Queries take a single condition */
+        result = ZDB_RESULT_UNSUPPORTED;
+    }
+
+    return result;
+}
+
+int _sqlType(ZdbSqlParser* parser, ZdbType** type)
+{
+    char name[ZDB_LIMIT_VARCHAR];
+    if (parser->token.kind != ZDB_SQL_TOKEN_WORD || _sqlName(parser, name) != ZDB_RESULT_SUCCESS)
+    {
+        return ZDB_RESULT_VALUE_ERROR;
+    }
+
+    for (char* c = name; *c != '\0'; c++)
+    {
+        *c = tolower((unsigned char)*c);
+    }
+
+    if (!strcmp(name, "int") || !strcmp(name, "integer") || !strcmp(name, "smallint"))
+    {
+        *type = ZdbStandardTypes->intType;
+    }
+    else if (!strcmp(name, "float") || !strcmp(name, "real"))
+    {
+        *type = ZdbStandardTypes->floatType;
+    }
+    else if (!strcmp(name, "boolean"))
+    {
+        *type = ZdbStandardTypes->booleanType;
+    }
+    else if (!strcmp(name, "varchar") || !strcmp(name, "char") || !strcmp(name, "character"))
+    {
+        *type = ZdbStandardTypes->varcharType;
+        if (_sqlAcceptSymbol(parser, "("))
+        {
+            /* Every varchar holds up to the limit, so a length only has to be within it */
+            const char* text;
+            int kind = _sqlLiteral(parser, &text);
+            if (kind != ZDB_SQL_LITERAL_NUMBER || strpbrk(text, ".eE-") != NULL || atoi(text) < 1 ||
+                atoi(text) >= ZDB_LIMIT_VARCHAR)
+            {
+                return ZDB_RESULT_VALUE_ERROR;
+            }
+            return _sqlExpectSymbol(parser, ")");
+        }
+    }
+    else
+    {
+        return ZdbTypeFind(name, type) == ZDB_RESULT_SUCCESS ? ZDB_RESULT_SUCCESS : ZDB_RESULT_NOT_FOUND;
+    }
+
+    return ZDB_RESULT_SUCCESS;
+}
+
+int _sqlCreate(ZdbSqlParser* parser)
+{
+    ZdbSqlStatement* statement = parser->statement;
+    statement->type = ZDB_SQL_CREATE_TABLE;
+    ZdbSqlTableDef* def = statement->definition = calloc(1, sizeof(ZdbSqlTableDef));
+
+    int result = _sqlExpectWord(parser, "table");
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = _sqlName(parser, def->name);
+    }
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = _sqlExpectSymbol(parser, "(");
+    }
+
+    while (result == ZDB_RESULT_SUCCESS)
+    {
+        if (def->columnCount == ZDB_LIMIT_COLUMNS)
+        {
+            /* Tables are limited to a fixed number of columns */
+            return ZDB_RESULT_INVALID_OPERATION;
+        }
+
+        int c = def->columnCount++;
+        result = _sqlName(parser, def->columnNames[c]);
+        for (int i = 0; result == ZDB_RESULT_SUCCESS && i < c; i++)
+        {
+            if (!strcasecmp(def->columnNames[i], def->columnNames[c]))
+            {
+                /* Names have to tell the columns apart */
+                result = ZDB_RESULT_INVALID_OPERATION;
+            }
+        }
+        if (result == ZDB_RESULT_SUCCESS)
+        {
+            result = _sqlType(parser, &def->types[c]);
+        }
+        if (result == ZDB_RESULT_SUCCESS)
+        {
+            def->autoincrement[c] = _sqlAcceptWord(parser, "autoincrement") || _sqlAcceptWord(parser, "auto_increment");
+            if (def->autoincrement[c] && !ZdbTypeSupportsNextValue(def->types[c]))
+            {
+                /* The type has no next value to hand out */
+                result = ZDB_RESULT_INVALID_OPERATION;
+            }
+        }
+        if (result == ZDB_RESULT_SUCCESS && !_sqlAcceptSymbol(parser, ","))
+        {
+            break;
+        }
+    }
+
+    return result == ZDB_RESULT_SUCCESS ? _sqlExpectSymbol(parser, ")") : result;
+}
+
+int _sqlInsert(ZdbSqlParser* parser)
+{
+    ZdbSqlStatement* statement = parser->statement;
+    statement->type = ZDB_SQL_INSERT;
+
+    int result = _sqlExpectWord(parser, "into");
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = _sqlTable(parser, &statement->table);
+    }
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        return result;
+    }
+
+    ZdbTable* table = statement->table;
+    int columns[ZDB_LIMIT_COLUMNS];
+    int columnCount = 0;
+    int given[ZDB_LIMIT_COLUMNS] = { 0 };
+
+    if (_sqlAcceptSymbol(parser, "("))
+    {
+        do
+        {
+            int column;
+            result = _sqlColumn(parser, &column);
+            if (result != ZDB_RESULT_SUCCESS)
+            {
+                return result;
+            }
+
+            if (table->columns[column]->autoincrement)
+            {
+                /* Cannot specify explicit value for autoincrement columns */
+                return ZDB_RESULT_VALUE_ERROR;
+            }
+
+            if (given[column]++)
+            {
+                /* Each column gets a single value */
+                return ZDB_RESULT_INVALID_OPERATION;
+            }
+
+            columns[columnCount++] = column;
+        }
+        while (_sqlAcceptSymbol(parser, ","));
+
+        result = _sqlExpectSymbol(parser, ")");
+    }
+    else
+    {
+        for (int i = 0; i < table->columnCount; i++)
+        {
+            if (!table->columns[i]->autoincrement)
+            {
+                given[i] = 1;
+                columns[columnCount++] = i;
+            }
+        }
+    }
+
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = _sqlExpectWord(parser, "values");
+    }
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = _sqlExpectSymbol(parser, "(");
+    }
+
+    for (int i = 0; i < columnCount && result == ZDB_RESULT_SUCCESS; i++)
+    {
+        if (i > 0)
+        {
+            result = _sqlExpectSymbol(parser, ",");
+        }
+        if (result == ZDB_RESULT_SUCCESS)
+        {
+            result = _sqlValue(parser, columns[i], &statement->values[columns[i]]);
+        }
+    }
+
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        /* A value for each column */
+        result = _sqlExpectSymbol(parser, ")");
+    }
+
+    for (int i = 0; i < table->columnCount && result == ZDB_RESULT_SUCCESS; i++)
+    {
+        if (!given[i] && !table->columns[i]->autoincrement)
+        {
+            result = ZdbTypeNewValue(table->columns[i]->type, "", &statement->values[i]);
+        }
+    }
+
+    statement->valueCount = table->columnCount;
+    return result;
+}
+
+int _sqlSelect(ZdbSqlParser* parser)
+{
+    ZdbSqlStatement* statement = parser->statement;
+    statement->type = ZDB_SQL_SELECT;
+
+    /* The columns can't be looked up until the table is known, so come back to them */
+    ZdbSqlParser list = *parser;
+    int all = _sqlAcceptSymbol(parser, "*");
+    if (!all && _sqlIsWord(parser, "from"))
+    {
+        /* Nothing selected */
+        return ZDB_RESULT_VALUE_ERROR;
+    }
+    while (!all && parser->token.kind != ZDB_SQL_TOKEN_END && !_sqlIsWord(parser, "from"))
+    {
+        _sqlNext(parser);
+    }
+
+    int result = _sqlExpectWord(parser, "from");
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = _sqlTable(parser, &statement->table);
+    }
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        return result;
+    }
+
+    if (all)
+    {
+        statement->projectionCount = statement->table->columnCount;
+        for (int i = 0; i < statement->projectionCount; i++)
+        {
+            statement->projection[i] = i;
+        }
+    }
+    else
+    {
+        ZdbSqlParser rest = *parser;
+        *parser = list;
+        do
+        {
+            if (statement->projectionCount == ZDB_LIMIT_COLUMNS)
+            {
+                return ZDB_RESULT_UNSUPPORTED;
+            }
+
+            result = _sqlColumn(parser, &statement->projection[statement->projectionCount++]);
+            if (result != ZDB_RESULT_SUCCESS)
+            {
+                return result;
+            }
+        }
+        while (_sqlAcceptSymbol(parser, ","));
+
+        if (!_sqlIsWord(parser, "from"))
+        {
+            return ZDB_RESULT_VALUE_ERROR;
+        }
+        *parser = rest;
+    }
+
+    result = _sqlWhere(parser);
+
+    if (result == ZDB_RESULT_SUCCESS && _sqlAcceptWord(parser, "order"))
+    {
+        result = _sqlExpectWord(parser, "by");
+        while (result == ZDB_RESULT_SUCCESS)
+        {
+            if (statement->orderCount == ZDB_QUERY_ORDER_COLUMNS)
+            {
+                return ZDB_RESULT_UNSUPPORTED;
+            }
+
+            int order = statement->orderCount++;
+            result = _sqlColumn(parser, &statement->orders[order]);
+            if (!_sqlAcceptWord(parser, "asc"))
+            {
+                statement->descending[order] = _sqlAcceptWord(parser, "desc");
+            }
+            if (!_sqlAcceptSymbol(parser, ","))
+            {
+                break;
+            }
+        }
+    }
+
+    return result;
+}
+
+int _sqlUpdate(ZdbSqlParser* parser)
+{
+    ZdbSqlStatement* statement = parser->statement;
+    statement->type = ZDB_SQL_UPDATE;
+
+    int result = _sqlTable(parser, &statement->table);
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = _sqlExpectWord(parser, "set");
+    }
+
+    while (result == ZDB_RESULT_SUCCESS)
+    {
+        int column;
+        result = _sqlColumn(parser, &column);
+        if (result != ZDB_RESULT_SUCCESS)
+        {
+            return result;
+        }
+
+        if (statement->table->columns[column]->autoincrement || statement->values[column] != NULL)
+        {
+            /* Autoincrement values are handed out once, and each column gets a single value */
+            return ZDB_RESULT_INVALID_OPERATION;
+        }
+
+        result = _sqlExpectSymbol(parser, "=");
+        if (result == ZDB_RESULT_SUCCESS)
+        {
+            result = _sqlValue(parser, column, &statement->values[column]);
+        }
+
+        if (column >= statement->valueCount)
+        {
+            statement->valueCount = column + 1;
+        }
+
+        if (!_sqlAcceptSymbol(parser, ","))
+        {
+            break;
+        }
+    }
+
+    return result == ZDB_RESULT_SUCCESS ? _sqlWhere(parser) : result;
+}
+
+int _sqlDelete(ZdbSqlParser* parser)
+{
+    ZdbSqlStatement* statement = parser->statement;
+    statement->type = ZDB_SQL_DELETE;
+
+    int result = _sqlExpectWord(parser, "from");
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = _sqlTable(parser, &statement->table);
+    }
+
+    return result == ZDB_RESULT_SUCCESS ? _sqlWhere(parser) : result;
+}
+
+void _sqlFreeStatement(ZdbSqlStatement* statement)
+{
+    for (int i = 0; i < ZDB_LIMIT_COLUMNS; i++)
+    {
+        free(statement->values[i]);
+    }
+    free(statement->definition);
+    free(statement->text);
+    free(statement->key);
+    free(statement);
+}
+
+int _sqlParse(ZdbDatabase* database, const char* sql, ZdbSqlStatement** statement)
+{
+    ZdbSqlStatement* s = calloc(1, sizeof(ZdbSqlStatement));
+    s->database = database;
+    s->text = malloc(2 * strlen(sql) + 2);   /* Literals never take up more than twice their source */
+
+    ZdbSqlParser parser;
+    parser.database = database;
+    parser.statement = s;
+    parser.position = sql;
+    _sqlNext(&parser);
+
+    int result;
+    if (_sqlAcceptWord(&parser, "create"))
+    {
+        result = _sqlCreate(&parser);
+    }
+    else if (_sqlAcceptWord(&parser, "insert"))
+    {
+        result = _sqlInsert(&parser);
+    }
+    else if (_sqlAcceptWord(&parser, "select"))
+    {
+        result = _sqlSelect(&parser);
+    }
+    else if (_sqlAcceptWord(&parser, "update"))
+    {
+        result = _sqlUpdate(&parser);
+    }
+    else if (_sqlAcceptWord(&parser, "delete"))
+    {
+        result = _sqlDelete(&parser);
+    }
+    else
+    {
+        result = ZDB_RESULT_VALUE_ERROR;
+    }
+
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        _sqlAcceptSymbol(&parser, ";");
+        if (parser.token.kind != ZDB_SQL_TOKEN_END)
+        {
+            /* Something left over */
+            result = ZDB_RESULT_VALUE_ERROR;
+        }
+    }
+
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        _sqlFreeStatement(s);
+        return result;
+    }
+
+    *statement = s;
+    return ZDB_RESULT_SUCCESS;
+}
+
+//
+// Cache
+//
+
+#define ZDB_SQL_CHAR_SPACE      1
+#define ZDB_SQL_CHAR_SYMBOL     2
+#define ZDB_SQL_CHAR_QUOTE      3
+
+/* What each character is to the normalizer, so it looks at each one just once */
+static const unsigned char sqlCharClasses[256] =
+{
+    [' '] = ZDB_SQL_CHAR_SPACE, ['\t'] = ZDB_SQL_CHAR_SPACE, ['\n'] = ZDB_SQL_CHAR_SPACE,
+    ['\v'] = ZDB_SQL_CHAR_SPACE, ['\f'] = ZDB_SQL_CHAR_SPACE, ['\r'] = ZDB_SQL_CHAR_SPACE,
+    ['('] = ZDB_SQL_CHAR_SYMBOL, [')'] = ZDB_SQL_CHAR_SYMBOL, [','] = ZDB_SQL_CHAR_SYMBOL,
+    ['='] = ZDB_SQL_CHAR_SYMBOL, ['<'] = ZDB_SQL_CHAR_SYMBOL, ['>'] = ZDB_SQL_CHAR_SYMBOL,
+    ['*'] = ZDB_SQL_CHAR_SYMBOL, [';'] = ZDB_SQL_CHAR_SYMBOL, ['+'] = ZDB_SQL_CHAR_SYMBOL,
+    ['-'] = ZDB_SQL_CHAR_SYMBOL, ['!'] = ZDB_SQL_CHAR_SYMBOL,
+    ['\''] = ZDB_SQL_CHAR_QUOTE, ['"'] = ZDB_SQL_CHAR_QUOTE
+};
+
+/* Writes the statement into the cache's key buffer with everything outside quotes lowered and each run of spaces
+   kept only where it parts two words or two symbols, hashing it on the way.  A trailing semicolon is dropped */
+size_t _sqlNormalize(ZdbSqlCache* cache, const char* sql, uint64_t* hash)
+{
+    size_t length = strlen(sql);
+    int semicolon = 0;
+    while (length > 0 && (sqlCharClasses[(unsigned char)sql[length - 1]] == ZDB_SQL_CHAR_SPACE ||
+                          (sql[length - 1] == ';' && !semicolon++)))
+    {
+        length--;
+    }
+
+    if (length + 1 > cache->keyCapacity)
+    {
+        cache->keyCapacity = 2 * (length + 1);
+        cache->key = realloc(cache->key, cache->keyCapacity);
+    }
+
+    /* FNV-1a */
+    uint64_t h = 14695981039346656037ULL;
+    char* out = cache->key;
+    size_t used = 0;
+    unsigned char quote = '\0';
+    int space = 0;
+    int last = -1;      /* Class of the last character written */
+    for (size_t i = 0; i < length; i++)
+    {
+        unsigned char c = sql[i];
+        int charClass = sqlCharClasses[c];
+        if (quote != '\0')
+        {
+            quote = c == quote ? '\0' : quote;
+        }
+        else if (charClass == ZDB_SQL_CHAR_SPACE)
+        {
+            space = 1;
+            continue;
+        }
+        else
+        {
+            int symbol = charClass == ZDB_SQL_CHAR_SYMBOL;
+            if (space && last == symbol)
+            {
+                out[used++] = ' ';
+                h = (h ^ ' ') * 1099511628211ULL;
+            }
+            quote = charClass == ZDB_SQL_CHAR_QUOTE ? c : '\0';
+            c = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+            last = symbol;
+        }
+
+        out[used++] = c;
+        h = (h ^ c) * 1099511628211ULL;
+        space = 0;
+    }
+
+    out[used] = '\0';
+    *hash = h;
+
+    return used;
+}
+
+void _sqlUnlinkUse(ZdbSqlCache* cache, ZdbSqlStatement* statement)
+{
+    if (statement->newer != NULL)
+    {
+        statement->newer->older = statement->older;
+    }
+    else
+    {
+        cache->newest = statement->older;
+    }
+
+    if (statement->older != NULL)
+    {
+        statement->older->newer = statement->newer;
+    }
+    else
+    {
+        cache->oldest = statement->newer;
+    }
+}
+
+void _sqlLinkNewest(ZdbSqlCache* cache, ZdbSqlStatement* statement)
+{
+    statement->newer = NULL;
+    statement->older = cache->newest;
+    if (cache->newest != NULL)
+    {
+        cache->newest->newer = statement;
+    }
+    cache->newest = statement;
+    if (cache->oldest == NULL)
+    {
+        cache->oldest = statement;
+    }
+}
+
+/* Takes the statement out of the cache, freeing it unless a caller still holds it */
+void _sqlRemove(ZdbSqlCache* cache, ZdbSqlStatement* statement)
+{
+    ZdbSqlStatement** link = &cache->buckets[statement->hash & (cache->bucketCount - 1)];
+    while (*link != statement)
+    {
+        link = &(*link)->chain;
+    }
+    *link = statement->chain;
+
+    _sqlUnlinkUse(cache, statement);
+    cache->stats.statementCount--;
+
+    statement->cache = NULL;
+    if (statement->references == 0)
+    {
+        _sqlFreeStatement(statement);
+    }
+}
+
+//
+// Public
+//
+
+int ZdbSqlCreateCache(ZdbDatabase* database, int capacity, ZdbSqlCache** cache)
+{
+    if (database == NULL || cache == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (capacity < 0)
+    {
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    ZdbSqlCache* c = calloc(1, sizeof(ZdbSqlCache));
+    c->database = database;
+    c->capacity = capacity;
+
+    /* Twice as many buckets as statements keeps the chains short */
+    c->bucketCount = 1;
+    while (c->bucketCount < 2 * capacity)
+    {
+        c->bucketCount *= 2;
+    }
+    c->buckets = calloc(c->bucketCount, sizeof(ZdbSqlStatement*));
+
+    *cache = c;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbSqlFreeCache(ZdbSqlCache* cache)
+{
+    if (cache == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    while (cache->oldest != NULL)
+    {
+        _sqlRemove(cache, cache->oldest);
+    }
+
+    free(cache->buckets);
+    free(cache->key);
+    free(cache);
+
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbSqlPrepare(ZdbSqlCache* cache, const char* sql, ZdbSqlStatement** statement)
+{
+    if (cache == NULL || sql == NULL || statement == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    cache->stats.lookups++;
+
+    /* Without room to keep statements there's nothing to look them up by */
+    uint64_t hash = 0;
+    size_t length = cache->capacity > 0 ? _sqlNormalize(cache, sql, &hash) : 0;
+
+    ZdbSqlStatement* s = cache->capacity > 0 ? cache->buckets[hash & (cache->bucketCount - 1)] : NULL;
+    while (s != NULL && (s->hash != hash || s->keyLength != length || memcmp(s->key, cache->key, length) != 0))
+    {
+        s = s->chain;
+    }
+
+    if (s != NULL && s->table != NULL && s->table->columns == NULL)
+    {
+        /* The table was dropped, so the statement has to be looked at again */
+        _sqlRemove(cache, s);
+        s = NULL;
+    }
+
+    if (s != NULL)
+    {
+        cache->stats.hits++;
+        _sqlUnlinkUse(cache, s);
+        _sqlLinkNewest(cache, s);
+    }
+    else
+    {
+        cache->stats.parses++;
+        int result = _sqlParse(cache->database, sql, &s);
+        if (result != ZDB_RESULT_SUCCESS)
+        {
+            return result;
+        }
+
+        if (cache->capacity > 0)
+        {
+            if (cache->stats.statementCount == cache->capacity)
+            {
+                cache->stats.evictions++;
+                _sqlRemove(cache, cache->oldest);
+            }
+
+            s->cache = cache;
+            s->key = malloc(length + 1);
+            memcpy(s->key, cache->key, length + 1);
+            s->keyLength = length;
+            s->hash = hash;
+
+            ZdbSqlStatement** bucket = &cache->buckets[hash & (cache->bucketCount - 1)];
+            s->chain = *bucket;
+            *bucket = s;
+            _sqlLinkNewest(cache, s);
+            cache->stats.statementCount++;
+        }
+    }
+
+    s->references++;
+    *statement = s;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbSqlRelease(ZdbSqlStatement* statement)
+{
+    if (statement == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (statement->references <= 0)
+    {
+        /* Released more often than prepared */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    if (--statement->references == 0 && statement->cache == NULL)
+    {
+        _sqlFreeStatement(statement);
+    }
+
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbSqlGetStatementType(ZdbSqlStatement* statement)
+{
+    return statement != NULL ? statement->type : ZDB_RESULT_INVALID_NULL;
+}
+
+int _sqlBuildQuery(ZdbSqlStatement* statement, ZdbQuery** query)
+{
+    ZdbQuery* q;
+    ZdbQueryCreate(statement->database, &q);
+
+    int result = ZdbQueryAddTable(q, statement->table);
+    if (result == ZDB_RESULT_SUCCESS && statement->condition == ZDB_QUERY_CONDITION_IN)
+    {
+        result = ZdbQueryAddInCondition(q, statement->conditionColumn,
+                                        statement->table->columns[statement->conditionColumn]->type,
+                                        statement->conditionCount, statement->conditionValues);
+    }
+    else if (result == ZDB_RESULT_SUCCESS && statement->condition != ZDB_QUERY_CONDITION_NONE)
+    {
+        result = ZdbQueryAddCondition(q, statement->condition, statement->conditionColumn,
+                                      statement->table->columns[statement->conditionColumn]->type,
+                                      statement->conditionValues[0]);
+    }
+
+    for (int i = 0; i < statement->orderCount && result == ZDB_RESULT_SUCCESS; i++)
+    {
+        result = ZdbQueryAddOrder(q, statement->orders[i], statement->descending[i]);
+    }
+
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = ZdbQuerySetProjection(q, statement->projectionCount, statement->projection);
+    }
+
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        ZdbQueryFree(q);
+        return result;
+    }
+
+    *query = q;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int _sqlExecuteCreate(ZdbSqlStatement* statement)
+{
+    ZdbSqlTableDef* def = statement->definition;
+    ZdbTable* table;
+    if (_sqlFindTable(statement->database, def->name, &table) == ZDB_RESULT_SUCCESS)
+    {
+        /* Names have to tell the tables apart */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    ZdbColumn* columns[ZDB_LIMIT_COLUMNS];
+    for (int i = 0; i < def->columnCount; i++)
+    {
+        ZdbEngineCreateColumn(def->columnNames[i], def->types[i], def->autoincrement[i], &columns[i]);
+    }
+
+    int result = ZdbEngineCreateTable(statement->database, def->name, def->columnCount, columns, &table);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        /* The table only takes the columns once it is made */
+        for (int i = 0; i < def->columnCount; i++)
+        {
+            free(columns[i]);
+        }
+        return result;
+    }
+
+    return 0;
+}
+
+int _sqlExecuteInsert(ZdbSqlStatement* statement)
+{
+    ZdbTable* table = statement->table;
+    ZdbRow* row;
+    int result = ZdbEngineInsertRow(table, table->columnCount, &row);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        return result;
+    }
+
+    result = ZdbEngineUpdateRowValues(table, row, statement->valueCount, statement->values);
+    if (result < 0)
+    {
+        /* Don't leave an empty row behind */
+        ZdbEngineDeleteRow(table, row);
+    }
+
+    return result;
+}
+
+int _sqlExecuteUpdate(ZdbSqlStatement* statement)
+{
+    ZdbQuery* query;
+    ZdbRecordset* recordset;
+    int result = _sqlBuildQuery(statement, &query);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        return result;
+    }
+
+    result = ZdbQueryExecute(query, &recordset);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        ZdbQueryFree(query);
+        return result;
+    }
+
+    /* Find every match first, so rows the update moves within an index aren't come across again */
+    int count = 0;
+    int capacity = 256;
+    int* rowIndexes = malloc(capacity * sizeof(int));
+    ZdbQueryBatch batch;
+    while (ZdbQueryNextBatch(recordset, ZDB_QUERY_BATCH_ROWS, &batch) > 0)
+    {
+        while (count + batch.count > capacity)
+        {
+            capacity *= 2;
+            rowIndexes = realloc(rowIndexes, capacity * sizeof(int));
+        }
+        memcpy(rowIndexes + count, batch.rows, batch.count * sizeof(int));
+        count += batch.count;
+    }
+
+    /* Columns the statement doesn't set are written back as they are, which the engine passes over */
+    ZdbTable* table = statement->table;
+    void* values[ZDB_LIMIT_COLUMNS];
+    for (int i = 0; i < count && result >= 0; i++)
+    {
+        ZdbRow* row = ZdbEngineRowAt(table, rowIndexes[i]);
+        for (int c = 0; c < statement->valueCount && result >= 0; c++)
+        {
+            values[c] = statement->values[c];
+            if (values[c] == NULL && !table->columns[c]->autoincrement)
+            {
+                result = ZdbEngineGetValue(table, row, c, &values[c]);
+            }
+        }
+
+        if (result >= 0)
+        {
+            result = ZdbEngineUpdateRowValues(table, row, statement->valueCount, values);
+        }
+    }
+
+    free(rowIndexes);
+    ZdbQueryFree(query);
+
+    return result < 0 ? result : count;
+}
+
+int ZdbSqlExecute(ZdbSqlStatement* statement, ZdbQuery** query, ZdbRecordset** recordset)
+{
+    if (statement == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (statement->table != NULL && statement->table->columns == NULL)
+    {
+        /* The table has been dropped since */
+        return ZDB_RESULT_NOT_FOUND;
+    }
+
+    switch (statement->type)
+    {
+        case ZDB_SQL_CREATE_TABLE:
+            return _sqlExecuteCreate(statement);
+
+        case ZDB_SQL_INSERT:
+            return _sqlExecuteInsert(statement);
+
+        case ZDB_SQL_UPDATE:
+            return _sqlExecuteUpdate(statement);
+    }
+
+    ZdbQuery* q;
+    int result = _sqlBuildQuery(statement, &q);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        return result;
+    }
+
+    if (statement->type == ZDB_SQL_DELETE)
+    {
+        result = ZdbQueryDelete(q);
+        ZdbQueryFree(q);
+        return result;
+    }
+
+    if (query == NULL || recordset == NULL)
+    {
+        ZdbQueryFree(q);
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    result = ZdbQueryExecute(q, recordset);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        ZdbQueryFree(q);
+        return result;
+    }
+
+    *query = q;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbSqlGetStats(ZdbSqlCache* cache, ZdbSqlStats* stats)
+{
+    if (cache == NULL || stats == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    *stats = cache->stats;
+    return ZDB_RESULT_SUCCESS;
+}
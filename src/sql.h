@@ -0,0 +1,70 @@
+//
+//  sql.h
+//  ZombieSQL
+//
+//  SQL text in, engine and query calls out.  Statements are parsed into plans that a cache keeps by their text,
+//  so a statement that comes round again is found rather than parsed.
+//
+
+#ifndef SQL_H
+#define SQL_H
+
+#include "query.h"
+
+#define ZDB_SQL_CREATE_TABLE        1
+#define ZDB_SQL_INSERT              2
+#define ZDB_SQL_SELECT              3
+#define ZDB_SQL_UPDATE              4
+#define ZDB_SQL_DELETE              5
+
+#define ZDB_SQL_CACHE_STATEMENTS    256     /* A good capacity for ZdbSqlCreateCache */
+#define ZDB_SQL_IN_VALUES           64      /* Most values an IN list can hold */
+
+typedef struct _ZdbSqlCache ZdbSqlCache;
+typedef struct _ZdbSqlStatement ZdbSqlStatement;
+
+typedef struct
+{
+    int64_t lookups;                /* Statements prepared through the cache */
+    int64_t hits;                   /* Lookups that found the statement already parsed */
+    int64_t parses;                 /* Lookups that had to parse it, including ones that turned out to be invalid */
+    int64_t evictions;              /* Statements dropped to make room for newer ones */
+    int statementCount;             /* Statements the cache holds now */
+} ZdbSqlStats;
+
+/* A cache of the statements prepared on a database, keeping up to capacity of the most recently used.  A capacity
+   of 0 caches nothing, so every statement is parsed.  A cache isn't safe to share between threads */
+int ZdbSqlCreateCache(ZdbDatabase* database, int capacity, ZdbSqlCache** cache);
+int ZdbSqlFreeCache(ZdbSqlCache* cache);      /* Statements still held are freed as they are released */
+
+/* Parses one statement of this subset of SQL-87, or finds it in the cache:
+
+       CREATE TABLE t (column type [AUTOINCREMENT], ...)
+       INSERT INTO t [(column, ...)] VALUES (literal, ...)
+       SELECT * | column, ... FROM t [WHERE condition] [ORDER BY column [ASC | DESC], ...]
+       UPDATE t SET column = literal, ... [WHERE condition]
+       DELETE FROM t [WHERE condition]
+
+   where a condition is column =, <>, <, <=, > or >= a literal, or column IN (literal, ...).  Literals are numbers,
+   'strings' with '' for a quote, TRUE and FALSE.  Keywords and names are matched without regard to case, and names
+   can be "quoted".  Types are INT, INTEGER, SMALLINT, FLOAT, REAL, BOOLEAN, VARCHAR, CHAR or CHARACTER, the last
+   three with an optional length of at most ZDB_LIMIT_VARCHAR - 1, or the name of a type made with ZdbTypeCreate.
+   An INSERT without a column list gives values to the columns that don't autoincrement, in order, and columns an
+   INSERT leaves out start at their type's value for an empty string.
+   Statements that differ only in the case of keywords and names or in spacing share a plan.  Syntax errors are
+   ZDB_RESULT_VALUE_ERROR, unknown tables, columns and types ZDB_RESULT_NOT_FOUND, literals that don't suit their
+   column ZDB_RESULT_INVALID_CAST and conditions joined with AND or OR ZDB_RESULT_UNSUPPORTED.
+   The statement is held until ZdbSqlRelease, even if the cache drops it meanwhile */
+int ZdbSqlPrepare(ZdbSqlCache* cache, const char* sql, ZdbSqlStatement** statement);
+int ZdbSqlRelease(ZdbSqlStatement* statement);
+int ZdbSqlGetStatementType(ZdbSqlStatement* statement);      /* ZDB_SQL_* */
+
+/* Runs the statement and returns the rows it inserted, updated or deleted.  A SELECT builds a query, projected
+   onto the selected columns, and executes it; the caller reads the recordset and frees the query, which frees the
+   recordset with it.  ZdbQueryGet* number columns as the table does, whatever was selected.  Other statements
+   leave query and recordset alone, and either may be NULL for them */
+int ZdbSqlExecute(ZdbSqlStatement* statement, ZdbQuery** query, ZdbRecordset** recordset);
+
+int ZdbSqlGetStats(ZdbSqlCache* cache, ZdbSqlStats* stats);
+
+#endif // SQL_H
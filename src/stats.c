@@ -0,0 +1,451 @@
+//
+//  stats.c
+//  ZombieSQL
+//
+//  Histograms are equi-depth: the sorted values of the analyzed rows are cut into buckets of about the same number
+//  of rows, so a bucket is narrow where values crowd together and wide where they thin out.  A value common enough
+//  to fill more than one bucket ends up alone in each of them.  Inserted rows are counted in the bucket their value
+//  falls in, widening the first or last bucket if it falls outside, so the buckets stop being of equal depth but
+//  their counts stay right.
+//
+//  Distinct counts come from a HyperLogLog sketch, which sees every row rather than the sample.  Each value is
+//  hashed; the top bits pick a register and the register keeps the longest run of leading zeros seen in the rest.
+//  Inserting a row only ever raises registers, so the sketch stays exact under inserts.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "types.h"
+#include "stats.h"
+
+/*
+ * Hashing
+ */
+
+uint64_t _statsMix(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ull;
+    value ^= value >> 33;
+    return value;
+}
+
+uint64_t _statsHashBytes(const unsigned char* bytes, size_t length)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return _statsMix(hash);
+}
+
+/* Hashes the row's value so that equal values hash the same.  Dictionary encoded values are hashed by code, which
+   is as distinct as the string and much cheaper.  Returns 0 for values of user-defined types that can't be sized */
+int _statsHashValue(ZdbTable* table, ZdbRow* row, int column, uint64_t* hash)
+{
+    int tag = table->layout.tags[column];
+    if (tag == ZDB_LAYOUT_TAG_DICTIONARY)
+    {
+        uint32_t code;
+        ZdbEngineGetValueCode(table, row, column, &code);
+        *hash = _statsMix(code);
+        return 1;
+    }
+
+    void* value;
+    ZdbEngineGetValue(table, row, column, &value);
+    switch (tag)
+    {
+        case ZDB_LAYOUT_TAG_INT:
+        case ZDB_LAYOUT_TAG_BOOLEAN:
+            *hash = _statsMix((uint32_t)*(int*)value);
+            return 1;
+        case ZDB_LAYOUT_TAG_FLOAT:
+        {
+            /* 0.0 and -0.0 are the same value, and so is every NaN */
+            float f = *(float*)value == 0.0f ? 0.0f : *(float*)value;
+            uint32_t bits = 0x7fc00000u;
+            if (f == f)
+            {
+                memcpy(&bits, &f, sizeof(bits));
+            }
+            *hash = _statsMix(bits);
+            return 1;
+        }
+        case ZDB_LAYOUT_TAG_VARCHAR:
+            *hash = _statsHashBytes(value, strlen(value));
+            return 1;
+    }
+
+    size_t size;
+    if (ZdbTypeSizeof(table->columns[column]->type, value, &size) != ZDB_RESULT_SUCCESS)
+    {
+        return 0;
+    }
+    *hash = _statsHashBytes(value, size);
+    return 1;
+}
+
+void _statsAddHash(ZdbColumnStats* stats, uint64_t hash)
+{
+    int reg = (int)(hash >> (64 - ZDB_STATS_REGISTER_BITS));
+    uint64_t rest = hash << ZDB_STATS_REGISTER_BITS;
+    uint8_t rank = rest == 0 ? 64 - ZDB_STATS_REGISTER_BITS + 1 : (uint8_t)(__builtin_clzll(rest) + 1);
+    if (rank > stats->registers[reg])
+    {
+        stats->registers[reg] = rank;
+    }
+}
+
+/*
+ * Histograms
+ */
+
+int _statsHasHistogram(int tag)
+{
+    return tag == ZDB_LAYOUT_TAG_INT || tag == ZDB_LAYOUT_TAG_FLOAT || tag == ZDB_LAYOUT_TAG_BOOLEAN;
+}
+
+double _statsNumber(int tag, const void* value)
+{
+    return tag == ZDB_LAYOUT_TAG_FLOAT ? *(const float*)value : *(const int*)value;
+}
+
+int _statsCompareNumbers(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Cuts count sorted values, each standing for scale rows, into buckets of equal depth */
+void _statsBuildHistogram(ZdbColumnStats* stats, const double* values, int count, double scale)
+{
+    int bucketCount = count < ZDB_STATS_BUCKETS ? count : ZDB_STATS_BUCKETS;
+    int sampleDistinct = 0;
+    for (int b = 0; b < bucketCount; b++)
+    {
+        int start = (int)((int64_t)b * count / bucketCount);
+        int end = (int)((int64_t)(b + 1) * count / bucketCount);
+        ZdbStatsBucket* bucket = &stats->buckets[b];
+        bucket->low = values[start];
+        bucket->high = values[end - 1];
+        bucket->rows = (end - start) * scale;
+        bucket->distinct = 1;
+        for (int i = start + 1; i < end; i++)
+        {
+            bucket->distinct += values[i] != values[i - 1];
+        }
+        sampleDistinct += (int)bucket->distinct - (b > 0 && bucket->low == stats->buckets[b - 1].high);
+    }
+    stats->bucketCount = bucketCount;
+    stats->histogramRows = count * scale;
+
+    /* A sample misses most of the values of a column with many, so each bucket is credited its share of the
+       distinct values the sketch saw over every row */
+    double distinct = ZdbStatsDistinct(stats);
+    if (scale > 1 && sampleDistinct > 0 && distinct > sampleDistinct)
+    {
+        double factor = distinct / sampleDistinct;
+        for (int b = 0; b < bucketCount; b++)
+        {
+            ZdbStatsBucket* bucket = &stats->buckets[b];
+            bucket->distinct = bucket->distinct * factor < bucket->rows ? bucket->distinct * factor : bucket->rows;
+        }
+    }
+}
+
+/* Counts a value inserted since the histogram was built */
+void _statsAddNumber(ZdbColumnStats* stats, double value)
+{
+    if (value != value)
+    {
+        stats->nanRows++;
+        return;
+    }
+
+    if (stats->bucketCount == 0)
+    {
+        /* The column had no values when it was analyzed */
+        stats->bucketCount = 1;
+        stats->buckets[0].low = value;
+        stats->buckets[0].high = value;
+        stats->buckets[0].distinct = 1;
+    }
+
+    /* The first bucket reaching up to the value, or the last one stretched to it */
+    int low = 0, high = stats->bucketCount - 1;
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (stats->buckets[middle].high < value)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    ZdbStatsBucket* bucket = &stats->buckets[low];
+    if (value > bucket->high)
+    {
+        bucket->high = value;
+        bucket->distinct++;
+    }
+    else if (value < bucket->low)
+    {
+        bucket->low = value;
+        bucket->distinct++;
+    }
+    bucket->rows++;
+    stats->histogramRows++;
+}
+
+/*
+ * Public functions
+ */
+
+int ZdbEngineAnalyzeTable(ZdbTable* table)
+{
+    if (table == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (table->columns == NULL)
+    {
+        /* The table has been dropped */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    /* Everything is allocated up front, so running out of memory leaves the old stats in place */
+    ZdbTableStats* stats = calloc(1, sizeof(ZdbTableStats));
+    ZdbColumnStats* columns = calloc(table->columnCount, sizeof(ZdbColumnStats));
+    int rowCount = table->rowCount - table->deletedCount;
+    int sampleRows = rowCount < ZDB_STATS_SAMPLE_ROWS ? rowCount : ZDB_STATS_SAMPLE_ROWS;
+    int* sample = malloc((sampleRows + 1) * sizeof(int));
+    double* values = malloc((sampleRows + 1) * sizeof(double));
+    if (stats == NULL || columns == NULL || sample == NULL || values == NULL)
+    {
+        free(stats);
+        free(columns);
+        free(sample);
+        free(values);
+        return ZDB_RESULT_OUT_OF_MEMORY;
+    }
+    stats->columns = columns;
+    stats->rowCount = rowCount;
+    stats->sampledRows = sampleRows;
+
+    /* Every live row goes into the sketches; an even spread of them into the histograms */
+    int sampled = 0;
+    for (int row = ZdbEngineNextLiveRow(table, 0), live = 0; row < table->rowCount;
+         row = ZdbEngineNextLiveRow(table, row + 1), live++)
+    {
+        if (sampled < stats->sampledRows && (int64_t)sampled * stats->rowCount <= (int64_t)live * stats->sampledRows)
+        {
+            sample[sampled++] = row;
+        }
+
+        for (int c = 0; c < table->columnCount; c++)
+        {
+            uint64_t hash;
+            if (_statsHashValue(table, ZdbEngineRowAt(table, row), c, &hash))
+            {
+                _statsAddHash(&stats->columns[c], hash);
+            }
+        }
+    }
+
+    stats->sampledRows = sampled;
+    double scale = sampled > 0 ? (double)stats->rowCount / sampled : 1;
+    for (int c = 0; c < table->columnCount; c++)
+    {
+        ZdbColumnStats* column = &stats->columns[c];
+        column->tag = table->layout.tags[c];
+        if (!_statsHasHistogram(column->tag))
+        {
+            continue;
+        }
+
+        int count = 0;
+        for (int i = 0; i < sampled; i++)
+        {
+            void* value;
+            ZdbEngineGetValue(table, ZdbEngineRowAt(table, sample[i]), c, &value);
+            double number = _statsNumber(column->tag, value);
+            if (number != number)
+            {
+                column->nanRows += scale;
+                continue;
+            }
+            values[count++] = number;
+        }
+
+        qsort(values, count, sizeof(double), _statsCompareNumbers);
+        _statsBuildHistogram(column, values, count, scale);
+    }
+    free(values);
+    free(sample);
+
+    ZdbStatsFree(table);
+    table->stats = stats;
+
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbEngineGetTableStats(ZdbTable* table, const ZdbTableStats** stats)
+{
+    if (table == NULL || stats == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (table->stats == NULL)
+    {
+        /* The table hasn't been analyzed */
+        return ZDB_RESULT_NOT_FOUND;
+    }
+
+    *stats = table->stats;
+    return ZDB_RESULT_SUCCESS;
+}
+
+double ZdbStatsDistinct(const ZdbColumnStats* stats)
+{
+    double sum = 0;
+    int zeros = 0;
+    for (int i = 0; i < ZDB_STATS_REGISTERS; i++)
+    {
+        sum += 1.0 / (double)(1ull << stats->registers[i]);
+        zeros += stats->registers[i] == 0;
+    }
+
+    double m = ZDB_STATS_REGISTERS;
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0)
+    {
+        /* Few values leave registers empty, and counting those is more accurate */
+        estimate = m * log(m / zeros);
+    }
+    return estimate;
+}
+
+double ZdbStatsEqualFraction(const ZdbColumnStats* stats, const void* value)
+{
+    if (!_statsHasHistogram(stats->tag) || stats->bucketCount == 0)
+    {
+        double distinct = ZdbStatsDistinct(stats);
+        return distinct > 1 ? 1 / distinct : 1;
+    }
+
+    double total = stats->histogramRows + stats->nanRows;
+    double number = _statsNumber(stats->tag, value);
+    if (total <= 0 || number != number)
+    {
+        /* NaN equals nothing */
+        return 0;
+    }
+
+    /* Rows are taken to be shared evenly between each bucket's distinct values */
+    double rows = 0;
+    for (int b = 0; b < stats->bucketCount; b++)
+    {
+        const ZdbStatsBucket* bucket = &stats->buckets[b];
+        if (bucket->low <= number && number <= bucket->high)
+        {
+            rows += bucket->rows / bucket->distinct;
+        }
+    }
+    return rows < total ? rows / total : 1;
+}
+
+double ZdbStatsBelowFraction(const ZdbColumnStats* stats, const void* value, int inclusive)
+{
+    if (!_statsHasHistogram(stats->tag) || stats->bucketCount == 0)
+    {
+        return 1.0 / 3;
+    }
+
+    double total = stats->histogramRows + stats->nanRows;
+    double number = _statsNumber(stats->tag, value);
+    if (total <= 0 || number != number)
+    {
+        return 0;
+    }
+
+    /* Values are taken to be spread evenly across a bucket; ints count the whole numbers in it */
+    int discrete = stats->tag != ZDB_LAYOUT_TAG_FLOAT;
+    double rows = 0;
+    for (int b = 0; b < stats->bucketCount; b++)
+    {
+        const ZdbStatsBucket* bucket = &stats->buckets[b];
+        if (bucket->high < number || (inclusive && bucket->high == number))
+        {
+            rows += bucket->rows;
+        }
+        else if (bucket->low < number || (inclusive && bucket->low == number))
+        {
+            double share = discrete ? (number - bucket->low + inclusive) / (bucket->high - bucket->low + 1)
+                                    : (number - bucket->low) / (bucket->high - bucket->low);
+            rows += bucket->rows * share;
+        }
+    }
+    return rows < total ? rows / total : 1;
+}
+
+void ZdbStatsAddRow(ZdbTable* table, ZdbRow* row)
+{
+    ZdbTableStats* stats = table->stats;
+    if (stats == NULL)
+    {
+        return;
+    }
+
+    stats->rowCount++;
+    stats->insertedRows++;
+    for (int c = 0; c < table->columnCount; c++)
+    {
+        ZdbColumnStats* column = &stats->columns[c];
+        uint64_t hash;
+        if (_statsHashValue(table, row, c, &hash))
+        {
+            _statsAddHash(column, hash);
+        }
+
+        if (_statsHasHistogram(column->tag))
+        {
+            void* value;
+            ZdbEngineGetValue(table, row, c, &value);
+            _statsAddNumber(column, _statsNumber(column->tag, value));
+        }
+    }
+}
+
+void ZdbStatsAddRows(ZdbTable* table, int firstRow, int rowCount)
+{
+    for (int i = firstRow; table->stats != NULL && i < firstRow + rowCount; i++)
+    {
+        ZdbStatsAddRow(table, ZdbEngineRowAt(table, i));
+    }
+}
+
+void ZdbStatsFree(ZdbTable* table)
+{
+    if (table->stats != NULL)
+    {
+        free(table->stats->columns);
+        free(table->stats);
+        table->stats = NULL;
+    }
+}
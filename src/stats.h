@@ -0,0 +1,67 @@
+//
+//  stats.h
+//  ZombieSQL
+//
+//  What a table's columns hold, summed up so the query layer can guess how many rows a condition matches without
+//  reading them.  Kept up to date as rows are inserted once the table has been analyzed.
+//
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "engine.h"
+
+#define ZDB_STATS_BUCKETS           32      /* Most buckets in a column's histogram */
+#define ZDB_STATS_SAMPLE_ROWS       32768   /* Histograms of larger tables are built from this many rows, evenly spread */
+#define ZDB_STATS_REGISTER_BITS     10
+#define ZDB_STATS_REGISTERS         (1 << ZDB_STATS_REGISTER_BITS)     /* HyperLogLog registers, for a 3% error */
+
+/* A stretch of a column's values, holding about as many rows as each of the others did when it was analyzed */
+typedef struct
+{
+    double low;                     /* Smallest and largest values in the bucket */
+    double high;
+    double rows;                    /* Rows whose value falls in the bucket, counting those inserted since */
+    double distinct;                /* Distinct values among the bucket's rows when it was analyzed */
+} ZdbStatsBucket;
+
+typedef struct
+{
+    int tag;                        /* ZDB_LAYOUT_TAG_* of the column */
+    int bucketCount;                /* Equi-depth histogram: int, float and boolean columns only, 0 for the others */
+    ZdbStatsBucket buckets[ZDB_STATS_BUCKETS];     /* In value order, neighbours sharing a bound when a value spans them */
+    double histogramRows;           /* Rows the buckets cover between them */
+    double nanRows;                 /* Float columns: rows holding NaN, which no bucket covers */
+    uint8_t registers[ZDB_STATS_REGISTERS];        /* HyperLogLog sketch of every value the column has held */
+} ZdbColumnStats;
+
+struct _ZdbTableStats
+{
+    int rowCount;                   /* Live rows when the table was analyzed, plus rows inserted since */
+    int insertedRows;               /* Rows inserted since it was analyzed */
+    int sampledRows;                /* Rows the histograms were built from */
+    ZdbColumnStats* columns;        /* One for each of the table's columns */
+};
+
+/* Reads the table's live rows and works out its row count and, for every column, a histogram and a distinct count
+   estimate, replacing any from before.  Without memory for the new stats it returns ZDB_RESULT_OUT_OF_MEMORY and the
+   old ones stay.  From then on inserted rows are added to the stats as they are written; updated and deleted rows
+   aren't taken out, so a table that changes a lot should be analyzed again.  Stats aren't saved with the database or
+   logged */
+int ZdbEngineAnalyzeTable(ZdbTable* table);
+int ZdbEngineGetTableStats(ZdbTable* table, const ZdbTableStats** stats);     /* ZDB_RESULT_NOT_FOUND until analyzed */
+
+double ZdbStatsDistinct(const ZdbColumnStats* stats);       /* Estimated distinct values the column has held */
+
+/* Estimated share of the column's rows, between 0 and 1, equal to value or below it.  value is an int, float or
+   string as the column's values are read.  Columns without a histogram have equality guessed from the distinct
+   count and ranges at a third */
+double ZdbStatsEqualFraction(const ZdbColumnStats* stats, const void* value);
+double ZdbStatsBelowFraction(const ZdbColumnStats* stats, const void* value, int inclusive);
+
+/* Used by the engine as rows are written and tables dropped */
+void ZdbStatsAddRow(ZdbTable* table, ZdbRow* row);
+void ZdbStatsAddRows(ZdbTable* table, int firstRow, int rowCount);
+void ZdbStatsFree(ZdbTable* table);
+
+#endif // STATS_H
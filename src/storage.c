@@ -0,0 +1,994 @@
+//
+//  storage.c
+//  ZombieSQL
+//
+//  A database file holds a header, the catalog of tables and columns, and then each table's row slots, column
+//  chunks, string heap pages, tombstones, zones, autoincrement values and dictionaries.  Data sections are page aligned and are laid
+//  out exactly as they are in memory, so opening a file maps it and points the tables into the mapping instead of
+//  reading it.
+//
+//  Checkpoints write the same file from a forked child, so the tables are captured at one instant without holding
+//  up the threads that keep changing them.  The parent plans the image and opens the file before forking, and the
+//  child only calls write().  Once the image is durable, the log records it covers are dropped.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "types.h"
+#include "storage.h"
+#include "wal.h"
+#include "index.h"
+
+#define ZDB_FILE_MAGIC          "ZOMBIEDB"
+#define ZDB_FILE_ALIGNMENT      4096
+#define ZDB_FILE_SLOT_BATCH     (64 * 1024)     /* Bytes of row slots handed to each write */
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t tableCount;
+    char name[ZDB_LIMIT_VARCHAR + 1];
+    uint64_t logSequence;           /* Last write-ahead log record the image includes */
+} ZdbFileHeader;
+
+typedef struct
+{
+    char name[ZDB_LIMIT_VARCHAR + 1];
+    int32_t columnCount;
+    int32_t storage;
+    int64_t rowCount;
+    uint64_t slotSize;              /* Checked against the layout the catalog produces when loading */
+    uint64_t rowSize;
+    uint64_t rowsOffset;            /* rowCount slots of slotSize bytes */
+    uint64_t chunksOffset;          /* chunkCount PAX chunks of ZDB_ROW_CHUNKS * rowSize bytes */
+    int64_t chunkCount;
+    uint64_t stringsOffset;         /* stringPageCount pages of ZDB_STRING_PAGE_SIZE bytes */
+    int64_t stringPageCount;
+    uint64_t stringPageUsed;
+    uint64_t stringBytesLive;
+    uint64_t stringBytesDead;
+    uint64_t tombstonesOffset;      /* One bit per row, set for deleted rows */
+    int64_t deletedCount;
+    int64_t compactRead;            /* Where an unfinished compaction pass stands */
+    int64_t compactWrite;
+    int64_t compactions;            /* Kept so cursor tokens from before a compaction stay stale across a reopen */
+    uint64_t zonesOffset;           /* columnCount zones for each chunk of ZDB_ROW_CHUNKS rows, then each chunk's new row count */
+} ZdbFileTable;
+
+typedef struct
+{
+    char name[ZDB_LIMIT_VARCHAR + 1];
+    char typeName[ZDB_LIMIT_VARCHAR + 1];
+    int32_t autoincrement;
+    int32_t encoding;
+    int32_t indexes;                /* Bit 1 << type for each kind of index on the column, rebuilt when loading */
+    int32_t reserved;
+    uint64_t lastValueOffset;       /* Last autoincrement value, or 0 if none has been handed out */
+    uint64_t dictionaryOffset;      /* dictionaryCount ZdbVarcharRef entries */
+    int64_t dictionaryCount;
+} ZdbFileColumn;
+
+/*
+ * Saving
+ */
+
+/* A save is planned before anything is written: the catalog is filled in, every section is placed and every buffer
+   is allocated.  Writing the image out then only copies memory and calls write(), which is all a checkpoint's
+   forked child can safely do */
+typedef struct
+{
+    int fd;
+    uint64_t position;              /* Bytes written so far */
+    ZdbFileHeader header;
+    int tableCount;
+    ZdbTable** tables;              /* Dropped tables keep their place in db->tables but lose their columns, and aren't saved */
+    ZdbFileTable* fileTables;
+    ZdbFileColumn** fileColumns;
+    char* slots;                    /* Row slots are renumbered here on their way out */
+    int slotCapacity;
+} ZdbFileImage;
+
+uint64_t _alignSection(uint64_t position)
+{
+    return (position + ZDB_FILE_ALIGNMENT - 1) / ZDB_FILE_ALIGNMENT * ZDB_FILE_ALIGNMENT;
+}
+
+int _writeBytes(ZdbFileImage* image, const void* data, size_t size)
+{
+    const char* bytes = data;
+    while (size > 0)
+    {
+        ssize_t written = write(image->fd, bytes, size);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return ZDB_RESULT_INVALID_OPERATION;
+        }
+        bytes += written;
+        size -= written;
+        image->position += written;
+    }
+    return ZDB_RESULT_SUCCESS;
+}
+
+/* Pads the file out to where the plan put the next section */
+int _beginSection(ZdbFileImage* image, uint64_t offset)
+{
+    static const char zeros[ZDB_FILE_ALIGNMENT] = {0};
+    return _writeBytes(image, zeros, offset - image->position);
+}
+
+void _describeTable(ZdbTable* table, ZdbFileTable* header, ZdbFileColumn* columns)
+{
+    memset(header, 0, sizeof(ZdbFileTable));
+    strncpy(header->name, table->name, ZDB_LIMIT_VARCHAR);
+    header->columnCount = table->columnCount;
+    header->storage = table->storage;
+    header->rowCount = table->rowCount;
+    header->slotSize = table->allocator.slotSize;
+    header->rowSize = table->layout.rowSize;
+    header->chunkCount = table->chunkCount;
+    header->stringPageCount = table->strings.pageCount;
+    header->stringPageUsed = table->strings.pageUsed;
+    header->stringBytesLive = table->strings.bytesLive;
+    header->stringBytesDead = table->strings.bytesDead;
+    header->deletedCount = table->deletedCount;
+    header->compactRead = table->compactRead;
+    header->compactWrite = table->compactWrite;
+    header->compactions = table->compactions;
+
+    for (int i = 0; i < table->columnCount; i++)
+    {
+        const char* typeName;
+        ZdbTypeGetName(table->columns[i]->type, &typeName);
+
+        memset(&columns[i], 0, sizeof(ZdbFileColumn));
+        strncpy(columns[i].name, table->columns[i]->name, ZDB_LIMIT_VARCHAR);
+        strncpy(columns[i].typeName, typeName, ZDB_LIMIT_VARCHAR);
+        columns[i].autoincrement = table->columns[i]->autoincrement;
+        columns[i].encoding = table->columns[i]->encoding;
+    }
+
+    for (int i = 0; i < table->indexCount; i++)
+    {
+        columns[table->indexes[i]->column].indexes |= 1u << table->indexes[i]->type;
+    }
+}
+
+/* Places the table's sections from position on, each on a section boundary, and returns where the last one ends */
+uint64_t _placeTable(ZdbTable* table, ZdbFileTable* header, ZdbFileColumn* columns, uint64_t position)
+{
+    uint64_t zoneChunks = (uint64_t)(table->rowCount + ZDB_ROW_CHUNKS - 1) / ZDB_ROW_CHUNKS;
+    header->rowsOffset = _alignSection(position);
+    header->chunksOffset = _alignSection(header->rowsOffset + (uint64_t)table->rowCount * table->allocator.slotSize);
+    header->stringsOffset = _alignSection(header->chunksOffset + (uint64_t)table->chunkCount * ZDB_ROW_CHUNKS * table->layout.rowSize);
+    header->tombstonesOffset = _alignSection(header->stringsOffset + (uint64_t)table->strings.pageCount * ZDB_STRING_PAGE_SIZE);
+    header->zonesOffset = _alignSection(header->tombstonesOffset + (uint64_t)(table->rowCount + 63) / 64 * sizeof(uint64_t));
+    position = header->zonesOffset + zoneChunks * (table->columnCount * sizeof(ZdbZone) + sizeof(int));
+
+    for (int i = 0; i < table->columnCount; i++)
+    {
+        ZdbColumn* column = table->columns[i];
+        if (column->autoincrement && column->lastInsertedValue != NULL)
+        {
+            columns[i].lastValueOffset = _alignSection(position);
+            position = columns[i].lastValueOffset + table->layout.sizes[i];
+        }
+
+        ZdbDictionary* dict = table->dictionaries[i];
+        if (dict != NULL)
+        {
+            columns[i].dictionaryOffset = _alignSection(position);
+            columns[i].dictionaryCount = dict->count;
+            position = columns[i].dictionaryOffset + dict->count * sizeof(ZdbVarcharRef);
+        }
+    }
+
+    return position;
+}
+
+void _freeImage(ZdbFileImage* image)
+{
+    for (int i = 0; image->fileColumns != NULL && i < image->tableCount; i++)
+    {
+        free(image->fileColumns[i]);
+    }
+    free(image->fileColumns);
+    free(image->fileTables);
+    free(image->tables);
+    free(image->slots);
+}
+
+/* Plans an image of the database for writing to fd.  The tables mustn't change until it has been written */
+int _planImage(ZdbFileImage* image, ZdbDatabase* db, uint64_t logSequence, int fd)
+{
+    memset(image, 0, sizeof(ZdbFileImage));
+    image->fd = fd;
+
+    int i;
+    size_t slotSize = 0;
+    image->tables = malloc((db->tableCount > 0 ? db->tableCount : 1) * sizeof(ZdbTable*));
+    if (image->tables == NULL)
+    {
+        return ZDB_RESULT_OUT_OF_MEMORY;
+    }
+    for (i = 0; i < db->tableCount; i++)
+    {
+        ZdbTable* table = db->tables[i];
+        if (table->columns != NULL)
+        {
+            image->tables[image->tableCount++] = table;
+            slotSize = table->allocator.slotSize > slotSize ? table->allocator.slotSize : slotSize;
+        }
+    }
+
+    int count = image->tableCount > 0 ? image->tableCount : 1;
+    image->fileTables = calloc(count, sizeof(ZdbFileTable));
+    image->fileColumns = calloc(count, sizeof(ZdbFileColumn*));
+    image->slotCapacity = slotSize > 0 && slotSize < ZDB_FILE_SLOT_BATCH ? ZDB_FILE_SLOT_BATCH / slotSize : 1;
+    image->slots = malloc(image->slotCapacity * (slotSize > 0 ? slotSize : 1));
+    if (image->fileTables == NULL || image->fileColumns == NULL || image->slots == NULL)
+    {
+        _freeImage(image);
+        return ZDB_RESULT_OUT_OF_MEMORY;
+    }
+
+    ZdbFileHeader* header = &image->header;
+    memcpy(header->magic, ZDB_FILE_MAGIC, sizeof(header->magic));
+    header->version = ZDB_FILE_VERSION;
+    header->tableCount = image->tableCount;
+    strncpy(header->name, db->name, ZDB_LIMIT_VARCHAR);
+    header->logSequence = logSequence;
+
+    /* The catalog comes first, then each table's data */
+    uint64_t position = sizeof(ZdbFileHeader);
+    for (i = 0; i < image->tableCount; i++)
+    {
+        position += sizeof(ZdbFileTable) + image->tables[i]->columnCount * sizeof(ZdbFileColumn);
+    }
+
+    for (i = 0; i < image->tableCount; i++)
+    {
+        ZdbTable* table = image->tables[i];
+        image->fileColumns[i] = calloc(table->columnCount > 0 ? table->columnCount : 1, sizeof(ZdbFileColumn));
+        if (image->fileColumns[i] == NULL)
+        {
+            _freeImage(image);
+            return ZDB_RESULT_OUT_OF_MEMORY;
+        }
+
+        _describeTable(table, &image->fileTables[i], image->fileColumns[i]);
+        position = _placeTable(table, &image->fileTables[i], image->fileColumns[i], position);
+    }
+
+    return ZDB_RESULT_SUCCESS;
+}
+
+int _writeTableData(ZdbFileImage* image, ZdbTable* table, ZdbFileTable* header, ZdbFileColumn* columns)
+{
+    int i;
+    size_t slotSize = table->allocator.slotSize;
+
+    /* Row slots.  The directory is written out in order, so each slot's index is its position in the file */
+    int result = _beginSection(image, header->rowsOffset);
+    for (int first = 0; first < table->rowCount && result == ZDB_RESULT_SUCCESS; first += image->slotCapacity)
+    {
+        int count = table->rowCount - first < image->slotCapacity ? table->rowCount - first : image->slotCapacity;
+        for (i = 0; i < count; i++)
+        {
+            ZdbRow* slot = (ZdbRow*)(image->slots + i * slotSize);
+            memcpy(slot, ZdbEngineRowAt(table, first + i), slotSize);
+            slot->index = first + i;
+        }
+        result = _writeBytes(image, image->slots, count * slotSize);
+    }
+
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = _beginSection(image, header->chunksOffset);
+    }
+    for (i = 0; i < table->chunkCount && result == ZDB_RESULT_SUCCESS; i++)
+    {
+        result = _writeBytes(image, table->chunks[i], ZDB_ROW_CHUNKS * table->layout.rowSize);
+    }
+
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = _beginSection(image, header->stringsOffset);
+    }
+    for (i = 0; i < table->strings.pageCount && result == ZDB_RESULT_SUCCESS; i++)
+    {
+        result = _writeBytes(image, table->strings.pages[i], ZDB_STRING_PAGE_SIZE);
+    }
+
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = _beginSection(image, header->tombstonesOffset);
+    }
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = _writeBytes(image, table->tombstones, (table->rowCount + 63) / 64 * sizeof(uint64_t));
+    }
+
+    size_t zoneChunks = (size_t)(table->rowCount + ZDB_ROW_CHUNKS - 1) / ZDB_ROW_CHUNKS;
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = _beginSection(image, header->zonesOffset);
+    }
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = _writeBytes(image, table->zones, zoneChunks * table->columnCount * sizeof(ZdbZone));
+    }
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = _writeBytes(image, table->newRows, zoneChunks * sizeof(int));
+    }
+
+    for (i = 0; i < table->columnCount && result == ZDB_RESULT_SUCCESS; i++)
+    {
+        if (columns[i].lastValueOffset != 0)
+        {
+            result = _beginSection(image, columns[i].lastValueOffset);
+            if (result == ZDB_RESULT_SUCCESS)
+            {
+                result = _writeBytes(image, table->columns[i]->lastInsertedValue, table->layout.sizes[i]);
+            }
+        }
+
+        if (result == ZDB_RESULT_SUCCESS && columns[i].dictionaryOffset != 0)
+        {
+            result = _beginSection(image, columns[i].dictionaryOffset);
+            if (result == ZDB_RESULT_SUCCESS)
+            {
+                result = _writeBytes(image, table->dictionaries[i]->entries, columns[i].dictionaryCount * sizeof(ZdbVarcharRef));
+            }
+        }
+    }
+
+    return result;
+}
+
+/* Writes a planned image out.  Safe in a forked child: it allocates nothing and takes no locks */
+int _writeImage(ZdbFileImage* image)
+{
+    int i;
+    int result = _writeBytes(image, &image->header, sizeof(ZdbFileHeader));
+    for (i = 0; i < image->tableCount && result == ZDB_RESULT_SUCCESS; i++)
+    {
+        result = _writeBytes(image, &image->fileTables[i], sizeof(ZdbFileTable));
+        if (result == ZDB_RESULT_SUCCESS)
+        {
+            result = _writeBytes(image, image->fileColumns[i], image->tables[i]->columnCount * sizeof(ZdbFileColumn));
+        }
+    }
+
+    for (i = 0; i < image->tableCount && result == ZDB_RESULT_SUCCESS; i++)
+    {
+        result = _writeTableData(image, image->tables[i], &image->fileTables[i], image->fileColumns[i]);
+    }
+
+    return result;
+}
+
+/* Images are written next to the file they replace and swapped in once durable, so a crash never leaves a half
+   written database behind.  A mapping of the old file stays valid after the rename */
+int _openImageFile(const char* path, char** tempPath, int* fd)
+{
+    *tempPath = malloc(strlen(path) + 5);
+    if (*tempPath == NULL)
+    {
+        return ZDB_RESULT_OUT_OF_MEMORY;
+    }
+    sprintf(*tempPath, "%s.tmp", path);
+
+    *fd = open(*tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (*fd < 0)
+    {
+        free(*tempPath);
+        *tempPath = NULL;
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+    return ZDB_RESULT_SUCCESS;
+}
+
+/* Syncs and swaps in the image if result says it was written, or else throws it away.  Frees tempPath */
+int _finishImageFile(int fd, char* tempPath, const char* path, int result)
+{
+    if (result == ZDB_RESULT_SUCCESS && fsync(fd) != 0)
+    {
+        result = ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    if (close(fd) != 0 && result == ZDB_RESULT_SUCCESS)
+    {
+        result = ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    if (result == ZDB_RESULT_SUCCESS && rename(tempPath, path) != 0)
+    {
+        result = ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        remove(tempPath);
+    }
+
+    free(tempPath);
+    return result;
+}
+
+/*
+ * Loading
+ */
+
+int _inFile(size_t fileSize, uint64_t offset, uint64_t size)
+{
+    return offset <= fileSize && size <= fileSize - offset;
+}
+
+int _loadTable(ZdbDatabase* db, char* base, size_t fileSize, ZdbFileTable* header, ZdbFileColumn* fileColumns)
+{
+    int i;
+    if (header->columnCount < 0 || header->columnCount > ZDB_LIMIT_COLUMNS || header->rowCount < 0)
+    {
+        /* Corrupt catalog */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    /* Names are fixed size in the file; make sure they end.  The mapping is private, so this never reaches disk */
+    header->name[ZDB_LIMIT_VARCHAR] = '\0';
+    for (i = 0; i < header->columnCount; i++)
+    {
+        fileColumns[i].name[ZDB_LIMIT_VARCHAR] = '\0';
+        fileColumns[i].typeName[ZDB_LIMIT_VARCHAR] = '\0';
+    }
+
+    /* Until the table is created the columns are ours to free.  From then on dropping the database frees the table
+       and everything it holds, so later failures just return */
+    ZdbColumn** columns = malloc((header->columnCount > 0 ? header->columnCount : 1) * sizeof(ZdbColumn*));
+    if (columns == NULL)
+    {
+        return ZDB_RESULT_OUT_OF_MEMORY;
+    }
+
+    int result = ZDB_RESULT_SUCCESS;
+    int created = 0;
+    for (; created < header->columnCount && result == ZDB_RESULT_SUCCESS; created++)
+    {
+        ZdbType* type;
+        if (ZdbTypeFind(fileColumns[created].typeName, &type) != ZDB_RESULT_SUCCESS)
+        {
+            /* The file uses a type that hasn't been created in this process */
+            result = ZDB_RESULT_NOT_FOUND;
+            break;
+        }
+
+        ZdbEngineCreateColumn(fileColumns[created].name, type, fileColumns[created].autoincrement, &columns[created]);
+        if (ZdbEngineSetColumnEncoding(columns[created], fileColumns[created].encoding) != ZDB_RESULT_SUCCESS)
+        {
+            result = ZDB_RESULT_INVALID_OPERATION;
+        }
+    }
+
+    ZdbTable* table;
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = ZdbEngineCreateTableWithStorage(db, header->name, header->columnCount, columns, header->storage, &table);
+    }
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        for (i = 0; i < created; i++)
+        {
+            free(columns[i]);
+        }
+        free(columns);
+        return result;
+    }
+    free(columns);
+
+    if (header->slotSize != table->allocator.slotSize || header->rowSize != table->layout.rowSize)
+    {
+        /* Rows were laid out differently when the file was written, e.g. by a different build */
+        return ZDB_RESULT_UNSUPPORTED;
+    }
+
+    size_t chunkBytes = ZDB_ROW_CHUNKS * table->layout.rowSize;
+    size_t zoneChunks = (header->rowCount + ZDB_ROW_CHUNKS - 1) / ZDB_ROW_CHUNKS;
+    if (!_inFile(fileSize, header->rowsOffset, header->rowCount * header->slotSize) ||
+        !_inFile(fileSize, header->chunksOffset, header->chunkCount * chunkBytes) ||
+        !_inFile(fileSize, header->stringsOffset, header->stringPageCount * (uint64_t)ZDB_STRING_PAGE_SIZE) ||
+        !_inFile(fileSize, header->tombstonesOffset, (header->rowCount + 63) / 64 * sizeof(uint64_t)) ||
+        !_inFile(fileSize, header->zonesOffset, zoneChunks * (header->columnCount * sizeof(ZdbZone) + sizeof(int))))
+    {
+        /* Truncated file */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    /* Rows are found in the mapping by position, so opening reads none of them.  Row pages are faulted in when
+       something reads them */
+    result = ZdbEngineMapRows(table, base + header->rowsOffset, header->rowCount);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        return result;
+    }
+
+    /* The bitmap and zones are small and change with every delete or update, so they're copied rather than mapped */
+    if (header->rowCount > 0)
+    {
+        memcpy(table->tombstones, base + header->tombstonesOffset, (header->rowCount + 63) / 64 * sizeof(uint64_t));
+        memcpy(table->zones, base + header->zonesOffset, zoneChunks * header->columnCount * sizeof(ZdbZone));
+        memcpy(table->newRows, base + header->zonesOffset + zoneChunks * header->columnCount * sizeof(ZdbZone), zoneChunks * sizeof(int));
+    }
+    table->deletedCount = header->deletedCount;
+    table->compactRead = header->compactRead;
+    table->compactWrite = header->compactWrite;
+    table->compactions = (int)header->compactions;
+
+    if (header->chunkCount > 0)
+    {
+        table->chunks = malloc(header->chunkCount * sizeof(char*));
+        if (table->chunks == NULL)
+        {
+            return ZDB_RESULT_OUT_OF_MEMORY;
+        }
+        for (i = 0; i < header->chunkCount; i++)
+        {
+            table->chunks[i] = base + header->chunksOffset + i * chunkBytes;
+        }
+        table->chunkCount = table->mappedChunkCount = header->chunkCount;
+    }
+
+    if (header->stringPageCount > 0)
+    {
+        table->strings.pages = malloc(header->stringPageCount * sizeof(char*));
+        if (table->strings.pages == NULL)
+        {
+            return ZDB_RESULT_OUT_OF_MEMORY;
+        }
+        for (i = 0; i < header->stringPageCount; i++)
+        {
+            table->strings.pages[i] = base + header->stringsOffset + i * (size_t)ZDB_STRING_PAGE_SIZE;
+        }
+        table->strings.pageCount = table->strings.mappedPageCount = header->stringPageCount;
+        table->strings.pageUsed = header->stringPageUsed;
+        table->strings.bytesLive = header->stringBytesLive;
+        table->strings.bytesDead = header->stringBytesDead;
+    }
+
+    for (i = 0; i < header->columnCount; i++)
+    {
+        if (fileColumns[i].lastValueOffset != 0)
+        {
+            if (!_inFile(fileSize, fileColumns[i].lastValueOffset, table->layout.sizes[i]))
+            {
+                return ZDB_RESULT_INVALID_OPERATION;
+            }
+
+            /* Autoincrement carries on from the saved value */
+            table->columns[i]->lastInsertedValue = malloc(table->layout.sizes[i]);
+            if (table->columns[i]->lastInsertedValue == NULL)
+            {
+                return ZDB_RESULT_OUT_OF_MEMORY;
+            }
+            memcpy(table->columns[i]->lastInsertedValue, base + fileColumns[i].lastValueOffset, table->layout.sizes[i]);
+        }
+
+        if (fileColumns[i].dictionaryOffset != 0)
+        {
+            if (!_inFile(fileSize, fileColumns[i].dictionaryOffset, fileColumns[i].dictionaryCount * sizeof(ZdbVarcharRef)))
+            {
+                return ZDB_RESULT_INVALID_OPERATION;
+            }
+
+            result = ZdbEngineLoadDictionary(table, i, (int)fileColumns[i].dictionaryCount, (ZdbVarcharRef*)(base + fileColumns[i].dictionaryOffset));
+            if (result != ZDB_RESULT_SUCCESS)
+            {
+                return result;
+            }
+        }
+    }
+
+    /* Indexes aren't saved, only which columns have them.  Each is built the first time a query asks for it */
+    for (i = 0; i < header->columnCount; i++)
+    {
+        for (int type = ZDB_INDEX_HASH; type < 32; type++)
+        {
+            if ((fileColumns[i].indexes & (1u << type)) && (result = ZdbIndexDefer(table, i, type)) != ZDB_RESULT_SUCCESS)
+            {
+                return result;
+            }
+        }
+    }
+
+    return ZDB_RESULT_SUCCESS;
+}
+
+int _loadDatabase(char* base, size_t fileSize, ZdbDatabase* db)
+{
+    ZdbFileHeader* header = (ZdbFileHeader*)base;
+    size_t position = sizeof(ZdbFileHeader);
+
+    for (uint32_t i = 0; i < header->tableCount; i++)
+    {
+        if (!_inFile(fileSize, position, sizeof(ZdbFileTable)))
+        {
+            return ZDB_RESULT_INVALID_OPERATION;
+        }
+
+        ZdbFileTable* table = (ZdbFileTable*)(base + position);
+        position += sizeof(ZdbFileTable);
+        if (table->columnCount < 0 || !_inFile(fileSize, position, table->columnCount * sizeof(ZdbFileColumn)))
+        {
+            return ZDB_RESULT_INVALID_OPERATION;
+        }
+
+        ZdbFileColumn* columns = (ZdbFileColumn*)(base + position);
+        position += table->columnCount * sizeof(ZdbFileColumn);
+
+        int result = _loadTable(db, base, fileSize, table, columns);
+        if (result != ZDB_RESULT_SUCCESS)
+        {
+            return result;
+        }
+    }
+
+    return ZDB_RESULT_SUCCESS;
+}
+
+/*
+ * Public Interface Methods
+ */
+
+/* If a log is given, it is locked while the tables are written out so that other threads can't change them, and the
+   image covers everything logged so far */
+int _saveDatabase(ZdbDatabase* db, const char* path, ZdbLog* log, uint64_t logSequence)
+{
+    char* tempPath;
+    int fd;
+    int result = _openImageFile(path, &tempPath, &fd);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        return result;
+    }
+
+    if (log != NULL)
+    {
+        ZdbLogLock(log);
+        logSequence = ZdbLogLastSequence(log);
+    }
+
+    ZdbFileImage image;
+    result = _planImage(&image, db, logSequence, fd);
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = _writeImage(&image);
+        _freeImage(&image);
+    }
+
+    if (log != NULL)
+    {
+        ZdbLogUnlock(log);
+    }
+
+    return _finishImageFile(fd, tempPath, path, result);
+}
+
+/*
+ * Checkpoints
+ */
+
+struct _ZdbCheckpoint
+{
+    pthread_mutex_t lock;
+    pthread_t waiter;               /* Reaps the child and truncates the log */
+    int running;                    /* A checkpoint was started and hasn't been joined yet */
+    int finished;
+    int result;
+
+    ZdbDatabase* db;
+    pid_t child;
+    int fd;                         /* The image the child writes, which the waiter syncs and swaps in */
+    char* tempPath;
+    char* path;
+    uint64_t logSequence;           /* Last record the image includes */
+    uint64_t logOffset;             /* Where the records after it start in the log */
+    double started;
+
+    ZdbCheckpointStats stats;
+};
+
+double _checkpointNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void* _checkpointWaiterMain(void* arg)
+{
+    ZdbCheckpoint* checkpoint = arg;
+    ZdbDatabase* db = checkpoint->db;
+
+    int status = 0;
+    while (waitpid(checkpoint->child, &status, 0) < 0 && errno == EINTR)
+    {
+    }
+
+    int result = (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? ZDB_RESULT_SUCCESS : ZDB_RESULT_INVALID_OPERATION;
+    result = _finishImageFile(checkpoint->fd, checkpoint->tempPath, checkpoint->path, result);
+    checkpoint->tempPath = NULL;
+
+    /* The image is durable, so the records it covers are no longer needed */
+    uint64_t dropped = 0;
+    if (result == ZDB_RESULT_SUCCESS && db->log != NULL)
+    {
+        result = ZdbLogTruncate(db->log, checkpoint->logOffset, &dropped);
+    }
+
+    struct stat st;
+    uint64_t bytes = (result == ZDB_RESULT_SUCCESS && stat(checkpoint->path, &st) == 0) ? st.st_size : 0;
+
+    pthread_mutex_lock(&checkpoint->lock);
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        checkpoint->stats.checkpoints++;
+        checkpoint->stats.lastBytes = bytes;
+        checkpoint->stats.totalBytes += bytes;
+        checkpoint->stats.logBytesTruncated += dropped;
+        checkpoint->stats.lastSequence = checkpoint->logSequence;
+    }
+    else
+    {
+        checkpoint->stats.failures++;
+    }
+    checkpoint->stats.lastDuration = _checkpointNow() - checkpoint->started;
+    checkpoint->result = result;
+    checkpoint->finished = 1;
+    pthread_mutex_unlock(&checkpoint->lock);
+
+    return NULL;
+}
+
+/*
+ * Public Interface Methods
+ */
+
+int ZdbEngineSaveDB(ZdbDatabase* db, const char* path)
+{
+    if (db == NULL || path == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    return _saveDatabase(db, path, db->log, db->logSequence);
+}
+
+int ZdbEngineCheckpoint(ZdbDatabase* db, const char* path)
+{
+    if (db == NULL || path == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (db->checkpoint == NULL)
+    {
+        db->checkpoint = calloc(1, sizeof(ZdbCheckpoint));
+        pthread_mutex_init(&db->checkpoint->lock, NULL);
+    }
+
+    ZdbCheckpoint* checkpoint = db->checkpoint;
+    if (checkpoint->running)
+    {
+        pthread_mutex_lock(&checkpoint->lock);
+        int finished = checkpoint->finished;
+        pthread_mutex_unlock(&checkpoint->lock);
+
+        if (!finished)
+        {
+            /* One checkpoint at a time */
+            return ZDB_RESULT_INVALID_OPERATION;
+        }
+
+        ZdbEngineWaitCheckpoint(db);
+    }
+
+    checkpoint->started = _checkpointNow();
+
+    char* tempPath;
+    int fd;
+    int result = _openImageFile(path, &tempPath, &fd);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        checkpoint->stats.failures++;
+        return result;
+    }
+
+    /* Writers only wait while the image is planned and the process forks.  The child sees the tables exactly as they
+       are now and writes them out while the parent carries on; the kernel copies pages either side touches.  The
+       flusher is parked first so it isn't part way through a log write when the process forks */
+    if (db->log != NULL)
+    {
+        ZdbLogLockIdle(db->log);
+    }
+
+    checkpoint->logSequence = db->log != NULL ? ZdbLogLastSequence(db->log) : db->logSequence;
+    checkpoint->logOffset = db->log != NULL ? ZdbLogEndOffset(db->log) : 0;
+
+    ZdbFileImage image;
+    result = _planImage(&image, db, checkpoint->logSequence, fd);
+    pid_t child = -1;
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        child = fork();
+        if (child == 0)
+        {
+            /* Only this thread was copied, and the others may have been holding locks inside malloc or stdio, so the
+               child does nothing but write the planned image */
+            _exit(_writeImage(&image) == ZDB_RESULT_SUCCESS ? 0 : 1);
+        }
+        _freeImage(&image);
+    }
+
+    if (db->log != NULL)
+    {
+        ZdbLogUnlock(db->log);
+    }
+
+    checkpoint->stats.lastPause = _checkpointNow() - checkpoint->started;
+    if (child < 0)
+    {
+        checkpoint->stats.failures++;
+        _finishImageFile(fd, tempPath, path, ZDB_RESULT_INVALID_OPERATION);
+        return result != ZDB_RESULT_SUCCESS ? result : ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    checkpoint->db = db;
+    checkpoint->child = child;
+    checkpoint->fd = fd;
+    checkpoint->tempPath = tempPath;
+    checkpoint->path = strdup(path);
+    checkpoint->finished = 0;
+    checkpoint->running = 1;
+    if (pthread_create(&checkpoint->waiter, NULL, _checkpointWaiterMain, checkpoint) != 0)
+    {
+        /* Nothing can reap the child in the background, so finish it here */
+        _checkpointWaiterMain(checkpoint);
+        checkpoint->running = 0;
+        free(checkpoint->path);
+        checkpoint->path = NULL;
+        return checkpoint->result;
+    }
+
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbEngineWaitCheckpoint(ZdbDatabase* db)
+{
+    if (db == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    ZdbCheckpoint* checkpoint = db->checkpoint;
+    if (checkpoint == NULL || !checkpoint->running)
+    {
+        /* Nothing in progress */
+        return ZDB_RESULT_SUCCESS;
+    }
+
+    pthread_join(checkpoint->waiter, NULL);
+    checkpoint->running = 0;
+    free(checkpoint->path);
+    checkpoint->path = NULL;
+
+    return checkpoint->result;
+}
+
+int ZdbEngineGetCheckpointStats(ZdbDatabase* db, ZdbCheckpointStats* stats)
+{
+    if (db == NULL || stats == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (db->checkpoint == NULL)
+    {
+        memset(stats, 0, sizeof(ZdbCheckpointStats));
+        return ZDB_RESULT_SUCCESS;
+    }
+
+    pthread_mutex_lock(&db->checkpoint->lock);
+    *stats = db->checkpoint->stats;
+    pthread_mutex_unlock(&db->checkpoint->lock);
+
+    return ZDB_RESULT_SUCCESS;
+}
+
+void ZdbEngineFreeCheckpoint(ZdbDatabase* db)
+{
+    if (db->checkpoint != NULL)
+    {
+        ZdbEngineWaitCheckpoint(db);
+        pthread_mutex_destroy(&db->checkpoint->lock);
+        free(db->checkpoint);
+        db->checkpoint = NULL;
+    }
+}
+
+int ZdbEngineOpenDB(const char* path, ZdbDatabase** database)
+{
+    if (path == NULL || database == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return ZDB_RESULT_NOT_FOUND;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ZdbFileHeader))
+    {
+        close(fd);
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    /* A private writable mapping lets rows be updated in place without the changes reaching the file */
+    size_t fileSize = st.st_size;
+    char* base = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    ZdbFileHeader* header = (ZdbFileHeader*)base;
+    if (memcmp(header->magic, ZDB_FILE_MAGIC, sizeof(header->magic)) != 0)
+    {
+        munmap(base, fileSize);
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    if (header->version != ZDB_FILE_VERSION)
+    {
+        munmap(base, fileSize);
+        return ZDB_RESULT_UNSUPPORTED;
+    }
+
+    ZdbDatabase* db;
+    header->name[ZDB_LIMIT_VARCHAR] = '\0';
+    ZdbEngineCreateDB(header->name, &db);
+    db->mapping = base;
+    db->mappingSize = fileSize;
+    db->logSequence = header->logSequence;
+
+    int result = _loadDatabase(base, fileSize, db);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        ZdbEngineDropDB(db);
+        free(db);
+        return result;
+    }
+
+    *database = db;
+    return ZDB_RESULT_SUCCESS;
+}
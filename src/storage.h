@@ -0,0 +1,37 @@
+//
+//  storage.h
+//  ZombieSQL
+//
+//  Saving databases to and opening them from a single file, in the foreground or as background checkpoints.
+//
+
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include "engine.h"
+
+#define ZDB_FILE_VERSION        6
+
+typedef struct
+{
+    uint64_t checkpoints;           /* Checkpoints that completed */
+    uint64_t failures;
+    double lastPause;               /* Seconds writers were held up to start the last checkpoint */
+    double lastDuration;            /* Seconds from starting the last checkpoint to its log being truncated */
+    uint64_t lastBytes;             /* Size of the last image written */
+    uint64_t totalBytes;
+    uint64_t logBytesTruncated;     /* Log bytes dropped because an image covered them */
+    uint64_t lastSequence;          /* Last log record covered by a completed checkpoint */
+} ZdbCheckpointStats;
+
+int ZdbEngineSaveDB(ZdbDatabase* db, const char* path);
+int ZdbEngineOpenDB(const char* path, ZdbDatabase** database);
+
+/* Saves the database in the background.  Returns once the snapshot is taken; the tables can be changed while it is
+   written, and an attached log is truncated when it is done */
+int ZdbEngineCheckpoint(ZdbDatabase* db, const char* path);
+int ZdbEngineWaitCheckpoint(ZdbDatabase* db);
+int ZdbEngineGetCheckpointStats(ZdbDatabase* db, ZdbCheckpointStats* stats);
+void ZdbEngineFreeCheckpoint(ZdbDatabase* db);
+
+#endif // STORAGE_H
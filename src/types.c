@@ -107,9 +107,24 @@ int _comparevarchar(void* value1, void* value2, int* result)
     return ZDB_RESULT_SUCCESS;
 }
 
+size_t _varcharLength(const char* value)
+{
+    /* Strings longer than the limit are truncated, leaving room for the terminator */
+    size_t length = strlen(value);
+    return length < ZDB_LIMIT_VARCHAR ? length : ZDB_LIMIT_VARCHAR - 1;
+}
+
 int _sizeofvarchar(void* value, size_t* result)
 {
-    *result = ZDB_LIMIT_VARCHAR;
+    if (value != NULL)
+    {
+        /* Just enough for this string and its terminator */
+        *result = _varcharLength((char*)value) + 1;
+    }
+    else
+    {
+        *result = ZDB_LIMIT_VARCHAR;
+    }
     
     return ZDB_RESULT_SUCCESS;
 }
@@ -121,7 +136,10 @@ int _copyvarchar(void* dest, void* src)
         return ZDB_RESULT_INVALID_NULL;
     }
     
-    strncpy((char*)dest, (char*)src, ZDB_LIMIT_VARCHAR);
+    /* Only copy what the string needs, since dest may have been sized from the value */
+    size_t length = _varcharLength((char*)src);
+    memmove(dest, src, length);
+    ((char*)dest)[length] = '\0';
     
     return ZDB_RESULT_SUCCESS;
 }
@@ -159,6 +177,7 @@ int _tostringvarchar(void* value, size_t* length, char* result)
 struct _ZdbType
 {
     char name[ZDB_LIMIT_VARCHAR];
+    int id;                         /* ZDB_TYPE_ID_* */
     ZdbTypeCompareFn compare;
     ZdbTypeSizeFn size;
     ZdbTypeCopyFn copy;
@@ -167,6 +186,9 @@ struct _ZdbType
     ZdbTypeNextValueFn nextValue;
 };
 
+static ZdbType** registeredTypes = NULL;
+static int registeredTypeCount = 0;
+
 DECLARE_COMPARISON_FN(int)
 DECLARE_SIZEOF_FN(int)
 DECLARE_COPY_FN(int)
@@ -197,6 +219,11 @@ int ZdbTypeInitialize()
     
     ZdbTypeCreate("varchar", _comparevarchar, _sizeofvarchar, _copyvarchar, _fromstringvarchar, _tostringvarchar, NULL, &ZdbStandardTypes->varcharType);
     
+    ZdbStandardTypes->intType->id = ZDB_TYPE_ID_INT;
+    ZdbStandardTypes->floatType->id = ZDB_TYPE_ID_FLOAT;
+    ZdbStandardTypes->booleanType->id = ZDB_TYPE_ID_BOOLEAN;
+    ZdbStandardTypes->varcharType->id = ZDB_TYPE_ID_VARCHAR;
+    
     return result;
 }
 
@@ -217,6 +244,7 @@ int ZdbTypeCreate(const char* name, ZdbTypeCompareFn compareFn, ZdbTypeSizeFn si
     
     ZdbType* t = malloc(sizeof(ZdbType));
     strncpy(t->name, name, ZDB_LIMIT_VARCHAR);
+    t->id = ZDB_TYPE_ID_USER;
     t->compare = compareFn;
     t->size = sizeFn;
     t->copy = copyFn;
@@ -224,6 +252,10 @@ int ZdbTypeCreate(const char* name, ZdbTypeCompareFn compareFn, ZdbTypeSizeFn si
     t->toString = toStringFn;
     t->nextValue = nextValueFn;
     
+    /* Remember the type so it can be found by name, e.g. when a database is loaded from disk */
+    registeredTypes = realloc(registeredTypes, (registeredTypeCount + 1) * sizeof(ZdbType*));
+    registeredTypes[registeredTypeCount++] = t;
+    
     *newType = t;
     return ZDB_RESULT_SUCCESS;
 }
@@ -263,21 +295,48 @@ int ZdbTypeNewValue(ZdbType* type, const char* str, void** result)
     return ZDB_RESULT_SUCCESS;
 }
 
-int ZdbTypeGetName(ZdbType* type, const char* result)
+int ZdbTypeGetName(ZdbType* type, const char** result)
 {
-    if (type == NULL)
+    if (type == NULL || result == NULL)
     {
         /* Must pass a valid type */
         return ZDB_RESULT_INVALID_NULL;
     }
     
-    result = type->name;
+    *result = type->name;
     
     return ZDB_RESULT_SUCCESS;
 }
 
+int ZdbTypeGetId(ZdbType* type)
+{
+    return type != NULL ? type->id : ZDB_TYPE_ID_USER;
+}
+
+int ZdbTypeFind(const char* name, ZdbType** result)
+{
+    if (name == NULL || result == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+    
+    /* Search newest first so a type created again replaces the older definition */
+    int i;
+    for (i = registeredTypeCount - 1; i >= 0; i--)
+    {
+        if (!strcmp(registeredTypes[i]->name, name))
+        {
+            *result = registeredTypes[i];
+            return ZDB_RESULT_SUCCESS;
+        }
+    }
+    
+    return ZDB_RESULT_NOT_FOUND;
+}
+
 int ZdbTypeSupportsCompare(ZdbType* type) { return type->compare != NULL; }
 int ZdbTypeSupportsSizeof(ZdbType* type) { return type->size != NULL; }
+int ZdbTypeSupportsCopy(ZdbType* type) { return type->copy != NULL; }
 int ZdbTypeSupportsFromString(ZdbType* type) { return type->fromString != NULL; }
 int ZdbTypeSupportsToString(ZdbType* type) { return type->toString != NULL; }
 int ZdbTypeSupportsNextValue(ZdbType* type) { return type->nextValue != NULL; }
@@ -321,13 +380,6 @@ int ZdbTypeSizeof(ZdbType* type, void* value, size_t* result)
         return ZDB_RESULT_UNSUPPORTED;
     }
     
-    if (value != NULL)
-    {
-        /* Per-value sizes are not yet supported */
-        /* TODO: Support this */
-        return ZDB_RESULT_UNSUPPORTED;
-    }
-    
     if (result == NULL)
     {
         /* Can't pass a null value to result */
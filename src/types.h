@@ -13,6 +13,14 @@
 
 #include <stddef.h>
 
+/* Stable identifiers for the standard types, so code that knows a type's layout can pick a specialized path
+   without comparing pointers.  Every type created through ZdbTypeCreate is ZDB_TYPE_ID_USER */
+#define ZDB_TYPE_ID_USER        0
+#define ZDB_TYPE_ID_INT         1
+#define ZDB_TYPE_ID_FLOAT       2
+#define ZDB_TYPE_ID_BOOLEAN     3
+#define ZDB_TYPE_ID_VARCHAR     4
+
 struct _ZdbStandardTypes
 {
     ZdbType* booleanType;
@@ -30,7 +38,7 @@ struct _ZdbStandardTypes* ZdbStandardTypes;
 // ZdbTypeCompareFn - Compares two values, returns 0 if equal, a negative number if value 1 is less than value 2, or a positive number if value 1 is greater than value 2.  Returns an error if the values can't be compared
 typedef int (*ZdbTypeCompareFn)(void* value1, void* value2, int* result);
 
-// ZdbTypeSizeFn - Given a value from a type, determines the amount of bytes are needed to store it.  If passed null, return the nominal or static size and ZdbMessages->InfoSuccess.  Otherwise return ZDB_RESULT_INVALID_STATE to signal that it is impossible to determine a nominal or static size
+// ZdbTypeSizeFn - Given a value from a type, determines the amount of bytes are needed to store it, which for variable length types may be less than the static size.  If passed null, return the nominal or static size and ZdbMessages->InfoSuccess.  Otherwise return ZDB_RESULT_INVALID_STATE to signal that it is impossible to determine a nominal or static size
 typedef int (*ZdbTypeSizeFn)(void* value, size_t* result);
 
 // ZdbTypeCopyFn - Given a source and destination, copies the source value to the destination.  At this time.  Returns ZdbMessages->InfoSuccess unless one of the parameters is NULL
@@ -51,7 +59,11 @@ int ZdbTypeCreate(const char* name, ZdbTypeCompareFn compareFn, ZdbTypeSizeFn si
 
 int ZdbTypeNewValue(ZdbType* type, const char* str, void** result);
 
-int ZdbTypeGetName(ZdbType* type, const char* result);
+int ZdbTypeGetName(ZdbType* type, const char** result);
+
+int ZdbTypeGetId(ZdbType* type);   /* ZDB_TYPE_ID_*, or ZDB_TYPE_ID_USER for NULL */
+
+int ZdbTypeFind(const char* name, ZdbType** result);
 
 int ZdbTypeCompare(ZdbType* type, void* value1, void* value2, int* result);
 
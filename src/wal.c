@@ -0,0 +1,1153 @@
+//
+//  wal.c
+//  ZombieSQL
+//
+//  The log file is a header followed by records.  Each record describes one change in terms of the values it left
+//  behind, so replaying it never depends on what the engine would have chosen at the time, e.g. autoincrement
+//  values.  Records are appended to a buffer under the log lock; a background flusher writes the buffer out and
+//  syncs it as soon as a commit is waiting, and every commit that arrives during that sync shares the next one.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "wal.h"
+#include "storage.h"
+#include "index.h"
+
+#define ZDB_LOG_MAGIC               "ZOMBIWAL"
+#define ZDB_LOG_BATCH_ROWS          1024            /* Rows per record when logging a bulk insert */
+#define ZDB_LOG_BATCH_DELETES       65536           /* Row indexes per record when logging a delete */
+#define ZDB_LOG_MAX_RECORD          (1 << 30)       /* Anything bigger is taken to be a torn write */
+#define ZDB_LOG_NO_VALUE            UINT64_MAX      /* Value size of a field the change left alone */
+
+#define ZDB_LOG_RECORD_CREATE_TABLE 1
+#define ZDB_LOG_RECORD_INSERT_ROW   2
+#define ZDB_LOG_RECORD_ROW_VALUES   3
+#define ZDB_LOG_RECORD_INSERT_ROWS  4
+#define ZDB_LOG_RECORD_DELETE_ROWS  5
+#define ZDB_LOG_RECORD_COMPACT      6
+#define ZDB_LOG_RECORD_CREATE_INDEX 7
+#define ZDB_LOG_RECORD_DROP_TABLE   8
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+} ZdbLogFileHeader;
+
+typedef struct
+{
+    uint32_t size;                  /* Bytes in the record including this header, always a multiple of 8 */
+    uint32_t checksum;              /* Of everything after this field */
+    uint64_t sequence;
+    uint32_t type;                  /* ZDB_LOG_RECORD_* */
+    uint32_t table;                 /* Position of the table among the database's tables that haven't been dropped */
+    uint32_t row;                   /* Row changed, the first row inserted, or the column indexed */
+    uint32_t count;                 /* Values, rows, columns or row indexes that follow, rows per compaction step, or index type */
+} ZdbLogRecord;
+
+typedef struct
+{
+    char name[ZDB_LIMIT_VARCHAR + 1];
+    int32_t storage;
+    int32_t reserved;
+} ZdbLogTable;
+
+typedef struct
+{
+    char name[ZDB_LIMIT_VARCHAR + 1];
+    char typeName[ZDB_LIMIT_VARCHAR + 1];
+    int32_t autoincrement;
+    int32_t encoding;
+} ZdbLogColumn;
+
+struct _ZdbLog
+{
+    ZdbLogOptions options;
+    char* path;
+    int fd;
+    uint64_t endOffset;             /* Where the next record will start in the file */
+
+    pthread_mutex_t lock;           /* Held while a table changes and its record is appended */
+    pthread_cond_t flushWanted;     /* Signalled when records are waiting for the flusher */
+    pthread_cond_t flushed;         /* Broadcast when durableSequence moves */
+    pthread_t flusher;
+    int running;
+    int stopping;
+    int failed;                     /* A write or sync failed, so nothing after it can be durable */
+    int waiters;                    /* Commits waiting for the next sync */
+    int flushing;                   /* The flusher is writing a batch without holding the lock */
+
+    char* buffer;                   /* Records appended but not yet handed to the flusher */
+    size_t used;
+    size_t capacity;
+    char* spare;                    /* Buffer the flusher is writing out */
+    size_t spareCapacity;
+
+    uint64_t sequence;              /* Last record appended */
+    uint64_t durableSequence;       /* Last record known to be on disk */
+
+    ZdbLogStats stats;
+};
+
+/*
+ * Private helper methods
+ */
+
+uint32_t _logChecksum(const char* data, size_t size)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+size_t _logPad(size_t size)
+{
+    return (size + 7) & ~(size_t)7;
+}
+
+int _logWriteAll(int fd, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = write(fd, data, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return ZDB_RESULT_INVALID_OPERATION;
+        }
+
+        data += written;
+        size -= written;
+    }
+
+    return ZDB_RESULT_SUCCESS;
+}
+
+/* Dropped tables keep their place in db->tables but lose their columns.  They aren't saved, so they aren't counted
+   here either, and a log replayed over a saved image numbers its tables the same way */
+int _logTableNumber(ZdbDatabase* db, ZdbTable* table)
+{
+    int number = 0;
+    for (int i = 0; i < db->tableCount; i++)
+    {
+        if (db->tables[i] == table)
+        {
+            return number;
+        }
+        if (db->tables[i]->columns != NULL)
+        {
+            number++;
+        }
+    }
+
+    return number;
+}
+
+ZdbTable* _logFindTable(ZdbDatabase* db, uint32_t number)
+{
+    for (int i = 0; i < db->tableCount; i++)
+    {
+        if (db->tables[i]->columns != NULL && number-- == 0)
+        {
+            return db->tables[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Writes out whatever is buffered and syncs it.  Only used when there is no flusher thread */
+void _logFlushLocked(ZdbLog* log)
+{
+    if (log->used > 0)
+    {
+        if (_logWriteAll(log->fd, log->buffer, log->used) != ZDB_RESULT_SUCCESS)
+        {
+            log->failed = 1;
+        }
+
+        log->stats.bytes += log->used;
+        log->used = 0;
+    }
+
+    if (log->durableSequence < log->sequence && !log->failed)
+    {
+        if (fdatasync(log->fd) != 0)
+        {
+            log->failed = 1;
+        }
+
+        log->stats.syncs++;
+        log->durableSequence = log->sequence;
+    }
+}
+
+/* Starts a record of the given payload size at the end of the buffer */
+ZdbLogRecord* _logBeginRecord(ZdbLog* log, int type, uint32_t table, size_t payloadSize)
+{
+    size_t size = sizeof(ZdbLogRecord) + _logPad(payloadSize);
+    if (log->used + size > log->capacity)
+    {
+        size_t capacity = log->capacity > 0 ? log->capacity : 64 * 1024;
+        while (log->used + size > capacity)
+        {
+            capacity *= 2;
+        }
+
+        char* buffer = realloc(log->buffer, capacity);
+        if (buffer == NULL)
+        {
+            return NULL;
+        }
+
+        log->buffer = buffer;
+        log->capacity = capacity;
+    }
+
+    ZdbLogRecord* record = (ZdbLogRecord*)(log->buffer + log->used);
+    memset(record, 0, size);
+    record->size = (uint32_t)size;
+    record->type = type;
+    record->table = table;
+    return record;
+}
+
+uint64_t _logEndRecord(ZdbLog* log, ZdbLogRecord* record)
+{
+    int wasEmpty = log->used == 0;
+
+    record->sequence = ++log->sequence;
+    record->checksum = _logChecksum((char*)&record->sequence, record->size - offsetof(ZdbLogRecord, sequence));
+    log->used += record->size;
+    log->endOffset += record->size;
+    log->stats.records++;
+
+    if (log->running)
+    {
+        if (wasEmpty || log->used >= log->options.flushBytes)
+        {
+            pthread_cond_signal(&log->flushWanted);
+        }
+    }
+    else if (log->used >= log->options.flushBytes && !log->failed)
+    {
+        /* Nobody syncs until the next commit, but don't let the buffer grow without bound */
+        if (_logWriteAll(log->fd, log->buffer, log->used) != ZDB_RESULT_SUCCESS)
+        {
+            log->failed = 1;
+        }
+
+        log->stats.bytes += log->used;
+        log->used = 0;
+    }
+
+    return log->sequence;
+}
+
+/* Finds each field a change left behind.  Autoincrement fields only change when a row is first written */
+size_t _logCollectValues(ZdbTable* table, ZdbRow* row, int valueCount, int newRow, void** values, size_t* sizes)
+{
+    size_t total = 0;
+    for (int i = 0; i < valueCount; i++)
+    {
+        values[i] = NULL;
+        sizes[i] = 0;
+        if (!table->columns[i]->autoincrement || newRow)
+        {
+            ZdbEngineGetValue(table, row, i, &values[i]);
+            ZdbTypeSizeof(table->columns[i]->type, values[i], &sizes[i]);
+        }
+
+        total += sizeof(uint64_t) + _logPad(sizes[i]);
+    }
+
+    return total;
+}
+
+char* _logWriteValues(char* dest, int valueCount, void** values, size_t* sizes)
+{
+    for (int i = 0; i < valueCount; i++)
+    {
+        *(uint64_t*)dest = values[i] != NULL ? sizes[i] : ZDB_LOG_NO_VALUE;
+        dest += sizeof(uint64_t);
+        if (values[i] != NULL)
+        {
+            memcpy(dest, values[i], sizes[i]);
+            dest += _logPad(sizes[i]);
+        }
+    }
+
+    return dest;
+}
+
+/* Points values at the fields encoded in a record.  Every value starts 8 byte aligned */
+const char* _logReadValues(const char* data, const char* end, int valueCount, void** values)
+{
+    for (int i = 0; i < valueCount; i++)
+    {
+        if (end - data < (ptrdiff_t)sizeof(uint64_t))
+        {
+            return NULL;
+        }
+
+        uint64_t size = *(uint64_t*)data;
+        data += sizeof(uint64_t);
+        if (size == ZDB_LOG_NO_VALUE)
+        {
+            values[i] = NULL;
+            continue;
+        }
+
+        if ((uint64_t)(end - data) < _logPad(size))
+        {
+            return NULL;
+        }
+
+        values[i] = (void*)data;
+        data += _logPad(size);
+    }
+
+    return data;
+}
+
+void* _logFlusherMain(void* arg)
+{
+    ZdbLog* log = arg;
+
+    pthread_mutex_lock(&log->lock);
+    for (;;)
+    {
+        while (log->used == 0 && !log->stopping)
+        {
+            pthread_cond_wait(&log->flushWanted, &log->lock);
+        }
+
+        if (log->used == 0)
+        {
+            /* Stopping with nothing left to write */
+            break;
+        }
+
+        if (log->waiters == 0 && log->used < log->options.flushBytes && !log->stopping)
+        {
+            /* Nobody is waiting yet, so let records gather until a commit, the size trigger or the interval */
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long)log->options.flushInterval * 1000;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+
+            while (log->waiters == 0 && log->used < log->options.flushBytes && !log->stopping)
+            {
+                if (pthread_cond_timedwait(&log->flushWanted, &log->lock, &deadline) == ETIMEDOUT)
+                {
+                    break;
+                }
+            }
+        }
+
+        /* Swap buffers so writers can carry on appending while this batch goes to disk */
+        char* batch = log->buffer;
+        size_t batchCapacity = log->capacity;
+        size_t batchSize = log->used;
+        uint64_t batchSequence = log->sequence;
+        log->buffer = log->spare;
+        log->capacity = log->spareCapacity;
+        log->used = 0;
+        log->spare = NULL;
+        log->spareCapacity = 0;
+        log->flushing = 1;
+        int failed = log->failed;
+
+        pthread_mutex_unlock(&log->lock);
+
+        int ok = !failed && _logWriteAll(log->fd, batch, batchSize) == ZDB_RESULT_SUCCESS && fdatasync(log->fd) == 0;
+
+        pthread_mutex_lock(&log->lock);
+        log->flushing = 0;
+        log->spare = batch;
+        log->spareCapacity = batchCapacity;
+        log->failed |= !ok;
+        log->stats.bytes += batchSize;
+        log->stats.syncs++;
+        log->durableSequence = batchSequence;
+        pthread_cond_broadcast(&log->flushed);
+    }
+    pthread_mutex_unlock(&log->lock);
+
+    return NULL;
+}
+
+/*
+ * Replay
+ */
+
+int _logApplyCreateTable(ZdbDatabase* db, ZdbLogRecord* record, const char* data, const char* end)
+{
+    /* The new table goes after every one there is, so numbering none of them gives its number */
+    if (record->table != (uint32_t)_logTableNumber(db, NULL) || record->count > ZDB_LIMIT_COLUMNS ||
+        (size_t)(end - data) < sizeof(ZdbLogTable) + record->count * sizeof(ZdbLogColumn))
+    {
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    ZdbLogTable* def = (ZdbLogTable*)data;
+    ZdbLogColumn* logColumns = (ZdbLogColumn*)(data + sizeof(ZdbLogTable));
+    ZdbColumn* columns[ZDB_LIMIT_COLUMNS];
+    uint32_t i;
+
+    def->name[ZDB_LIMIT_VARCHAR] = '\0';
+    for (i = 0; i < record->count; i++)
+    {
+        ZdbType* type;
+        logColumns[i].name[ZDB_LIMIT_VARCHAR] = '\0';
+        logColumns[i].typeName[ZDB_LIMIT_VARCHAR] = '\0';
+        if (ZdbTypeFind(logColumns[i].typeName, &type) != ZDB_RESULT_SUCCESS)
+        {
+            /* The log uses a type that hasn't been created in this process */
+            return ZDB_RESULT_NOT_FOUND;
+        }
+
+        ZdbEngineCreateColumn(logColumns[i].name, type, logColumns[i].autoincrement, &columns[i]);
+        ZdbEngineSetColumnEncoding(columns[i], logColumns[i].encoding);
+    }
+
+    ZdbTable* table;
+    return ZdbEngineCreateTableWithStorage(db, def->name, record->count, columns, def->storage, &table);
+}
+
+int _logApplyRow(ZdbTable* table, uint32_t rowIndex, int valueCount, int insert, const char** data, const char* end)
+{
+    ZdbRow* row;
+    if (insert)
+    {
+        if (rowIndex != (uint32_t)table->rowCount || ZdbEngineInsertRow(table, table->columnCount, &row) != ZDB_RESULT_SUCCESS)
+        {
+            return ZDB_RESULT_INVALID_OPERATION;
+        }
+    }
+    else if (rowIndex < (uint32_t)table->rowCount)
+    {
+        row = ZdbEngineRowAt(table, rowIndex);
+    }
+    else
+    {
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    if (valueCount == 0)
+    {
+        return ZDB_RESULT_SUCCESS;
+    }
+
+    void* values[ZDB_LIMIT_COLUMNS];
+    *data = _logReadValues(*data, end, valueCount, values);
+    if (*data == NULL || valueCount > table->columnCount)
+    {
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    int result = ZdbEngineRestoreRowValues(table, row, valueCount, values);
+    return result < 0 ? result : ZDB_RESULT_SUCCESS;
+}
+
+int _logApply(ZdbDatabase* db, ZdbLogRecord* record)
+{
+    const char* data = (char*)record + sizeof(ZdbLogRecord);
+    const char* end = (char*)record + record->size;
+
+    if (record->type == ZDB_LOG_RECORD_CREATE_TABLE)
+    {
+        return _logApplyCreateTable(db, record, data, end);
+    }
+
+    ZdbTable* table = _logFindTable(db, record->table);
+    if (table == NULL)
+    {
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    switch (record->type)
+    {
+        case ZDB_LOG_RECORD_INSERT_ROW:
+            return _logApplyRow(table, record->row, 0, 1, &data, end);
+        case ZDB_LOG_RECORD_ROW_VALUES:
+            return _logApplyRow(table, record->row, record->count, 0, &data, end);
+        case ZDB_LOG_RECORD_INSERT_ROWS:
+            for (uint32_t i = 0; i < record->count; i++)
+            {
+                int result = _logApplyRow(table, record->row + i, table->columnCount, 1, &data, end);
+                if (result != ZDB_RESULT_SUCCESS)
+                {
+                    return result;
+                }
+            }
+            return ZDB_RESULT_SUCCESS;
+        case ZDB_LOG_RECORD_DELETE_ROWS:
+            if (record->count > (size_t)(end - data) / sizeof(uint32_t))
+            {
+                return ZDB_RESULT_INVALID_OPERATION;
+            }
+            for (uint32_t i = 0; i < record->count; i++)
+            {
+                int rowIndex = ((const uint32_t*)data)[i];
+                int result = ZdbEngineDeleteRows(table, 1, &rowIndex);
+                if (result < 0)
+                {
+                    return result;
+                }
+            }
+            return ZDB_RESULT_SUCCESS;
+        case ZDB_LOG_RECORD_CREATE_INDEX:
+            return ZdbIndexCreate(table, record->row, record->count);
+        case ZDB_LOG_RECORD_COMPACT:
+        {
+            int result = ZdbEngineCompactTable(table, record->count);
+            return result < 0 ? result : ZDB_RESULT_SUCCESS;
+        }
+        case ZDB_LOG_RECORD_DROP_TABLE:
+            return ZdbEngineDropTable(table);
+        default:
+            return ZDB_RESULT_UNSUPPORTED;
+    }
+}
+
+/* Applies every intact record past db->logSequence.  Stops at the first torn or partial record and reports where
+   the intact part of the log ends */
+int _logReplay(ZdbDatabase* db, ZdbLog* log, off_t* end)
+{
+    off_t position = sizeof(ZdbLogFileHeader);
+    char* buffer = NULL;
+    size_t capacity = 0;
+    int result = ZDB_RESULT_SUCCESS;
+
+    log->sequence = db->logSequence;
+    for (;;)
+    {
+        ZdbLogRecord header;
+        if (pread(log->fd, &header, sizeof(ZdbLogRecord), position) != sizeof(ZdbLogRecord) ||
+            header.size < sizeof(ZdbLogRecord) || header.size % 8 != 0 || header.size > ZDB_LOG_MAX_RECORD)
+        {
+            break;
+        }
+
+        if (header.size > capacity)
+        {
+            capacity = header.size;
+            free(buffer);
+            buffer = malloc(capacity);
+        }
+
+        if (pread(log->fd, buffer, header.size, position) != (ssize_t)header.size)
+        {
+            break;
+        }
+
+        ZdbLogRecord* record = (ZdbLogRecord*)buffer;
+        if (record->checksum != _logChecksum((char*)&record->sequence, record->size - offsetof(ZdbLogRecord, sequence)))
+        {
+            break;
+        }
+
+        if (record->sequence > db->logSequence)
+        {
+            if (record->sequence != log->sequence + 1)
+            {
+                /* A gap means the log doesn't belong to this image */
+                result = ZDB_RESULT_INVALID_OPERATION;
+                break;
+            }
+
+            result = _logApply(db, record);
+            if (result != ZDB_RESULT_SUCCESS)
+            {
+                break;
+            }
+
+            log->sequence = record->sequence;
+            log->stats.replayed++;
+        }
+
+        position += header.size;
+    }
+
+    free(buffer);
+    *end = position;
+    return result;
+}
+
+/*
+ * Engine hooks
+ */
+
+void ZdbLogLock(ZdbLog* log)
+{
+    pthread_mutex_lock(&log->lock);
+}
+
+void ZdbLogLockIdle(ZdbLog* log)
+{
+    pthread_mutex_lock(&log->lock);
+    while (log->flushing)
+    {
+        pthread_cond_wait(&log->flushed, &log->lock);
+    }
+}
+
+void ZdbLogUnlock(ZdbLog* log)
+{
+    pthread_mutex_unlock(&log->lock);
+}
+
+int ZdbLogIsAutocommit(ZdbLog* log)
+{
+    return log->options.autocommit;
+}
+
+uint64_t ZdbLogLastSequence(ZdbLog* log)
+{
+    return log->sequence;
+}
+
+uint64_t ZdbLogCreateTable(ZdbLog* log, ZdbTable* table)
+{
+    ZdbLogRecord* record = _logBeginRecord(log, ZDB_LOG_RECORD_CREATE_TABLE, _logTableNumber(table->db, table),
+                                           sizeof(ZdbLogTable) + table->columnCount * sizeof(ZdbLogColumn));
+    if (record == NULL)
+    {
+        log->failed = 1;
+        return log->sequence;
+    }
+
+    ZdbLogTable* def = (ZdbLogTable*)(record + 1);
+    ZdbLogColumn* columns = (ZdbLogColumn*)(def + 1);
+    strncpy(def->name, table->name, ZDB_LIMIT_VARCHAR);
+    def->storage = table->storage;
+    for (int i = 0; i < table->columnCount; i++)
+    {
+        const char* typeName;
+        ZdbTypeGetName(table->columns[i]->type, &typeName);
+        strncpy(columns[i].name, table->columns[i]->name, ZDB_LIMIT_VARCHAR);
+        strncpy(columns[i].typeName, typeName, ZDB_LIMIT_VARCHAR);
+        columns[i].autoincrement = table->columns[i]->autoincrement;
+        columns[i].encoding = table->columns[i]->encoding;
+    }
+
+    record->count = table->columnCount;
+    return _logEndRecord(log, record);
+}
+
+uint64_t ZdbLogInsertRow(ZdbLog* log, ZdbTable* table, ZdbRow* row)
+{
+    ZdbLogRecord* record = _logBeginRecord(log, ZDB_LOG_RECORD_INSERT_ROW, _logTableNumber(table->db, table), 0);
+    if (record == NULL)
+    {
+        log->failed = 1;
+        return log->sequence;
+    }
+
+    record->row = row->index;
+    return _logEndRecord(log, record);
+}
+
+uint64_t ZdbLogRowValues(ZdbLog* log, ZdbTable* table, ZdbRow* row, int valueCount, int newRow)
+{
+    void* values[ZDB_LIMIT_COLUMNS];
+    size_t sizes[ZDB_LIMIT_COLUMNS];
+    size_t payloadSize = _logCollectValues(table, row, valueCount, newRow, values, sizes);
+
+    ZdbLogRecord* record = _logBeginRecord(log, ZDB_LOG_RECORD_ROW_VALUES, _logTableNumber(table->db, table), payloadSize);
+    if (record == NULL)
+    {
+        log->failed = 1;
+        return log->sequence;
+    }
+
+    record->row = row->index;
+    record->count = valueCount;
+    _logWriteValues((char*)(record + 1), valueCount, values, sizes);
+    return _logEndRecord(log, record);
+}
+
+uint64_t ZdbLogInsertRows(ZdbLog* log, ZdbTable* table, int firstRow, int rowCount)
+{
+    int tableNumber = _logTableNumber(table->db, table);
+    void* values[ZDB_LIMIT_COLUMNS];
+    size_t sizes[ZDB_LIMIT_COLUMNS];
+    int columnCount = table->columnCount;
+
+    for (int batchStart = firstRow; batchStart < firstRow + rowCount; batchStart += ZDB_LOG_BATCH_ROWS)
+    {
+        int batchEnd = batchStart + ZDB_LOG_BATCH_ROWS < firstRow + rowCount ? batchStart + ZDB_LOG_BATCH_ROWS : firstRow + rowCount;
+        size_t payloadSize = 0;
+        int i;
+
+        for (i = batchStart; i < batchEnd; i++)
+        {
+            payloadSize += _logCollectValues(table, ZdbEngineRowAt(table, i), columnCount, 1, values, sizes);
+        }
+
+        ZdbLogRecord* record = _logBeginRecord(log, ZDB_LOG_RECORD_INSERT_ROWS, tableNumber, payloadSize);
+        if (record == NULL)
+        {
+            log->failed = 1;
+            return log->sequence;
+        }
+
+        record->row = batchStart;
+        record->count = batchEnd - batchStart;
+
+        char* dest = (char*)(record + 1);
+        for (i = batchStart; i < batchEnd; i++)
+        {
+            _logCollectValues(table, ZdbEngineRowAt(table, i), columnCount, 1, values, sizes);
+            dest = _logWriteValues(dest, columnCount, values, sizes);
+        }
+
+        _logEndRecord(log, record);
+    }
+
+    return log->sequence;
+}
+
+uint64_t ZdbLogDeleteRows(ZdbLog* log, ZdbTable* table, int count, const int* rowIndexes)
+{
+    int tableNumber = _logTableNumber(table->db, table);
+
+    for (int batchStart = 0; batchStart < count; batchStart += ZDB_LOG_BATCH_DELETES)
+    {
+        int batchCount = count - batchStart < ZDB_LOG_BATCH_DELETES ? count - batchStart : ZDB_LOG_BATCH_DELETES;
+        ZdbLogRecord* record = _logBeginRecord(log, ZDB_LOG_RECORD_DELETE_ROWS, tableNumber, batchCount * sizeof(uint32_t));
+        if (record == NULL)
+        {
+            log->failed = 1;
+            return log->sequence;
+        }
+
+        record->count = batchCount;
+        uint32_t* indexes = (uint32_t*)(record + 1);
+        for (int i = 0; i < batchCount; i++)
+        {
+            indexes[i] = rowIndexes[batchStart + i];
+        }
+
+        _logEndRecord(log, record);
+    }
+
+    return log->sequence;
+}
+
+uint64_t ZdbLogCompactTable(ZdbLog* log, ZdbTable* table, int maxRows)
+{
+    ZdbLogRecord* record = _logBeginRecord(log, ZDB_LOG_RECORD_COMPACT, _logTableNumber(table->db, table), 0);
+    if (record == NULL)
+    {
+        log->failed = 1;
+        return log->sequence;
+    }
+
+    record->count = maxRows;
+    return _logEndRecord(log, record);
+}
+
+uint64_t ZdbLogCreateIndex(ZdbLog* log, ZdbTable* table, int column, int type)
+{
+    ZdbLogRecord* record = _logBeginRecord(log, ZDB_LOG_RECORD_CREATE_INDEX, _logTableNumber(table->db, table), 0);
+    if (record == NULL)
+    {
+        log->failed = 1;
+        return log->sequence;
+    }
+
+    record->row = column;
+    record->count = type;
+    return _logEndRecord(log, record);
+}
+
+uint64_t ZdbLogDropTable(ZdbLog* log, ZdbTable* table)
+{
+    ZdbLogRecord* record = _logBeginRecord(log, ZDB_LOG_RECORD_DROP_TABLE, _logTableNumber(table->db, table), 0);
+    if (record == NULL)
+    {
+        log->failed = 1;
+        return log->sequence;
+    }
+
+    return _logEndRecord(log, record);
+}
+
+uint64_t ZdbLogEndOffset(ZdbLog* log)
+{
+    return log->endOffset;
+}
+
+int _logCopyTail(int fromFd, int toFd, uint64_t start, uint64_t end)
+{
+    char* block = malloc(64 * 1024);
+    int result = ZDB_RESULT_SUCCESS;
+
+    while (start < end && result == ZDB_RESULT_SUCCESS)
+    {
+        size_t size = end - start < 64 * 1024 ? end - start : 64 * 1024;
+        if (pread(fromFd, block, size, start) != (ssize_t)size)
+        {
+            result = ZDB_RESULT_INVALID_OPERATION;
+            break;
+        }
+
+        result = _logWriteAll(toFd, block, size);
+        start += size;
+    }
+
+    free(block);
+    return result;
+}
+
+/* Writes out everything appended so far, with the lock held, so the file holds the whole log */
+int _logDrainLocked(ZdbLog* log)
+{
+    while (log->flushing)
+    {
+        pthread_cond_wait(&log->flushed, &log->lock);
+    }
+
+    if (!log->failed)
+    {
+        _logFlushLocked(log);
+        pthread_cond_broadcast(&log->flushed);
+    }
+
+    return log->failed ? ZDB_RESULT_INVALID_OPERATION : ZDB_RESULT_SUCCESS;
+}
+
+int ZdbLogTruncate(ZdbLog* log, uint64_t offset, uint64_t* bytesDropped)
+{
+    if (offset < sizeof(ZdbLogFileHeader))
+    {
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    char* tempPath = malloc(strlen(log->path) + 5);
+    sprintf(tempPath, "%s.tmp", log->path);
+
+    ZdbLogFileHeader header;
+    memset(&header, 0, sizeof(ZdbLogFileHeader));
+    memcpy(header.magic, ZDB_LOG_MAGIC, sizeof(header.magic));
+    header.version = ZDB_LOG_VERSION;
+
+    /* The records that follow offset go into a new file that is swapped in whole, so a crash leaves either the old
+       log or the new one.  Most of them are copied while writers carry on; only what arrived during that copy is
+       copied with the lock held */
+    pthread_mutex_lock(&log->lock);
+    int result = _logDrainLocked(log);
+    uint64_t copied = log->endOffset;
+    pthread_mutex_unlock(&log->lock);
+
+    int fd = -1;
+    if (result == ZDB_RESULT_SUCCESS && offset <= copied)
+    {
+        fd = open(tempPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    }
+
+    if (fd < 0)
+    {
+        free(tempPath);
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    result = _logWriteAll(fd, (char*)&header, sizeof(ZdbLogFileHeader));
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = _logCopyTail(log->fd, fd, offset, copied);
+    }
+
+    if (result == ZDB_RESULT_SUCCESS && fdatasync(fd) != 0)
+    {
+        result = ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    pthread_mutex_lock(&log->lock);
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = _logDrainLocked(log);
+    }
+
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        result = _logCopyTail(log->fd, fd, copied, log->endOffset);
+    }
+
+    if (result == ZDB_RESULT_SUCCESS && (fsync(fd) != 0 || rename(tempPath, log->path) != 0))
+    {
+        result = ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    int oldFd = -1;
+    if (result == ZDB_RESULT_SUCCESS)
+    {
+        oldFd = log->fd;
+        log->fd = fd;
+        lseek(fd, 0, SEEK_END);
+        *bytesDropped = offset - sizeof(ZdbLogFileHeader);
+        log->endOffset -= *bytesDropped;
+    }
+    else
+    {
+        close(fd);
+        remove(tempPath);
+    }
+    pthread_mutex_unlock(&log->lock);
+
+    if (oldFd >= 0)
+    {
+        /* Closing the replaced file releases all of its blocks, which can take a while */
+        close(oldFd);
+    }
+
+    free(tempPath);
+    return result;
+}
+
+int ZdbLogWait(ZdbLog* log, uint64_t sequence)
+{
+    pthread_mutex_lock(&log->lock);
+    log->stats.commits++;
+
+    if (!log->running)
+    {
+        /* No flusher, so this commit pays for its own sync */
+        if (log->durableSequence < sequence)
+        {
+            _logFlushLocked(log);
+        }
+    }
+    else
+    {
+        /* Commits that arrive while a sync is running all share the next one */
+        log->waiters++;
+        pthread_cond_signal(&log->flushWanted);
+        while (log->durableSequence < sequence && !log->failed)
+        {
+            pthread_cond_wait(&log->flushed, &log->lock);
+        }
+        log->waiters--;
+    }
+
+    int result = log->failed ? ZDB_RESULT_INVALID_OPERATION : ZDB_RESULT_SUCCESS;
+    pthread_mutex_unlock(&log->lock);
+
+    return result;
+}
+
+/*
+ * Public Interface Methods
+ */
+
+void ZdbLogDefaultOptions(ZdbLogOptions* options)
+{
+    options->groupCommit = 1;
+    options->flushInterval = 1000;
+    options->flushBytes = 1024 * 1024;
+    options->autocommit = 1;
+}
+
+int ZdbEngineAttachLog(ZdbDatabase* db, const char* path, const ZdbLogOptions* options)
+{
+    if (db == NULL || path == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (db->log != NULL)
+    {
+        /* Only one log per database */
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    ZdbLogFileHeader header;
+    ssize_t headerSize = pread(fd, &header, sizeof(ZdbLogFileHeader), 0);
+    if (headerSize == 0)
+    {
+        /* New log */
+        memset(&header, 0, sizeof(ZdbLogFileHeader));
+        memcpy(header.magic, ZDB_LOG_MAGIC, sizeof(header.magic));
+        header.version = ZDB_LOG_VERSION;
+        if (_logWriteAll(fd, (char*)&header, sizeof(ZdbLogFileHeader)) != ZDB_RESULT_SUCCESS || fsync(fd) != 0)
+        {
+            close(fd);
+            return ZDB_RESULT_INVALID_OPERATION;
+        }
+    }
+    else if (headerSize != sizeof(ZdbLogFileHeader) || memcmp(header.magic, ZDB_LOG_MAGIC, sizeof(header.magic)) != 0)
+    {
+        close(fd);
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+    else if (header.version != ZDB_LOG_VERSION)
+    {
+        close(fd);
+        return ZDB_RESULT_UNSUPPORTED;
+    }
+
+    ZdbLog* log = calloc(1, sizeof(ZdbLog));
+    log->fd = fd;
+    log->path = strdup(path);
+    if (options != NULL)
+    {
+        log->options = *options;
+    }
+    else
+    {
+        ZdbLogDefaultOptions(&log->options);
+    }
+
+    off_t end;
+    int result = _logReplay(db, log, &end);
+    if (result != ZDB_RESULT_SUCCESS)
+    {
+        close(fd);
+        free(log->path);
+        free(log);
+        return result;
+    }
+
+    /* Drop any torn tail so new records follow the last intact one */
+    if (ftruncate(fd, end) != 0 || lseek(fd, end, SEEK_SET) != end)
+    {
+        close(fd);
+        free(log->path);
+        free(log);
+        return ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    db->logSequence = log->sequence;
+    log->durableSequence = log->sequence;
+    log->endOffset = end;
+
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_cond_init(&log->flushWanted, NULL);
+    pthread_cond_init(&log->flushed, NULL);
+    if (log->options.groupCommit)
+    {
+        log->running = pthread_create(&log->flusher, NULL, _logFlusherMain, log) == 0;
+    }
+
+    db->log = log;
+    return ZDB_RESULT_SUCCESS;
+}
+
+int ZdbEngineDetachLog(ZdbDatabase* db)
+{
+    if (db == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    ZdbLog* log = db->log;
+    if (log == NULL)
+    {
+        return ZDB_RESULT_NOT_FOUND;
+    }
+
+    /* A checkpoint in progress truncates the log when it is done */
+    ZdbEngineWaitCheckpoint(db);
+
+    if (log->running)
+    {
+        /* The flusher drains the buffer before it stops */
+        pthread_mutex_lock(&log->lock);
+        log->stopping = 1;
+        pthread_cond_signal(&log->flushWanted);
+        pthread_mutex_unlock(&log->lock);
+        pthread_join(log->flusher, NULL);
+        log->running = 0;
+    }
+
+    _logFlushLocked(log);
+    int result = log->failed ? ZDB_RESULT_INVALID_OPERATION : ZDB_RESULT_SUCCESS;
+    if (close(log->fd) != 0)
+    {
+        result = ZDB_RESULT_INVALID_OPERATION;
+    }
+
+    db->logSequence = log->sequence;
+    db->log = NULL;
+
+    pthread_cond_destroy(&log->flushed);
+    pthread_cond_destroy(&log->flushWanted);
+    pthread_mutex_destroy(&log->lock);
+    free(log->buffer);
+    free(log->spare);
+    free(log->path);
+    free(log);
+
+    return result;
+}
+
+int ZdbEngineCommit(ZdbDatabase* db)
+{
+    if (db == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (db->log == NULL)
+    {
+        /* Nothing to make durable */
+        return ZDB_RESULT_SUCCESS;
+    }
+
+    pthread_mutex_lock(&db->log->lock);
+    uint64_t sequence = db->log->sequence;
+    pthread_mutex_unlock(&db->log->lock);
+
+    return ZdbLogWait(db->log, sequence);
+}
+
+int ZdbEngineGetLogStats(ZdbDatabase* db, ZdbLogStats* stats)
+{
+    if (db == NULL || stats == NULL)
+    {
+        return ZDB_RESULT_INVALID_NULL;
+    }
+
+    if (db->log == NULL)
+    {
+        return ZDB_RESULT_NOT_FOUND;
+    }
+
+    pthread_mutex_lock(&db->log->lock);
+    *stats = db->log->stats;
+    pthread_mutex_unlock(&db->log->lock);
+
+    return ZDB_RESULT_SUCCESS;
+}
@@ -0,0 +1,60 @@
+//
+//  wal.h
+//  ZombieSQL
+//
+//  Write-ahead log of table changes, so a database survives a crash between saves.
+//
+
+#ifndef WAL_H
+#define WAL_H
+
+#include "engine.h"
+
+#define ZDB_LOG_VERSION         1
+
+typedef struct
+{
+    int groupCommit;                /* Commits share syncs issued by a background flusher.  Otherwise each commit syncs the log itself */
+    int flushInterval;              /* Microseconds records may wait to be synced when no commit is waiting for them */
+    size_t flushBytes;              /* Unsynced bytes that start a sync without waiting out the interval */
+    int autocommit;                 /* Each change waits until it is durable before returning */
+} ZdbLogOptions;
+
+typedef struct
+{
+    uint64_t records;               /* Records appended since the log was attached */
+    uint64_t bytes;                 /* Bytes written to the log file */
+    uint64_t syncs;                 /* Times the log file was synced */
+    uint64_t commits;               /* Calls that waited for their changes to become durable */
+    uint64_t replayed;              /* Records applied when the log was attached */
+} ZdbLogStats;
+
+void ZdbLogDefaultOptions(ZdbLogOptions* options);
+
+/* Replays whatever the log holds beyond db->logSequence, then records every later change to the database.  Tables
+   may be changed from several threads once a log is attached: changes are applied one at a time and their syncs are
+   shared.  Reading a table while another thread changes it is still not safe */
+int ZdbEngineAttachLog(ZdbDatabase* db, const char* path, const ZdbLogOptions* options);
+int ZdbEngineDetachLog(ZdbDatabase* db);
+int ZdbEngineCommit(ZdbDatabase* db);       /* Waits until every change made so far is durable */
+int ZdbEngineGetLogStats(ZdbDatabase* db, ZdbLogStats* stats);
+
+/* Used by the engine, which holds the log lock while it changes a table and records the change, and by checkpoints */
+void ZdbLogLock(ZdbLog* log);
+void ZdbLogLockIdle(ZdbLog* log);           /* Also waits for the flusher to finish any batch it is writing */
+void ZdbLogUnlock(ZdbLog* log);
+int ZdbLogIsAutocommit(ZdbLog* log);
+uint64_t ZdbLogLastSequence(ZdbLog* log);
+uint64_t ZdbLogEndOffset(ZdbLog* log);
+int ZdbLogTruncate(ZdbLog* log, uint64_t offset, uint64_t* bytesDropped);   /* Drops the records before offset */
+uint64_t ZdbLogCreateTable(ZdbLog* log, ZdbTable* table);
+uint64_t ZdbLogInsertRow(ZdbLog* log, ZdbTable* table, ZdbRow* row);
+uint64_t ZdbLogRowValues(ZdbLog* log, ZdbTable* table, ZdbRow* row, int valueCount, int newRow);
+uint64_t ZdbLogInsertRows(ZdbLog* log, ZdbTable* table, int firstRow, int rowCount);
+uint64_t ZdbLogDeleteRows(ZdbLog* log, ZdbTable* table, int count, const int* rowIndexes);
+uint64_t ZdbLogCompactTable(ZdbLog* log, ZdbTable* table, int maxRows);
+uint64_t ZdbLogCreateIndex(ZdbLog* log, ZdbTable* table, int column, int type);
+uint64_t ZdbLogDropTable(ZdbLog* log, ZdbTable* table);      /* Before the table is dropped, while it still has a number */
+int ZdbLogWait(ZdbLog* log, uint64_t sequence);
+
+#endif // WAL_H
@@ -12,6 +12,12 @@
 #include "types.h"
 #include "engine.h"
 #include "query.h"
+#include "sql.h"
+#include "storage.h"
+#include "wal.h"
+#include "index.h"
+#include "stats.h"
+#include "kernel.h"
 
 #endif // ZDB_H
 